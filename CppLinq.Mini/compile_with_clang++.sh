@@ -1 +1 @@
-clang++ -std=c++0x -O2 -Wall CppLinq.Mini.cpp -o cpplinqmini
+clang++ -std=c++0x -O2 -Wall -pthread CppLinq.Mini.cpp -o cpplinqmini
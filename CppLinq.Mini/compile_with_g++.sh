@@ -1 +1 @@
-g++ -std=c++0x -O2 -Wall CppLinq.Mini.cpp -o cpplinqmini
+g++ -std=c++0x -O2 -Wall -pthread CppLinq.Mini.cpp -o cpplinqmini
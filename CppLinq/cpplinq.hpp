@@ -15,18 +15,69 @@
 #   define CPPLINQ__HEADER_GUARD
 // ----------------------------------------------------------------------------
 #include <algorithm>
+#include <array>
 #include <cassert>
 #include <climits>
+#include <clocale>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <exception>
 #include <functional>
 #include <iterator>
+#include <limits>
 #include <list>
 #include <map>
+#include <memory>
+#include <new>
 #include <numeric>
 #include <set>
+#include <stdexcept>
 #include <string>
+#include <tuple>
 #include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
+#if defined(_MSC_VER) && _MSC_VER < 1700 && !defined(CPPLINQ_NO_THREADS)
+    // VS2010 has neither <thread> nor <atomic>
+#   define CPPLINQ_NO_THREADS
+#endif
+#ifndef CPPLINQ_NO_THREADS
+#   include <atomic>
+#   include <chrono>
+#   include <condition_variable>
+#   include <deque>
+#   include <mutex>
+#   include <thread>
+#endif
+#ifndef CPPLINQ_NO_MMAP
+#   if defined(__unix__) || defined(__APPLE__)
+#       define CPPLINQ_MMAP_POSIX
+#       include <fcntl.h>
+#       include <sys/mman.h>
+#       include <sys/stat.h>
+#       include <unistd.h>
+#   endif
+#endif
+#ifndef CPPLINQ_NO_SIMD
+#   if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#       define CPPLINQ_SIMD_SSE2
+#       include <emmintrin.h>
+#       if defined(_MSC_VER) && _MSC_VER >= 1700
+#           define CPPLINQ_SIMD_AVX2
+#           define CPPLINQ_TARGET_AVX2
+#           include <immintrin.h>
+#           include <intrin.h>
+#       elif defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+#           define CPPLINQ_SIMD_AVX2
+#           define CPPLINQ_TARGET_AVX2 __attribute__ ((target ("avx2")))
+#           include <immintrin.h>
+#       endif
+#   endif
+#endif
 #// ----------------------------------------------------------------------------
 #ifdef _MSC_VER
 #   pragma warning (push)
@@ -50,6 +101,13 @@
 #ifndef CPPLINQ_NOEXCEPT
 #   define CPPLINQ_NOEXCEPT throw ()
 #endif
+#ifndef CPPLINQ_THREAD_LOCAL
+#   if defined(_MSC_VER) && _MSC_VER < 1900
+#       define CPPLINQ_THREAD_LOCAL __declspec(thread)
+#   else
+#       define CPPLINQ_THREAD_LOCAL thread_local
+#   endif
+#endif
 // ----------------------------------------------------------------------------
 
 // TODO:    Struggled with getting slice protection
@@ -90,1478 +148,2258 @@ namespace cpplinq
         }
     };
 
+    struct duplicate_key_exception : base_exception
+    {
+        virtual const char* what ()  const CPPLINQ_NOEXCEPT
+        {
+            return "duplicate_key_exception";
+        }
+    };
+
+    struct io_exception : base_exception
+    {
+        virtual const char* what ()  const CPPLINQ_NOEXCEPT
+        {
+            return "io_exception";
+        }
+    };
+
+    struct parse_exception : base_exception
+    {
+        virtual const char* what ()  const CPPLINQ_NOEXCEPT
+        {
+            return "parse_exception";
+        }
+    };
+
     // -------------------------------------------------------------------------
 
+    // What to_map, to_unordered_map and to_flat_map do when a key is seen again
+    enum duplicate_key_policy
+    {
+        first_value_wins        ,
+        last_value_wins         ,
+        throw_on_duplicate_key
+    };
+
     // -------------------------------------------------------------------------
-    // Tedious implementation details of cpplinq
+    // Instrumentation. When cpplinq is compiled with CPPLINQ_INSTRUMENT the
+    // ranges and builders count per query operator:
+    //      pulled      values the operator pulled from its source
+    //      yielded     values the operator handed to its consumer
+    //      copies      values the operator copied into or out of its storage
+    //      moves       values the operator moved into or out of its storage
+    //      allocations allocations drawn from new_delete_resource ()
+    //      bytes       bytes drawn from new_delete_resource ()
+    // The counters are kept per thread, get_stats () returns a snapshot of
+    // the calling thread. Subtracting the snapshot taken before a query from
+    // the one taken after gives the stats of that query. Parallel queries
+    // count the work of their workers on the worker threads. Without
+    // CPPLINQ_INSTRUMENT the counters stay zero and cost nothing.
     // -------------------------------------------------------------------------
 
-    namespace detail
+    enum query_operator
     {
+        query_none                  ,   // Outside of any cpplinq operator
+        query_from                  ,
+        query_range                 ,
+        query_repeat                ,
+        query_empty                 ,
+        query_singleton             ,
+        query_generate              ,
+        query_from_lines            ,
+        query_from_records          ,
+        query_from_csv              ,
+        query_orderby               ,
+        query_thenby                ,
+        query_reverse               ,
+        query_where                 ,
+        query_take                  ,
+        query_take_while            ,
+        query_skip                  ,
+        query_skip_while            ,
+        query_ref                   ,
+        query_with_memory_resource  ,
+        query_select                ,
+        query_select_many           ,
+        query_join                  ,
+        query_hash_join             ,
+        query_distinct              ,
+        query_union_with            ,
+        query_intersect_with        ,
+        query_except                ,
+        query_concat                ,
+        query_parallel              ,
+        query_pairwise              ,
+        query_zip_with              ,
+        query_group_by              ,
+        query_to_vector             ,
+        query_to_list               ,
+        query_to_map                ,
+        query_to_lookup             ,
+        query_to_hash_lookup        ,
+        query_for_each              ,
+        query_first                 ,
+        query_first_or_default      ,
+        query_last_or_default       ,
+        query_count                 ,
+        query_sum                   ,
+        query_max                   ,
+        query_min                   ,
+        query_avg                   ,
+        query_aggregate             ,
+        query_sequence_equal        ,
+        query_concatenate           ,
+        query_to_output_iterator    ,
+        query_to_ostream            ,
+        query_to_file               ,
+        query_any                   ,
+        query_all                   ,
+        query_contains              ,
+        query_element_at_or_default ,
+        query_operator_count
+    };
 
-        // -------------------------------------------------------------------------
+    CPPLINQ_INLINEMETHOD char const * get_operator_name (query_operator op) CPPLINQ_NOEXCEPT
+    {
+        static char const * const names[] =
+        {
+            "none"                  ,
+            "from"                  ,
+            "range"                 ,
+            "repeat"                ,
+            "empty"                 ,
+            "singleton"             ,
+            "generate"              ,
+            "from_lines"            ,
+            "from_records"          ,
+            "from_csv"              ,
+            "orderby"               ,
+            "thenby"                ,
+            "reverse"               ,
+            "where"                 ,
+            "take"                  ,
+            "take_while"            ,
+            "skip"                  ,
+            "skip_while"            ,
+            "ref"                   ,
+            "with_memory_resource"  ,
+            "select"                ,
+            "select_many"           ,
+            "join"                  ,
+            "hash_join"             ,
+            "distinct"              ,
+            "union_with"            ,
+            "intersect_with"        ,
+            "except"                ,
+            "concat"                ,
+            "parallel"              ,
+            "pairwise"              ,
+            "zip_with"              ,
+            "group_by"              ,
+            "to_vector"             ,
+            "to_list"               ,
+            "to_map"                ,
+            "to_lookup"             ,
+            "to_hash_lookup"        ,
+            "for_each"              ,
+            "first"                 ,
+            "first_or_default"      ,
+            "last_or_default"       ,
+            "count"                 ,
+            "sum"                   ,
+            "max"                   ,
+            "min"                   ,
+            "avg"                   ,
+            "aggregate"             ,
+            "sequence_equal"        ,
+            "concatenate"           ,
+            "to_output_iterator"    ,
+            "to_ostream"            ,
+            "to_file"               ,
+            "any"                   ,
+            "all"                   ,
+            "contains"              ,
+            "element_at_or_default" ,
+        };
 
-        size_type const invalid_size = static_cast<size_type>(-1);
+        static_assert (sizeof (names) / sizeof (names[0]) == query_operator_count, "Every query_operator needs a name");
 
-        // -------------------------------------------------------------------------
+        return op < query_operator_count ? names[op] : "unknown";
+    }
 
-        template<typename TValue>
-        struct cleanup_type
+    struct operator_stats
+    {
+        size_type   pulled      ;
+        size_type   yielded     ;
+        size_type   copies      ;
+        size_type   moves       ;
+        size_type   allocations ;
+        size_type   bytes       ;
+    };
+
+    CPPLINQ_INLINEMETHOD operator_stats operator+ (operator_stats const & left, operator_stats const & right) CPPLINQ_NOEXCEPT
+    {
+        operator_stats result =
         {
-            typedef typename std::remove_const<
-                typename std::remove_reference<TValue>::type
-                >::type                                         type;
+                left.pulled         + right.pulled
+            ,   left.yielded        + right.yielded
+            ,   left.copies         + right.copies
+            ,   left.moves          + right.moves
+            ,   left.allocations    + right.allocations
+            ,   left.bytes          + right.bytes
         };
+        return result;
+    }
 
-        template<typename TRangeBuilder, typename TRange>
-        struct get_builtup_type
+    CPPLINQ_INLINEMETHOD operator_stats operator- (operator_stats const & left, operator_stats const & right) CPPLINQ_NOEXCEPT
+    {
+        operator_stats result =
         {
-            static TRangeBuilder get_builder ();
-            static TRange get_range ();
-
-            typedef decltype (get_builder ().build (get_range ()))  type;
+                left.pulled         - right.pulled
+            ,   left.yielded        - right.yielded
+            ,   left.copies         - right.copies
+            ,   left.moves          - right.moves
+            ,   left.allocations    - right.allocations
+            ,   left.bytes          - right.bytes
         };
+        return result;
+    }
 
-        template<typename TPredicate, typename TValue>
-        struct get_transformed_type
-        {
-            static TValue                       get_value ();
-            static TPredicate                   get_predicate ();
+    // stats is a plain aggregate so that it can live in thread local storage
+    struct stats
+    {
+        operator_stats  operators[query_operator_count] ;
 
-            typedef     decltype (get_predicate ()(get_value ()))   raw_type    ;
-            typedef     typename cleanup_type<raw_type>::type       type        ;
-        };
+        CPPLINQ_INLINEMETHOD operator_stats const & operator[] (query_operator op) const CPPLINQ_NOEXCEPT
+        {
+            CPPLINQ_ASSERT (op < query_operator_count);
+            return operators[op];
+        }
 
-        template<typename TArray>
-        struct get_array_properties;
+        CPPLINQ_INLINEMETHOD operator_stats & operator[] (query_operator op) CPPLINQ_NOEXCEPT
+        {
+            CPPLINQ_ASSERT (op < query_operator_count);
+            return operators[op];
+        }
 
-        template<typename TValue, int Size>
-        struct get_array_properties<TValue[Size]>
+        // The counters of all operators added up
+        CPPLINQ_METHOD operator_stats total () const CPPLINQ_NOEXCEPT
         {
-            enum
+            operator_stats result = {};
+            for (auto && op : operators)
             {
-                size = Size ,
-            };
+                result = result + op;
+            }
+            return result;
+        }
+    };
 
-            typedef typename    cleanup_type<TValue>::type  value_type      ;
-            typedef             value_type const *          iterator_type   ;
+    CPPLINQ_INLINEMETHOD stats operator- (stats const & left, stats const & right) CPPLINQ_NOEXCEPT
+    {
+        stats result;
+        for (auto op = 0; op < query_operator_count; ++op)
+        {
+            result.operators[op] = left.operators[op] - right.operators[op];
+        }
+        return result;
+    }
+
+    namespace detail
+    {
+        struct instrument_state
+        {
+            stats           counters    ;
+            query_operator  current     ;   // The operator that is running on this thread
         };
 
-        template<typename TValue>
-        struct opt
+        CPPLINQ_INLINEMETHOD instrument_state & get_instrument_state () CPPLINQ_NOEXCEPT
         {
-            typedef     TValue  value_type;
+            static CPPLINQ_THREAD_LOCAL instrument_state state;
+            return state;
+        }
+    }
 
-            CPPLINQ_INLINEMETHOD opt () CPPLINQ_NOEXCEPT
-                :   is_initialized (false)
-            {
-            }
+    // Returns the counters of the calling thread
+    CPPLINQ_INLINEMETHOD stats get_stats () CPPLINQ_NOEXCEPT
+    {
+        return detail::get_instrument_state ().counters;
+    }
 
-            CPPLINQ_INLINEMETHOD explicit opt (value_type && value)
-                :   is_initialized      (true)
-            {
-                new (&storage) value_type (std::move (value));
-            }
+    CPPLINQ_INLINEMETHOD void reset_stats () CPPLINQ_NOEXCEPT
+    {
+        detail::get_instrument_state ().counters = stats ();
+    }
 
-            CPPLINQ_INLINEMETHOD explicit opt (value_type const & value)
-                :   is_initialized      (true)
-            {
-                new (&storage) value_type (value);
-            }
+    // -------------------------------------------------------------------------
+    // memory_resource mirrors std::pmr::memory_resource (C++17). The buffers
+    // of a query (orderby, reverse, the set operators, join, to_lookup) are
+    // drawn from the memory resource of their source range, see
+    // with_memory_resource. By default that is new_delete_resource ().
+    // -------------------------------------------------------------------------
 
-            CPPLINQ_INLINEMETHOD ~opt () CPPLINQ_NOEXCEPT
-            {
-                auto ptr = get_ptr ();
-                if (ptr)
+    struct memory_resource
+    {
+        CPPLINQ_INLINEMETHOD virtual ~memory_resource () CPPLINQ_NOEXCEPT
+        {
+        }
+
+        CPPLINQ_INLINEMETHOD void * allocate (size_type bytes, size_type alignment = alignof (std::max_align_t))
+        {
+            return do_allocate (bytes, alignment);
+        }
+
+        CPPLINQ_INLINEMETHOD void deallocate (void * p, size_type bytes, size_type alignment = alignof (std::max_align_t))
+        {
+            do_deallocate (p, bytes, alignment);
+        }
+
+        CPPLINQ_INLINEMETHOD bool is_equal (memory_resource const & other) const CPPLINQ_NOEXCEPT
+        {
+            return do_is_equal (other);
+        }
+
+    protected:
+        virtual void *  do_allocate (size_type bytes, size_type alignment) = 0;
+        virtual void    do_deallocate (void * p, size_type bytes, size_type alignment) = 0;
+
+        virtual bool    do_is_equal (memory_resource const & other) const CPPLINQ_NOEXCEPT
+        {
+            return this == &other;
+        }
+    };
+
+    CPPLINQ_INLINEMETHOD memory_resource * new_delete_resource () CPPLINQ_NOEXCEPT
+    {
+        struct new_delete_memory_resource : memory_resource
+        {
+        protected:
+            virtual void * do_allocate (size_type bytes, size_type alignment)
+            {
+                CPPLINQ_ASSERT (alignment > 0U && (alignment & (alignment - 1U)) == 0U);
+#ifdef CPPLINQ_INSTRUMENT
+                auto & state    = detail::get_instrument_state ();
+                auto & counters = state.counters[state.current];
+                ++counters.allocations;
+                counters.bytes += bytes;
+#endif
+                if (alignment <= alignof (std::max_align_t))
                 {
-                    ptr->~value_type ();
+                    return ::operator new (bytes);
                 }
-                is_initialized = false;
-            }
 
-            CPPLINQ_INLINEMETHOD opt (opt const & v)
-                :   is_initialized      (v.is_initialized)
-            {
-                if (v.is_initialized)
+#ifdef __cpp_aligned_new
+                return ::operator new (bytes, std::align_val_t (alignment));
+#else
+                // Over-allocates and keeps the pointer to free just before
+                // the aligned block, there is room for it as the block
+                // returned by new is aligned to max_align_t
+                if (bytes > static_cast<size_type> (-1) - alignment)
                 {
-                    copy (&storage  , &v.storage    );
+                    throw std::bad_alloc ();
                 }
+
+                auto raw        = ::operator new (bytes + alignment);
+                auto aligned    = (reinterpret_cast<std::uintptr_t> (raw) + alignment) & ~static_cast<std::uintptr_t> (alignment - 1U);
+                auto p          = reinterpret_cast<void *> (aligned);
+                static_cast<void **> (p)[-1] = raw;
+                return p;
+#endif
             }
 
-            CPPLINQ_INLINEMETHOD opt (opt && v)  CPPLINQ_NOEXCEPT
-                :   is_initialized      (v.is_initialized)
+            virtual void do_deallocate (void * p, size_type, size_type alignment)
             {
-                if (v.is_initialized)
+                if (alignment <= alignof (std::max_align_t))
                 {
-                    move (&storage  , &v.storage    );
+                    ::operator delete (p);
+                    return;
                 }
-                v.is_initialized = false;
+
+#ifdef __cpp_aligned_new
+                ::operator delete (p, std::align_val_t (alignment));
+#else
+                ::operator delete (static_cast<void **> (p)[-1]);
+#endif
             }
+        };
 
-            CPPLINQ_METHOD void swap (opt & v)
-            {
-                if (is_initialized && v.is_initialized)
-                {
-                    storage_type tmp;
+        static new_delete_memory_resource resource;
+        return &resource;
+    }
 
-                    move (&tmp          , &storage      );
-                    move (&storage      , &v.storage    );
-                    move (&v.storage    , &tmp          );
-                }
-                else if (is_initialized)
-                {
-                    move (&v.storage    , &storage      );
-                    v.is_initialized= true;
-                    is_initialized  = false;
-                }
-                else if (v.is_initialized)
-                {
-                    move (&storage      , &v.storage    );
-                    v.is_initialized= false;
-                    is_initialized  = true;
-                }
-                else
-                {
-                    // Do nothing
-                }
-            }
+    // resource_allocator mirrors std::pmr::polymorphic_allocator, copies of
+    // containers keep drawing from the same memory resource. Unlike
+    // polymorphic_allocator it moves and swaps along with the container so
+    // that buffers can be swapped between containers in O(1).
+    template<typename TValue>
+    struct resource_allocator
+    {
+        typedef                 TValue                          value_type      ;
 
-            CPPLINQ_INLINEMETHOD opt & operator= (opt const & v)
-            {
-                if (this == std::addressof (v))
-                {
-                    return *this;
-                }
+        typedef                 std::true_type                  propagate_on_container_move_assignment  ;
+        typedef                 std::true_type                  propagate_on_container_swap             ;
 
-                opt<value_type> o (v);
+        template<typename TOther>
+        struct rebind
+        {
+            typedef             resource_allocator<TOther>      other           ;
+        };
 
-                swap (o);
+        CPPLINQ_INLINEMETHOD resource_allocator () CPPLINQ_NOEXCEPT
+            :   memory  (new_delete_resource ())
+        {
+        }
 
-                return *this;
-            }
+        CPPLINQ_INLINEMETHOD resource_allocator (memory_resource * memory) CPPLINQ_NOEXCEPT
+            :   memory  (memory)
+        {
+            CPPLINQ_ASSERT (memory);
+        }
 
-            CPPLINQ_INLINEMETHOD opt & operator= (opt && v)
+        template<typename TOther>
+        CPPLINQ_INLINEMETHOD resource_allocator (resource_allocator<TOther> const & v) CPPLINQ_NOEXCEPT
+            :   memory  (v.resource ())
+        {
+        }
+
+        CPPLINQ_INLINEMETHOD value_type * allocate (size_type count)
+        {
+            if (count > static_cast<size_type> (-1) / sizeof (value_type))
             {
-                if (this == std::addressof (v))
-                {
-                    return *this;
-                }
+                throw std::bad_alloc ();
+            }
 
-                swap (v);
+            return static_cast<value_type *> (memory->allocate (count * sizeof (value_type), alignof (value_type)));
+        }
 
-                return *this;
+        CPPLINQ_INLINEMETHOD void deallocate (value_type * p, size_type count)
+        {
+            memory->deallocate (p, count * sizeof (value_type), alignof (value_type));
+        }
+
+        CPPLINQ_INLINEMETHOD memory_resource * resource () const CPPLINQ_NOEXCEPT
+        {
+            return memory;
+        }
+
+    private:
+        memory_resource *       memory  ;
+    };
+
+    template<typename TLeft, typename TRight>
+    CPPLINQ_INLINEMETHOD bool operator== (resource_allocator<TLeft> const & left, resource_allocator<TRight> const & right) CPPLINQ_NOEXCEPT
+    {
+        return left.resource () == right.resource () || left.resource ()->is_equal (*right.resource ());
+    }
+
+    template<typename TLeft, typename TRight>
+    CPPLINQ_INLINEMETHOD bool operator!= (resource_allocator<TLeft> const & left, resource_allocator<TRight> const & right) CPPLINQ_NOEXCEPT
+    {
+        return !(left == right);
+    }
+
+    // -------------------------------------------------------------------------
+    // arena is a monotonic memory resource that hands out memory by bumping a
+    // pointer through chunks drawn from its upstream resource. Memory is only
+    // given back by reset (), which rewinds the arena but keeps its chunks,
+    // so a query that is run again after a reset draws no memory from the
+    // upstream resource. An arena is not thread safe.
+    // -------------------------------------------------------------------------
+
+    struct arena : memory_resource
+    {
+        CPPLINQ_INLINEMETHOD explicit arena (
+                size_type           chunk_size  = 64U * 1024U
+            ,   memory_resource *   upstream    = new_delete_resource ()
+            ) CPPLINQ_NOEXCEPT
+            :   upstream    (upstream)
+            ,   first       (nullptr)
+            ,   current     (nullptr)
+            ,   top         (nullptr)
+            ,   end         (nullptr)
+            ,   next_size   (chunk_size > 0U ? chunk_size : 1U)
+        {
+            CPPLINQ_ASSERT (upstream);
+        }
+
+        CPPLINQ_INLINEMETHOD ~arena () CPPLINQ_NOEXCEPT
+        {
+            release ();
+        }
+
+        // Makes all memory handed out available again, the chunks are kept
+        CPPLINQ_INLINEMETHOD void reset () CPPLINQ_NOEXCEPT
+        {
+            enter (first);
+        }
+
+        // Gives all chunks back to the upstream resource
+        CPPLINQ_METHOD void release () CPPLINQ_NOEXCEPT
+        {
+            while (first)
+            {
+                auto c = first;
+                first = c->next;
+                upstream->deallocate (c, header_size + c->size, alignof (std::max_align_t));
             }
 
-            CPPLINQ_INLINEMETHOD opt & operator= (value_type v)
+            current = nullptr;
+            top     = nullptr;
+            end     = nullptr;
+        }
+
+        // The number of bytes held in chunks
+        CPPLINQ_METHOD size_type capacity () const CPPLINQ_NOEXCEPT
+        {
+            size_type result = 0U;
+            for (auto c = first; c; c = c->next)
             {
-                return *this = opt (std::move (v));
+                result += c->size;
             }
+            return result;
+        }
 
-            CPPLINQ_INLINEMETHOD void clear () CPPLINQ_NOEXCEPT
+    protected:
+        virtual void * do_allocate (size_type bytes, size_type alignment)
+        {
+            CPPLINQ_ASSERT (alignment > 0U && (alignment & (alignment - 1U)) == 0U);
+
+            auto p = bump (bytes, alignment);
+            if (p)
             {
-                opt empty;
-                swap (empty);
+                return p;
             }
 
-            CPPLINQ_INLINEMETHOD value_type const * get_ptr () const CPPLINQ_NOEXCEPT
+            // Moves on to the chunks kept from before a reset and only asks
+            // the upstream resource for memory when none of them fits
+            while (current && current->next)
             {
-                if (is_initialized)
-                {
-                    return reinterpret_cast<value_type const *> (&storage);
-                }
-                else
+                enter (current->next);
+                p = bump (bytes, alignment);
+                if (p)
                 {
-                    return nullptr;
+                    return p;
                 }
             }
 
-            CPPLINQ_INLINEMETHOD value_type * get_ptr () CPPLINQ_NOEXCEPT
+            auto size = next_size;
+            if (size < bytes + alignment)
             {
-                if (is_initialized)
+                if (bytes + alignment < bytes)
                 {
-                    return reinterpret_cast<value_type*> (&storage);
-                }
-                else
-                {
-                    return nullptr;
+                    throw std::bad_alloc ();
                 }
+                size = bytes + alignment;
             }
 
-            CPPLINQ_INLINEMETHOD value_type const & get () const CPPLINQ_NOEXCEPT
-            {
-                CPPLINQ_ASSERT (is_initialized);
-                return *get_ptr ();
-            }
+            auto c = static_cast<chunk *> (upstream->allocate (header_size + size, alignof (std::max_align_t)));
+            c->next = nullptr;
+            c->size = size;
 
-            CPPLINQ_INLINEMETHOD value_type & get () CPPLINQ_NOEXCEPT
+            if (current)
             {
-                CPPLINQ_ASSERT (is_initialized);
-                return *get_ptr ();
+                current->next = c;
             }
-
-            CPPLINQ_INLINEMETHOD bool has_value () const CPPLINQ_NOEXCEPT
+            else
             {
-                return is_initialized;
+                first = c;
             }
 
-            // TODO: To be replaced with explicit operator bool ()
-            typedef bool (opt::*type_safe_bool_type) () const;
+            enter (c);
 
-            CPPLINQ_INLINEMETHOD operator type_safe_bool_type () const CPPLINQ_NOEXCEPT
+            // Chunks grow geometrically so that a large query needs few of them
+            next_size = size + size / 2U;
+
+            p = bump (bytes, alignment);
+            CPPLINQ_ASSERT (p);
+            return p;
+        }
+
+        // Only the most recent allocation is given back, anything else waits
+        // for reset ()
+        virtual void do_deallocate (void * p, size_type bytes, size_type)
+        {
+            if (static_cast<char *> (p) + bytes == top)
             {
-                return is_initialized ? &opt::has_value : nullptr;
+                top = static_cast<char *> (p);
             }
+        }
 
-            CPPLINQ_INLINEMETHOD value_type const & operator* () const CPPLINQ_NOEXCEPT
+    private:
+        struct chunk
+        {
+            chunk *     next    ;
+            size_type   size    ;
+        };
+
+        static size_type const header_size =
+                (sizeof (chunk) + alignof (std::max_align_t) - 1U)
+            &   ~(alignof (std::max_align_t) - 1U)
+            ;
+
+        memory_resource *   upstream    ;
+        chunk *             first       ;
+        chunk *             current     ;
+        char *              top         ;
+        char *              end         ;
+        size_type           next_size   ;
+
+        arena (arena const &);
+        arena & operator= (arena const &);
+
+        CPPLINQ_INLINEMETHOD void enter (chunk * c) CPPLINQ_NOEXCEPT
+        {
+            current = c;
+            if (c)
             {
-                return get ();
+                top = reinterpret_cast<char *> (c) + header_size;
+                end = top + c->size;
             }
-
-            CPPLINQ_INLINEMETHOD value_type & operator* () CPPLINQ_NOEXCEPT
+            else
             {
-                return get ();
+                top = nullptr;
+                end = nullptr;
             }
+        }
 
-            CPPLINQ_INLINEMETHOD value_type const * operator-> () const CPPLINQ_NOEXCEPT
+        CPPLINQ_INLINEMETHOD void * bump (size_type bytes, size_type alignment) CPPLINQ_NOEXCEPT
+        {
+            if (!current)
             {
-                return get_ptr ();
+                return nullptr;
             }
 
-            CPPLINQ_INLINEMETHOD value_type * operator-> () CPPLINQ_NOEXCEPT
+            auto address    = reinterpret_cast<std::uintptr_t> (top);
+            auto aligned    = (address + alignment - 1U) & ~static_cast<std::uintptr_t> (alignment - 1U);
+            auto available  = static_cast<size_type> (end - top);
+            auto padding    = static_cast<size_type> (aligned - address);
+
+            if (padding > available || bytes > available - padding)
             {
-                return get_ptr ();
+                return nullptr;
             }
 
-        private:
-            typedef typename std::aligned_storage<
-                    sizeof (value_type)
-                ,   std::alignment_of<value_type>::value
-                >::type storage_type    ;
+            auto result = top + padding;
+            top = result + bytes;
+            return result;
+        }
+    };
 
-            storage_type    storage         ;
-            bool            is_initialized  ;
+    // -------------------------------------------------------------------------
 
-            CPPLINQ_INLINEMETHOD static void move (
-                    storage_type * to
-                ,   storage_type * from
-                ) CPPLINQ_NOEXCEPT
-            {
-                auto f = reinterpret_cast<value_type*> (from);
-                new (to) value_type (std::move (*f));
-                f->~value_type ();
-            }
+    // -------------------------------------------------------------------------
+    // basic_string_ref is a non-owning view of a sequence of characters, like
+    // std::basic_string_view (C++17). The characters are not null terminated
+    // and must outlive the view.
+    // -------------------------------------------------------------------------
 
-            CPPLINQ_INLINEMETHOD static void copy (
-                    storage_type * to
-                ,   storage_type const * from
-                )
-            {
-                auto f = reinterpret_cast<value_type const *> (from);
-                new (to) value_type (*f);
-            }
+    template<typename TCharType>
+    struct basic_string_ref
+    {
+        typedef             TCharType                       value_type      ;
+        typedef             std::char_traits<TCharType>     traits_type     ;
+        typedef             TCharType const *               const_iterator  ;
+        typedef             const_iterator                  iterator        ;
 
+        static size_type const npos = static_cast<size_type> (-1);
 
-        };
+        CPPLINQ_INLINEMETHOD basic_string_ref () CPPLINQ_NOEXCEPT
+            :   first   (nullptr)
+            ,   count   (0U)
+        {
+        }
 
-        // -------------------------------------------------------------------------
-        // The generic interface
-        // -------------------------------------------------------------------------
-        // _range classes:
-        //      inherit base_range
-        //      COPYABLE
-        //      MOVEABLE (movesemantics)
-        //      typedef                 ...         this_type       ;
-        //      typedef                 ...         value_type      ;
-        //      typedef                 ...         return_type     ;   // value_type | value_type const &
-        //      enum { returns_reference = 0|1 };
-        //      return_type front () const
-        //      bool next ()
-        //      template<typename TRangeBuilder>
-        //      typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
-        // -------------------------------------------------------------------------
-        // _builder classes:
-        //      inherit base_builder
-        //      COPYABLE
-        //      MOVEABLE (movesemantics)
-        //      typedef                 ...         this_type       ;
-        //      template<typename TRange>
-        //      TAggregated build (TRange range) const
-        // -------------------------------------------------------------------------
+        CPPLINQ_INLINEMETHOD basic_string_ref (value_type const * first, size_type count) CPPLINQ_NOEXCEPT
+            :   first   (first)
+            ,   count   (count)
+        {
+        }
 
-        struct base_range
+        CPPLINQ_INLINEMETHOD basic_string_ref (value_type const * text)
+            :   first   (text)
+            ,   count   (traits_type::length (text))
         {
-#ifdef CPPLINQ_DETECT_INVALID_METHODS
-        protected:
-            // In order to prevent object slicing
+        }
 
-            CPPLINQ_INLINEMETHOD base_range () CPPLINQ_NOEXCEPT
-            {
-            }
+        template<typename TTraits, typename TAllocator>
+        CPPLINQ_INLINEMETHOD basic_string_ref (std::basic_string<value_type, TTraits, TAllocator> const & text) CPPLINQ_NOEXCEPT
+            :   first   (text.data ())
+            ,   count   (text.size ())
+        {
+        }
 
-            CPPLINQ_INLINEMETHOD base_range (base_range const &) CPPLINQ_NOEXCEPT
-            {
-            }
+        CPPLINQ_INLINEMETHOD const_iterator begin () const CPPLINQ_NOEXCEPT
+        {
+            return first;
+        }
 
-            CPPLINQ_INLINEMETHOD base_range (base_range &&) CPPLINQ_NOEXCEPT
-            {
-            }
+        CPPLINQ_INLINEMETHOD const_iterator end () const CPPLINQ_NOEXCEPT
+        {
+            return first + count;
+        }
 
-            CPPLINQ_INLINEMETHOD ~base_range () CPPLINQ_NOEXCEPT
-            {
-            }
+        CPPLINQ_INLINEMETHOD value_type const * data () const CPPLINQ_NOEXCEPT
+        {
+            return first;
+        }
 
-        private:
-            CPPLINQ_INLINEMETHOD base_range & operator= (base_range const &);
-            CPPLINQ_INLINEMETHOD base_range & operator= (base_range &&);
-#endif
-        };
+        CPPLINQ_INLINEMETHOD size_type size () const CPPLINQ_NOEXCEPT
+        {
+            return count;
+        }
 
-        struct base_builder
+        CPPLINQ_INLINEMETHOD bool empty () const CPPLINQ_NOEXCEPT
         {
-#ifdef CPPLINQ_DETECT_INVALID_METHODS
-        protected:
-            // In order to prevent object slicing
+            return count == 0U;
+        }
 
-            CPPLINQ_INLINEMETHOD base_builder () CPPLINQ_NOEXCEPT
-            {
-            }
+        CPPLINQ_INLINEMETHOD value_type const & operator[] (size_type index) const CPPLINQ_NOEXCEPT
+        {
+            CPPLINQ_ASSERT (index < count);
+            return first[index];
+        }
 
-            CPPLINQ_INLINEMETHOD base_builder (base_builder const &) CPPLINQ_NOEXCEPT
-            {
-            }
+        // Clamps the view like std::basic_string_view::substr but never throws
+        CPPLINQ_INLINEMETHOD basic_string_ref substr (size_type position, size_type length = npos) const CPPLINQ_NOEXCEPT
+        {
+            position = std::min (position, count);
+            return basic_string_ref (first + position, std::min (length, count - position));
+        }
 
-            CPPLINQ_INLINEMETHOD base_builder (base_builder &&) CPPLINQ_NOEXCEPT
+        CPPLINQ_INLINEMETHOD size_type find (value_type ch, size_type position = 0U) const CPPLINQ_NOEXCEPT
+        {
+            if (position >= count)
             {
+                return npos;
             }
 
-            CPPLINQ_INLINEMETHOD ~base_builder () CPPLINQ_NOEXCEPT
+            auto found = traits_type::find (first + position, count - position, ch);
+            return found ? static_cast<size_type> (found - first) : npos;
+        }
+
+        CPPLINQ_INLINEMETHOD int compare (basic_string_ref other) const CPPLINQ_NOEXCEPT
+        {
+            auto result = traits_type::compare (first, other.first, std::min (count, other.count));
+            if (result != 0)
             {
+                return result;
             }
 
-        private:
-            CPPLINQ_INLINEMETHOD base_builder & operator= (base_builder const &);
-            CPPLINQ_INLINEMETHOD base_builder & operator= (base_builder &&);
-#endif
-        };
+            return count < other.count ? -1 : (count > other.count ? 1 : 0);
+        }
 
-        template<typename TValueIterator>
-        struct from_range : base_range
+        CPPLINQ_INLINEMETHOD std::basic_string<value_type> str () const
         {
-            static TValueIterator get_iterator ();
+            return std::basic_string<value_type> (first, count);
+        }
 
-            typedef                 from_range<TValueIterator>          this_type       ;
-            typedef                 TValueIterator                      iterator_type   ;
+    private:
+        value_type const *  first   ;
+        size_type           count   ;
+    };
 
-            typedef                 decltype (*get_iterator ())         raw_value_type  ;
-            typedef        typename cleanup_type<raw_value_type>::type  value_type      ;
-            typedef                 value_type const &                  return_type     ;
-            enum
-            {
-                returns_reference = 1,
-            };
+    template<typename TCharType>
+    size_type const basic_string_ref<TCharType>::npos;
 
-            iterator_type           current ;
-            iterator_type           upcoming;
-            iterator_type           end     ;
+    template<typename TCharType>
+    CPPLINQ_INLINEMETHOD bool operator== (basic_string_ref<TCharType> left, basic_string_ref<TCharType> right) CPPLINQ_NOEXCEPT
+    {
+        return left.size () == right.size () && left.compare (right) == 0;
+    }
 
+    template<typename TCharType>
+    CPPLINQ_INLINEMETHOD bool operator!= (basic_string_ref<TCharType> left, basic_string_ref<TCharType> right) CPPLINQ_NOEXCEPT
+    {
+        return !(left == right);
+    }
 
-            CPPLINQ_INLINEMETHOD from_range (
-                    iterator_type begin
-                ,   iterator_type end
-                ) CPPLINQ_NOEXCEPT
-                :   current (std::move (begin))
-                ,   upcoming(current)
-                ,   end     (std::move (end))
-            {
-            }
+    template<typename TCharType>
+    CPPLINQ_INLINEMETHOD bool operator< (basic_string_ref<TCharType> left, basic_string_ref<TCharType> right) CPPLINQ_NOEXCEPT
+    {
+        return left.compare (right) < 0;
+    }
 
-            CPPLINQ_INLINEMETHOD from_range (from_range const & v) CPPLINQ_NOEXCEPT
-                :   current (v.current)
-                ,   upcoming(v.upcoming)
-                ,   end     (v.end)
-            {
-            }
+    template<typename TCharType>
+    CPPLINQ_INLINEMETHOD bool operator<= (basic_string_ref<TCharType> left, basic_string_ref<TCharType> right) CPPLINQ_NOEXCEPT
+    {
+        return left.compare (right) <= 0;
+    }
 
-            CPPLINQ_INLINEMETHOD from_range (from_range && v) CPPLINQ_NOEXCEPT
-                :   current (std::move (v.current))
-                ,   upcoming(std::move (v.upcoming))
-                ,   end     (std::move (v.end))
-            {
-            }
+    template<typename TCharType>
+    CPPLINQ_INLINEMETHOD bool operator> (basic_string_ref<TCharType> left, basic_string_ref<TCharType> right) CPPLINQ_NOEXCEPT
+    {
+        return left.compare (right) > 0;
+    }
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
-            {
-                return range_builder.build (*this);
-            }
+    template<typename TCharType>
+    CPPLINQ_INLINEMETHOD bool operator>= (basic_string_ref<TCharType> left, basic_string_ref<TCharType> right) CPPLINQ_NOEXCEPT
+    {
+        return left.compare (right) >= 0;
+    }
 
-            CPPLINQ_INLINEMETHOD return_type front () const
-            {
-                CPPLINQ_ASSERT (current != upcoming);
-                CPPLINQ_ASSERT (current != end);
+    typedef     basic_string_ref<char>      string_ref  ;
+    typedef     basic_string_ref<wchar_t>   wstring_ref ;
 
-                return *current;
-            }
+    // -------------------------------------------------------------------------
+    // basic_shared_string_ref is a basic_string_ref that shares the ownership
+    // of the storage of its characters, the view stays valid as long as any
+    // copy of it is alive. from_lines and from_csv yield views into a file
+    // this way so that to_vector, to_lookup and friends can keep them.
+    // -------------------------------------------------------------------------
 
-            CPPLINQ_INLINEMETHOD bool next () CPPLINQ_NOEXCEPT
-            {
-                if (upcoming == end)
-                {
-                    return false;
-                }
+    template<typename TCharType>
+    struct basic_shared_string_ref : basic_string_ref<TCharType>
+    {
+        typedef             basic_string_ref<TCharType>     base_type       ;
 
-                current = upcoming;
-                ++upcoming;
-                return true;
-            }
-        };
+        CPPLINQ_INLINEMETHOD basic_shared_string_ref () CPPLINQ_NOEXCEPT
+        {
+        }
 
-        // -------------------------------------------------------------------------
+        // A view that owns nothing, for instance a key to look up
+        CPPLINQ_INLINEMETHOD basic_shared_string_ref (base_type text) CPPLINQ_NOEXCEPT
+            :   base_type   (text)
+        {
+        }
 
-        // -------------------------------------------------------------------------
+        CPPLINQ_INLINEMETHOD basic_shared_string_ref (std::shared_ptr<void const> owner, base_type text) CPPLINQ_NOEXCEPT
+            :   base_type   (text)
+            ,   storage     (std::move (owner))
+        {
+        }
 
-        template<typename TContainer>
-        struct from_copy_range : base_range
+        CPPLINQ_INLINEMETHOD std::shared_ptr<void const> const & owner () const CPPLINQ_NOEXCEPT
         {
-            typedef                 from_copy_range<TContainer>         this_type       ;
-
-            typedef                 TContainer                          container_type  ;
-            typedef        typename TContainer::const_iterator          iterator_type   ;
-            typedef        typename TContainer::value_type              value_type      ;
-            typedef                 value_type const &                  return_type     ;
-            enum
-            {
-                returns_reference = 1 ,
-            };
-
-            container_type          container   ;
-
-            iterator_type           current     ;
-            iterator_type           upcoming    ;
-            iterator_type           end         ;
-
-            CPPLINQ_INLINEMETHOD from_copy_range (
-                    container_type&&        container
-                )
-                :   container   (std::move (container))
-                ,   current     (container.begin ())
-                ,   upcoming    (container.begin ())
-                ,   end         (container.end ())
-            {
-            }
-
-            CPPLINQ_INLINEMETHOD from_copy_range (
-                    container_type const &  container
-                )
-                :   container   (container)
-                ,   current     (container.begin ())
-                ,   upcoming    (container.begin ())
-                ,   end         (container.end ())
-            {
-            }
+            return storage;
+        }
 
-            CPPLINQ_INLINEMETHOD from_copy_range (from_copy_range const & v)
-                :   container   (v.container)
-                ,   current     (v.current)
-                ,   upcoming    (v.upcoming)
-                ,   end         (v.end)
-            {
-            }
+        // The view shares the ownership of the characters
+        CPPLINQ_INLINEMETHOD basic_shared_string_ref substr (size_type position, size_type length = base_type::npos) const CPPLINQ_NOEXCEPT
+        {
+            return basic_shared_string_ref (storage, base_type::substr (position, length));
+        }
 
-            CPPLINQ_INLINEMETHOD from_copy_range (from_copy_range && v) CPPLINQ_NOEXCEPT
-                :   container   (std::move (v.container))
-                ,   current     (std::move (v.current))
-                ,   upcoming    (std::move (v.upcoming))
-                ,   end         (std::move (v.end))
+        // Views text owned by owner, owner is only copied when it changes so
+        // that rebinding the view within the same storage is cheap
+        template<typename TOwner>
+        CPPLINQ_INLINEMETHOD void assign (std::shared_ptr<TOwner> const & owner, base_type text) CPPLINQ_NOEXCEPT
+        {
+            if (storage != owner)
             {
+                storage = owner;
             }
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
-            {
-                return range_builder.build (*this);
-            }
+            static_cast<base_type &> (*this) = text;
+        }
 
-            CPPLINQ_INLINEMETHOD return_type front () const
-            {
-                CPPLINQ_ASSERT (current != upcoming);
-                CPPLINQ_ASSERT (current != end);
+    private:
+        std::shared_ptr<void const> storage ;
+    };
 
-                return *current;
-            }
+    typedef     basic_shared_string_ref<char>       shared_string_ref   ;
+    typedef     basic_shared_string_ref<wchar_t>    shared_wstring_ref  ;
 
-            CPPLINQ_INLINEMETHOD bool next () CPPLINQ_NOEXCEPT
-            {
-                if (upcoming == end)
-                {
-                    return false;
-                }
+    // -------------------------------------------------------------------------
+    // from_csv projects columns of delimited text into typed fields.
+    // csv_column<TField> (index) selects the column at index (0-based) and
+    // parses it as TField, one of
+    //      string_ref      a view into the text, quotes ("") are kept doubled,
+    //                      yielded as a shared_string_ref that keeps the file
+    //                      alive (shared_string_ref is accepted as well)
+    //      std::string     a copy of the text with quotes ("") undoubled
+    //      integral and floating point types, the decimal point is '.'
+    //      whatever the LC_NUMERIC locale
+    // -------------------------------------------------------------------------
 
-                current = upcoming;
-                ++upcoming;
-                return true;
-            }
-        };
+    template<typename TField>
+    struct csv_column
+    {
+        typedef     TField      value_type  ;
 
-        // -------------------------------------------------------------------------
+        size_type   index   ;
 
-        struct int_range : base_range
+        CPPLINQ_INLINEMETHOD explicit csv_column (size_type index) CPPLINQ_NOEXCEPT
+            :   index   (index)
         {
-            typedef                 int_range                           this_type       ;
-            typedef                 int                                 value_type      ;
-            typedef                 int                                 return_type     ;
-            enum
-            {
-                returns_reference = 0   ,
-            };
+        }
+    };
 
-            int                     current ;
-            int                     end     ;
+    struct csv_options
+    {
+        char        delimiter   ;
+        bool        has_header  ;   // The first record is skipped
 
-            static int get_current (int begin, int end)
-            {
-                return (begin < end ? begin : end) - 1; // -1 in order to start one-step before the first element
-            }
+        CPPLINQ_INLINEMETHOD explicit csv_options (char delimiter = ',', bool has_header = false) CPPLINQ_NOEXCEPT
+            :   delimiter   (delimiter)
+            ,   has_header  (has_header)
+        {
+        }
+    };
 
-            static int get_end (int begin, int end)     // -1 in order to avoid an extra test in next
-            {
-                return (begin < end ? end : begin) - 1;
-            }
+    namespace detail
+    {
+        // Numbers in text always use '.' as decimal point while the C library
+        // reads and writes the decimal point of the LC_NUMERIC locale
+        CPPLINQ_INLINEMETHOD char get_decimal_point () CPPLINQ_NOEXCEPT
+        {
+            auto point = std::localeconv ()->decimal_point;
+            return point && point[0] && !point[1]
+                ?   point[0]
+                :   '.'
+                ;
+        }
+    }
 
-            CPPLINQ_INLINEMETHOD int_range (
-                    int begin
-                ,   int end
-                ) CPPLINQ_NOEXCEPT
-                :   current (get_current (begin, end))
-                ,   end     (get_end (begin,end))
-            {
-            }
+    // -------------------------------------------------------------------------
+    // buffered_writer collects text in a buffer of fixed capacity and writes
+    // it to a file whenever the buffer is full, so that to_file runs in
+    // constant memory. The formatters of to_file write through it.
+    // -------------------------------------------------------------------------
 
-            CPPLINQ_INLINEMETHOD int_range (int_range const & v) CPPLINQ_NOEXCEPT
-                :   current (v.current)
-                ,   end     (v.end)
-            {
-            }
+    struct buffered_writer
+    {
+        CPPLINQ_INLINEMETHOD buffered_writer (std::FILE * file, size_type capacity)
+            :   file        (file)
+            ,   capacity    (std::max (capacity, size_type (64U)))
+            ,   used        (0U)
+            ,   buffer      (new char [this->capacity])
+        {
+            CPPLINQ_ASSERT (file);
+        }
 
-            CPPLINQ_INLINEMETHOD int_range (int_range && v) CPPLINQ_NOEXCEPT
-                :   current (std::move (v.current))
-                ,   end     (std::move (v.end))
+        CPPLINQ_INLINEMETHOD void put (char ch)
+        {
+            if (used == capacity)
             {
+                flush ();
             }
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
-            {
-                return range_builder.build (*this);
-            }
+            buffer[used++] = ch;
+        }
 
-            CPPLINQ_INLINEMETHOD return_type front () const
-            {
-                return current;
-            }
+        CPPLINQ_METHOD void write (string_ref text)
+        {
+            auto first  = text.data ();
+            auto count  = text.size ();
 
-            CPPLINQ_INLINEMETHOD bool next () CPPLINQ_NOEXCEPT
+            while (count > 0U)
             {
-                if (current >= end)
+                if (used == capacity)
                 {
-                    return false;
+                    flush ();
                 }
 
-                ++current;
+                auto chunk = std::min (count, capacity - used);
+                std::memcpy (buffer.get () + used, first, chunk);
 
-                return true;
+                used    += chunk;
+                first   += chunk;
+                count   -= chunk;
             }
-        };
+        }
 
-        // -------------------------------------------------------------------------
+        CPPLINQ_METHOD void write_number (long long value)
+        {
+            char text[32];
+            write (string_ref (text, written (std::snprintf (text, sizeof (text), "%lld", value), sizeof (text))));
+        }
 
-        template <typename TValue>
-        struct repeat_range : base_range
+        CPPLINQ_METHOD void write_number (unsigned long long value)
         {
-            typedef                 repeat_range<TValue>                this_type       ;
-            typedef                 TValue                              value_type      ;
-            typedef                 TValue                              return_type     ;
-            enum
-            {
-                returns_reference = 0   ,
-            };
+            char text[32];
+            write (string_ref (text, written (std::snprintf (text, sizeof (text), "%llu", value), sizeof (text))));
+        }
 
-            TValue                  value       ;
-            size_type               remaining   ;
+        // Writes value with enough digits to be read back exactly and '.' as
+        // decimal point whatever the LC_NUMERIC locale
+        CPPLINQ_METHOD void write_number (double value)
+        {
+            char text[32];
+            write_decimal (text, written (std::snprintf (text, sizeof (text), "%.17g", value), sizeof (text)));
+        }
 
-            CPPLINQ_INLINEMETHOD repeat_range (
-                    value_type element
-                ,   size_type count
-                ) CPPLINQ_NOEXCEPT
-                :   value       (std::move (element))
-                ,   remaining   (count)
-            {
-            }
+        CPPLINQ_METHOD void write_number (long double value)
+        {
+            char text[64];
+            write_decimal (text, written (std::snprintf (text, sizeof (text), "%.*Lg", std::numeric_limits<long double>::max_digits10, value), sizeof (text)));
+        }
 
-            CPPLINQ_INLINEMETHOD repeat_range (repeat_range const & v) CPPLINQ_NOEXCEPT
-                :   value       (v.value)
-                ,   remaining   (v.remaining)
-            {
-            }
+        template<typename TValue>
+        CPPLINQ_INLINEMETHOD typename std::enable_if<std::is_integral<TValue>::value && std::is_signed<TValue>::value>::type write_number (TValue value)
+        {
+            write_number (static_cast<long long> (value));
+        }
 
-            CPPLINQ_INLINEMETHOD repeat_range (repeat_range && v) CPPLINQ_NOEXCEPT
-                :   value       (std::move (v.value))
-                ,   remaining   (std::move (v.remaining))
-            {
-            }
+        template<typename TValue>
+        CPPLINQ_INLINEMETHOD typename std::enable_if<std::is_integral<TValue>::value && std::is_unsigned<TValue>::value>::type write_number (TValue value)
+        {
+            write_number (static_cast<unsigned long long> (value));
+        }
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
-            {
-                return range_builder.build (*this);
-            }
+        template<typename TValue>
+        CPPLINQ_INLINEMETHOD typename std::enable_if<std::is_floating_point<TValue>::value>::type write_number (TValue value)
+        {
+            write_number (static_cast<double> (value));
+        }
 
-            CPPLINQ_INLINEMETHOD return_type front () const
+        CPPLINQ_METHOD void flush ()
+        {
+            if (used > 0U && std::fwrite (buffer.get (), 1U, used, file) != used)
             {
-                return value;
+                throw io_exception ();
             }
 
-            CPPLINQ_INLINEMETHOD bool next () CPPLINQ_NOEXCEPT
-            {
-                if (remaining == 0U)
-                {
-                    return false;
-                }
-
-                --remaining;
+            used = 0U;
+        }
 
-                return true;
-            }
-        };
+    private:
+        std::FILE *                 file        ;
+        size_type                   capacity    ;
+        size_type                   used        ;
+        std::unique_ptr<char []>    buffer      ;
 
-        // -------------------------------------------------------------------------
+        CPPLINQ_INLINEMETHOD buffered_writer (buffered_writer const &);
+        CPPLINQ_INLINEMETHOD buffered_writer & operator= (buffered_writer const &);
 
-        template <typename TValue>
-        struct empty_range : base_range
+        static CPPLINQ_INLINEMETHOD size_type written (int count, size_type size) CPPLINQ_NOEXCEPT
         {
-            typedef                 empty_range<TValue>                 this_type       ;
-            typedef                 TValue                              value_type      ;
-            typedef                 TValue                              return_type     ;
-            enum
-            {
-                returns_reference = 0   ,
-            };
+            CPPLINQ_ASSERT (count >= 0 && static_cast<size_type> (count) < size);
+            return static_cast<size_type> (count);
+        }
 
-            CPPLINQ_INLINEMETHOD empty_range () CPPLINQ_NOEXCEPT
+        // snprintf writes the decimal point of the LC_NUMERIC locale
+        CPPLINQ_METHOD void write_decimal (char * text, size_type count)
+        {
+            auto point = detail::get_decimal_point ();
+            if (point != '.')
             {
+                std::replace (text, text + count, point, '.');
             }
 
-            CPPLINQ_INLINEMETHOD empty_range (empty_range const & v) CPPLINQ_NOEXCEPT
-            {
-            }
+            write (string_ref (text, count));
+        }
+    };
 
-            CPPLINQ_INLINEMETHOD empty_range (empty_range && v) CPPLINQ_NOEXCEPT
-            {
-            }
+    // -------------------------------------------------------------------------
+    // Tedious implementation details of cpplinq
+    // -------------------------------------------------------------------------
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
-            {
-                return range_builder.build (*this);
-            }
+    namespace detail
+    {
 
-            CPPLINQ_INLINEMETHOD return_type front () const
-            {
-                CPPLINQ_ASSERT (false);
-                throw programming_error_exception ();
-            }
+        // -------------------------------------------------------------------------
 
-            CPPLINQ_INLINEMETHOD bool next () CPPLINQ_NOEXCEPT
-            {
-                return false;
-            }
-        };
+        size_type const invalid_size = static_cast<size_type>(-1);
 
         // -------------------------------------------------------------------------
 
-        template <typename TValue>
-        struct singleton_range : base_range
+        template<typename TValue>
+        struct cleanup_type
         {
-            typedef                 singleton_range<TValue>             this_type       ;
-            typedef                 TValue                              value_type      ;
-            typedef                 TValue const &                      return_type     ;
+            typedef typename std::remove_const<
+                typename std::remove_reference<TValue>::type
+                >::type                                         type;
+        };
+
+        template<typename TRangeBuilder, typename TRange>
+        struct get_builtup_type
+        {
+            static TRangeBuilder get_builder ();
+            static TRange get_range ();
+
+            typedef decltype (get_builder ().build (get_range ()))  type;
+        };
+
+        template<typename TPredicate, typename TValue>
+        struct get_transformed_type
+        {
+            static TValue                       get_value ();
+            static TPredicate                   get_predicate ();
+
+            typedef     decltype (get_predicate ()(get_value ()))   raw_type    ;
+            typedef     typename cleanup_type<raw_type>::type       type        ;
+        };
 
+        template<typename TArray>
+        struct get_array_properties;
+
+        template<typename TValue, int Size>
+        struct get_array_properties<TValue[Size]>
+        {
             enum
             {
-                returns_reference = 1   ,
+                size = Size ,
             };
 
-            value_type  value   ;
-            bool        done    ;
+            typedef typename    cleanup_type<TValue>::type  value_type      ;
+            typedef             value_type const *          iterator_type   ;
+        };
 
-            CPPLINQ_INLINEMETHOD singleton_range (TValue const & value)
-                :   value   (value)
-                ,   done    (false)
-            {
-            }
+        template<typename TValue>
+        struct is_character
+            :   std::integral_constant<
+                    bool
+                ,       std::is_same<TValue, char>::value
+                    ||  std::is_same<TValue, wchar_t>::value
+                    ||  std::is_same<TValue, char16_t>::value
+                    ||  std::is_same<TValue, char32_t>::value
+                >
+        {
+        };
 
-            CPPLINQ_INLINEMETHOD singleton_range (TValue&& value) CPPLINQ_NOEXCEPT
-                :   value   (std::move (value))
-                ,   done    (false)
-            {
-            }
+        template<typename TIterator, typename TValue, bool is_string = is_character<TValue>::value>
+        struct is_string_iterator : std::false_type
+        {
+        };
 
-            CPPLINQ_INLINEMETHOD singleton_range (singleton_range const & v) CPPLINQ_NOEXCEPT
-                :   value   (v.value)
-                ,   done    (v.done)
-            {
-            }
+        template<typename TIterator, typename TValue>
+        struct is_string_iterator<TIterator, TValue, true>
+            :   std::integral_constant<
+                    bool
+                ,       std::is_same<TIterator, typename std::basic_string<TValue>::iterator>::value
+                    ||  std::is_same<TIterator, typename std::basic_string<TValue>::const_iterator>::value
+                >
+        {
+        };
 
-            CPPLINQ_INLINEMETHOD singleton_range (singleton_range && v) CPPLINQ_NOEXCEPT
-                :   value   (std::move (v.value))
-                ,   done    (std::move (v.done))
-            {
-            }
+        template<typename TIterator>
+        struct is_contiguous_iterator
+        {
+            typedef        typename std::iterator_traits<TIterator>::value_type value_type      ;
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            enum
             {
-                return range_builder.build (*this);
-            }
+                value =
+                        std::is_pointer<TIterator>::value
+                    ||  (   !std::is_same<value_type, bool>::value
+                        &&  (   std::is_same<TIterator, typename std::vector<value_type>::iterator>::value
+                            ||  std::is_same<TIterator, typename std::vector<value_type>::const_iterator>::value
+                            )
+                        )
+                    ||  is_string_iterator<TIterator, value_type>::value
+                    ,
+            };
+        };
 
-            CPPLINQ_INLINEMETHOD return_type front () const CPPLINQ_NOEXCEPT
+        // from () reads containers with contiguous storage through pointers
+        template<typename TContainer>
+        struct from_container_traits
+        {
+            typedef        typename TContainer::const_iterator          iterator_type   ;
+
+            static CPPLINQ_INLINEMETHOD iterator_type begin_of (TContainer const & container)
             {
-                return value;
+                return container.begin ();
             }
 
-            CPPLINQ_INLINEMETHOD bool next () CPPLINQ_NOEXCEPT
+            static CPPLINQ_INLINEMETHOD iterator_type end_of (TContainer const & container)
             {
-                auto d  = done;
-                done    = true;
-                return !d;
+                return container.end ();
             }
         };
 
-        // -------------------------------------------------------------------------
-
-        struct sorting_range : base_range
+        template<typename TContainer>
+        struct contiguous_container_traits
         {
-#ifdef CPPLINQ_DETECT_INVALID_METHODS
-        protected:
-            // In order to prevent object slicing
+            typedef        typename TContainer::value_type const *      iterator_type   ;
 
-            CPPLINQ_INLINEMETHOD sorting_range () CPPLINQ_NOEXCEPT
+            static CPPLINQ_INLINEMETHOD iterator_type begin_of (TContainer const & container) CPPLINQ_NOEXCEPT
             {
+                return container.data ();
             }
 
-            CPPLINQ_INLINEMETHOD sorting_range (sorting_range const &) CPPLINQ_NOEXCEPT
+            static CPPLINQ_INLINEMETHOD iterator_type end_of (TContainer const & container) CPPLINQ_NOEXCEPT
             {
+                return container.data () + container.size ();
             }
+        };
 
-            CPPLINQ_INLINEMETHOD sorting_range (sorting_range &&) CPPLINQ_NOEXCEPT
+        template<typename TValue, typename TAllocator>
+        struct from_container_traits<std::vector<TValue, TAllocator>>
+            :   contiguous_container_traits<std::vector<TValue, TAllocator>>
+        {
+        };
+
+        template<typename TAllocator>
+        struct from_container_traits<std::vector<bool, TAllocator>>
+        {
+            typedef                 std::vector<bool, TAllocator>       container_type  ;
+            typedef        typename container_type::const_iterator      iterator_type   ;
+
+            static CPPLINQ_INLINEMETHOD iterator_type begin_of (container_type const & container)
             {
+                return container.begin ();
             }
 
-            CPPLINQ_INLINEMETHOD ~sorting_range () CPPLINQ_NOEXCEPT
+            static CPPLINQ_INLINEMETHOD iterator_type end_of (container_type const & container)
             {
+                return container.end ();
             }
-        private:
-            CPPLINQ_INLINEMETHOD sorting_range & operator= (sorting_range const &);
-            CPPLINQ_INLINEMETHOD sorting_range & operator= (sorting_range &&);
-#endif
         };
 
-        template<typename TRange, typename TPredicate>
-        struct orderby_range : sorting_range
+        template<typename TChar, typename TTraits, typename TAllocator>
+        struct from_container_traits<std::basic_string<TChar, TTraits, TAllocator>>
+            :   contiguous_container_traits<std::basic_string<TChar, TTraits, TAllocator>>
         {
+        };
 
-            typedef                 orderby_range<TRange, TPredicate>   this_type               ;
-            typedef                 TRange                              range_type              ;
-            typedef                 TPredicate                          predicate_type          ;
-
-            typedef                 typename TRange::value_type         value_type              ;
-            typedef                 typename TRange::return_type        forwarding_return_type  ;
-            typedef                 value_type const &                  return_type             ;
-            enum
-            {
-                forward_returns_reference   = TRange::returns_reference ,
-                returns_reference           = 1                         ,
-            };
-
-            range_type              range           ;
-            predicate_type          predicate       ;
-            bool                    sort_ascending  ;
+        template<typename TValue, std::size_t Size>
+        struct from_container_traits<std::array<TValue, Size>>
+            :   contiguous_container_traits<std::array<TValue, Size>>
+        {
+        };
 
-            size_type               current         ;
-            std::vector<value_type> sorted_values   ;
+        template<typename TValue>
+        struct opt
+        {
+            typedef     TValue  value_type;
 
-            CPPLINQ_INLINEMETHOD orderby_range (
-                    range_type      range
-                ,   predicate_type  predicate
-                ,   bool            sort_ascending
-                ) CPPLINQ_NOEXCEPT
-                :   range           (std::move (range))
-                ,   predicate       (std::move (predicate))
-                ,   sort_ascending  (sort_ascending)
-                ,   current         (invalid_size)
+            CPPLINQ_INLINEMETHOD opt () CPPLINQ_NOEXCEPT
+                :   is_initialized (false)
             {
-                static_assert (
-                        !std::is_convertible<range_type, sorting_range>::value
-                    ,   "orderby may not follow orderby or thenby"
-                    );
             }
 
-            CPPLINQ_INLINEMETHOD orderby_range (orderby_range const & v)
-                :   range           (v.range)
-                ,   predicate       (v.predicate)
-                ,   sort_ascending  (v.sort_ascending)
-                ,   current         (v.current)
-                ,   sorted_values   (v.sorted_values)
+            CPPLINQ_INLINEMETHOD explicit opt (value_type && value)
+                :   is_initialized      (true)
             {
+                new (&storage) value_type (std::move (value));
             }
 
-            CPPLINQ_INLINEMETHOD orderby_range (orderby_range && v) CPPLINQ_NOEXCEPT
-                :   range           (std::move (v.range))
-                ,   predicate       (std::move (v.predicate))
-                ,   sort_ascending  (std::move (v.sort_ascending))
-                ,   current         (std::move (v.current))
-                ,   sorted_values   (std::move (v.sorted_values))
+            CPPLINQ_INLINEMETHOD explicit opt (value_type const & value)
+                :   is_initialized      (true)
             {
+                new (&storage) value_type (value);
             }
 
-            CPPLINQ_INLINEMETHOD forwarding_return_type forwarding_front () const
+            CPPLINQ_INLINEMETHOD ~opt () CPPLINQ_NOEXCEPT
             {
-                return range.front ();
+                auto ptr = get_ptr ();
+                if (ptr)
+                {
+                    ptr->~value_type ();
+                }
+                is_initialized = false;
             }
 
-            CPPLINQ_INLINEMETHOD bool forwarding_next ()
+            // A move-only value can't be copied, ranges copy their cached
+            // values through copy_cache
+            CPPLINQ_INLINEMETHOD opt (opt const & v)
+                :   is_initialized      (v.is_initialized)
             {
-                return range.next ();
-            }
+                static_assert (std::is_copy_constructible<value_type>::value, "opt of a move-only value can't be copied");
 
-            CPPLINQ_INLINEMETHOD bool compare_values (value_type const & l, value_type const & r) const
-            {
-                if (sort_ascending)
-                {
-                    return predicate (l) < predicate (r);
-                }
-                else
+                if (v.is_initialized)
                 {
-                    return predicate (r) < predicate (l);
+                    copy (&storage  , &v.storage    );
                 }
             }
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            CPPLINQ_INLINEMETHOD opt (opt && v)  CPPLINQ_NOEXCEPT
+                :   is_initialized      (v.is_initialized)
             {
-                return range_builder.build (*this);
+                if (v.is_initialized)
+                {
+                    move (&storage  , &v.storage    );
+                }
+                v.is_initialized = false;
             }
 
-            CPPLINQ_INLINEMETHOD return_type front () const
+            CPPLINQ_METHOD void swap (opt & v)
             {
-                return sorted_values[current];
+                if (is_initialized && v.is_initialized)
+                {
+                    storage_type tmp;
+
+                    move (&tmp          , &storage      );
+                    move (&storage      , &v.storage    );
+                    move (&v.storage    , &tmp          );
+                }
+                else if (is_initialized)
+                {
+                    move (&v.storage    , &storage      );
+                    v.is_initialized= true;
+                    is_initialized  = false;
+                }
+                else if (v.is_initialized)
+                {
+                    move (&storage      , &v.storage    );
+                    v.is_initialized= false;
+                    is_initialized  = true;
+                }
+                else
+                {
+                    // Do nothing
+                }
             }
 
-            CPPLINQ_METHOD bool next ()
+            CPPLINQ_INLINEMETHOD opt & operator= (opt const & v)
             {
-                if (current == invalid_size)
+                if (this == std::addressof (v))
                 {
-                    sorted_values.clear ();
-
-                    while (range.next ())
-                    {
-                        sorted_values.push_back (range.front ());
-                    }
+                    return *this;
+                }
 
-                    if (sorted_values.size () == 0)
-                    {
-                        return false;
-                    }
+                opt<value_type> o (v);
 
-                    std::sort (
-                            sorted_values.begin ()
-                        ,   sorted_values.end ()
-                        ,   [this] (value_type const & l, value_type const & r)
-                            {
-                                return this->compare_values (l,r);
-                            }
-                        );
+                swap (o);
 
-                    current = 0U;
-                    return true;
-                }
+                return *this;
+            }
 
-                if (current < sorted_values.size ())
+            CPPLINQ_INLINEMETHOD opt & operator= (opt && v)
+            {
+                if (this == std::addressof (v))
                 {
-                    ++current;
+                    return *this;
                 }
 
-                return current < sorted_values.size ();
-            }
-        };
+                swap (v);
 
-        template<typename TPredicate>
-        struct orderby_builder : base_builder
-        {
-            typedef                 orderby_builder<TPredicate> this_type       ;
-            typedef                 TPredicate                  predicate_type  ;
+                return *this;
+            }
 
-            predicate_type          predicate       ;
-            bool                    sort_ascending  ;
+            CPPLINQ_INLINEMETHOD opt & operator= (value_type v)
+            {
+                return *this = opt (std::move (v));
+            }
 
-            CPPLINQ_INLINEMETHOD explicit orderby_builder (predicate_type predicate, bool sort_ascending) CPPLINQ_NOEXCEPT
-                :   predicate       (std::move (predicate))
-                ,   sort_ascending  (sort_ascending)
+            CPPLINQ_INLINEMETHOD void clear () CPPLINQ_NOEXCEPT
             {
+                opt empty;
+                swap (empty);
             }
 
-            CPPLINQ_INLINEMETHOD orderby_builder (orderby_builder const & v)
-                :   predicate       (v.predicate)
-                ,   sort_ascending  (v.sort_ascending)
+            CPPLINQ_INLINEMETHOD value_type const * get_ptr () const CPPLINQ_NOEXCEPT
             {
+                if (is_initialized)
+                {
+                    return reinterpret_cast<value_type const *> (&storage);
+                }
+                else
+                {
+                    return nullptr;
+                }
             }
 
-            CPPLINQ_INLINEMETHOD orderby_builder (orderby_builder && v) CPPLINQ_NOEXCEPT
-                :   predicate       (std::move (v.predicate))
-                ,   sort_ascending  (std::move (v.sort_ascending))
+            CPPLINQ_INLINEMETHOD value_type * get_ptr () CPPLINQ_NOEXCEPT
             {
+                if (is_initialized)
+                {
+                    return reinterpret_cast<value_type*> (&storage);
+                }
+                else
+                {
+                    return nullptr;
+                }
             }
 
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD orderby_range<TRange, TPredicate> build (TRange range) const
+            CPPLINQ_INLINEMETHOD value_type const & get () const CPPLINQ_NOEXCEPT
             {
-                return orderby_range<TRange, TPredicate>(std::move (range), predicate, sort_ascending);
+                CPPLINQ_ASSERT (is_initialized);
+                return *get_ptr ();
+            }
+
+            CPPLINQ_INLINEMETHOD value_type & get () CPPLINQ_NOEXCEPT
+            {
+                CPPLINQ_ASSERT (is_initialized);
+                return *get_ptr ();
+            }
+
+            CPPLINQ_INLINEMETHOD bool has_value () const CPPLINQ_NOEXCEPT
+            {
+                return is_initialized;
+            }
+
+            // TODO: To be replaced with explicit operator bool ()
+            typedef bool (opt::*type_safe_bool_type) () const;
+
+            CPPLINQ_INLINEMETHOD operator type_safe_bool_type () const CPPLINQ_NOEXCEPT
+            {
+                return is_initialized ? &opt::has_value : nullptr;
+            }
+
+            CPPLINQ_INLINEMETHOD value_type const & operator* () const CPPLINQ_NOEXCEPT
+            {
+                return get ();
+            }
+
+            CPPLINQ_INLINEMETHOD value_type & operator* () CPPLINQ_NOEXCEPT
+            {
+                return get ();
+            }
+
+            CPPLINQ_INLINEMETHOD value_type const * operator-> () const CPPLINQ_NOEXCEPT
+            {
+                return get_ptr ();
+            }
+
+            CPPLINQ_INLINEMETHOD value_type * operator-> () CPPLINQ_NOEXCEPT
+            {
+                return get_ptr ();
+            }
+
+        private:
+            typedef typename std::aligned_storage<
+                    sizeof (value_type)
+                ,   std::alignment_of<value_type>::value
+                >::type storage_type    ;
+
+            storage_type    storage         ;
+            bool            is_initialized  ;
+
+            CPPLINQ_INLINEMETHOD static void move (
+                    storage_type * to
+                ,   storage_type * from
+                ) CPPLINQ_NOEXCEPT
+            {
+                auto f = reinterpret_cast<value_type*> (from);
+                new (to) value_type (std::move (*f));
+                f->~value_type ();
+            }
+
+            CPPLINQ_INLINEMETHOD static void copy (
+                    storage_type * to
+                ,   storage_type const * from
+                )
+            {
+                auto f = reinterpret_cast<value_type const *> (from);
+                new (to) value_type (*f);
             }
 
         };
 
+        // Ranges are copied while they are built up, before any value is
+        // cached. A cached move-only value can't be copied so copying a range
+        // that holds one is a programming error.
+        template<typename TValue>
+        CPPLINQ_INLINEMETHOD opt<TValue> copy_cache (opt<TValue> const & v, std::true_type)
+        {
+            return v;
+        }
+
+        template<typename TValue>
+        CPPLINQ_INLINEMETHOD opt<TValue> copy_cache (opt<TValue> const & v, std::false_type)
+        {
+            if (v.has_value ())
+            {
+                throw programming_error_exception ();
+            }
+
+            return opt<TValue> ();
+        }
+
+        template<typename TValue>
+        CPPLINQ_INLINEMETHOD opt<TValue> copy_cache (opt<TValue> const & v)
+        {
+            return copy_cache (v, std::is_copy_constructible<TValue> ());
+        }
+
         // -------------------------------------------------------------------------
 
-        template<typename TRange, typename TPredicate>
-        struct thenby_range : sorting_range
+        struct default_hash
         {
-            typedef                 thenby_range<TRange, TPredicate>        this_type               ;
-            typedef                 TRange                                  range_type              ;
-            typedef                 TPredicate                              predicate_type          ;
+            template<typename TValue>
+            CPPLINQ_INLINEMETHOD std::size_t operator() (TValue const & value) const
+            {
+                return std::hash<TValue> () (value);
+            }
+        };
 
-            typedef                 typename TRange::value_type             value_type              ;
-            typedef                 typename TRange::forwarding_return_type forwarding_return_type  ;
-            typedef                 value_type const &                      return_type             ;
-            enum
+        struct default_equal_to
+        {
+            template<typename TValue>
+            CPPLINQ_INLINEMETHOD bool operator() (TValue const & left, TValue const & right) const
             {
-                forward_returns_reference   = TRange::forward_returns_reference ,
-                returns_reference           = 1                                 ,
-            };
+                return left == right;
+            }
+        };
 
-            range_type              range           ;
-            predicate_type          predicate       ;
-            bool                    sort_ascending  ;
+        struct identity_selector
+        {
+            template<typename TValue>
+            CPPLINQ_INLINEMETHOD TValue const & operator() (TValue const & v) const CPPLINQ_NOEXCEPT
+            {
+                return v;
+            }
+        };
 
-            size_type               current         ;
-            std::vector<value_type> sorted_values   ;
+        // -------------------------------------------------------------------------
+        // flat_hash_set is an open addressing hash set that keeps the values in
+        // insertion order in one contiguous buffer. The slot table holds the
+        // index of a value and its hash so that probing rarely has to look at
+        // the values. Erased values stay in the buffer so that iterators
+        // (pointers to values) remain valid until the next insert.
+        // -------------------------------------------------------------------------
 
-            CPPLINQ_INLINEMETHOD thenby_range (
-                    range_type      range
-                ,   predicate_type  predicate
-                ,   bool            sort_ascending
-                ) CPPLINQ_NOEXCEPT
-                :   range           (std::move (range))
-                ,   predicate       (std::move (predicate))
-                ,   sort_ascending  (sort_ascending)
-                ,   current         (invalid_size)
+        template<typename TValue, typename THash = default_hash, typename TEqual = default_equal_to>
+        struct flat_hash_set
+        {
+            typedef                 flat_hash_set<TValue, THash, TEqual>    this_type       ;
+            typedef                 TValue                                  value_type      ;
+            typedef                 THash                                   hasher          ;
+            typedef                 TEqual                                  key_equal       ;
+            typedef                 value_type const *                      const_iterator  ;
+            typedef                 const_iterator                          iterator        ;
+
+            CPPLINQ_INLINEMETHOD explicit flat_hash_set (
+                    hasher              hash    = hasher ()
+                ,   key_equal           equal   = key_equal ()
+                ,   memory_resource *   memory  = new_delete_resource ()
+                )
+                :   hash        (std::move (hash))
+                ,   equal       (std::move (equal))
+                ,   values      (resource_allocator<value_type> (memory))
+                ,   slots       (resource_allocator<slot_type> (memory))
+                ,   live        (0U)
+                ,   used        (0U)
             {
-                static_assert (
-                        std::is_convertible<range_type, sorting_range>::value
-                    ,   "thenby may only follow orderby or thenby"
-                    );
             }
 
-            CPPLINQ_INLINEMETHOD thenby_range (thenby_range const & v)
-                :   range           (v.range)
-                ,   predicate       (v.predicate)
-                ,   sort_ascending  (v.sort_ascending)
-                ,   current         (v.current)
-                ,   sorted_values   (v.sorted_values)
+            CPPLINQ_INLINEMETHOD flat_hash_set (flat_hash_set const & v)
+                :   hash        (v.hash)
+                ,   equal       (v.equal)
+                ,   values      (v.values)
+                ,   slots       (v.slots)
+                ,   live        (v.live)
+                ,   used        (v.used)
             {
             }
 
-            CPPLINQ_INLINEMETHOD thenby_range (thenby_range && v) CPPLINQ_NOEXCEPT
-                :   range           (std::move (v.range))
-                ,   predicate       (std::move (v.predicate))
-                ,   sort_ascending  (std::move (v.sort_ascending))
-                ,   current         (std::move (v.current))
-                ,   sorted_values   (std::move (v.sorted_values))
+            CPPLINQ_INLINEMETHOD flat_hash_set (flat_hash_set && v) CPPLINQ_NOEXCEPT
+                :   hash        (std::move (v.hash))
+                ,   equal       (std::move (v.equal))
+                ,   values      (std::move (v.values))
+                ,   slots       (std::move (v.slots))
+                ,   live        (std::move (v.live))
+                ,   used        (std::move (v.used))
             {
             }
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            CPPLINQ_INLINEMETHOD void swap (flat_hash_set & v)
             {
-                return range_builder.build (*this);
+                std::swap (hash, v.hash);
+                std::swap (equal, v.equal);
+                values.swap (v.values);
+                slots.swap (v.slots);
+                std::swap (live, v.live);
+                std::swap (used, v.used);
             }
 
-            CPPLINQ_INLINEMETHOD forwarding_return_type forwarding_front () const
+            CPPLINQ_INLINEMETHOD const_iterator end () const CPPLINQ_NOEXCEPT
             {
-                return range.front ();
+                return nullptr;
             }
 
-            CPPLINQ_INLINEMETHOD bool forwarding_next ()
+            CPPLINQ_INLINEMETHOD bool empty () const CPPLINQ_NOEXCEPT
             {
-                return range.next ();
+                return live == 0U;
             }
 
-            CPPLINQ_INLINEMETHOD bool compare_values (value_type const & l, value_type const & r) const
+            CPPLINQ_INLINEMETHOD size_type size () const CPPLINQ_NOEXCEPT
             {
-                auto pless = range.compare_values (l,r);
-                if (pless)
+                return live;
+            }
+
+            CPPLINQ_METHOD void clear () CPPLINQ_NOEXCEPT
+            {
+                values.clear ();
+                slots.clear ();
+                live = 0U;
+                used = 0U;
+            }
+
+            CPPLINQ_METHOD const_iterator find (value_type const & value) const
+            {
+                if (slots.empty ())
                 {
-                    return true;
+                    return end ();
                 }
 
-                auto pgreater = range.compare_values (r,l);
-                if (pgreater)
+                auto & slot = slots[find_slot (value, hash_of (value))];
+                return slot.index < deleted_slot
+                    ?   std::addressof (values[slot.index])
+                    :   end ()
+                    ;
+            }
+
+            template<typename TOther>
+            CPPLINQ_METHOD std::pair<const_iterator, bool> insert (TOther && value)
+            {
+                // Keep the load factor, including erased slots, below 3/4
+                if (4U * (used + 1U) > 3U * slots.size ())
                 {
-                    return false;
+                    rehash (std::max (size_type (16U), 4U * (live + 1U) > slots.size () ? 2U * slots.size () : slots.size ()));
                 }
 
-                if (sort_ascending)
+                auto h      = hash_of (value);
+                auto & slot = slots[find_slot (value, h)];
+
+                if (slot.index < deleted_slot)
                 {
-                    return predicate (l) < predicate (r);
+                    return std::make_pair (std::addressof (values[slot.index]), false);
                 }
-                else
+
+                values.push_back (std::forward<TOther> (value));
+
+                if (slot.index == empty_slot)
                 {
-                    return predicate (r) < predicate (l);
+                    ++used;
                 }
+                slot.index  = values.size () - 1U;
+                slot.hash   = h;
+                ++live;
+
+                return std::make_pair (std::addressof (values.back ()), true);
             }
 
-            CPPLINQ_INLINEMETHOD return_type front () const
+            // Position of the value in insertion order
+            CPPLINQ_INLINEMETHOD size_type index_of (const_iterator position) const CPPLINQ_NOEXCEPT
             {
-                return sorted_values[current];
+                CPPLINQ_ASSERT (position != end ());
+                return static_cast<size_type> (position - values.data ());
             }
 
-            CPPLINQ_METHOD bool next ()
+            CPPLINQ_METHOD void erase (const_iterator position)
             {
-                if (current == invalid_size)
-                {
-                    sorted_values.clear ();
+                CPPLINQ_ASSERT (position != end ());
 
-                    while (range.forwarding_next ())
-                    {
-                        sorted_values.push_back (range.forwarding_front ());
-                    }
+                auto index  = static_cast<size_type> (position - values.data ());
+                auto mask   = slots.size () - 1U;
 
-                    if (sorted_values.size () == 0)
+                for (auto slot = hash_of (*position) & mask; slots[slot].index != empty_slot; slot = (slot + 1U) & mask)
+                {
+                    if (slots[slot].index == index)
                     {
-                        return false;
+                        slots[slot].index = deleted_slot;
+                        --live;
+                        return;
                     }
-
-                    std::sort (
-                            sorted_values.begin ()
-                        ,   sorted_values.end ()
-                        ,   [this] (value_type const & l, value_type const & r)
-                            {
-                                return this->compare_values (l,r);
-                            }
-                        );
-
-                    current = 0U;
-                    return true;
-                }
-
-                if (current < sorted_values.size ())
-                {
-                    ++current;
                 }
 
-                return current < sorted_values.size ();
+                CPPLINQ_ASSERT (false);
             }
-        };
 
-        template<typename TPredicate>
-        struct thenby_builder : base_builder
-        {
-            typedef                 thenby_builder<TPredicate>  this_type       ;
-            typedef                 TPredicate                  predicate_type  ;
+        private:
+            static size_type const  empty_slot      = static_cast<size_type> (-1);
+            static size_type const  deleted_slot    = static_cast<size_type> (-2);
 
-            predicate_type          predicate       ;
-            bool                    sort_ascending  ;
+            struct slot_type
+            {
+                size_type           index       ;   // Into values or empty_slot or deleted_slot
+                size_type           hash        ;
+            };
 
-            CPPLINQ_INLINEMETHOD explicit thenby_builder (predicate_type predicate, bool sort_ascending) CPPLINQ_NOEXCEPT
-                :   predicate       (std::move (predicate))
-                ,   sort_ascending  (sort_ascending)
+            typedef                 std::vector<value_type, resource_allocator<value_type>> values_type ;
+            typedef                 std::vector<slot_type, resource_allocator<slot_type>>   slots_type  ;
+
+            hasher                  hash        ;
+            key_equal               equal       ;
+            values_type             values      ;
+            slots_type              slots       ;
+            size_type               live        ;   // Values not erased
+            size_type               used        ;   // Slots not empty, including erased slots
+
+            CPPLINQ_INLINEMETHOD size_type hash_of (value_type const & value) const
             {
+                // Fibonacci hashing spreads weak hashes (ie identity for
+                // integers) over the high bits which are then folded down
+                auto h = static_cast<unsigned long long> (hash (value)) * 11400714819323198485ULL;
+                return static_cast<size_type> (h ^ (h >> 32));
             }
 
-            CPPLINQ_INLINEMETHOD thenby_builder (thenby_builder const & v)
-                :   predicate       (v.predicate)
-                ,   sort_ascending  (v.sort_ascending)
+            // Returns the slot holding value or the slot value should be inserted into
+            CPPLINQ_METHOD size_type find_slot (value_type const & value, size_type h) const
             {
-            }
+                auto mask       = slots.size () - 1U;
+                auto insert_at  = empty_slot;
 
-            CPPLINQ_INLINEMETHOD thenby_builder (thenby_builder && v) CPPLINQ_NOEXCEPT
-                :   predicate       (std::move (v.predicate))
-                ,   sort_ascending  (std::move (v.sort_ascending))
-            {
+                for (auto slot = h & mask;; slot = (slot + 1U) & mask)
+                {
+                    auto & s = slots[slot];
+                    if (s.index == empty_slot)
+                    {
+                        return insert_at == empty_slot ? slot : insert_at;
+                    }
+                    else if (s.index == deleted_slot)
+                    {
+                        if (insert_at == empty_slot)
+                        {
+                            insert_at = slot;
+                        }
+                    }
+                    else if (s.hash == h && equal (values[s.index], value))
+                    {
+                        return slot;
+                    }
+                }
             }
 
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD thenby_range<TRange, TPredicate> build (TRange range) const
+            CPPLINQ_METHOD void rehash (size_type slot_count)
             {
-                return thenby_range<TRange, TPredicate>(std::move (range), predicate, sort_ascending);
-            }
-
-        };
-
-        // -------------------------------------------------------------------------
-
-        template<typename TRange>
-        struct reverse_range : base_range
-        {
-            typedef                 reverse_range<TRange>                       this_type           ;
-            typedef                 TRange                                      range_type          ;
+                slot_type empty = { empty_slot, 0U };
+                slots_type rehashed (slot_count, empty, slots.get_allocator ());
 
-            typedef                 typename TRange::value_type                 value_type          ;
-            typedef                 value_type const &                          return_type         ;
+                auto mask = slot_count - 1U;
+                for (auto & s : slots)
+                {
+                    if (s.index < deleted_slot)
+                    {
+                        auto slot = s.hash & mask;
+                        while (rehashed[slot].index != empty_slot)
+                        {
+                            slot = (slot + 1U) & mask;
+                        }
+                        rehashed[slot] = s;
+                    }
+                }
 
-            typedef                 std::vector<value_type>                     stack_type          ;
+                slots.swap (rehashed);
+                used = live;
+            }
+        };
 
-            enum
-            {
-                returns_reference   = 1     ,
-            };
+        template<typename TValue, typename THash, typename TEqual>
+        size_type const flat_hash_set<TValue, THash, TEqual>::empty_slot;
 
+        template<typename TValue, typename THash, typename TEqual>
+        size_type const flat_hash_set<TValue, THash, TEqual>::deleted_slot;
 
-            range_type                  range               ;
-            size_type                   capacity            ;
-            std::vector<value_type>     reversed            ;
-            bool                        start               ;
+        // -------------------------------------------------------------------------
+        // The generic interface
+        // -------------------------------------------------------------------------
+        // _range classes:
+        //      inherit base_range
+        //      COPYABLE
+        //      MOVEABLE (movesemantics)
+        //      typedef                 ...         this_type       ;
+        //      typedef                 ...         value_type      ;
+        //      typedef                 ...         return_type     ;   // value_type | value_type const &
+        //      enum { returns_reference = 0|1 };
+        //      return_type front () const
+        //      bool next ()
+        //      template<typename TRangeBuilder>
+        //      typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+        // -------------------------------------------------------------------------
+        // _builder classes:
+        //      inherit base_builder
+        //      COPYABLE
+        //      MOVEABLE (movesemantics)
+        //      typedef                 ...         this_type       ;
+        //      template<typename TRange>
+        //      TAggregated build (TRange range) const
+        // -------------------------------------------------------------------------
 
-            CPPLINQ_INLINEMETHOD reverse_range (
-                    range_type          range
-                ,   size_type           capacity
-                ) CPPLINQ_NOEXCEPT
-                :   range               (std::move (range))
-                ,   capacity            (capacity)
-                ,   start               (true)
-            {
-            }
+        struct base_range
+        {
+#ifdef CPPLINQ_DETECT_INVALID_METHODS
+        protected:
+            // In order to prevent object slicing
 
-            CPPLINQ_INLINEMETHOD reverse_range (reverse_range const & v) CPPLINQ_NOEXCEPT
-                :   range               (v.range)
-                ,   capacity            (v.capacity)
-                ,   reversed            (v.reversed)
-                ,   start               (v.start)
+            CPPLINQ_INLINEMETHOD base_range () CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD reverse_range (reverse_range && v) CPPLINQ_NOEXCEPT
-                :   range               (std::move (v.range))
-                ,   capacity            (std::move (v.capacity))
-                ,   reversed            (std::move (v.reversed))
-                ,   start               (std::move (v.start))
+            CPPLINQ_INLINEMETHOD base_range (base_range const &) CPPLINQ_NOEXCEPT
             {
             }
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            CPPLINQ_INLINEMETHOD base_range (base_range &&) CPPLINQ_NOEXCEPT
             {
-                return range_builder.build (*this);
             }
 
-            CPPLINQ_INLINEMETHOD return_type front () const CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD ~base_range () CPPLINQ_NOEXCEPT
             {
-                CPPLINQ_ASSERT (!start);
-                CPPLINQ_ASSERT (!reversed.empty ());
-                return reversed[reversed.size () - 1];
             }
 
-            CPPLINQ_INLINEMETHOD bool next ()
-            {
-                if (start)
-                {
-                    start = false;
-
-                    reversed.clear ();
-                    reversed.reserve (capacity);
-
-                    while (range.next ())
-                    {
-                        reversed.push_back (range.front ());
-                    }
-
-                    return !reversed.empty ();
-                }
-
-                if (reversed.empty ())
-                {
-                    return false;
-                }
-
-                reversed.pop_back ();
-
-                return !reversed.empty ();
-            }
+        private:
+            CPPLINQ_INLINEMETHOD base_range & operator= (base_range const &);
+            CPPLINQ_INLINEMETHOD base_range & operator= (base_range &&);
+#endif
         };
 
-        struct reverse_builder : base_builder
+        struct base_builder
         {
-            typedef             reverse_builder     this_type   ;
-
-            size_type           capacity                        ;
+#ifdef CPPLINQ_DETECT_INVALID_METHODS
+        protected:
+            // In order to prevent object slicing
 
-            CPPLINQ_INLINEMETHOD reverse_builder (size_type capacity) CPPLINQ_NOEXCEPT
-                :   capacity (capacity)
+            CPPLINQ_INLINEMETHOD base_builder () CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD reverse_builder (reverse_builder const & v) CPPLINQ_NOEXCEPT
-                :   capacity (v.capacity)
+            CPPLINQ_INLINEMETHOD base_builder (base_builder const &) CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD reverse_builder (reverse_builder && v) CPPLINQ_NOEXCEPT
-                :   capacity (std::move (v.capacity))
+            CPPLINQ_INLINEMETHOD base_builder (base_builder &&) CPPLINQ_NOEXCEPT
             {
             }
 
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD reverse_range<TRange> build (TRange range) const
+            CPPLINQ_INLINEMETHOD ~base_builder () CPPLINQ_NOEXCEPT
             {
-                return reverse_range<TRange> (std::move (range), capacity);
             }
+
+        private:
+            CPPLINQ_INLINEMETHOD base_builder & operator= (base_builder const &);
+            CPPLINQ_INLINEMETHOD base_builder & operator= (base_builder &&);
+#endif
         };
 
+        // -------------------------------------------------------------------------
+        // Instrumentation hooks, without CPPLINQ_INSTRUMENT they reduce to the
+        // plain operation. Ranges name the operator they count as with
+        //      enum { instrumented_as = query_... };
+        // Operators pull values with pull (op, range) instead of range.next ()
+        // and count the values they store with count_store.
         // -------------------------------------------------------------------------
 
-        template<typename TRange, typename TPredicate>
-        struct where_range : base_range
+        template<typename TRange, typename TEnable = void>
+        struct get_instrumented_as : std::integral_constant<int, query_none>
         {
-            typedef                 where_range<TRange, TPredicate> this_type       ;
-            typedef                 TRange                          range_type      ;
-            typedef                 TPredicate                      predicate_type  ;
-
-            typedef                 typename TRange::value_type     value_type      ;
-            typedef                 typename TRange::return_type    return_type     ;
-            enum
-            {
-                returns_reference   = TRange::returns_reference   ,
-            };
+        };
 
-            range_type              range       ;
-            predicate_type          predicate   ;
+        template<typename TRange>
+        struct get_instrumented_as<TRange, typename std::enable_if<(TRange::instrumented_as >= 0)>::type>
+            :   std::integral_constant<int, TRange::instrumented_as>
+        {
+        };
 
-            CPPLINQ_INLINEMETHOD where_range (
-                    range_type      range
-                ,   predicate_type  predicate
-                ) CPPLINQ_NOEXCEPT
-                :   range       (std::move (range))
-                ,   predicate   (std::move (predicate))
+#ifdef CPPLINQ_INSTRUMENT
+        // Attributes the allocations made during its lifetime to op
+        struct instrument_scope
+        {
+            CPPLINQ_INLINEMETHOD explicit instrument_scope (query_operator op) CPPLINQ_NOEXCEPT
+                :   previous    (get_instrument_state ().current)
             {
+                get_instrument_state ().current = op;
             }
 
-            CPPLINQ_INLINEMETHOD where_range (where_range const & v)
-                :   range       (v.range)
-                ,   predicate   (v.predicate)
+            CPPLINQ_INLINEMETHOD ~instrument_scope () CPPLINQ_NOEXCEPT
             {
+                get_instrument_state ().current = previous;
             }
 
-            CPPLINQ_INLINEMETHOD where_range (where_range && v) CPPLINQ_NOEXCEPT
-                :   range       (std::move (v.range))
-                ,   predicate   (std::move (v.predicate))
-            {
-            }
+        private:
+            query_operator  previous    ;
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
-            {
-                return range_builder.build (*this);
-            }
+            CPPLINQ_INLINEMETHOD instrument_scope (instrument_scope const &);
+            CPPLINQ_INLINEMETHOD instrument_scope & operator= (instrument_scope const &);
+        };
 
-            CPPLINQ_INLINEMETHOD return_type front () const
+        CPPLINQ_INLINEMETHOD void count_pulled (query_operator op, query_operator source, size_type count) CPPLINQ_NOEXCEPT
+        {
+            auto & counters = get_instrument_state ().counters;
+            counters[op].pulled      += count;
+            counters[source].yielded += count;
+        }
+
+        template<typename TRange>
+        CPPLINQ_INLINEMETHOD bool pull (query_operator op, TRange & range)
+        {
+            auto source = static_cast<query_operator> (get_instrumented_as<TRange>::value);
+
+            bool pulled;
             {
-                return range.front ();
+                instrument_scope scope (source);
+                pulled = range.next ();
             }
 
-            CPPLINQ_INLINEMETHOD bool next ()
+            if (pulled)
             {
-                while (range.next ())
-                {
-                    if (predicate (range.front ()))
-                    {
-                        return true;
-                    }
-                }
-
-                return false;
+                count_pulled (op, source, 1U);
             }
-        };
 
-        template<typename TPredicate>
-        struct where_builder : base_builder
-        {
-            typedef                 where_builder<TPredicate>   this_type       ;
-            typedef                 TPredicate                  predicate_type  ;
+            return pulled;
+        }
 
-            predicate_type          predicate   ;
+        template<typename TRange>
+        CPPLINQ_INLINEMETHOD size_type pull_batch (query_operator op, TRange & range, typename TRange::value_type * values, size_type capacity)
+        {
+            auto source = static_cast<query_operator> (get_instrumented_as<TRange>::value);
 
-            CPPLINQ_INLINEMETHOD explicit where_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
-                :   predicate (std::move (predicate))
+            size_type pulled;
             {
+                instrument_scope scope (source);
+                pulled = range.next_batch (values, capacity);
             }
 
-            CPPLINQ_INLINEMETHOD where_builder (where_builder const & v)
-                :   predicate (v.predicate)
+            count_pulled (op, source, pulled);
+
+            return pulled;
+        }
+
+        // Counts count values of type TValue that op stores or hands out,
+        // values that are only available by reference have to be copied
+        template<typename TValue>
+        CPPLINQ_INLINEMETHOD void count_store (query_operator op, size_type count = 1U) CPPLINQ_NOEXCEPT
+        {
+            auto & counters = get_instrument_state ().counters[op];
+            if (std::is_lvalue_reference<TValue>::value)
             {
+                counters.copies += count;
             }
-
-            CPPLINQ_INLINEMETHOD where_builder (where_builder && v) CPPLINQ_NOEXCEPT
-                :   predicate (std::move (v.predicate))
+            else
             {
+                counters.moves  += count;
             }
-
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD where_range<TRange, TPredicate> build (TRange range) const
+        }
+#else
+        struct instrument_scope
+        {
+            CPPLINQ_INLINEMETHOD explicit instrument_scope (query_operator) CPPLINQ_NOEXCEPT
             {
-                return where_range<TRange, TPredicate>(std::move (range), predicate);
             }
-
         };
 
-        // -------------------------------------------------------------------------
-
-        // -------------------------------------------------------------------------
+        template<typename TRange>
+        CPPLINQ_INLINEMETHOD bool pull (query_operator, TRange & range)
+        {
+            return range.next ();
+        }
 
         template<typename TRange>
-        struct take_range : base_range
+        CPPLINQ_INLINEMETHOD size_type pull_batch (query_operator, TRange & range, typename TRange::value_type * values, size_type capacity)
         {
-            typedef                 take_range<TRange>              this_type       ;
-            typedef                 TRange                          range_type      ;
+            return range.next_batch (values, capacity);
+        }
 
-            typedef                 typename TRange::value_type     value_type      ;
-            typedef                 typename TRange::return_type    return_type     ;
-            enum
-            {
-                returns_reference   = TRange::returns_reference   ,
-            };
+        template<typename TValue>
+        CPPLINQ_INLINEMETHOD void count_store (query_operator, size_type = 1U) CPPLINQ_NOEXCEPT
+        {
+        }
+#endif
 
-            range_type              range       ;
-            size_type               count       ;
-            size_type               current     ;
+        // -------------------------------------------------------------------------
+        // Ranges with enum { batched = 1 } can also be consumed in batches
+        //      // Copies up to capacity of the next values into values and
+        //      // returns how many were copied, 0 when the range is exhausted
+        //      size_type next_batch (value_type * values, size_type capacity)
+        // A range is consumed either by next ()/front () or by next_batch ().
+        // Only ranges of small trivial value types are batched. to_vector
+        // appends whole batches; reductions like sum and count keep pulling
+        // single values as the compiler already fuses those loops.
+        // -------------------------------------------------------------------------
 
+        // Batches are arrays on the stack, a batch holds at most batch_size
+        // values and at most batch_bytes
+        size_type const batch_size      = 1024U     ;
+        size_type const batch_bytes     = 16384U    ;
+        size_type const min_batch_size  = 16U       ;
 
-            CPPLINQ_INLINEMETHOD take_range (
-                    range_type      range
-                ,   size_type       count
-                ) CPPLINQ_NOEXCEPT
-                :   range       (std::move (range))
-                ,   count       (std::move (count))
-                ,   current     (0)
-            {
-            }
+        template<typename TValue>
+        struct is_batchable_value
+            :   std::integral_constant<
+                        bool
+                    ,       std::is_trivial<TValue>::value
+                        &&  sizeof (TValue) * min_batch_size <= batch_bytes
+                    >
+        {
+        };
 
-            CPPLINQ_INLINEMETHOD take_range (take_range const & v)
-                :   range       (v.range)
-                ,   count       (v.count)
-                ,   current     (v.current)
-            {
-            }
+        template<typename TValue>
+        struct get_batch_size
+            :   std::integral_constant<
+                        size_type
+                    ,   (batch_bytes / sizeof (TValue) < batch_size ? batch_bytes / sizeof (TValue) : batch_size)
+                    >
+        {
+        };
 
-            CPPLINQ_INLINEMETHOD take_range (take_range && v) CPPLINQ_NOEXCEPT
-                :   range       (std::move (v.range))
-                ,   count       (std::move (v.count))
-                ,   current     (std::move (v.current))
-            {
-            }
+        template<typename TRange, typename TEnable = void>
+        struct is_batched : std::false_type
+        {
+        };
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
-            {
-                return range_builder.build (*this);
-            }
+        template<typename TRange>
+        struct is_batched<TRange, typename std::enable_if<TRange::batched != 0>::type> : std::true_type
+        {
+        };
 
-            CPPLINQ_INLINEMETHOD return_type front () const
+        // Calls consumer (values, count) for each batch of range
+        template<typename TRange, typename TConsumer>
+        CPPLINQ_METHOD void for_each_batch (query_operator op, TRange & range, TConsumer consumer)
+        {
+            typedef typename TRange::value_type value_type;
+
+            value_type values[get_batch_size<value_type>::value];
+
+            size_type count;
+            while ((count = pull_batch (op, range, values, get_batch_size<value_type>::value)) > 0U)
             {
-                return range.front ();
+                consumer (static_cast<typename TRange::value_type const *> (values), count);
             }
+        }
 
-            CPPLINQ_INLINEMETHOD bool next ()
-            {
-                if (current >= count)
-                {
-                    return false;
-                }
+        // -------------------------------------------------------------------------
+        // Ranges that know how many values are left can expose
+        //      // Returns the exact number of values the following next ()
+        //      // calls yield, invalid_size if that isn't known
+        //      size_type size_hint () const
+        // Builders that materialize a range use it to reserve storage once.
+        // Ranges that might drop values (where, distinct, ...) don't expose
+        // upper bounds as reserving for them could waste a lot of memory.
+        // -------------------------------------------------------------------------
 
-                ++current;
-                return range.next ();
-            }
+        template<typename TRange, typename TEnable = void>
+        struct has_size_hint : std::false_type
+        {
         };
 
-        struct take_builder : base_builder
+        template<typename TRange>
+        struct has_size_hint<
+                TRange
+            ,   typename std::enable_if<
+                        std::is_same<decltype (std::declval<TRange const &> ().size_hint ()), size_type>::value
+                    >::type
+            >
+            :   std::true_type
         {
-            typedef                 take_builder        this_type       ;
+        };
 
-            size_type               count       ;
+        template<typename TRange>
+        CPPLINQ_INLINEMETHOD size_type get_size_hint (TRange const & range, std::true_type)
+        {
+            return range.size_hint ();
+        }
 
-            CPPLINQ_INLINEMETHOD explicit take_builder (size_type count) CPPLINQ_NOEXCEPT
-                :   count (std::move (count))
-            {
-            }
+        template<typename TRange>
+        CPPLINQ_INLINEMETHOD size_type get_size_hint (TRange const &, std::false_type) CPPLINQ_NOEXCEPT
+        {
+            return invalid_size;
+        }
 
-            CPPLINQ_INLINEMETHOD take_builder (take_builder const & v) CPPLINQ_NOEXCEPT
-                :   count (v.count)
-            {
-            }
+        template<typename TRange>
+        CPPLINQ_INLINEMETHOD size_type get_size_hint (TRange const & range)
+        {
+            return get_size_hint (range, has_size_hint<TRange> ());
+        }
 
-            CPPLINQ_INLINEMETHOD take_builder (take_builder && v) CPPLINQ_NOEXCEPT
-                :   count (std::move (v.count))
-            {
-            }
+        // Reserves room for hint values, or for capacity values if hint is unknown
+        template<typename TValue, typename TAllocator>
+        CPPLINQ_INLINEMETHOD void reserve_for_hint (std::vector<TValue, TAllocator> & values, size_type hint, size_type capacity)
+        {
+            values.reserve (hint == invalid_size ? capacity : hint);
+        }
 
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD take_range<TRange> build (TRange range) const
+        // -------------------------------------------------------------------------
+        // Ranges may expose the memory resource that buffering ranges built on
+        // them draw from
+        //      memory_resource * resource () const
+        // Ranges that don't buffer forward the resource of their source.
+        // -------------------------------------------------------------------------
+
+        template<typename TRange, typename TEnable = void>
+        struct has_memory_resource : std::false_type
+        {
+        };
+
+        template<typename TRange>
+        struct has_memory_resource<
+                TRange
+            ,   typename std::enable_if<
+                        std::is_same<decltype (std::declval<TRange const &> ().resource ()), memory_resource *>::value
+                    >::type
+            >
+            :   std::true_type
+        {
+        };
+
+        template<typename TRange>
+        CPPLINQ_INLINEMETHOD memory_resource * get_memory_resource (TRange const & range, std::true_type) CPPLINQ_NOEXCEPT
+        {
+            return range.resource ();
+        }
+
+        template<typename TRange>
+        CPPLINQ_INLINEMETHOD memory_resource * get_memory_resource (TRange const &, std::false_type) CPPLINQ_NOEXCEPT
+        {
+            return new_delete_resource ();
+        }
+
+        template<typename TRange>
+        CPPLINQ_INLINEMETHOD memory_resource * get_memory_resource (TRange const & range) CPPLINQ_NOEXCEPT
+        {
+            return get_memory_resource (range, has_memory_resource<TRange> ());
+        }
+
+        template<typename TValue>
+        struct resource_vector
+        {
+            typedef                 std::vector<TValue, resource_allocator<TValue>>     type            ;
+        };
+
+        template<typename TAllocator, typename TValue>
+        struct rebind_allocator
+        {
+            typedef typename        std::allocator_traits<TAllocator>::template rebind_alloc<TValue>
+                                                                                        type            ;
+        };
+
+        // Ranges are copied while they are built up, before they are iterated.
+        // Buffers of move-only values are therefore empty when copied, a
+        // filled buffer of move-only values can't be copied and copying the
+        // range that holds it is a programming error like in copy_cache.
+        template<typename TValue, typename TAllocator>
+        CPPLINQ_INLINEMETHOD std::vector<TValue, TAllocator> copy_buffer (std::vector<TValue, TAllocator> const & values, std::true_type)
+        {
+            return values;
+        }
+
+        template<typename TValue, typename TAllocator>
+        CPPLINQ_INLINEMETHOD std::vector<TValue, TAllocator> copy_buffer (std::vector<TValue, TAllocator> const & values, std::false_type)
+        {
+            if (!values.empty ())
             {
-                return take_range<TRange>(std::move (range), count);
+                throw programming_error_exception ();
             }
 
+            return std::vector<TValue, TAllocator> (values.get_allocator ());
+        }
+
+        template<typename TValue, typename TAllocator>
+        CPPLINQ_INLINEMETHOD std::vector<TValue, TAllocator> copy_buffer (std::vector<TValue, TAllocator> const & values)
+        {
+            return copy_buffer (values, std::is_copy_constructible<TValue> ());
+        }
+
+        // -------------------------------------------------------------------------
+        // Ranges that keep their current value themselves (select, generate)
+        // can hand it over to the builder that consumes them
+        //      // Moves the current value out of the range, front () is not
+        //      // valid again until the following next ()
+        //      value_type take_front ()
+        // Builders that store values (to_vector, orderby, to_lookup, ...)
+        // read them with move_front, so values are moved rather than copied
+        // wherever possible and move-only values like std::unique_ptr can be
+        // collected. Ranges without take_front are read with front ().
+        // -------------------------------------------------------------------------
+
+        template<typename TRange, typename TEnable = void>
+        struct has_take_front : std::false_type
+        {
+        };
+
+        template<typename TRange>
+        struct has_take_front<
+                TRange
+            ,   typename std::enable_if<
+                        std::is_same<decltype (std::declval<TRange &> ().take_front ()), typename TRange::value_type>::value
+                    >::type
+            >
+            :   std::true_type
+        {
+        };
+
+        template<typename TRange>
+        struct move_front_type
+        {
+            typedef typename        std::conditional<
+                    has_take_front<TRange>::value
+                ,   typename TRange::value_type
+                ,   typename TRange::return_type
+                >::type                                                                 type            ;
+        };
+
+        template<typename TRange>
+        CPPLINQ_INLINEMETHOD typename TRange::value_type move_front (TRange & range, std::true_type)
+        {
+            return range.take_front ();
+        }
+
+        template<typename TRange>
+        CPPLINQ_INLINEMETHOD typename TRange::return_type move_front (TRange & range, std::false_type)
+        {
+            return range.front ();
+        }
+
+        template<typename TRange>
+        CPPLINQ_INLINEMETHOD typename move_front_type<TRange>::type move_front (TRange & range)
+        {
+            return move_front (range, has_take_front<TRange> ());
+        }
+
+        // move_front for values that op stores
+        template<typename TRange>
+        CPPLINQ_INLINEMETHOD typename move_front_type<TRange>::type store_front (query_operator op, TRange & range)
+        {
+            count_store<typename move_front_type<TRange>::type> (op);
+            return move_front (range, has_take_front<TRange> ());
+        }
+
+        // -------------------------------------------------------------------------
+        // Ranges with enum { random_access = 1 } can be sized, advanced and
+        // indexed in O(1)
+        //      // Returns the number of values the following next () calls
+        //      // yield, may evaluate a buffering range (reverse, orderby)
+        //      size_type   size ()
+        //      // Skips the count next values, stops at the end of the range
+        //      void        advance (size_type count)
+        //      // Returns the index:th next value, index < size ()
+        //      value_type  at (size_type index) const
+        // front () is only valid after next () has been called again.
+        // -------------------------------------------------------------------------
+
+        template<typename TRange, typename TEnable = void>
+        struct is_random_access_range : std::false_type
+        {
+        };
+
+        template<typename TRange>
+        struct is_random_access_range<TRange, typename std::enable_if<TRange::random_access != 0>::type> : std::true_type
+        {
         };
 
         // -------------------------------------------------------------------------
 
-        template<typename TRange, typename TPredicate>
-        struct take_while_range : base_range
+        template<typename TValueIterator>
+        struct from_range : base_range
         {
-            typedef                 take_while_range<TRange, TPredicate>    this_type       ;
-            typedef                 TRange                                  range_type      ;
-            typedef                 TPredicate                              predicate_type  ;
+            static TValueIterator get_iterator ();
 
-            typedef                 typename TRange::value_type             value_type      ;
-            typedef                 typename TRange::return_type            return_type     ;
+            typedef                 from_range<TValueIterator>          this_type       ;
+            typedef                 TValueIterator                      iterator_type   ;
+
+            typedef                 decltype (*get_iterator ())         raw_value_type  ;
+            typedef        typename cleanup_type<raw_value_type>::type  value_type      ;
+            typedef                 value_type const &                  return_type     ;
+            typedef        typename std::iterator_traits<TValueIterator>::iterator_category
+                                                                        iterator_category;
+            typedef        typename std::iterator_traits<TValueIterator>::difference_type
+                                                                        difference_type ;
             enum
             {
-                returns_reference   = TRange::returns_reference   ,
+                returns_reference = 1,
+                batched           = is_batchable_value<value_type>::value,
+                random_access     = std::is_convertible<iterator_category, std::random_access_iterator_tag>::value,
+                instrumented_as   = query_from,
             };
 
-            range_type              range       ;
-            predicate_type          predicate   ;
-            bool                    done        ;
+            iterator_type           current ;
+            iterator_type           upcoming;
+            iterator_type           end     ;
 
 
-            CPPLINQ_INLINEMETHOD take_while_range (
-                    range_type      range
-                ,   predicate_type  predicate
+            CPPLINQ_INLINEMETHOD from_range (
+                    iterator_type begin
+                ,   iterator_type end
                 ) CPPLINQ_NOEXCEPT
-                :   range       (std::move (range))
-                ,   predicate   (std::move (predicate))
-                ,   done        (false)
+                :   current (std::move (begin))
+                ,   upcoming(current)
+                ,   end     (std::move (end))
             {
             }
 
-            CPPLINQ_INLINEMETHOD take_while_range (take_while_range const & v)
-                :   range       (v.range)
-                ,   predicate   (v.predicate)
-                ,   done        (v.done)
+            CPPLINQ_INLINEMETHOD from_range (from_range const & v) CPPLINQ_NOEXCEPT
+                :   current (v.current)
+                ,   upcoming(v.upcoming)
+                ,   end     (v.end)
             {
             }
 
-            CPPLINQ_INLINEMETHOD take_while_range (take_while_range && v) CPPLINQ_NOEXCEPT
-                :   range       (std::move (v.range))
-                ,   predicate   (std::move (v.predicate))
-                ,   done        (std::move (v.done))
+            CPPLINQ_INLINEMETHOD from_range (from_range && v) CPPLINQ_NOEXCEPT
+                :   current (std::move (v.current))
+                ,   upcoming(std::move (v.upcoming))
+                ,   end     (std::move (v.end))
             {
             }
 
@@ -1573,42 +2411,2341 @@ namespace cpplinq
 
             CPPLINQ_INLINEMETHOD return_type front () const
             {
-                return range.front ();
+                CPPLINQ_ASSERT (current != upcoming);
+                CPPLINQ_ASSERT (current != end);
+
+                return *current;
             }
 
-            CPPLINQ_INLINEMETHOD bool next ()
+            CPPLINQ_INLINEMETHOD bool next () CPPLINQ_NOEXCEPT
             {
-                if (done)
-                {
-                    return false;
-                }
-
-                if (!range.next ())
-                {
-                    done = true;
-                    return false;
-                }
-
-                if (!predicate (range.front ()))
+                if (upcoming == end)
                 {
-                    done = true;
                     return false;
                 }
 
+                current = upcoming;
+                ++upcoming;
                 return true;
             }
-        };
-
-        template<typename TPredicate>
-        struct take_while_builder : base_builder
-        {
-            typedef                 take_while_builder<TPredicate>  this_type       ;
-            typedef                 TPredicate                      predicate_type  ;
 
-            predicate_type          predicate   ;
-
-            CPPLINQ_INLINEMETHOD take_while_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
-                :   predicate (std::move (predicate))
+            CPPLINQ_INLINEMETHOD size_type size_hint () const
+            {
+                return size_hint (iterator_category ());
+            }
+
+            CPPLINQ_INLINEMETHOD size_type size_hint (std::random_access_iterator_tag) const
+            {
+                return size ();
+            }
+
+            CPPLINQ_INLINEMETHOD size_type size_hint (std::input_iterator_tag) const CPPLINQ_NOEXCEPT
+            {
+                return invalid_size;
+            }
+
+            CPPLINQ_INLINEMETHOD size_type size () const
+            {
+                return static_cast<size_type> (end - upcoming);
+            }
+
+            CPPLINQ_INLINEMETHOD void advance (size_type count)
+            {
+                upcoming += static_cast<difference_type> (std::min (count, size ()));
+            }
+
+            CPPLINQ_INLINEMETHOD return_type at (size_type index) const
+            {
+                CPPLINQ_ASSERT (index < size ());
+                return upcoming[static_cast<difference_type> (index)];
+            }
+
+            CPPLINQ_INLINEMETHOD size_type next_batch (value_type * values, size_type capacity)
+            {
+                return next_batch (
+                        values
+                    ,   capacity
+                    ,   iterator_category ()
+                    );
+            }
+
+            CPPLINQ_METHOD size_type next_batch (value_type * values, size_type capacity, std::random_access_iterator_tag)
+            {
+                auto count = std::min (capacity, size ());
+                auto last  = upcoming + static_cast<difference_type> (count);
+
+                std::copy (upcoming, last, values);
+                upcoming = last;
+
+                return count;
+            }
+
+            CPPLINQ_METHOD size_type next_batch (value_type * values, size_type capacity, std::input_iterator_tag)
+            {
+                auto count = size_type (0U);
+                for (; count < capacity && upcoming != end; ++upcoming, ++count)
+                {
+                    values[count] = *upcoming;
+                }
+
+                return count;
+            }
+        };
+
+        // -------------------------------------------------------------------------
+        // contiguous_range_traits<TRange> describes ranges over contiguous storage
+        //      enum { is_contiguous = 0|1 };
+        //      static value_type const *   data_of (TRange const &)
+        //      static size_type            size_of (TRange const &)
+        // -------------------------------------------------------------------------
+
+        template<typename TRange>
+        struct contiguous_range_traits
+        {
+            enum
+            {
+                is_contiguous = 0   ,
+            };
+        };
+
+        template<typename TValueIterator>
+        struct contiguous_range_traits<from_range<TValueIterator>>
+        {
+            typedef                 from_range<TValueIterator>          range_type      ;
+            typedef        typename range_type::value_type              value_type      ;
+
+            enum
+            {
+                is_contiguous = is_contiguous_iterator<TValueIterator>::value   ,
+            };
+
+            static CPPLINQ_INLINEMETHOD value_type const * data_of (range_type const & range)
+            {
+                return range.upcoming == range.end ? nullptr : &*range.upcoming;
+            }
+
+            static CPPLINQ_INLINEMETHOD size_type size_of (range_type const & range)
+            {
+                return static_cast<size_type> (range.end - range.upcoming);
+            }
+        };
+
+        // -------------------------------------------------------------------------
+
+        template<typename TContainer>
+        struct from_copy_range : base_range
+        {
+            typedef                 from_copy_range<TContainer>         this_type       ;
+
+            typedef                 TContainer                          container_type  ;
+            typedef        typename TContainer::const_iterator          iterator_type   ;
+            typedef        typename TContainer::value_type              value_type      ;
+            typedef                 value_type const &                  return_type     ;
+            enum
+            {
+                returns_reference = 1 ,
+                instrumented_as   = query_from ,
+            };
+
+            container_type          container   ;
+
+            iterator_type           current     ;
+            iterator_type           upcoming    ;
+            iterator_type           end         ;
+
+            CPPLINQ_INLINEMETHOD from_copy_range (
+                    container_type&&        container
+                )
+                :   container   (std::move (container))
+                ,   current     (container.begin ())
+                ,   upcoming    (container.begin ())
+                ,   end         (container.end ())
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD from_copy_range (
+                    container_type const &  container
+                )
+                :   container   (container)
+                ,   current     (container.begin ())
+                ,   upcoming    (container.begin ())
+                ,   end         (container.end ())
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD from_copy_range (from_copy_range const & v)
+                :   container   (v.container)
+                ,   current     (v.current)
+                ,   upcoming    (v.upcoming)
+                ,   end         (v.end)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD from_copy_range (from_copy_range && v) CPPLINQ_NOEXCEPT
+                :   container   (std::move (v.container))
+                ,   current     (std::move (v.current))
+                ,   upcoming    (std::move (v.upcoming))
+                ,   end         (std::move (v.end))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            {
+                return range_builder.build (*this);
+            }
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                CPPLINQ_ASSERT (current != upcoming);
+                CPPLINQ_ASSERT (current != end);
+
+                return *current;
+            }
+
+            CPPLINQ_INLINEMETHOD bool next () CPPLINQ_NOEXCEPT
+            {
+                if (upcoming == end)
+                {
+                    return false;
+                }
+
+                current = upcoming;
+                ++upcoming;
+                return true;
+            }
+        };
+
+        // -------------------------------------------------------------------------
+
+        struct int_range : base_range
+        {
+            typedef                 int_range                           this_type       ;
+            typedef                 int                                 value_type      ;
+            typedef                 int                                 return_type     ;
+            enum
+            {
+                returns_reference = 0   ,
+                batched           = 1   ,
+                random_access     = 1   ,
+                instrumented_as   = query_range ,
+            };
+
+            int                     current ;
+            int                     end     ;
+
+            static int get_current (int begin, int end)
+            {
+                return (begin < end ? begin : end) - 1; // -1 in order to start one-step before the first element
+            }
+
+            static int get_end (int begin, int end)     // -1 in order to avoid an extra test in next
+            {
+                return (begin < end ? end : begin) - 1;
+            }
+
+            CPPLINQ_INLINEMETHOD int_range (
+                    int begin
+                ,   int end
+                ) CPPLINQ_NOEXCEPT
+                :   current (get_current (begin, end))
+                ,   end     (get_end (begin,end))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD int_range (int_range const & v) CPPLINQ_NOEXCEPT
+                :   current (v.current)
+                ,   end     (v.end)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD int_range (int_range && v) CPPLINQ_NOEXCEPT
+                :   current (std::move (v.current))
+                ,   end     (std::move (v.end))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            {
+                return range_builder.build (*this);
+            }
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                return current;
+            }
+
+            CPPLINQ_INLINEMETHOD bool next () CPPLINQ_NOEXCEPT
+            {
+                if (current >= end)
+                {
+                    return false;
+                }
+
+                ++current;
+
+                return true;
+            }
+
+            CPPLINQ_INLINEMETHOD size_type size_hint () const CPPLINQ_NOEXCEPT
+            {
+                return size ();
+            }
+
+            CPPLINQ_INLINEMETHOD size_type size () const CPPLINQ_NOEXCEPT
+            {
+                return static_cast<size_type> (static_cast<long long> (end) - current);
+            }
+
+            CPPLINQ_INLINEMETHOD void advance (size_type count) CPPLINQ_NOEXCEPT
+            {
+                current += static_cast<int> (std::min (count, size ()));
+            }
+
+            CPPLINQ_INLINEMETHOD return_type at (size_type index) const CPPLINQ_NOEXCEPT
+            {
+                CPPLINQ_ASSERT (index < size ());
+                return current + 1 + static_cast<int> (index);
+            }
+
+            CPPLINQ_INLINEMETHOD size_type next_batch (value_type * values, size_type capacity) CPPLINQ_NOEXCEPT
+            {
+                auto count = std::min (capacity, size ());
+                for (auto index = size_type (0U); index < count; ++index)
+                {
+                    values[index] = current + 1 + static_cast<int> (index);
+                }
+
+                current += static_cast<int> (count);
+
+                return count;
+            }
+        };
+
+        // -------------------------------------------------------------------------
+
+        template <typename TValue>
+        struct repeat_range : base_range
+        {
+            typedef                 repeat_range<TValue>                this_type       ;
+            typedef                 TValue                              value_type      ;
+            typedef                 TValue                              return_type     ;
+            enum
+            {
+                returns_reference = 0   ,
+                random_access     = 1   ,
+                instrumented_as   = query_repeat ,
+            };
+
+            TValue                  value       ;
+            size_type               remaining   ;
+
+            CPPLINQ_INLINEMETHOD repeat_range (
+                    value_type element
+                ,   size_type count
+                ) CPPLINQ_NOEXCEPT
+                :   value       (std::move (element))
+                ,   remaining   (count)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD repeat_range (repeat_range const & v) CPPLINQ_NOEXCEPT
+                :   value       (v.value)
+                ,   remaining   (v.remaining)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD repeat_range (repeat_range && v) CPPLINQ_NOEXCEPT
+                :   value       (std::move (v.value))
+                ,   remaining   (std::move (v.remaining))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            {
+                return range_builder.build (*this);
+            }
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                return value;
+            }
+
+            CPPLINQ_INLINEMETHOD size_type size_hint () const CPPLINQ_NOEXCEPT
+            {
+                return remaining;
+            }
+
+            CPPLINQ_INLINEMETHOD size_type size () const CPPLINQ_NOEXCEPT
+            {
+                return remaining;
+            }
+
+            CPPLINQ_INLINEMETHOD void advance (size_type count) CPPLINQ_NOEXCEPT
+            {
+                remaining -= std::min (count, remaining);
+            }
+
+            CPPLINQ_INLINEMETHOD return_type at (size_type index) const
+            {
+                CPPLINQ_ASSERT (index < remaining);
+                return value;
+            }
+
+            CPPLINQ_INLINEMETHOD bool next () CPPLINQ_NOEXCEPT
+            {
+                if (remaining == 0U)
+                {
+                    return false;
+                }
+
+                --remaining;
+
+                return true;
+            }
+        };
+
+        // -------------------------------------------------------------------------
+
+        template <typename TValue>
+        struct empty_range : base_range
+        {
+            typedef                 empty_range<TValue>                 this_type       ;
+            typedef                 TValue                              value_type      ;
+            typedef                 TValue                              return_type     ;
+            enum
+            {
+                returns_reference = 0   ,
+                instrumented_as   = query_empty ,
+            };
+
+            CPPLINQ_INLINEMETHOD empty_range () CPPLINQ_NOEXCEPT
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD empty_range (empty_range const & v) CPPLINQ_NOEXCEPT
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD empty_range (empty_range && v) CPPLINQ_NOEXCEPT
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            {
+                return range_builder.build (*this);
+            }
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                CPPLINQ_ASSERT (false);
+                throw programming_error_exception ();
+            }
+
+            CPPLINQ_INLINEMETHOD bool next () CPPLINQ_NOEXCEPT
+            {
+                return false;
+            }
+        };
+
+        // -------------------------------------------------------------------------
+
+        template <typename TValue>
+        struct singleton_range : base_range
+        {
+            typedef                 singleton_range<TValue>             this_type       ;
+            typedef                 TValue                              value_type      ;
+            typedef                 TValue const &                      return_type     ;
+
+            enum
+            {
+                returns_reference = 1   ,
+                instrumented_as   = query_singleton ,
+            };
+
+            value_type  value   ;
+            bool        done    ;
+
+            CPPLINQ_INLINEMETHOD singleton_range (TValue const & value)
+                :   value   (value)
+                ,   done    (false)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD singleton_range (TValue&& value) CPPLINQ_NOEXCEPT
+                :   value   (std::move (value))
+                ,   done    (false)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD singleton_range (singleton_range const & v) CPPLINQ_NOEXCEPT
+                :   value   (v.value)
+                ,   done    (v.done)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD singleton_range (singleton_range && v) CPPLINQ_NOEXCEPT
+                :   value   (std::move (v.value))
+                ,   done    (std::move (v.done))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            {
+                return range_builder.build (*this);
+            }
+
+            CPPLINQ_INLINEMETHOD return_type front () const CPPLINQ_NOEXCEPT
+            {
+                return value;
+            }
+
+            CPPLINQ_INLINEMETHOD bool next () CPPLINQ_NOEXCEPT
+            {
+                auto d  = done;
+                done    = true;
+                return !d;
+            }
+        };
+
+        // -------------------------------------------------------------------------
+        // orderby and thenby sort with an LSD radix sort when every sort key is
+        // an integral or floating point value or a std::pair/std::tuple of such.
+        // Each key is computed once and mapped onto an unsigned integer that
+        // preserves its order. The indices of the values are then sorted
+        // stably by these keys, least significant key first.
+        // -------------------------------------------------------------------------
+
+        template<typename TBits>
+        struct radix_item
+        {
+            TBits                   bits    ;
+            size_type               index   ;
+        };
+
+        // Sorts [first, first + size) stably by the digits below digit_count,
+        // 11 bits per digit. buffer must hold size items. Returns first or
+        // buffer depending on where the sorted items ended up.
+        template<typename TBits>
+        CPPLINQ_METHOD radix_item<TBits> * radix_sort_digits (
+                radix_item<TBits> *     first
+            ,   radix_item<TBits> *     buffer
+            ,   size_type               size
+            ,   size_type               digit_count
+            ,   size_type *             counts      // digit_count * 2048
+            )
+        {
+            auto const  digit_bits  = 11U;
+            auto const  bucket_count= 1U << digit_bits;
+            auto const  digit_mask  = bucket_count - 1U;
+
+            std::fill (counts, counts + digit_count * bucket_count, size_type (0U));
+            for (auto iter = first; iter != first + size; ++iter)
+            {
+                for (auto digit = 0U; digit < digit_count; ++digit)
+                {
+                    ++counts[digit * bucket_count + ((iter->bits >> (digit_bits * digit)) & digit_mask)];
+                }
+            }
+
+            for (auto digit = 0U; digit < digit_count; ++digit)
+            {
+                auto shift  = digit_bits * digit;
+                auto offsets= counts + digit * bucket_count;
+
+                // Skip digits that are the same for all keys
+                if (offsets[(first->bits >> shift) & digit_mask] == size)
+                {
+                    continue;
+                }
+
+                auto offset = size_type (0U);
+                for (auto bucket = 0U; bucket < bucket_count; ++bucket)
+                {
+                    auto count      = offsets[bucket];
+                    offsets[bucket] = offset;
+                    offset          += count;
+                }
+
+                for (auto iter = first; iter != first + size; ++iter)
+                {
+                    buffer[offsets[(iter->bits >> shift) & digit_mask]++] = *iter;
+                }
+
+                std::swap (first, buffer);
+            }
+
+            return first;
+        }
+
+        // Stable merge sort for row indices and radix items. Unlike
+        // std::stable_sort the merge buffer is drawn from the allocator of
+        // values. Short runs are sorted by insertion first.
+        template<typename TValues, typename TLess>
+        CPPLINQ_METHOD void stable_sort_values (TValues & values, TLess less)
+        {
+            typedef typename TValues::value_type value_type;
+
+            auto const  run_size    = size_type (32U);
+            auto        size        = values.size ();
+            auto        data        = values.data ();
+
+            for (auto begin = size_type (0U); begin < size; begin += run_size)
+            {
+                auto end = std::min (begin + run_size, size);
+                for (auto index = begin + 1U; index < end; ++index)
+                {
+                    auto value  = data[index];
+                    auto at     = index;
+                    for (; at > begin && less (value, data[at - 1U]); --at)
+                    {
+                        data[at] = data[at - 1U];
+                    }
+                    data[at] = value;
+                }
+            }
+
+            if (size <= run_size)
+            {
+                return;
+            }
+
+            TValues buffer (size, value_type (), values.get_allocator ());
+
+            auto from   = data;
+            auto to     = buffer.data ();
+            for (auto width = run_size; width < size; width *= 2U)
+            {
+                for (auto low = size_type (0U); low < size; low += 2U * width)
+                {
+                    auto middle = std::min (low + width, size);
+                    auto high   = std::min (middle + width, size);
+                    std::merge (from + low, from + middle, from + middle, from + high, to + low, less);
+                }
+
+                std::swap (from, to);
+            }
+
+            if (from != data)
+            {
+                std::copy (from, from + size, data);
+            }
+        }
+
+        // Sorts items stably by bits
+        template<typename TBits>
+        CPPLINQ_METHOD void radix_sort_items (std::vector<radix_item<TBits>, resource_allocator<radix_item<TBits>>> & items)
+        {
+            typedef typename resource_vector<radix_item<TBits>>::type   items_type  ;
+            typedef typename resource_vector<size_type>::type           counts_type ;
+
+            auto const  digit_bits  = 11U;
+            auto const  bucket_count= 1U << digit_bits;
+            auto const  digit_mask  = bucket_count - 1U;
+            auto const  digit_count = (8U * sizeof (TBits) + digit_bits - 1U) / digit_bits;
+            auto        size        = items.size ();
+
+            if (size < 256U)
+            {
+                stable_sort_values (
+                        items
+                    ,   [] (radix_item<TBits> const & l, radix_item<TBits> const & r)
+                        {
+                            return l.bits < r.bits;
+                        }
+                    );
+                return;
+            }
+
+            items_type      buffer  (size, radix_item<TBits> (), items.get_allocator ());
+            counts_type     counts  (digit_count * bucket_count, 0U, items.get_allocator ());
+
+            // Small inputs fit in the cache, sort them one digit at a time
+            if (size * sizeof (radix_item<TBits>) <= 512U * 1024U || digit_count == 1U)
+            {
+                if (radix_sort_digits (items.data (), buffer.data (), size, digit_count, counts.data ()) != items.data ())
+                {
+                    items.swap (buffer);
+                }
+                return;
+            }
+
+            // Large inputs are first split on the most significant digit that
+            // differs, the buckets are then small enough to be sorted in the
+            // cache by the remaining digits
+            auto & top_counts   = counts;
+            auto   top_digit    = digit_count;
+            TBits  all_bits     = 0U;
+            for (auto & item : items)
+            {
+                all_bits |= item.bits ^ items[0].bits;
+            }
+
+            while (top_digit > 0U && ((all_bits >> (digit_bits * (top_digit - 1U))) & digit_mask) == 0U)
+            {
+                --top_digit;
+            }
+
+            if (top_digit == 0U)
+            {
+                return;
+            }
+
+            auto shift = digit_bits * (top_digit - 1U);
+            std::fill (top_counts.begin (), top_counts.begin () + bucket_count, size_type (0U));
+            for (auto & item : items)
+            {
+                ++top_counts[(item.bits >> shift) & digit_mask];
+            }
+
+            counts_type offsets (bucket_count + 1U, 0U, items.get_allocator ());
+            for (auto bucket = 0U; bucket < bucket_count; ++bucket)
+            {
+                offsets[bucket + 1U] = offsets[bucket] + top_counts[bucket];
+            }
+
+            {
+                auto positions = offsets;
+                for (auto & item : items)
+                {
+                    buffer[positions[(item.bits >> shift) & digit_mask]++] = item;
+                }
+            }
+
+            for (auto bucket = 0U; bucket < bucket_count; ++bucket)
+            {
+                auto begin  = offsets[bucket];
+                auto count  = offsets[bucket + 1U] - begin;
+
+                if (count == 0U)
+                {
+                    continue;
+                }
+
+                auto sorted = radix_sort_digits (buffer.data () + begin, items.data () + begin, count, top_digit - 1U, counts.data ());
+                if (sorted != items.data () + begin)
+                {
+                    std::copy (sorted, sorted + count, items.data () + begin);
+                }
+            }
+        }
+
+        // radix_key_traits<TKey>
+        //      enum { is_radix_sortable = 0|1, key_count = ... };
+        //      // Sorts order stably by get (order[i]), a TKey
+        //      template<typename TGet>
+        //      static void sort (resource_vector<size_type>::type & order, TGet get, bool sort_ascending)
+        template<typename TKey, typename TEnable = void>
+        struct radix_key_traits
+        {
+            enum
+            {
+                is_radix_sortable = 0   ,
+            };
+        };
+
+        template<typename TKey, typename TBits>
+        struct radix_scalar_traits
+        {
+            typedef                 TBits                       bits_type       ;
+            enum
+            {
+                is_radix_sortable = 1   ,
+                key_count         = 1   ,
+            };
+
+            template<typename TGet>
+            static CPPLINQ_METHOD void sort (resource_vector<size_type>::type & order, TGet get, bool sort_ascending)
+            {
+                auto flip = sort_ascending
+                    ?   bits_type (0U)
+                    :   static_cast<bits_type> (~bits_type (0U))
+                    ;
+
+                typename resource_vector<radix_item<bits_type>>::type items (order.size (), radix_item<bits_type> (), order.get_allocator ());
+                for (auto index = 0U; index < order.size (); ++index)
+                {
+                    items[index].bits   = static_cast<bits_type> (radix_key_traits<TKey>::to_bits (get (order[index])) ^ flip);
+                    items[index].index  = order[index];
+                }
+
+                radix_sort_items (items);
+
+                for (auto index = 0U; index < order.size (); ++index)
+                {
+                    order[index] = items[index].index;
+                }
+            }
+        };
+
+        template<typename TKey>
+        struct radix_key_traits<
+                TKey
+            ,   typename std::enable_if<std::is_integral<TKey>::value && !std::is_same<TKey, bool>::value>::type
+            >
+            :   radix_scalar_traits<TKey, typename std::make_unsigned<TKey>::type>
+        {
+            typedef        typename std::make_unsigned<TKey>::type  bits_type       ;
+
+            static CPPLINQ_INLINEMETHOD bits_type to_bits (TKey key) CPPLINQ_NOEXCEPT
+            {
+                // Flipping the sign bit orders negative values before positive values
+                return std::is_signed<TKey>::value
+                    ?   static_cast<bits_type> (static_cast<bits_type> (key) ^ (bits_type (1U) << (8U * sizeof (TKey) - 1U)))
+                    :   static_cast<bits_type> (key)
+                    ;
+            }
+        };
+
+        template<typename TKey>
+        struct radix_key_traits<
+                TKey
+            ,   typename std::enable_if<
+                        std::is_floating_point<TKey>::value
+                    &&  std::numeric_limits<TKey>::is_iec559
+                    &&  (sizeof (TKey) == 4U || sizeof (TKey) == 8U)
+                    >::type
+            >
+            :   radix_scalar_traits<TKey, typename std::conditional<sizeof (TKey) == 4U, std::uint32_t, std::uint64_t>::type>
+        {
+            typedef        typename std::conditional<sizeof (TKey) == 4U, std::uint32_t, std::uint64_t>::type
+                                                                bits_type       ;
+
+            static CPPLINQ_INLINEMETHOD bits_type to_bits (TKey key) CPPLINQ_NOEXCEPT
+            {
+                // -0.0 and 0.0 compare equal and should keep their relative order
+                if (key == TKey (0))
+                {
+                    key = TKey (0);
+                }
+
+                bits_type bits;
+                std::memcpy (&bits, &key, sizeof (bits));
+
+                // Negative values are ordered in reverse by their magnitude bits
+                auto sign_bit = bits_type (1U) << (8U * sizeof (TKey) - 1U);
+                return (bits & sign_bit)
+                    ?   static_cast<bits_type> (~bits)
+                    :   static_cast<bits_type> (bits | sign_bit)
+                    ;
+            }
+        };
+
+        template<size_type index, typename TGet>
+        struct tuple_element_getter
+        {
+            TGet                    get     ;
+
+            CPPLINQ_INLINEMETHOD explicit tuple_element_getter (TGet get)
+                :   get (std::move (get))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD auto operator() (size_type value_index) const -> decltype (std::get<index> (get (value_index)))
+            {
+                return std::get<index> (get (value_index));
+            }
+        };
+
+        template<typename TTuple, size_type count = std::tuple_size<TTuple>::value>
+        struct radix_tuple_traits
+        {
+            typedef        typename cleanup_type<typename std::tuple_element<count - 1U, TTuple>::type>::type
+                                                                element_type    ;
+            enum
+            {
+                is_radix_sortable =
+                        radix_key_traits<element_type>::is_radix_sortable
+                    &&  radix_tuple_traits<TTuple, count - 1U>::is_radix_sortable
+                    ,
+                key_count         = count   ,
+            };
+
+            template<typename TGet>
+            static CPPLINQ_METHOD void sort (resource_vector<size_type>::type & order, TGet get, bool sort_ascending)
+            {
+                // The last element is the least significant
+                radix_key_traits<element_type>::sort (order, tuple_element_getter<count - 1U, TGet> (get), sort_ascending);
+                radix_tuple_traits<TTuple, count - 1U>::sort (order, get, sort_ascending);
+            }
+        };
+
+        template<typename TTuple>
+        struct radix_tuple_traits<TTuple, 0U>
+        {
+            enum
+            {
+                is_radix_sortable = 1   ,
+            };
+
+            template<typename TGet>
+            static CPPLINQ_INLINEMETHOD void sort (resource_vector<size_type>::type &, TGet, bool)
+            {
+            }
+        };
+
+        template<typename TFirst, typename TSecond>
+        struct radix_key_traits<std::pair<TFirst, TSecond>, void>
+            :   radix_tuple_traits<std::pair<TFirst, TSecond>>
+        {
+        };
+
+        template<typename... TElements>
+        struct radix_key_traits<std::tuple<TElements...>, void>
+            :   radix_tuple_traits<std::tuple<TElements...>>
+        {
+        };
+
+        // Sorts order stably by the keys predicate selects from values. Keys
+        // made up of several values are computed once up front.
+        template<typename TKey, typename TValues, typename TPredicate>
+        CPPLINQ_METHOD void radix_sort_level (
+                resource_vector<size_type>::type &  order
+            ,   TValues const &                     values
+            ,   TPredicate const &              predicate
+            ,   bool                            sort_ascending
+            )
+        {
+            if (radix_key_traits<TKey>::key_count == 1)
+            {
+                radix_key_traits<TKey>::sort (
+                        order
+                    ,   [&] (size_type index) -> TKey { return predicate (values[index]); }
+                    ,   sort_ascending
+                    );
+                return;
+            }
+
+            typename resource_vector<TKey>::type keys (order.get_allocator ());
+            keys.reserve (values.size ());
+            for (auto & value : values)
+            {
+                keys.push_back (predicate (value));
+            }
+
+            radix_key_traits<TKey>::sort (
+                    order
+                ,   [&keys] (size_type index) -> TKey const & { return keys[index]; }
+                ,   sort_ascending
+                );
+        }
+
+        // Keys are cached by value unless the key selector returns a reference,
+        // then only the address is kept
+        template<typename TKey, typename TResult>
+        struct cached_key_traits
+        {
+            typedef                 TKey                        stored_type     ;
+
+            static CPPLINQ_INLINEMETHOD stored_type store (stored_type key)
+            {
+                return key;
+            }
+
+            static CPPLINQ_INLINEMETHOD TKey const & get (stored_type const & key) CPPLINQ_NOEXCEPT
+            {
+                return key;
+            }
+        };
+
+        template<typename TKey, typename TResult>
+        struct cached_key_traits<TKey, TResult &>
+        {
+            typedef                 TKey const *                stored_type     ;
+
+            static CPPLINQ_INLINEMETHOD stored_type store (TKey const & key) CPPLINQ_NOEXCEPT
+            {
+                return &key;
+            }
+
+            static CPPLINQ_INLINEMETHOD TKey const & get (stored_type key) CPPLINQ_NOEXCEPT
+            {
+                return *key;
+            }
+        };
+
+        // bool keys are wrapped as std::vector<bool> can't hand out references
+        template<>
+        struct cached_key_traits<bool, bool>
+        {
+            struct stored_type
+            {
+                bool                    key             ;
+            };
+
+            static CPPLINQ_INLINEMETHOD stored_type store (bool key) CPPLINQ_NOEXCEPT
+            {
+                stored_type result = { key };
+                return result;
+            }
+
+            static CPPLINQ_INLINEMETHOD bool const & get (stored_type const & key) CPPLINQ_NOEXCEPT
+            {
+                return key.key;
+            }
+        };
+
+        // is_stable_reference_range<TRange> is true when the references returned
+        // by front () stay valid after next (), ie the range reads a container
+        template<typename TRange>
+        struct is_stable_reference_range : std::false_type
+        {
+        };
+
+        // is_repeatable_range<TRange> is true when a copy of the range can be
+        // traversed without running user code or consuming the source, ie the
+        // range reads a container through forward iterators
+        template<typename TRange>
+        struct is_repeatable_range : std::false_type
+        {
+        };
+
+        // The values a sorting range collects are stored by value unless the
+        // source range has stable references, then only the address is kept
+        template<typename TRange, bool by_reference = is_stable_reference_range<TRange>::value>
+        struct sorted_value_traits
+        {
+            typedef        typename TRange::value_type  value_type      ;
+            typedef                 value_type          stored_type     ;
+
+            template<typename TValue>
+            static CPPLINQ_INLINEMETHOD TValue && store (query_operator op, TValue && value) CPPLINQ_NOEXCEPT
+            {
+                count_store<TValue> (op);
+                return std::forward<TValue> (value);
+            }
+
+            static CPPLINQ_INLINEMETHOD value_type const & get (stored_type const & value) CPPLINQ_NOEXCEPT
+            {
+                return value;
+            }
+
+            static CPPLINQ_INLINEMETHOD value_type && take (stored_type & value) CPPLINQ_NOEXCEPT
+            {
+                return std::move (value);
+            }
+        };
+
+        template<typename TRange>
+        struct sorted_value_traits<TRange, true>
+        {
+            typedef        typename TRange::value_type  value_type      ;
+            typedef                 value_type const *  stored_type     ;
+
+            static CPPLINQ_INLINEMETHOD stored_type store (query_operator, value_type const & value) CPPLINQ_NOEXCEPT
+            {
+                return std::addressof (value);
+            }
+
+            static CPPLINQ_INLINEMETHOD value_type const & get (stored_type value) CPPLINQ_NOEXCEPT
+            {
+                return *value;
+            }
+
+            static CPPLINQ_INLINEMETHOD value_type const & take (stored_type value) CPPLINQ_NOEXCEPT
+            {
+                return *value;
+            }
+        };
+
+        template<typename TValue, typename TAllocator>
+        CPPLINQ_METHOD void permute_values (std::vector<TValue, TAllocator> & values, resource_vector<size_type>::type const & order)
+        {
+            std::vector<TValue, TAllocator> sorted (values.get_allocator ());
+            sorted.reserve (values.size ());
+            for (auto index : order)
+            {
+                sorted.push_back (std::move (values[index]));
+            }
+
+            values.swap (sorted);
+        }
+
+        // Sorts values in place, with a radix sort when the sorting range
+        // supports it and otherwise a stable comparison sort on keys that
+        // are computed once per value. Either way only row indices are moved
+        // during the sort.
+        template<typename TSortingRange, typename TValues>
+        CPPLINQ_METHOD void sort_values (TSortingRange const & range, TValues & values, std::true_type)
+        {
+            resource_vector<size_type>::type order (values.size (), 0U, values.get_allocator ());
+            for (auto index = 0U; index < order.size (); ++index)
+            {
+                order[index] = index;
+            }
+
+            range.radix_sort (order, values);
+
+            permute_values (values, order);
+        }
+
+        template<typename TSortingRange, typename TValues>
+        CPPLINQ_METHOD void sort_values (TSortingRange const & range, TValues & values, std::false_type)
+        {
+            resource_vector<size_type>::type order (values.size (), 0U, values.get_allocator ());
+            for (auto index = 0U; index < order.size (); ++index)
+            {
+                order[index] = index;
+            }
+
+            typename TSortingRange::key_cache cache (order.get_allocator ().resource ());
+            range.cache_keys (cache, values);
+
+            stable_sort_values (
+                    order
+                ,   [&range, &cache] (size_type l, size_type r)
+                    {
+                        return range.less_keys (cache, l, r);
+                    }
+                );
+
+            permute_values (values, order);
+        }
+
+        // When only the first limit values of a sorting range are consumed the
+        // collected values are sorted and trimmed back to limit values every
+        // time the buffer fills up. This keeps memory at O(limit) and time at
+        // O(n log limit) while yielding the same values as a full stable sort.
+        CPPLINQ_INLINEMETHOD size_type get_trim_size (size_type limit) CPPLINQ_NOEXCEPT
+        {
+            return limit < invalid_size / 4U
+                ?   limit + std::max (limit, size_type (1024U))
+                :   invalid_size
+                ;
+        }
+
+        // Number of values a sorting range yields given the size hint of its source
+        CPPLINQ_INLINEMETHOD size_type get_sorted_size_hint (size_type hint, size_type limit) CPPLINQ_NOEXCEPT
+        {
+            return hint == invalid_size ? invalid_size : std::min (hint, limit);
+        }
+
+        // The buffer never grows beyond trim_size so neither does the reservation
+        template<typename TValues>
+        CPPLINQ_INLINEMETHOD void reserve_sorted_values (TValues & values, size_type hint, size_type trim_size)
+        {
+            if (hint != invalid_size)
+            {
+                values.reserve (std::min (hint, trim_size));
+            }
+        }
+
+        template<typename TSortingRange, typename TValues>
+        CPPLINQ_METHOD void sort_values (TSortingRange const & range, TValues & values, size_type limit)
+        {
+            sort_values (range, values, std::integral_constant<bool, TSortingRange::radix_sortable != 0> ());
+
+            if (values.size () > limit)
+            {
+                values.erase (values.begin () + limit, values.end ());
+            }
+        }
+
+        // -------------------------------------------------------------------------
+
+        struct sorting_range : base_range
+        {
+#ifdef CPPLINQ_DETECT_INVALID_METHODS
+        protected:
+            // In order to prevent object slicing
+
+            CPPLINQ_INLINEMETHOD sorting_range () CPPLINQ_NOEXCEPT
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD sorting_range (sorting_range const &) CPPLINQ_NOEXCEPT
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD sorting_range (sorting_range &&) CPPLINQ_NOEXCEPT
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD ~sorting_range () CPPLINQ_NOEXCEPT
+            {
+            }
+        private:
+            CPPLINQ_INLINEMETHOD sorting_range & operator= (sorting_range const &);
+            CPPLINQ_INLINEMETHOD sorting_range & operator= (sorting_range &&);
+#endif
+        };
+
+        // Lets a sorting range know that only its first count values are consumed
+        template<typename TRange>
+        CPPLINQ_INLINEMETHOD void limit_range (TRange & range, size_type count, std::true_type)
+        {
+            range.limit_to (count);
+        }
+
+        template<typename TRange>
+        CPPLINQ_INLINEMETHOD void limit_range (TRange &, size_type, std::false_type) CPPLINQ_NOEXCEPT
+        {
+        }
+
+        template<typename TRange>
+        CPPLINQ_INLINEMETHOD void limit_range (TRange & range, size_type count)
+        {
+            limit_range (range, count, std::integral_constant<bool, std::is_base_of<sorting_range, TRange>::value> ());
+        }
+
+        template<typename TRange, typename TPredicate>
+        struct orderby_range : sorting_range
+        {
+
+            static typename TRange::value_type      get_source ()   ;
+            static          TPredicate              get_predicate ();
+
+            typedef                 orderby_range<TRange, TPredicate>   this_type               ;
+            typedef                 TRange                              range_type              ;
+            typedef                 TPredicate                          predicate_type          ;
+
+            typedef                 typename TRange::value_type         value_type              ;
+            typedef        typename move_front_type<TRange>::type       forwarding_return_type  ;
+            typedef                 value_type const &                  return_type             ;
+            typedef                 decltype (get_predicate () (get_source ()))
+                                                                        key_result_type         ;
+            typedef        typename cleanup_type<key_result_type>::type key_type                ;
+            typedef                 sorted_value_traits<TRange>         sorted_value_type       ;
+            typedef        typename resource_vector<typename sorted_value_type::stored_type>::type
+                                                                        values_type             ;
+            typedef                 cached_key_traits<key_type, key_result_type>
+                                                                        cached_key_type         ;
+
+            struct key_cache
+            {
+                typename resource_vector<typename cached_key_type::stored_type>::type   keys    ;
+
+                CPPLINQ_INLINEMETHOD explicit key_cache (memory_resource * memory) CPPLINQ_NOEXCEPT
+                    :   keys    (memory)
+                {
+                }
+            };
+
+            enum
+            {
+                forward_returns_reference   = TRange::returns_reference ,
+                returns_reference           = 1                         ,
+                radix_sortable              = radix_key_traits<key_type>::is_radix_sortable ,
+                random_access               = 1                         ,
+                instrumented_as             = query_orderby ,
+            };
+
+            range_type              range           ;
+            predicate_type          predicate       ;
+            bool                    sort_ascending  ;
+
+            size_type               limit           ;
+            size_type               upcoming        ;
+            values_type             sorted_values   ;
+
+            CPPLINQ_INLINEMETHOD orderby_range (
+                    range_type      range
+                ,   predicate_type  predicate
+                ,   bool            sort_ascending
+                ) CPPLINQ_NOEXCEPT
+                :   range           (std::move (range))
+                ,   predicate       (std::move (predicate))
+                ,   sort_ascending  (sort_ascending)
+                ,   limit           (invalid_size)
+                ,   upcoming        (invalid_size)
+                ,   sorted_values   (typename values_type::allocator_type (get_memory_resource (this->range)))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD orderby_range (orderby_range const & v)
+                :   range           (v.range)
+                ,   predicate       (v.predicate)
+                ,   sort_ascending  (v.sort_ascending)
+                ,   limit           (v.limit)
+                ,   upcoming        (v.upcoming)
+                ,   sorted_values   (copy_buffer (v.sorted_values))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD orderby_range (orderby_range && v) CPPLINQ_NOEXCEPT
+                :   range           (std::move (v.range))
+                ,   predicate       (std::move (v.predicate))
+                ,   sort_ascending  (std::move (v.sort_ascending))
+                ,   limit           (std::move (v.limit))
+                ,   upcoming        (std::move (v.upcoming))
+                ,   sorted_values   (std::move (v.sorted_values))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD forwarding_return_type forwarding_front ()
+            {
+                return move_front (range);
+            }
+
+            CPPLINQ_INLINEMETHOD bool forwarding_next ()
+            {
+                return pull (query_orderby, range);
+            }
+
+            CPPLINQ_INLINEMETHOD size_type forwarding_size_hint () const
+            {
+                return get_size_hint (range);
+            }
+
+            CPPLINQ_METHOD void cache_keys (key_cache & cache, values_type const & values) const
+            {
+                cache.keys.reserve (values.size ());
+                for (auto & value : values)
+                {
+                    cache.keys.push_back (cached_key_type::store (predicate (sorted_value_type::get (value))));
+                }
+            }
+
+            CPPLINQ_INLINEMETHOD bool less_keys (key_cache const & cache, size_type l, size_type r) const
+            {
+                auto & lkey = cached_key_type::get (cache.keys[l]);
+                auto & rkey = cached_key_type::get (cache.keys[r]);
+                if (sort_ascending)
+                {
+                    return lkey < rkey;
+                }
+                else
+                {
+                    return rkey < lkey;
+                }
+            }
+
+            CPPLINQ_METHOD void radix_sort (resource_vector<size_type>::type & order, values_type const & values) const
+            {
+                radix_sort_level<key_type> (
+                        order
+                    ,   values
+                    ,   [this] (typename values_type::value_type const & value) -> key_result_type
+                        {
+                            return predicate (sorted_value_type::get (value));
+                        }
+                    ,   sort_ascending
+                    );
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            {
+                return range_builder.build (*this);
+            }
+
+            CPPLINQ_INLINEMETHOD memory_resource * resource () const CPPLINQ_NOEXCEPT
+            {
+                return get_memory_resource (range);
+            }
+
+            CPPLINQ_INLINEMETHOD void limit_to (size_type count) CPPLINQ_NOEXCEPT
+            {
+                limit = std::min (limit, count);
+            }
+
+            CPPLINQ_INLINEMETHOD size_type size_hint () const
+            {
+                return upcoming == invalid_size
+                    ?   get_sorted_size_hint (forwarding_size_hint (), limit)
+                    :   sorted_values.size () - upcoming
+                    ;
+            }
+
+            // Sorts the source values once, upcoming is the index of the next value
+            CPPLINQ_METHOD void materialize ()
+            {
+                if (upcoming != invalid_size)
+                {
+                    return;
+                }
+
+                sorted_values.clear ();
+
+                auto trim_size = get_trim_size (limit);
+
+                reserve_sorted_values (sorted_values, forwarding_size_hint (), trim_size);
+
+                while (pull (query_orderby, range))
+                {
+                    sorted_values.push_back (sorted_value_type::store (query_orderby, move_front (range)));
+
+                    if (sorted_values.size () >= trim_size)
+                    {
+                        sort_values (*this, sorted_values, limit);
+                    }
+                }
+
+                sort_values (*this, sorted_values, limit);
+
+                upcoming = 0U;
+            }
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                CPPLINQ_ASSERT (upcoming != invalid_size);
+                CPPLINQ_ASSERT (upcoming > 0U);
+                return sorted_value_type::get (sorted_values[upcoming - 1U]);
+            }
+
+            CPPLINQ_INLINEMETHOD value_type take_front ()
+            {
+                CPPLINQ_ASSERT (upcoming != invalid_size);
+                CPPLINQ_ASSERT (upcoming > 0U);
+                count_store<decltype (sorted_value_type::take (sorted_values[upcoming - 1U]))> (query_orderby);
+                return sorted_value_type::take (sorted_values[upcoming - 1U]);
+            }
+
+            CPPLINQ_METHOD bool next ()
+            {
+                materialize ();
+
+                if (upcoming < sorted_values.size ())
+                {
+                    ++upcoming;
+                    return true;
+                }
+
+                return false;
+            }
+
+            CPPLINQ_INLINEMETHOD size_type size ()
+            {
+                materialize ();
+                return sorted_values.size () - upcoming;
+            }
+
+            CPPLINQ_INLINEMETHOD void advance (size_type count)
+            {
+                materialize ();
+                upcoming += std::min (count, sorted_values.size () - upcoming);
+            }
+
+            CPPLINQ_INLINEMETHOD return_type at (size_type index) const
+            {
+                CPPLINQ_ASSERT (upcoming != invalid_size);
+                CPPLINQ_ASSERT (index < sorted_values.size () - upcoming);
+                return sorted_value_type::get (sorted_values[upcoming + index]);
+            }
+        };
+
+        template<typename TPredicate>
+        struct orderby_builder : base_builder
+        {
+            typedef                 orderby_builder<TPredicate> this_type       ;
+            typedef                 TPredicate                  predicate_type  ;
+
+            predicate_type          predicate       ;
+            bool                    sort_ascending  ;
+
+            CPPLINQ_INLINEMETHOD explicit orderby_builder (predicate_type predicate, bool sort_ascending) CPPLINQ_NOEXCEPT
+                :   predicate       (std::move (predicate))
+                ,   sort_ascending  (sort_ascending)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD orderby_builder (orderby_builder const & v)
+                :   predicate       (v.predicate)
+                ,   sort_ascending  (v.sort_ascending)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD orderby_builder (orderby_builder && v) CPPLINQ_NOEXCEPT
+                :   predicate       (std::move (v.predicate))
+                ,   sort_ascending  (std::move (v.sort_ascending))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD orderby_range<TRange, TPredicate> build (TRange range) const
+            {
+                static_assert (
+                        !std::is_convertible<TRange, sorting_range>::value
+                    ,   "orderby may not follow orderby or thenby"
+                    );
+
+                return orderby_range<TRange, TPredicate>(std::move (range), predicate, sort_ascending);
+            }
+
+        };
+
+        // -------------------------------------------------------------------------
+
+        template<typename TRange, typename TPredicate>
+        struct thenby_range : sorting_range
+        {
+            static typename TRange::value_type      get_source ()   ;
+            static          TPredicate              get_predicate ();
+
+            typedef                 thenby_range<TRange, TPredicate>        this_type               ;
+            typedef                 TRange                                  range_type              ;
+            typedef                 TPredicate                              predicate_type          ;
+
+            typedef                 typename TRange::value_type             value_type              ;
+            typedef                 typename TRange::forwarding_return_type forwarding_return_type  ;
+            typedef                 value_type const &                      return_type             ;
+            typedef                 decltype (get_predicate () (get_source ()))
+                                                                            key_result_type         ;
+            typedef        typename cleanup_type<key_result_type>::type     key_type                ;
+            typedef        typename TRange::sorted_value_type               sorted_value_type       ;
+            typedef        typename TRange::values_type                     values_type             ;
+            typedef                 cached_key_traits<key_type, key_result_type>
+                                                                            cached_key_type         ;
+
+            struct key_cache
+            {
+                typename TRange::key_cache                                              parent  ;
+                typename resource_vector<typename cached_key_type::stored_type>::type   keys    ;
+
+                CPPLINQ_INLINEMETHOD explicit key_cache (memory_resource * memory) CPPLINQ_NOEXCEPT
+                    :   parent  (memory)
+                    ,   keys    (memory)
+                {
+                }
+            };
+
+            enum
+            {
+                forward_returns_reference   = TRange::forward_returns_reference ,
+                returns_reference           = 1                                 ,
+                radix_sortable              =
+                        TRange::radix_sortable
+                    &&  radix_key_traits<key_type>::is_radix_sortable
+                    ,
+                instrumented_as             = query_thenby ,
+            };
+
+            range_type              range           ;
+            predicate_type          predicate       ;
+            bool                    sort_ascending  ;
+
+            size_type               limit           ;
+            size_type               current         ;
+            values_type             sorted_values   ;
+
+            CPPLINQ_INLINEMETHOD thenby_range (
+                    range_type      range
+                ,   predicate_type  predicate
+                ,   bool            sort_ascending
+                ) CPPLINQ_NOEXCEPT
+                :   range           (std::move (range))
+                ,   predicate       (std::move (predicate))
+                ,   sort_ascending  (sort_ascending)
+                ,   limit           (invalid_size)
+                ,   current         (invalid_size)
+                ,   sorted_values   (typename values_type::allocator_type (get_memory_resource (this->range)))
+            {
+                static_assert (
+                        std::is_convertible<range_type, sorting_range>::value
+                    ,   "thenby may only follow orderby or thenby"
+                    );
+            }
+
+            CPPLINQ_INLINEMETHOD thenby_range (thenby_range const & v)
+                :   range           (v.range)
+                ,   predicate       (v.predicate)
+                ,   sort_ascending  (v.sort_ascending)
+                ,   limit           (v.limit)
+                ,   current         (v.current)
+                ,   sorted_values   (copy_buffer (v.sorted_values))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD thenby_range (thenby_range && v) CPPLINQ_NOEXCEPT
+                :   range           (std::move (v.range))
+                ,   predicate       (std::move (v.predicate))
+                ,   sort_ascending  (std::move (v.sort_ascending))
+                ,   limit           (std::move (v.limit))
+                ,   current         (std::move (v.current))
+                ,   sorted_values   (std::move (v.sorted_values))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            {
+                return range_builder.build (*this);
+            }
+
+            CPPLINQ_INLINEMETHOD memory_resource * resource () const CPPLINQ_NOEXCEPT
+            {
+                return get_memory_resource (range);
+            }
+
+            CPPLINQ_INLINEMETHOD forwarding_return_type forwarding_front ()
+            {
+                return range.forwarding_front ();
+            }
+
+            CPPLINQ_INLINEMETHOD bool forwarding_next ()
+            {
+                return range.forwarding_next ();
+            }
+
+            CPPLINQ_INLINEMETHOD size_type forwarding_size_hint () const
+            {
+                return range.forwarding_size_hint ();
+            }
+
+            CPPLINQ_METHOD void cache_keys (key_cache & cache, values_type const & values) const
+            {
+                range.cache_keys (cache.parent, values);
+
+                cache.keys.reserve (values.size ());
+                for (auto & value : values)
+                {
+                    cache.keys.push_back (cached_key_type::store (predicate (sorted_value_type::get (value))));
+                }
+            }
+
+            CPPLINQ_INLINEMETHOD bool less_keys (key_cache const & cache, size_type l, size_type r) const
+            {
+                auto pless = range.less_keys (cache.parent, l, r);
+                if (pless)
+                {
+                    return true;
+                }
+
+                auto pgreater = range.less_keys (cache.parent, r, l);
+                if (pgreater)
+                {
+                    return false;
+                }
+
+                auto & lkey = cached_key_type::get (cache.keys[l]);
+                auto & rkey = cached_key_type::get (cache.keys[r]);
+                if (sort_ascending)
+                {
+                    return lkey < rkey;
+                }
+                else
+                {
+                    return rkey < lkey;
+                }
+            }
+
+            // Least significant key first
+            CPPLINQ_METHOD void radix_sort (resource_vector<size_type>::type & order, values_type const & values) const
+            {
+                radix_sort_level<key_type> (
+                        order
+                    ,   values
+                    ,   [this] (typename values_type::value_type const & value) -> key_result_type
+                        {
+                            return predicate (sorted_value_type::get (value));
+                        }
+                    ,   sort_ascending
+                    );
+
+                range.radix_sort (order, values);
+            }
+
+            CPPLINQ_INLINEMETHOD void limit_to (size_type count) CPPLINQ_NOEXCEPT
+            {
+                limit = std::min (limit, count);
+            }
+
+            CPPLINQ_INLINEMETHOD size_type size_hint () const
+            {
+                return current == invalid_size
+                    ?   get_sorted_size_hint (forwarding_size_hint (), limit)
+                    :   sorted_values.size () - std::min (sorted_values.size (), current + 1U)
+                    ;
+            }
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                return sorted_value_type::get (sorted_values[current]);
+            }
+
+            CPPLINQ_INLINEMETHOD value_type take_front ()
+            {
+                count_store<decltype (sorted_value_type::take (sorted_values[current]))> (query_thenby);
+                return sorted_value_type::take (sorted_values[current]);
+            }
+
+            CPPLINQ_METHOD bool next ()
+            {
+                if (current == invalid_size)
+                {
+                    sorted_values.clear ();
+
+                    auto trim_size = get_trim_size (limit);
+
+                    reserve_sorted_values (sorted_values, forwarding_size_hint (), trim_size);
+
+                    while (range.forwarding_next ())
+                    {
+                        sorted_values.push_back (sorted_value_type::store (query_thenby, range.forwarding_front ()));
+
+                        if (sorted_values.size () >= trim_size)
+                        {
+                            sort_values (*this, sorted_values, limit);
+                        }
+                    }
+
+                    sort_values (*this, sorted_values, limit);
+
+                    if (sorted_values.size () == 0)
+                    {
+                        return false;
+                    }
+
+                    current = 0U;
+                    return true;
+                }
+
+                if (current < sorted_values.size ())
+                {
+                    ++current;
+                }
+
+                return current < sorted_values.size ();
+            }
+        };
+
+        template<typename TPredicate>
+        struct thenby_builder : base_builder
+        {
+            typedef                 thenby_builder<TPredicate>  this_type       ;
+            typedef                 TPredicate                  predicate_type  ;
+
+            predicate_type          predicate       ;
+            bool                    sort_ascending  ;
+
+            CPPLINQ_INLINEMETHOD explicit thenby_builder (predicate_type predicate, bool sort_ascending) CPPLINQ_NOEXCEPT
+                :   predicate       (std::move (predicate))
+                ,   sort_ascending  (sort_ascending)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD thenby_builder (thenby_builder const & v)
+                :   predicate       (v.predicate)
+                ,   sort_ascending  (v.sort_ascending)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD thenby_builder (thenby_builder && v) CPPLINQ_NOEXCEPT
+                :   predicate       (std::move (v.predicate))
+                ,   sort_ascending  (std::move (v.sort_ascending))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD thenby_range<TRange, TPredicate> build (TRange range) const
+            {
+                return thenby_range<TRange, TPredicate>(std::move (range), predicate, sort_ascending);
+            }
+
+        };
+
+        // -------------------------------------------------------------------------
+
+        template<typename TRange>
+        struct reverse_range : base_range
+        {
+            typedef                 reverse_range<TRange>                       this_type           ;
+            typedef                 TRange                                      range_type          ;
+
+            typedef                 typename TRange::value_type                 value_type          ;
+            typedef                 value_type const &                          return_type         ;
+
+            typedef        typename resource_vector<value_type>::type           stack_type          ;
+
+            enum
+            {
+                returns_reference   = 1     ,
+                random_access       = 1     ,
+                instrumented_as     = query_reverse ,
+            };
+
+
+            range_type                  range               ;
+            size_type                   capacity            ;
+            stack_type                  reversed            ;
+            size_type                   upcoming            ;
+            bool                        start               ;
+
+            CPPLINQ_INLINEMETHOD reverse_range (
+                    range_type          range
+                ,   size_type           capacity
+                ) CPPLINQ_NOEXCEPT
+                :   range               (std::move (range))
+                ,   capacity            (capacity)
+                ,   reversed            (resource_allocator<value_type> (get_memory_resource (this->range)))
+                ,   upcoming            (0U)
+                ,   start               (true)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD reverse_range (reverse_range const & v)
+                :   range               (v.range)
+                ,   capacity            (v.capacity)
+                ,   reversed            (copy_buffer (v.reversed))
+                ,   upcoming            (v.upcoming)
+                ,   start               (v.start)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD reverse_range (reverse_range && v) CPPLINQ_NOEXCEPT
+                :   range               (std::move (v.range))
+                ,   capacity            (std::move (v.capacity))
+                ,   reversed            (std::move (v.reversed))
+                ,   upcoming            (std::move (v.upcoming))
+                ,   start               (std::move (v.start))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            {
+                return range_builder.build (*this);
+            }
+
+            CPPLINQ_INLINEMETHOD memory_resource * resource () const CPPLINQ_NOEXCEPT
+            {
+                return get_memory_resource (range);
+            }
+
+            // The values are stored in source order and read back to front,
+            // upcoming is the number of values left
+            CPPLINQ_METHOD void materialize ()
+            {
+                if (start)
+                {
+                    start = false;
+
+                    reversed.clear ();
+                    reserve_for_hint (reversed, get_size_hint (range), capacity);
+
+                    while (pull (query_reverse, range))
+                    {
+                        reversed.push_back (store_front (query_reverse, range));
+                    }
+
+                    upcoming = reversed.size ();
+                }
+            }
+
+            CPPLINQ_INLINEMETHOD return_type front () const CPPLINQ_NOEXCEPT
+            {
+                CPPLINQ_ASSERT (!start);
+                CPPLINQ_ASSERT (upcoming < reversed.size ());
+                return reversed[upcoming];
+            }
+
+            CPPLINQ_INLINEMETHOD value_type take_front ()
+            {
+                CPPLINQ_ASSERT (!start);
+                CPPLINQ_ASSERT (upcoming < reversed.size ());
+                count_store<value_type> (query_reverse);
+                return std::move (reversed[upcoming]);
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                materialize ();
+
+                if (upcoming == 0U)
+                {
+                    return false;
+                }
+
+                --upcoming;
+
+                return true;
+            }
+
+            CPPLINQ_INLINEMETHOD size_type size_hint () const
+            {
+                return start ? get_size_hint (range) : upcoming;
+            }
+
+            CPPLINQ_INLINEMETHOD size_type size ()
+            {
+                materialize ();
+                return upcoming;
+            }
+
+            CPPLINQ_INLINEMETHOD void advance (size_type count)
+            {
+                materialize ();
+                upcoming -= std::min (count, upcoming);
+            }
+
+            CPPLINQ_INLINEMETHOD return_type at (size_type index) const CPPLINQ_NOEXCEPT
+            {
+                CPPLINQ_ASSERT (!start);
+                CPPLINQ_ASSERT (index < upcoming);
+                return reversed[upcoming - 1U - index];
+            }
+        };
+
+        // -------------------------------------------------------------------------
+        // reverse_traits<TRange> describes ranges that can be walked backwards
+        // without buffering their values
+        //      enum { is_reversible = 0|1 };
+        //      typedef                 ...         reversed_type   ;
+        //      static reversed_type    reverse_of  (TRange const &)
+        // -------------------------------------------------------------------------
+
+        template<typename TRange>
+        struct reverse_traits
+        {
+            typedef                 TRange                              reversed_type   ;
+            enum
+            {
+                is_reversible = 0   ,
+            };
+        };
+
+        template<typename TValueIterator>
+        struct reverse_traits<from_range<TValueIterator>>
+        {
+            typedef                 from_range<TValueIterator>          range_type      ;
+            typedef                 std::reverse_iterator<TValueIterator>
+                                                                        iterator_type   ;
+            typedef                 from_range<iterator_type>           reversed_type   ;
+            enum
+            {
+                is_reversible = std::is_convertible<
+                        typename std::iterator_traits<TValueIterator>::iterator_category
+                    ,   std::bidirectional_iterator_tag
+                    >::value ,
+            };
+
+            static CPPLINQ_INLINEMETHOD reversed_type reverse_of (range_type const & range)
+            {
+                return reversed_type (iterator_type (range.end), iterator_type (range.upcoming));
+            }
+        };
+
+        struct reverse_builder : base_builder
+        {
+            typedef             reverse_builder     this_type   ;
+
+            size_type           capacity                        ;
+
+            CPPLINQ_INLINEMETHOD reverse_builder (size_type capacity) CPPLINQ_NOEXCEPT
+                :   capacity (capacity)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD reverse_builder (reverse_builder const & v) CPPLINQ_NOEXCEPT
+                :   capacity (v.capacity)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD reverse_builder (reverse_builder && v) CPPLINQ_NOEXCEPT
+                :   capacity (std::move (v.capacity))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD typename std::enable_if<
+                    !reverse_traits<TRange>::is_reversible
+                ,   reverse_range<TRange>
+                >::type build (TRange range) const
+            {
+                return reverse_range<TRange> (std::move (range), capacity);
+            }
+
+            // Bidirectional sources are walked backwards instead
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD typename std::enable_if<
+                    reverse_traits<TRange>::is_reversible != 0
+                ,   typename reverse_traits<TRange>::reversed_type
+                >::type build (TRange range) const
+            {
+                return reverse_traits<TRange>::reverse_of (range);
+            }
+        };
+
+        // -------------------------------------------------------------------------
+
+        template<typename TRange, typename TPredicate>
+        struct where_range : base_range
+        {
+            typedef                 where_range<TRange, TPredicate> this_type       ;
+            typedef                 TRange                          range_type      ;
+            typedef                 TPredicate                      predicate_type  ;
+
+            typedef                 typename TRange::value_type     value_type      ;
+            typedef                 typename TRange::return_type    return_type     ;
+            enum
+            {
+                returns_reference   = TRange::returns_reference   ,
+                batched             = is_batched<TRange>::value   ,
+                instrumented_as     = query_where ,
+            };
+
+            range_type              range       ;
+            predicate_type          predicate   ;
+
+            CPPLINQ_INLINEMETHOD where_range (
+                    range_type      range
+                ,   predicate_type  predicate
+                ) CPPLINQ_NOEXCEPT
+                :   range       (std::move (range))
+                ,   predicate   (std::move (predicate))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD where_range (where_range const & v)
+                :   range       (v.range)
+                ,   predicate   (v.predicate)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD where_range (where_range && v) CPPLINQ_NOEXCEPT
+                :   range       (std::move (v.range))
+                ,   predicate   (std::move (v.predicate))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            {
+                return range_builder.build (*this);
+            }
+
+            CPPLINQ_INLINEMETHOD memory_resource * resource () const CPPLINQ_NOEXCEPT
+            {
+                return get_memory_resource (range);
+            }
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                return range.front ();
+            }
+
+            template<typename TSource = TRange>
+            CPPLINQ_INLINEMETHOD auto take_front ()
+                -> decltype (std::declval<TSource &> ().take_front ())
+            {
+                return range.take_front ();
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                while (pull (query_where, range))
+                {
+                    if (predicate (range.front ()))
+                    {
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+
+            CPPLINQ_METHOD size_type next_batch (value_type * values, size_type capacity)
+            {
+                size_type fetched;
+                while ((fetched = pull_batch (query_where, range, values, capacity)) > 0U)
+                {
+                    // Compacting without a branch avoids mispredictions on
+                    // unpredictable filters
+                    auto kept = size_type (0U);
+                    for (auto index = size_type (0U); index < fetched; ++index)
+                    {
+                        auto value = values[index];
+                        values[kept] = value;
+                        kept += predicate (value) ? 1U : 0U;
+                    }
+
+                    if (kept > 0U)
+                    {
+                        return kept;
+                    }
+                }
+
+                return 0U;
+            }
+        };
+
+        template<typename TPredicate>
+        struct where_builder : base_builder
+        {
+            typedef                 where_builder<TPredicate>   this_type       ;
+            typedef                 TPredicate                  predicate_type  ;
+
+            predicate_type          predicate   ;
+
+            CPPLINQ_INLINEMETHOD explicit where_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
+                :   predicate (std::move (predicate))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD where_builder (where_builder const & v)
+                :   predicate (v.predicate)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD where_builder (where_builder && v) CPPLINQ_NOEXCEPT
+                :   predicate (std::move (v.predicate))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD where_range<TRange, TPredicate> build (TRange range) const
+            {
+                return where_range<TRange, TPredicate>(std::move (range), predicate);
+            }
+
+        };
+
+        // -------------------------------------------------------------------------
+
+        // -------------------------------------------------------------------------
+
+        template<typename TRange>
+        struct take_range : base_range
+        {
+            typedef                 take_range<TRange>              this_type       ;
+            typedef                 TRange                          range_type      ;
+
+            typedef                 typename TRange::value_type     value_type      ;
+            typedef                 typename TRange::return_type    return_type     ;
+            enum
+            {
+                returns_reference   = TRange::returns_reference   ,
+                batched             = is_batched<TRange>::value   ,
+                instrumented_as     = query_take ,
+            };
+
+            range_type              range       ;
+            size_type               count       ;
+            size_type               current     ;
+
+
+            CPPLINQ_INLINEMETHOD take_range (
+                    range_type      range
+                ,   size_type       count
+                ) CPPLINQ_NOEXCEPT
+                :   range       (std::move (range))
+                ,   count       (std::move (count))
+                ,   current     (0)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD take_range (take_range const & v)
+                :   range       (v.range)
+                ,   count       (v.count)
+                ,   current     (v.current)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD take_range (take_range && v) CPPLINQ_NOEXCEPT
+                :   range       (std::move (v.range))
+                ,   count       (std::move (v.count))
+                ,   current     (std::move (v.current))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            {
+                return range_builder.build (*this);
+            }
+
+            CPPLINQ_INLINEMETHOD memory_resource * resource () const CPPLINQ_NOEXCEPT
+            {
+                return get_memory_resource (range);
+            }
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                return range.front ();
+            }
+
+            template<typename TSource = TRange>
+            CPPLINQ_INLINEMETHOD auto take_front ()
+                -> decltype (std::declval<TSource &> ().take_front ())
+            {
+                return range.take_front ();
+            }
+
+            CPPLINQ_INLINEMETHOD size_type size_hint () const
+            {
+                auto hint = get_size_hint (range);
+                if (hint == invalid_size)
+                {
+                    return invalid_size;
+                }
+
+                return current < count ? std::min (hint, count - current) : 0U;
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                if (current >= count)
+                {
+                    return false;
+                }
+
+                ++current;
+                return pull (query_take, range);
+            }
+
+            CPPLINQ_INLINEMETHOD size_type next_batch (value_type * values, size_type capacity)
+            {
+                if (current >= count)
+                {
+                    return 0U;
+                }
+
+                auto fetched = pull_batch (query_take, range, values, std::min (capacity, count - current));
+                current += fetched;
+                return fetched;
+            }
+        };
+
+        struct take_builder : base_builder
+        {
+            typedef                 take_builder        this_type       ;
+
+            size_type               count       ;
+
+            CPPLINQ_INLINEMETHOD explicit take_builder (size_type count) CPPLINQ_NOEXCEPT
+                :   count (std::move (count))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD take_builder (take_builder const & v) CPPLINQ_NOEXCEPT
+                :   count (v.count)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD take_builder (take_builder && v) CPPLINQ_NOEXCEPT
+                :   count (std::move (v.count))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD take_range<TRange> build (TRange range) const
+            {
+                limit_range (range, count);
+                return take_range<TRange>(std::move (range), count);
+            }
+
+            // Random access sources are sliced instead
+            template<typename TValueIterator>
+            CPPLINQ_INLINEMETHOD typename std::enable_if<
+                    is_random_access_range<from_range<TValueIterator>>::value
+                ,   from_range<TValueIterator>
+                >::type build (from_range<TValueIterator> range) const
+            {
+                auto size = static_cast<size_type> (range.end - range.upcoming);
+                return from_range<TValueIterator> (
+                        range.upcoming
+                    ,   range.upcoming + static_cast<typename std::iterator_traits<TValueIterator>::difference_type> (std::min (count, size))
+                    );
+            }
+
+        };
+
+        // -------------------------------------------------------------------------
+
+        template<typename TRange, typename TPredicate>
+        struct take_while_range : base_range
+        {
+            typedef                 take_while_range<TRange, TPredicate>    this_type       ;
+            typedef                 TRange                                  range_type      ;
+            typedef                 TPredicate                              predicate_type  ;
+
+            typedef                 typename TRange::value_type             value_type      ;
+            typedef                 typename TRange::return_type            return_type     ;
+            enum
+            {
+                returns_reference   = TRange::returns_reference   ,
+                instrumented_as     = query_take_while ,
+            };
+
+            range_type              range       ;
+            predicate_type          predicate   ;
+            bool                    done        ;
+
+
+            CPPLINQ_INLINEMETHOD take_while_range (
+                    range_type      range
+                ,   predicate_type  predicate
+                ) CPPLINQ_NOEXCEPT
+                :   range       (std::move (range))
+                ,   predicate   (std::move (predicate))
+                ,   done        (false)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD take_while_range (take_while_range const & v)
+                :   range       (v.range)
+                ,   predicate   (v.predicate)
+                ,   done        (v.done)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD take_while_range (take_while_range && v) CPPLINQ_NOEXCEPT
+                :   range       (std::move (v.range))
+                ,   predicate   (std::move (v.predicate))
+                ,   done        (std::move (v.done))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            {
+                return range_builder.build (*this);
+            }
+
+            CPPLINQ_INLINEMETHOD memory_resource * resource () const CPPLINQ_NOEXCEPT
+            {
+                return get_memory_resource (range);
+            }
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                return range.front ();
+            }
+
+            template<typename TSource = TRange>
+            CPPLINQ_INLINEMETHOD auto take_front ()
+                -> decltype (std::declval<TSource &> ().take_front ())
+            {
+                return range.take_front ();
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                if (done)
+                {
+                    return false;
+                }
+
+                if (!pull (query_take_while, range))
+                {
+                    done = true;
+                    return false;
+                }
+
+                if (!predicate (range.front ()))
+                {
+                    done = true;
+                    return false;
+                }
+
+                return true;
+            }
+        };
+
+        template<typename TPredicate>
+        struct take_while_builder : base_builder
+        {
+            typedef                 take_while_builder<TPredicate>  this_type       ;
+            typedef                 TPredicate                      predicate_type  ;
+
+            predicate_type          predicate   ;
+
+            CPPLINQ_INLINEMETHOD take_while_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
+                :   predicate (std::move (predicate))
             {
             }
 
@@ -1617,910 +4754,5233 @@ namespace cpplinq
             {
             }
 
-            CPPLINQ_INLINEMETHOD take_while_builder (take_while_builder && v) CPPLINQ_NOEXCEPT
-                :   predicate (std::move (v.predicate))
+            CPPLINQ_INLINEMETHOD take_while_builder (take_while_builder && v) CPPLINQ_NOEXCEPT
+                :   predicate (std::move (v.predicate))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD take_while_range<TRange, TPredicate> build (TRange range) const
+            {
+                return take_while_range<TRange, TPredicate>(std::move (range), predicate);
+            }
+
+        };
+
+        // -------------------------------------------------------------------------
+
+        template<typename TRange>
+        struct skip_range : base_range
+        {
+            typedef                 skip_range<TRange>              this_type       ;
+            typedef                 TRange                          range_type      ;
+
+            typedef                 typename TRange::value_type     value_type      ;
+            typedef                 typename TRange::return_type    return_type     ;
+            enum
+            {
+                returns_reference   = TRange::returns_reference   ,
+                batched             = is_batched<TRange>::value   ,
+                instrumented_as     = query_skip ,
+            };
+
+            range_type              range       ;
+            size_type               count       ;
+            size_type               current     ;
+
+            CPPLINQ_INLINEMETHOD skip_range (
+                    range_type      range
+                ,   size_type       count
+                ) CPPLINQ_NOEXCEPT
+                :   range       (std::move (range))
+                ,   count       (std::move (count))
+                ,   current     (0)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD skip_range (skip_range const & v)
+                :   range       (v.range)
+                ,   count       (v.count)
+                ,   current     (v.current)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD skip_range (skip_range && v) CPPLINQ_NOEXCEPT
+                :   range       (std::move (v.range))
+                ,   count       (std::move (v.count))
+                ,   current     (std::move (v.current))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            {
+                return range_builder.build (*this);
+            }
+
+            CPPLINQ_INLINEMETHOD memory_resource * resource () const CPPLINQ_NOEXCEPT
+            {
+                return get_memory_resource (range);
+            }
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                return range.front ();
+            }
+
+            template<typename TSource = TRange>
+            CPPLINQ_INLINEMETHOD auto take_front ()
+                -> decltype (std::declval<TSource &> ().take_front ())
+            {
+                return range.take_front ();
+            }
+
+            CPPLINQ_INLINEMETHOD size_type size_hint () const
+            {
+                if (current == invalid_size)
+                {
+                    return 0U;
+                }
+
+                auto hint = get_size_hint (range);
+                if (hint == invalid_size)
+                {
+                    return invalid_size;
+                }
+
+                auto skipping = count - current;
+                return hint > skipping ? hint - skipping : 0U;
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                if (current == invalid_size)
+                {
+                    return false;
+                }
+
+                if (current < count)
+                {
+                    skip_values (is_random_access_range<TRange> ());
+                }
+
+                if (current < count)
+                {
+                    current = invalid_size;
+                    return false;
+                }
+
+                return pull (query_skip, range);
+            }
+
+            CPPLINQ_METHOD void skip_values (std::false_type)
+            {
+                while (current < count && pull (query_skip, range))
+                {
+                    ++current;
+                }
+            }
+
+            // Random access ranges skip in O(1)
+            CPPLINQ_INLINEMETHOD void skip_values (std::true_type)
+            {
+                auto skipping = std::min (count - current, range.size ());
+                range.advance (skipping);
+                current += skipping;
+            }
+
+            CPPLINQ_METHOD size_type next_batch (value_type * values, size_type capacity)
+            {
+                if (current == invalid_size)
+                {
+                    return 0U;
+                }
+
+                if (current < count)
+                {
+                    skip_values (values, capacity, is_random_access_range<TRange> ());
+                }
+
+                if (current < count)
+                {
+                    current = invalid_size;
+                    return 0U;
+                }
+
+                return pull_batch (query_skip, range, values, capacity);
+            }
+
+            CPPLINQ_METHOD void skip_values (value_type * values, size_type capacity, std::false_type)
+            {
+                while (current < count)
+                {
+                    auto skipped = pull_batch (query_skip, range, values, std::min (capacity, count - current));
+                    if (skipped == 0U)
+                    {
+                        return;
+                    }
+
+                    current += skipped;
+                }
+            }
+
+            CPPLINQ_INLINEMETHOD void skip_values (value_type *, size_type, std::true_type)
+            {
+                skip_values (std::true_type ());
+            }
+        };
+
+        struct skip_builder : base_builder
+        {
+            typedef                 skip_builder        this_type       ;
+
+            size_type               count       ;
+
+            CPPLINQ_INLINEMETHOD explicit skip_builder (size_type count) CPPLINQ_NOEXCEPT
+                :   count (std::move (count))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD skip_builder (skip_builder const & v) CPPLINQ_NOEXCEPT
+                :   count (v.count)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD skip_builder (skip_builder && v) CPPLINQ_NOEXCEPT
+                :   count (std::move (v.count))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD skip_range<TRange> build (TRange range) const
+            {
+                return skip_range<TRange>(std::move (range), count);
+            }
+
+            // Random access sources are sliced instead
+            template<typename TValueIterator>
+            CPPLINQ_INLINEMETHOD typename std::enable_if<
+                    is_random_access_range<from_range<TValueIterator>>::value
+                ,   from_range<TValueIterator>
+                >::type build (from_range<TValueIterator> range) const
+            {
+                auto size = static_cast<size_type> (range.end - range.upcoming);
+                return from_range<TValueIterator> (
+                        range.upcoming + static_cast<typename std::iterator_traits<TValueIterator>::difference_type> (std::min (count, size))
+                    ,   range.end
+                    );
+            }
+
+        };
+
+        // -------------------------------------------------------------------------
+
+        template<typename TRange, typename TPredicate>
+        struct skip_while_range : base_range
+        {
+            typedef                 skip_while_range<TRange, TPredicate>    this_type       ;
+            typedef                 TRange                                  range_type      ;
+            typedef                 TPredicate                              predicate_type  ;
+
+            typedef                 typename TRange::value_type     value_type      ;
+            typedef                 typename TRange::return_type    return_type     ;
+            enum
+            {
+                returns_reference   = TRange::returns_reference   ,
+                instrumented_as     = query_skip_while ,
+            };
+
+            range_type              range       ;
+            predicate_type          predicate   ;
+            bool                    skipping    ;
+
+            CPPLINQ_INLINEMETHOD skip_while_range (
+                    range_type      range
+                ,   predicate_type  predicate
+                ) CPPLINQ_NOEXCEPT
+                :   range       (std::move (range))
+                ,   predicate   (std::move (predicate))
+                ,   skipping    (true)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD skip_while_range (skip_while_range const & v)
+                :   range       (v.range)
+                ,   predicate   (v.predicate)
+                ,   skipping    (v.skipping)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD skip_while_range (skip_while_range && v) CPPLINQ_NOEXCEPT
+                :   range       (std::move (v.range))
+                ,   predicate   (std::move (v.predicate))
+                ,   skipping    (std::move (v.skipping))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            {
+                return range_builder.build (*this);
+            }
+
+            CPPLINQ_INLINEMETHOD memory_resource * resource () const CPPLINQ_NOEXCEPT
+            {
+                return get_memory_resource (range);
+            }
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                return range.front ();
+            }
+
+            template<typename TSource = TRange>
+            CPPLINQ_INLINEMETHOD auto take_front ()
+                -> decltype (std::declval<TSource &> ().take_front ())
+            {
+                return range.take_front ();
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                if (!skipping)
+                {
+                    return pull (query_skip_while, range);
+                }
+
+                while (pull (query_skip_while, range))
+                {
+                    if (!predicate (range.front ()))
+                    {
+                        skipping = false;
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+        };
+
+        template <typename TPredicate>
+        struct skip_while_builder : base_builder
+        {
+            typedef                 skip_while_builder<TPredicate>  this_type       ;
+            typedef                 TPredicate                      predicate_type  ;
+
+            predicate_type          predicate   ;
+
+            CPPLINQ_INLINEMETHOD skip_while_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
+                :   predicate (std::move (predicate))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD skip_while_builder (skip_while_builder const & v) CPPLINQ_NOEXCEPT
+                :   predicate (v.predicate)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD skip_while_builder (skip_while_builder && v) CPPLINQ_NOEXCEPT
+                :   predicate (std::move (v.predicate))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD skip_while_range<TRange, TPredicate> build (TRange range) const
+            {
+                return skip_while_range<TRange, TPredicate>(std::move (range), predicate);
+            }
+
+        };
+
+        // -------------------------------------------------------------------------
+
+        template<typename TRange>
+        struct ref_range : base_range
+        {
+            typedef        std::reference_wrapper<
+                                typename TRange::value_type const>  value_type  ;
+            typedef                 value_type                      return_type ;
+            enum
+            {
+                returns_reference   = 0   ,
+                instrumented_as     = query_ref ,
+            };
+
+            typedef                 ref_range<TRange>               this_type   ;
+            typedef                 TRange                          range_type  ;
+
+            range_type              range       ;
+
+            CPPLINQ_INLINEMETHOD ref_range (
+                    range_type      range
+                ) CPPLINQ_NOEXCEPT
+                :   range       (std::move (range))
+            {
+                static_assert (
+                        TRange::returns_reference
+                    ,   "ref may only follow a range that returns references"
+                    );
+            }
+
+            CPPLINQ_INLINEMETHOD ref_range (ref_range const & v)
+                :   range       (v.range)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD ref_range (ref_range && v) CPPLINQ_NOEXCEPT
+                :   range       (std::move (v.range))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            {
+                return range_builder.build (*this);
+            }
+
+            CPPLINQ_INLINEMETHOD memory_resource * resource () const CPPLINQ_NOEXCEPT
+            {
+                return get_memory_resource (range);
+            }
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                return value_type (range.front ());
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                return pull (query_ref, range);
+            }
+        };
+
+        struct ref_builder : base_builder
+        {
+            typedef                 ref_builder this_type   ;
+
+            CPPLINQ_INLINEMETHOD ref_builder () CPPLINQ_NOEXCEPT
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD ref_builder (ref_builder const & v)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD ref_builder (ref_builder && v) CPPLINQ_NOEXCEPT
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD ref_range<TRange> build (TRange range) const
+            {
+                return ref_range<TRange>(std::move (range));
+            }
+
+        };
+
+        // -------------------------------------------------------------------------
+
+        // Hands memory to the buffering ranges that follow it
+        template<typename TRange>
+        struct memory_resource_range : base_range
+        {
+            typedef                 typename TRange::value_type     value_type  ;
+            typedef                 typename TRange::return_type    return_type ;
+            enum
+            {
+                returns_reference   = TRange::returns_reference   ,
+                batched             = is_batched<TRange>::value   ,
+                random_access       = is_random_access_range<TRange>::value ,
+                instrumented_as     = query_with_memory_resource ,
+            };
+
+            typedef                 memory_resource_range<TRange>   this_type   ;
+            typedef                 TRange                          range_type  ;
+
+            range_type              range       ;
+            memory_resource *       memory      ;
+
+            CPPLINQ_INLINEMETHOD memory_resource_range (
+                    range_type          range
+                ,   memory_resource *   memory
+                ) CPPLINQ_NOEXCEPT
+                :   range       (std::move (range))
+                ,   memory      (memory)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD memory_resource_range (memory_resource_range const & v)
+                :   range       (v.range)
+                ,   memory      (v.memory)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD memory_resource_range (memory_resource_range && v) CPPLINQ_NOEXCEPT
+                :   range       (std::move (v.range))
+                ,   memory      (std::move (v.memory))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            {
+                return range_builder.build (*this);
+            }
+
+            CPPLINQ_INLINEMETHOD size_type size_hint () const
+            {
+                return get_size_hint (range);
+            }
+
+            CPPLINQ_INLINEMETHOD memory_resource * resource () const CPPLINQ_NOEXCEPT
+            {
+                return memory;
+            }
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                return range.front ();
+            }
+
+            template<typename TSource = TRange>
+            CPPLINQ_INLINEMETHOD auto take_front ()
+                -> decltype (std::declval<TSource &> ().take_front ())
+            {
+                return range.take_front ();
+            }
+
+            CPPLINQ_INLINEMETHOD size_type size ()
+            {
+                return range.size ();
+            }
+
+            CPPLINQ_INLINEMETHOD void advance (size_type count)
+            {
+                range.advance (count);
+            }
+
+            // Returns what the source returns, select returns a value
+            template<typename TSource = TRange>
+            CPPLINQ_INLINEMETHOD auto at (size_type index) const
+                -> decltype (std::declval<TSource const &> ().at (index))
+            {
+                return range.at (index);
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                return pull (query_with_memory_resource, range);
+            }
+
+            CPPLINQ_INLINEMETHOD size_type next_batch (value_type * values, size_type capacity)
+            {
+                return pull_batch (query_with_memory_resource, range, values, capacity);
+            }
+        };
+
+        template<typename TRange>
+        struct contiguous_range_traits<memory_resource_range<TRange>>
+        {
+            typedef                 memory_resource_range<TRange>       range_type      ;
+            typedef        typename range_type::value_type              value_type      ;
+            typedef                 contiguous_range_traits<TRange>     source_traits   ;
+
+            enum
+            {
+                is_contiguous = source_traits::is_contiguous    ,
+            };
+
+            static CPPLINQ_INLINEMETHOD value_type const * data_of (range_type const & range)
+            {
+                return source_traits::data_of (range.range);
+            }
+
+            static CPPLINQ_INLINEMETHOD size_type size_of (range_type const & range)
+            {
+                return source_traits::size_of (range.range);
+            }
+        };
+
+        struct memory_resource_builder : base_builder
+        {
+            typedef                 memory_resource_builder this_type   ;
+
+            memory_resource *       memory      ;
+
+            CPPLINQ_INLINEMETHOD explicit memory_resource_builder (memory_resource * memory) CPPLINQ_NOEXCEPT
+                :   memory      (memory)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD memory_resource_builder (memory_resource_builder const & v) CPPLINQ_NOEXCEPT
+                :   memory      (v.memory)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD memory_resource_builder (memory_resource_builder && v) CPPLINQ_NOEXCEPT
+                :   memory      (std::move (v.memory))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD memory_resource_range<TRange> build (TRange range) const
+            {
+                return memory_resource_range<TRange>(std::move (range), memory);
+            }
+
+        };
+
+        // -------------------------------------------------------------------------
+
+        // -------------------------------------------------------------------------
+
+        template<typename TRange, typename TPredicate>
+        struct select_range : base_range
+        {
+            static typename TRange::value_type get_source ();
+            static          TPredicate get_predicate ();
+
+
+            typedef        decltype (get_predicate ()(get_source ()))   raw_value_type  ;
+            typedef        typename cleanup_type<raw_value_type>::type  value_type      ;
+            typedef                 value_type const &                  return_type     ;
+            enum
+            {
+                returns_reference   = 1   ,
+                batched             =
+                        is_batched<TRange>::value
+                    &&  is_batchable_value<value_type>::value
+                    ,
+                random_access       = is_random_access_range<TRange>::value ,
+                instrumented_as     = query_select ,
+            };
+
+            typedef                 select_range<TRange, TPredicate>    this_type       ;
+            typedef                 TRange                              range_type      ;
+            typedef                 TPredicate                          predicate_type  ;
+
+            range_type              range       ;
+            predicate_type          predicate   ;
+
+            opt<value_type>         cache_value ;
+
+            CPPLINQ_INLINEMETHOD select_range (
+                    range_type      range
+                ,   predicate_type  predicate
+                ) CPPLINQ_NOEXCEPT
+                :   range       (std::move (range))
+                ,   predicate   (std::move (predicate))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD select_range (select_range const & v)
+                :   range       (v.range)
+                ,   predicate   (v.predicate)
+                ,   cache_value (copy_cache (v.cache_value))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD select_range (select_range && v) CPPLINQ_NOEXCEPT
+                :   range       (std::move (v.range))
+                ,   predicate   (std::move (v.predicate))
+                ,   cache_value (std::move (v.cache_value))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            {
+                return range_builder.build (*this);
+            }
+
+            CPPLINQ_INLINEMETHOD memory_resource * resource () const CPPLINQ_NOEXCEPT
+            {
+                return get_memory_resource (range);
+            }
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                CPPLINQ_ASSERT (cache_value);
+                return *cache_value;
+            }
+
+            CPPLINQ_INLINEMETHOD value_type take_front ()
+            {
+                CPPLINQ_ASSERT (cache_value);
+                return std::move (*cache_value);
+            }
+
+            CPPLINQ_INLINEMETHOD size_type size_hint () const
+            {
+                return get_size_hint (range);
+            }
+
+            CPPLINQ_INLINEMETHOD size_type size ()
+            {
+                return range.size ();
+            }
+
+            CPPLINQ_INLINEMETHOD void advance (size_type count)
+            {
+                range.advance (count);
+            }
+
+            CPPLINQ_INLINEMETHOD value_type at (size_type index) const
+            {
+                return predicate (range.at (index));
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                if (pull (query_select, range))
+                {
+                    cache_value = predicate (range.front ());
+                    return true;
+                }
+
+                cache_value.clear ();
+
+                return false;
+            }
+
+            CPPLINQ_METHOD size_type next_batch (value_type * values, size_type capacity)
+            {
+                typedef typename TRange::value_type source_type;
+
+                source_type source[get_batch_size<source_type>::value];
+
+                auto fetched = pull_batch (query_select, range, source, std::min (capacity, size_type (get_batch_size<source_type>::value)));
+                for (auto index = size_type (0U); index < fetched; ++index)
+                {
+                    values[index] = predicate (source[index]);
+                }
+
+                return fetched;
+            }
+        };
+
+        // select is applied to the reversed source
+        template<typename TRange, typename TPredicate>
+        struct reverse_traits<select_range<TRange, TPredicate>>
+        {
+            typedef                 select_range<TRange, TPredicate>    range_type      ;
+            typedef                 reverse_traits<TRange>              source_traits   ;
+            typedef                 select_range<typename source_traits::reversed_type, TPredicate>
+                                                                        reversed_type   ;
+            enum
+            {
+                is_reversible = source_traits::is_reversible ,
+            };
+
+            static CPPLINQ_INLINEMETHOD reversed_type reverse_of (range_type const & range)
+            {
+                return reversed_type (source_traits::reverse_of (range.range), range.predicate);
+            }
+        };
+
+        template<typename TPredicate>
+        struct select_builder : base_builder
+        {
+            typedef                 select_builder<TPredicate>  this_type       ;
+            typedef                 TPredicate                  predicate_type  ;
+
+            predicate_type          predicate   ;
+
+            CPPLINQ_INLINEMETHOD explicit select_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
+                :   predicate (std::move (predicate))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD select_builder (select_builder const & v)
+                :   predicate (v.predicate)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD select_builder (select_builder && v) CPPLINQ_NOEXCEPT
+                :   predicate (std::move (v.predicate))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD select_range<TRange, TPredicate> build (TRange range) const
+            {
+                return select_range<TRange, TPredicate>(std::move (range), predicate);
+            }
+
+        };
+
+        // -------------------------------------------------------------------------
+
+        // Some trickery in order to force the code to compile on VS2012
+        template<typename TRange, typename TPredicate>
+        struct select_many_range_helper
+        {
+            static typename TRange::value_type get_source ();
+            static          TPredicate get_predicate ();
+
+            typedef        decltype (get_predicate ()(get_source ()))           raw_inner_range_type    ;
+            typedef        typename cleanup_type<raw_inner_range_type>::type    inner_range_type        ;
+
+            static         inner_range_type get_inner_range ();
+
+            typedef        decltype (get_inner_range ().front ())               raw_value_type          ;
+            typedef        typename cleanup_type<raw_value_type>::type          value_type              ;
+
+        };
+
+        template<typename TRange, typename TPredicate>
+        struct select_many_range : base_range
+        {
+            typedef select_many_range_helper<TRange, TPredicate>    helper_type         ;
+
+            typedef        typename helper_type::inner_range_type   inner_range_type    ;
+            typedef        typename helper_type::value_type         value_type          ;
+            typedef                 value_type                      return_type         ;
+            enum
+            {
+                returns_reference   = 0   ,
+                instrumented_as     = query_select_many ,
+            };
+
+            typedef                 select_many_range<TRange, TPredicate>       this_type               ;
+            typedef                 TRange                                      range_type              ;
+            typedef                 TPredicate                                  predicate_type          ;
+
+            range_type              range       ;
+            predicate_type          predicate   ;
+
+            opt<inner_range_type>   inner_range ;
+
+
+            CPPLINQ_INLINEMETHOD select_many_range (
+                    range_type      range
+                ,   predicate_type  predicate
+                ) CPPLINQ_NOEXCEPT
+                :   range       (std::move (range))
+                ,   predicate   (std::move (predicate))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD select_many_range (select_many_range const & v)
+                :   range       (v.range)
+                ,   predicate   (v.predicate)
+                ,   inner_range (v.inner_range)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD select_many_range (select_many_range && v) CPPLINQ_NOEXCEPT
+                :   range       (std::move (v.range))
+                ,   predicate   (std::move (v.predicate))
+                ,   inner_range (std::move (v.inner_range))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            {
+                return range_builder.build (*this);
+            }
+
+            CPPLINQ_INLINEMETHOD memory_resource * resource () const CPPLINQ_NOEXCEPT
+            {
+                return get_memory_resource (range);
+            }
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                CPPLINQ_ASSERT (inner_range);
+                return inner_range->front ();
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                if (inner_range && inner_range->next ())
+                {
+                    return true;
+                }
+
+                if (pull (query_select_many, range))
+                {
+                    inner_range = predicate (range.front ());
+                    return inner_range && inner_range->next ();
+                }
+
+                inner_range.clear ();
+
+                return false;
+            }
+        };
+
+        template<typename TPredicate>
+        struct select_many_builder : base_builder
+        {
+            typedef                 select_many_builder<TPredicate> this_type       ;
+            typedef                 TPredicate                      predicate_type  ;
+
+            predicate_type          predicate   ;
+
+            CPPLINQ_INLINEMETHOD explicit select_many_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
+                :   predicate (std::move (predicate))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD select_many_builder (select_many_builder const & v)
+                :   predicate (v.predicate)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD select_many_builder (select_many_builder && v) CPPLINQ_NOEXCEPT
+                :   predicate (std::move (v.predicate))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD select_many_range<TRange, TPredicate> build (TRange range) const
+            {
+                return select_many_range<TRange, TPredicate>(std::move (range), predicate);
+            }
+
+        };
+
+        // -------------------------------------------------------------------------
+
+        template<
+                typename TRange
+            ,   typename TOtherRange
+            ,   typename TKeySelector
+            ,   typename TOtherKeySelector
+            ,   typename TCombiner
+            >
+        struct join_range : base_range
+        {
+            static typename TRange::value_type      get_source ()               ;
+            static typename TOtherRange::value_type get_other_source ()         ;
+            static          TKeySelector            get_key_selector ()         ;
+            static          TOtherKeySelector       get_other_key_selector ()   ;
+            static          TCombiner               get_combiner ()             ;
+
+            typedef         decltype (get_key_selector () (get_source ()))      raw_key_type    ;
+            typedef         typename cleanup_type<raw_key_type>::type           key_type        ;
+
+            typedef         decltype (get_other_key_selector () (get_other_source ()))
+                                                                                raw_other_key_type  ;
+            typedef         typename cleanup_type<raw_other_key_type>::type     other_key_type      ;
+
+            typedef         decltype (get_combiner () (get_source (), get_other_source ()))
+                                                                                raw_value_type  ;
+            typedef         typename cleanup_type<raw_value_type>::type         value_type      ;
+            typedef                 value_type                                  return_type     ;
+            enum
+            {
+                returns_reference   = 0   ,
+                instrumented_as     = query_join ,
+            };
+
+            typedef                 join_range<
+                    TRange
+                ,   TOtherRange
+                ,   TKeySelector
+                ,   TOtherKeySelector
+                ,   TCombiner
+                >                                               this_type               ;
+            typedef                 TRange                      range_type              ;
+            typedef                 TOtherRange                 other_range_type        ;
+            typedef                 TKeySelector                key_selector_type       ;
+            typedef                 TOtherKeySelector           other_key_selector_type ;
+            typedef                 TCombiner                   combiner_type           ;
+            typedef                 std::multimap<
+                                            other_key_type
+                                        ,   typename TOtherRange::value_type
+                                        ,   std::less<other_key_type>
+                                        ,   resource_allocator<
+                                                std::pair<
+                                                        other_key_type const
+                                                    ,   typename TOtherRange::value_type
+                                                    >
+                                            >
+                                        >                       map_type                ;
+            typedef     typename    map_type::const_iterator    map_iterator_type       ;
+
+            range_type                  range               ;
+            other_range_type            other_range         ;
+            key_selector_type           key_selector        ;
+            other_key_selector_type     other_key_selector  ;
+            combiner_type               combiner            ;
+
+            bool                        start               ;
+            map_type                    map                 ;
+            map_iterator_type           current             ;
+
+            CPPLINQ_INLINEMETHOD join_range (
+                    range_type              range
+                ,   other_range_type        other_range
+                ,   key_selector_type       key_selector
+                ,   other_key_selector_type other_key_selector
+                ,   combiner_type           combiner
+                ) CPPLINQ_NOEXCEPT
+                :   range              (std::move (range))
+                ,   other_range        (std::move (other_range))
+                ,   key_selector       (std::move (key_selector))
+                ,   other_key_selector (std::move (other_key_selector))
+                ,   combiner           (std::move (combiner))
+                ,   start              (true)
+                ,   map                (std::less<other_key_type> (), get_memory_resource (this->range))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD join_range (join_range const & v)
+                :   range              (v.range)
+                ,   other_range        (v.other_range)
+                ,   key_selector       (v.key_selector)
+                ,   other_key_selector (v.other_key_selector)
+                ,   combiner           (v.combiner)
+                ,   start              (v.start)
+                ,   map                (v.map)
+                ,   current            (v.current)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD join_range (join_range && v) CPPLINQ_NOEXCEPT
+                :   range              (std::move (v.range))
+                ,   other_range        (std::move (v.other_range))
+                ,   key_selector       (std::move (v.key_selector))
+                ,   other_key_selector (std::move (v.other_key_selector))
+                ,   combiner           (std::move (v.combiner))
+                ,   start              (std::move (v.start))
+                ,   map                (std::move (v.map))
+                ,   current            (std::move (v.current))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            {
+                return range_builder.build (*this);
+            }
+
+            CPPLINQ_INLINEMETHOD memory_resource * resource () const CPPLINQ_NOEXCEPT
+            {
+                return get_memory_resource (range);
+            }
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                CPPLINQ_ASSERT (current != map.end ());
+                return combiner (range.front (), current->second);
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                if (start)
+                {
+                    start = false;
+                    while (pull (query_join, other_range))
+                    {
+                        auto other_value    = store_front (query_join, other_range);
+                        auto other_key      = other_key_selector (other_value);
+                        map.insert (typename map_type::value_type (std::move (other_key), std::move (other_value)));
+                    }
+
+                    current = map.end ();
+                    if (map.size () == 0U)
+                    {
+                        return false;
+                    }
+                }
+
+                if (current != map.end ())
+                {
+                    auto previous = current;
+                    ++current;
+                    if (current != map.end () && !(previous->first < current->first))
+                    {
+                        return true;
+                    }
+                }
+
+                while (pull (query_join, range))
+                {
+                    auto key    = key_selector (range.front ());
+
+                    current     = map.find (key);
+                    if (current != map.end ())
+                    {
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+        };
+
+        template<
+                typename TOtherRange
+            ,   typename TKeySelector
+            ,   typename TOtherKeySelector
+            ,   typename TCombiner
+            >
+        struct join_builder : base_builder
+        {
+            typedef                 join_builder<
+                    TOtherRange
+                ,   TKeySelector
+                ,   TOtherKeySelector
+                ,   TCombiner
+                >                                               this_type               ;
+
+            typedef                 TOtherRange                 other_range_type        ;
+            typedef                 TKeySelector                key_selector_type       ;
+            typedef                 TOtherKeySelector           other_key_selector_type ;
+            typedef                 TCombiner                   combiner_type           ;
+
+            other_range_type        other_range         ;
+            key_selector_type       key_selector        ;
+            other_key_selector_type other_key_selector  ;
+            combiner_type           combiner            ;
+
+            CPPLINQ_INLINEMETHOD join_builder (
+                    other_range_type        other_range
+                ,   key_selector_type       key_selector
+                ,   other_key_selector_type other_key_selector
+                ,   combiner_type           combiner
+                ) CPPLINQ_NOEXCEPT
+                :   other_range        (std::move (other_range))
+                ,   key_selector       (std::move (key_selector))
+                ,   other_key_selector (std::move (other_key_selector))
+                ,   combiner           (std::move (combiner))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD join_builder (join_builder const & v)
+                :   other_range        (v.other_range)
+                ,   key_selector       (v.key_selector)
+                ,   other_key_selector (v.other_key_selector)
+                ,   combiner           (v.combiner)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD join_builder (join_builder && v) CPPLINQ_NOEXCEPT
+                :   other_range        (std::move (v.other_range))
+                ,   key_selector       (std::move (v.key_selector))
+                ,   other_key_selector (std::move (v.other_key_selector))
+                ,   combiner           (std::move (v.combiner))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD join_range<TRange, TOtherRange, TKeySelector, TOtherKeySelector, TCombiner> build (TRange range) const
+            {
+                return join_range<TRange, TOtherRange, TKeySelector, TOtherKeySelector, TCombiner> (
+                        std::move (range)
+                    ,   other_range
+                    ,   key_selector
+                    ,   other_key_selector
+                    ,   combiner
+                    );
+            }
+        };
+
+        // -------------------------------------------------------------------------
+        // Ranges with stable references
+        // -------------------------------------------------------------------------
+
+        template<typename TValueIterator>
+        struct is_stable_reference_range<from_range<TValueIterator>>
+            :   std::integral_constant<
+                        bool
+                    ,       std::is_reference<typename from_range<TValueIterator>::raw_value_type>::value
+                        &&  std::is_convertible<
+                                    typename std::iterator_traits<TValueIterator>::iterator_category
+                                ,   std::forward_iterator_tag
+                                >::value
+                    >
+        {
+        };
+
+        template<typename TRange, typename TPredicate>
+        struct is_stable_reference_range<where_range<TRange, TPredicate>>
+            :   is_stable_reference_range<TRange>
+        {
+        };
+
+        template<typename TRange>
+        struct is_stable_reference_range<take_range<TRange>>
+            :   is_stable_reference_range<TRange>
+        {
+        };
+
+        template<typename TRange, typename TPredicate>
+        struct is_stable_reference_range<take_while_range<TRange, TPredicate>>
+            :   is_stable_reference_range<TRange>
+        {
+        };
+
+        template<typename TRange>
+        struct is_stable_reference_range<skip_range<TRange>>
+            :   is_stable_reference_range<TRange>
+        {
+        };
+
+        template<typename TRange, typename TPredicate>
+        struct is_stable_reference_range<skip_while_range<TRange, TPredicate>>
+            :   is_stable_reference_range<TRange>
+        {
+        };
+
+        template<typename TRange>
+        struct is_stable_reference_range<memory_resource_range<TRange>>
+            :   is_stable_reference_range<TRange>
+        {
+        };
+
+        // -------------------------------------------------------------------------
+        // Repeatable ranges
+        // -------------------------------------------------------------------------
+
+        template<typename TValueIterator>
+        struct is_repeatable_range<from_range<TValueIterator>>
+            :   std::is_convertible<
+                        typename std::iterator_traits<TValueIterator>::iterator_category
+                    ,   std::forward_iterator_tag
+                    >
+        {
+        };
+
+        template<typename TRange>
+        struct is_repeatable_range<take_range<TRange>>
+            :   is_repeatable_range<TRange>
+        {
+        };
+
+        template<typename TRange>
+        struct is_repeatable_range<skip_range<TRange>>
+            :   is_repeatable_range<TRange>
+        {
+        };
+
+        template<typename TRange>
+        struct is_repeatable_range<memory_resource_range<TRange>>
+            :   is_repeatable_range<TRange>
+        {
+        };
+
+        // -------------------------------------------------------------------------
+
+        // Rows of the inner range of a hash join in a contiguous buffer. Rows
+        // from ranges with stable references are stored as pointers.
+        template<typename TRange, bool by_reference = is_stable_reference_range<TRange>::value>
+        struct join_rows
+        {
+            typedef        typename cleanup_type<typename TRange::value_type>::type value_type  ;
+
+            typename resource_vector<value_type>::type  rows    ;
+
+            CPPLINQ_INLINEMETHOD explicit join_rows (memory_resource * memory) CPPLINQ_NOEXCEPT
+                :   rows    (resource_allocator<value_type> (memory))
+            {
+            }
+
+            template<typename TRow>
+            CPPLINQ_INLINEMETHOD void push_back (TRow && row)
+            {
+                count_store<TRow> (query_hash_join);
+                rows.push_back (std::forward<TRow> (row));
+            }
+
+            CPPLINQ_INLINEMETHOD value_type const & operator[] (size_type index) const CPPLINQ_NOEXCEPT
+            {
+                return rows[index];
+            }
+
+            CPPLINQ_INLINEMETHOD size_type size () const CPPLINQ_NOEXCEPT
+            {
+                return rows.size ();
+            }
+        };
+
+        template<typename TRange>
+        struct join_rows<TRange, true>
+        {
+            typedef        typename cleanup_type<typename TRange::value_type>::type value_type  ;
+
+            typename resource_vector<value_type const *>::type  rows    ;
+
+            CPPLINQ_INLINEMETHOD explicit join_rows (memory_resource * memory) CPPLINQ_NOEXCEPT
+                :   rows    (resource_allocator<value_type const *> (memory))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD void push_back (value_type const & row)
+            {
+                rows.push_back (std::addressof (row));
+            }
+
+            CPPLINQ_INLINEMETHOD value_type const & operator[] (size_type index) const CPPLINQ_NOEXCEPT
+            {
+                return *rows[index];
+            }
+
+            CPPLINQ_INLINEMETHOD size_type size () const CPPLINQ_NOEXCEPT
+            {
+                return rows.size ();
+            }
+        };
+
+        // hash_join_range yields the same sequence as join_range. The inner
+        // range is read into join_rows, its distinct keys into a flat_hash_set
+        // and the rows sharing a key are chained in inner range order.
+        template<
+                typename TRange
+            ,   typename TOtherRange
+            ,   typename TKeySelector
+            ,   typename TOtherKeySelector
+            ,   typename TCombiner
+            ,   typename THash
+            ,   typename TEqual
+            >
+        struct hash_join_range : base_range
+        {
+            static typename TRange::value_type      get_source ()               ;
+            static typename TOtherRange::value_type get_other_source ()         ;
+            static          TOtherKeySelector       get_other_key_selector ()   ;
+            static          TCombiner               get_combiner ()             ;
+
+            typedef         decltype (get_other_key_selector () (get_other_source ()))
+                                                                                raw_other_key_type  ;
+            typedef         typename cleanup_type<raw_other_key_type>::type     other_key_type      ;
+
+            typedef         decltype (get_combiner () (get_source (), get_other_source ()))
+                                                                                raw_value_type  ;
+            typedef         typename cleanup_type<raw_value_type>::type         value_type      ;
+            typedef                 value_type                                  return_type     ;
+            enum
+            {
+                returns_reference   = 0   ,
+                instrumented_as     = query_hash_join ,
+            };
+
+            typedef                 hash_join_range<
+                    TRange
+                ,   TOtherRange
+                ,   TKeySelector
+                ,   TOtherKeySelector
+                ,   TCombiner
+                ,   THash
+                ,   TEqual
+                >                                               this_type               ;
+            typedef                 TRange                      range_type              ;
+            typedef                 TOtherRange                 other_range_type        ;
+            typedef                 TKeySelector                key_selector_type       ;
+            typedef                 TOtherKeySelector           other_key_selector_type ;
+            typedef                 TCombiner                   combiner_type           ;
+            typedef                 flat_hash_set<
+                                            other_key_type
+                                        ,   THash
+                                        ,   TEqual
+                                        >                       key_set_type            ;
+            typedef                 join_rows<TOtherRange>      rows_type               ;
+            typedef        typename resource_vector<size_type>::type
+                                                                indices_type            ;
+
+            range_type                  range               ;
+            other_range_type            other_range         ;
+            key_selector_type           key_selector        ;
+            other_key_selector_type     other_key_selector  ;
+            combiner_type               combiner            ;
+
+            bool                        start               ;
+            key_set_type                keys                ;
+            rows_type                   rows                ;
+            indices_type                first_rows          ;   // Per key
+            indices_type                last_rows           ;   // Per key
+            indices_type                next_rows           ;   // Per row
+            size_type                   current             ;
+
+            CPPLINQ_INLINEMETHOD hash_join_range (
+                    range_type              range
+                ,   other_range_type        other_range
+                ,   key_selector_type       key_selector
+                ,   other_key_selector_type other_key_selector
+                ,   combiner_type           combiner
+                ,   THash                   hash
+                ,   TEqual                  equal
+                )
+                :   range              (std::move (range))
+                ,   other_range        (std::move (other_range))
+                ,   key_selector       (std::move (key_selector))
+                ,   other_key_selector (std::move (other_key_selector))
+                ,   combiner           (std::move (combiner))
+                ,   start              (true)
+                ,   keys               (std::move (hash), std::move (equal), get_memory_resource (this->range))
+                ,   rows               (get_memory_resource (this->range))
+                ,   first_rows         (get_memory_resource (this->range))
+                ,   last_rows          (get_memory_resource (this->range))
+                ,   next_rows          (get_memory_resource (this->range))
+                ,   current            (invalid_size)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD hash_join_range (hash_join_range const & v)
+                :   range              (v.range)
+                ,   other_range        (v.other_range)
+                ,   key_selector       (v.key_selector)
+                ,   other_key_selector (v.other_key_selector)
+                ,   combiner           (v.combiner)
+                ,   start              (v.start)
+                ,   keys               (v.keys)
+                ,   rows               (v.rows)
+                ,   first_rows         (v.first_rows)
+                ,   last_rows          (v.last_rows)
+                ,   next_rows          (v.next_rows)
+                ,   current            (v.current)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD hash_join_range (hash_join_range && v) CPPLINQ_NOEXCEPT
+                :   range              (std::move (v.range))
+                ,   other_range        (std::move (v.other_range))
+                ,   key_selector       (std::move (v.key_selector))
+                ,   other_key_selector (std::move (v.other_key_selector))
+                ,   combiner           (std::move (v.combiner))
+                ,   start              (std::move (v.start))
+                ,   keys               (std::move (v.keys))
+                ,   rows               (std::move (v.rows))
+                ,   first_rows         (std::move (v.first_rows))
+                ,   last_rows          (std::move (v.last_rows))
+                ,   next_rows          (std::move (v.next_rows))
+                ,   current            (std::move (v.current))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            {
+                return range_builder.build (*this);
+            }
+
+            CPPLINQ_INLINEMETHOD memory_resource * resource () const CPPLINQ_NOEXCEPT
+            {
+                return get_memory_resource (range);
+            }
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                CPPLINQ_ASSERT (current != invalid_size);
+                return combiner (range.front (), rows[current]);
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                if (start)
+                {
+                    start = false;
+                    while (pull (query_hash_join, other_range))
+                    {
+                        rows.push_back (move_front (other_range));
+
+                        auto row        = rows.size () - 1U;
+                        auto inserted   = keys.insert (other_key_selector (rows[row]));
+                        auto key        = keys.index_of (inserted.first);
+
+                        next_rows.push_back (invalid_size);
+                        if (inserted.second)
+                        {
+                            first_rows.push_back (row);
+                            last_rows.push_back (row);
+                        }
+                        else
+                        {
+                            next_rows[last_rows[key]]   = row;
+                            last_rows[key]              = row;
+                        }
+                    }
+
+                    if (rows.size () == 0U)
+                    {
+                        return false;
+                    }
+                }
+
+                if (current != invalid_size)
+                {
+                    current = next_rows[current];
+                    if (current != invalid_size)
+                    {
+                        return true;
+                    }
+                }
+
+                while (pull (query_hash_join, range))
+                {
+                    auto found = keys.find (key_selector (range.front ()));
+                    if (found != keys.end ())
+                    {
+                        current = first_rows[keys.index_of (found)];
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+        };
+
+        template<
+                typename TOtherRange
+            ,   typename TKeySelector
+            ,   typename TOtherKeySelector
+            ,   typename TCombiner
+            ,   typename THash
+            ,   typename TEqual
+            >
+        struct hash_join_builder : base_builder
+        {
+            typedef                 hash_join_builder<
+                    TOtherRange
+                ,   TKeySelector
+                ,   TOtherKeySelector
+                ,   TCombiner
+                ,   THash
+                ,   TEqual
+                >                                               this_type               ;
+
+            typedef                 TOtherRange                 other_range_type        ;
+            typedef                 TKeySelector                key_selector_type       ;
+            typedef                 TOtherKeySelector           other_key_selector_type ;
+            typedef                 TCombiner                   combiner_type           ;
+            typedef                 THash                       hasher                  ;
+            typedef                 TEqual                      key_equal               ;
+
+            other_range_type        other_range         ;
+            key_selector_type       key_selector        ;
+            other_key_selector_type other_key_selector  ;
+            combiner_type           combiner            ;
+            hasher                  hash                ;
+            key_equal               equal               ;
+
+            CPPLINQ_INLINEMETHOD hash_join_builder (
+                    other_range_type        other_range
+                ,   key_selector_type       key_selector
+                ,   other_key_selector_type other_key_selector
+                ,   combiner_type           combiner
+                ,   hasher                  hash
+                ,   key_equal               equal
+                ) CPPLINQ_NOEXCEPT
+                :   other_range        (std::move (other_range))
+                ,   key_selector       (std::move (key_selector))
+                ,   other_key_selector (std::move (other_key_selector))
+                ,   combiner           (std::move (combiner))
+                ,   hash               (std::move (hash))
+                ,   equal              (std::move (equal))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD hash_join_builder (hash_join_builder const & v)
+                :   other_range        (v.other_range)
+                ,   key_selector       (v.key_selector)
+                ,   other_key_selector (v.other_key_selector)
+                ,   combiner           (v.combiner)
+                ,   hash               (v.hash)
+                ,   equal              (v.equal)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD hash_join_builder (hash_join_builder && v) CPPLINQ_NOEXCEPT
+                :   other_range        (std::move (v.other_range))
+                ,   key_selector       (std::move (v.key_selector))
+                ,   other_key_selector (std::move (v.other_key_selector))
+                ,   combiner           (std::move (v.combiner))
+                ,   hash               (std::move (v.hash))
+                ,   equal              (std::move (v.equal))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD hash_join_range<TRange, TOtherRange, TKeySelector, TOtherKeySelector, TCombiner, THash, TEqual> build (TRange range) const
+            {
+                return hash_join_range<TRange, TOtherRange, TKeySelector, TOtherKeySelector, TCombiner, THash, TEqual> (
+                        std::move (range)
+                    ,   other_range
+                    ,   key_selector
+                    ,   other_key_selector
+                    ,   combiner
+                    ,   hash
+                    ,   equal
+                    );
+            }
+        };
+
+
+        // -------------------------------------------------------------------------
+        // The set operators (distinct, union_with, intersect_with, except) keep
+        // track of the values seen in a set created by a set policy
+        //      template<typename TValue> struct rebind { typedef ... type; };
+        //      template<typename TValue> typename rebind<TValue>::type make_set (memory_resource *) const
+        // -------------------------------------------------------------------------
+
+        struct ordered_set_policy
+        {
+            template<typename TValue>
+            struct rebind
+            {
+                typedef                 std::set<
+                                                TValue
+                                            ,   std::less<TValue>
+                                            ,   resource_allocator<TValue>
+                                            >                                   type            ;
+            };
+
+            template<typename TValue>
+            CPPLINQ_INLINEMETHOD typename rebind<TValue>::type make_set (memory_resource * memory) const
+            {
+                return typename rebind<TValue>::type (std::less<TValue> (), memory);
+            }
+        };
+
+        template<typename THash, typename TEqual>
+        struct hashed_set_policy
+        {
+            typedef                 THash                                       hasher          ;
+            typedef                 TEqual                                      key_equal       ;
+
+            template<typename TValue>
+            struct rebind
+            {
+                typedef                 flat_hash_set<TValue, THash, TEqual>    type            ;
+            };
+
+            hasher                  hash        ;
+            key_equal               equal       ;
+
+            CPPLINQ_INLINEMETHOD hashed_set_policy (hasher hash, key_equal equal)
+                :   hash        (std::move (hash))
+                ,   equal       (std::move (equal))
+            {
+            }
+
+            template<typename TValue>
+            CPPLINQ_INLINEMETHOD typename rebind<TValue>::type make_set (memory_resource * memory) const
+            {
+                return typename rebind<TValue>::type (hash, equal, memory);
+            }
+        };
+
+        // -------------------------------------------------------------------------
+
+        template<typename TRange, typename TSetPolicy = ordered_set_policy>
+        struct distinct_range : base_range
+        {
+            typedef             distinct_range<TRange, TSetPolicy>              this_type           ;
+            typedef             TRange                                          range_type          ;
+            typedef             TSetPolicy                                      set_policy_type     ;
+
+            typedef    typename cleanup_type<typename TRange::value_type>::type value_type          ;
+            typedef             value_type const &                              return_type         ;
+            enum
+            {
+                returns_reference   = 1 ,
+                instrumented_as     = query_distinct ,
+            };
+
+            typedef    typename set_policy_type::template rebind<value_type>::type  set_type         ;
+            typedef    typename set_type::const_iterator           set_iterator_type                ;
+
+            range_type                  range               ;
+            set_type                    set                 ;
+            set_iterator_type           current             ;
+
+            CPPLINQ_INLINEMETHOD distinct_range (
+                        range_type              range
+                    ,   set_policy_type const & set_policy  = set_policy_type ()
+                )
+                :   range               (std::move (range))
+                ,   set                 (set_policy.template make_set<value_type> (get_memory_resource (this->range)))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD distinct_range (distinct_range const & v) CPPLINQ_NOEXCEPT
+                :   range               (v.range)
+                ,   set                 (v.set)
+                ,   current             (v.current)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD distinct_range (distinct_range && v) CPPLINQ_NOEXCEPT
+                :   range               (std::move (v.range))
+                ,   set                 (std::move (v.set))
+                ,   current             (std::move (v.current))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            {
+                return range_builder.build (*this);
+            }
+
+            CPPLINQ_INLINEMETHOD memory_resource * resource () const CPPLINQ_NOEXCEPT
+            {
+                return get_memory_resource (range);
+            }
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                return *current;
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                while (pull (query_distinct, range))
+                {
+                    auto result = set.insert (move_front (range));
+                    if (result.second)
+                    {
+                        count_store<decltype (move_front (range))> (query_distinct);
+                        current = result.first;
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+        };
+
+        template<typename TSetPolicy = ordered_set_policy>
+        struct distinct_builder : base_builder
+        {
+            typedef                 distinct_builder<TSetPolicy>        this_type               ;
+            typedef                 TSetPolicy                          set_policy_type         ;
+
+            set_policy_type         set_policy          ;
+
+            CPPLINQ_INLINEMETHOD explicit distinct_builder (set_policy_type set_policy = set_policy_type ()) CPPLINQ_NOEXCEPT
+                :   set_policy  (std::move (set_policy))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD distinct_builder (distinct_builder const & v) CPPLINQ_NOEXCEPT
+                :   set_policy  (v.set_policy)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD distinct_builder (distinct_builder && v) CPPLINQ_NOEXCEPT
+                :   set_policy  (std::move (v.set_policy))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD distinct_range<TRange, TSetPolicy> build (TRange range) const
+            {
+                return distinct_range<TRange, TSetPolicy> (std::move (range), set_policy);
+            }
+        };
+
+        // -------------------------------------------------------------------------
+
+        template<typename TRange, typename TOtherRange, typename TSetPolicy = ordered_set_policy>
+        struct union_range : base_range
+        {
+            typedef             union_range<TRange, TOtherRange, TSetPolicy>              this_type           ;
+            typedef             TRange                                          range_type          ;
+            typedef             TOtherRange                                     other_range_type    ;
+            typedef             TSetPolicy                                      set_policy_type     ;
+
+            typedef    typename cleanup_type<typename TRange::value_type>::type value_type          ;
+            typedef             value_type const &                              return_type         ;
+            enum
+            {
+                returns_reference   = 1 ,
+                instrumented_as     = query_union_with ,
+            };
+
+            typedef    typename set_policy_type::template rebind<value_type>::type  set_type         ;
+            typedef    typename set_type::const_iterator           set_iterator_type                ;
+
+
+            range_type                  range               ;
+            other_range_type            other_range         ;
+            set_type                    set                 ;
+            set_iterator_type           current             ;
+
+            CPPLINQ_INLINEMETHOD union_range (
+                        range_type              range
+                    ,   other_range_type        other_range
+                    ,   set_policy_type const & set_policy  = set_policy_type ()
+                )
+                :   range               (std::move (range))
+                ,   other_range         (std::move (other_range))
+                ,   set                 (set_policy.template make_set<value_type> (get_memory_resource (this->range)))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD union_range (union_range const & v) CPPLINQ_NOEXCEPT
+                :   range               (v.range)
+                ,   other_range         (v.other_range)
+                ,   set                 (v.set)
+                ,   current             (v.current)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD union_range (union_range && v) CPPLINQ_NOEXCEPT
+                :   range               (std::move (v.range))
+                ,   other_range         (std::move (v.other_range))
+                ,   set                 (std::move (v.set))
+                ,   current             (std::move (v.current))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            {
+                return range_builder.build (*this);
+            }
+
+            CPPLINQ_INLINEMETHOD memory_resource * resource () const CPPLINQ_NOEXCEPT
+            {
+                return get_memory_resource (range);
+            }
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                return *current;
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                while (pull (query_union_with, range))
+                {
+                    auto result = set.insert (move_front (range));
+                    if (result.second)
+                    {
+                        count_store<decltype (move_front (range))> (query_union_with);
+                        current = result.first;
+                        return true;
+                    }
+                }
+
+                while (pull (query_union_with, other_range))
+                {
+                    auto result = set.insert (move_front (other_range));
+                    if (result.second)
+                    {
+                        count_store<decltype (move_front (other_range))> (query_union_with);
+                        current = result.first;
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+        };
+
+        template <typename TOtherRange, typename TSetPolicy = ordered_set_policy>
+        struct union_builder : base_builder
+        {
+            typedef                 union_builder<TOtherRange, TSetPolicy>     this_type       ;
+            typedef                 TOtherRange                             other_range_type;
+            typedef                 TSetPolicy                              set_policy_type ;
+
+            other_range_type        other_range         ;
+            set_policy_type         set_policy          ;
+
+            CPPLINQ_INLINEMETHOD union_builder (TOtherRange other_range, set_policy_type set_policy = set_policy_type ()) CPPLINQ_NOEXCEPT
+                : other_range (std::move (other_range))
+                , set_policy  (std::move (set_policy))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD union_builder (union_builder const & v) CPPLINQ_NOEXCEPT
+                : other_range (v.other_range)
+                , set_policy  (v.set_policy)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD union_builder (union_builder && v) CPPLINQ_NOEXCEPT
+                : other_range (std::move (v.other_range))
+                , set_policy  (std::move (v.set_policy))
+            {
+            }
+
+            template <typename TRange>
+            CPPLINQ_INLINEMETHOD union_range<TRange, TOtherRange, TSetPolicy> build (TRange range) const
+            {
+                return union_range<TRange, TOtherRange, TSetPolicy> (std::move (range), std::move (other_range), set_policy);
+            }
+        };
+
+        // -------------------------------------------------------------------------
+
+        template<typename TRange, typename TOtherRange, typename TSetPolicy = ordered_set_policy>
+        struct intersect_range : base_range
+        {
+            typedef             intersect_range<TRange, TOtherRange, TSetPolicy>          this_type           ;
+            typedef             TRange                                          range_type          ;
+            typedef             TOtherRange                                     other_range_type    ;
+            typedef             TSetPolicy                                      set_policy_type     ;
+
+            typedef    typename cleanup_type<typename TRange::value_type>::type value_type          ;
+            typedef             value_type const &                              return_type         ;
+            enum
+            {
+                returns_reference   = 1 ,
+                instrumented_as     = query_intersect_with ,
+            };
+
+            typedef    typename set_policy_type::template rebind<value_type>::type  set_type         ;
+            typedef    typename set_type::const_iterator           set_iterator_type                ;
+
+
+            range_type                  range               ;
+            other_range_type            other_range         ;
+            set_type                    set                 ;
+            set_iterator_type           current             ;
+            bool                        start               ;
+
+            CPPLINQ_INLINEMETHOD intersect_range (
+                        range_type              range
+                    ,   other_range_type        other_range
+                    ,   set_policy_type const & set_policy  = set_policy_type ()
+                )
+                :   range               (std::move (range))
+                ,   other_range         (std::move (other_range))
+                ,   set                 (set_policy.template make_set<value_type> (get_memory_resource (this->range)))
+                ,   start               (true)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD intersect_range (intersect_range const & v) CPPLINQ_NOEXCEPT
+                :   range               (v.range)
+                ,   other_range         (v.other_range)
+                ,   set                 (v.set)
+                ,   current             (v.current)
+                ,   start               (v.start)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD intersect_range (intersect_range && v) CPPLINQ_NOEXCEPT
+                :   range               (std::move (v.range))
+                ,   other_range         (std::move (v.other_range))
+                ,   set                 (std::move (v.set))
+                ,   current             (std::move (v.current))
+                ,   start               (std::move (v.start))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            {
+                return range_builder.build (*this);
+            }
+
+            CPPLINQ_INLINEMETHOD memory_resource * resource () const CPPLINQ_NOEXCEPT
+            {
+                return get_memory_resource (range);
+            }
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                CPPLINQ_ASSERT (!start);
+                return *current;
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                if (start)
+                {
+                    start = false;
+
+                    while (pull (query_intersect_with, other_range))
+                    {
+                        if (set.insert (move_front (other_range)).second)
+                        {
+                            count_store<decltype (move_front (other_range))> (query_intersect_with);
+                        }
+                    }
+
+                    while (pull (query_intersect_with, range))
+                    {
+                        current = set.find (range.front ());
+                        if (current != set.end ())
+                        {
+                            return true;
+                        }
+                    }
+
+                    set.clear ();
+
+                    return false;
+                }
+
+                if (set.empty ())
+                {
+                    return false;
+                }
+
+                set.erase (current);
+
+                while (pull (query_intersect_with, range))
+                {
+                    current = set.find (range.front ());
+                    if (current != set.end ())
+                    {
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+        };
+
+        template <typename TOtherRange, typename TSetPolicy = ordered_set_policy>
+        struct intersect_builder : base_builder
+        {
+            typedef                 intersect_builder<TOtherRange, TSetPolicy>     this_type       ;
+            typedef                 TOtherRange                             other_range_type;
+            typedef                 TSetPolicy                              set_policy_type ;
+
+            other_range_type        other_range         ;
+            set_policy_type         set_policy          ;
+
+            CPPLINQ_INLINEMETHOD intersect_builder (TOtherRange other_range, set_policy_type set_policy = set_policy_type ()) CPPLINQ_NOEXCEPT
+                : other_range (std::move (other_range))
+                , set_policy  (std::move (set_policy))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD intersect_builder (intersect_builder const & v) CPPLINQ_NOEXCEPT
+                : other_range (v.other_range)
+                , set_policy  (v.set_policy)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD intersect_builder (intersect_builder && v) CPPLINQ_NOEXCEPT
+                : other_range (std::move (v.other_range))
+                , set_policy  (std::move (v.set_policy))
+            {
+            }
+
+            template <typename TRange>
+            CPPLINQ_INLINEMETHOD intersect_range<TRange, TOtherRange, TSetPolicy> build (TRange range) const
+            {
+                return intersect_range<TRange, TOtherRange, TSetPolicy> (std::move (range), std::move (other_range), set_policy);
+            }
+        };
+
+        // -------------------------------------------------------------------------
+
+        template<typename TRange, typename TOtherRange, typename TSetPolicy = ordered_set_policy>
+        struct except_range : base_range
+        {
+            typedef             except_range<TRange, TOtherRange, TSetPolicy>             this_type           ;
+            typedef             TRange                                          range_type          ;
+            typedef             TOtherRange                                     other_range_type    ;
+            typedef             TSetPolicy                                      set_policy_type     ;
+
+            typedef    typename cleanup_type<typename TRange::value_type>::type value_type          ;
+            typedef             value_type const &                              return_type         ;
+            enum
+            {
+                returns_reference   = 1 ,
+                instrumented_as     = query_except ,
+            };
+
+            typedef    typename set_policy_type::template rebind<value_type>::type  set_type         ;
+            typedef    typename set_type::const_iterator           set_iterator_type                ;
+
+            range_type                  range               ;
+            other_range_type            other_range         ;
+            set_type                    set                 ;
+            set_iterator_type           current             ;
+            bool                        start               ;
+
+            CPPLINQ_INLINEMETHOD except_range (
+                        range_type              range
+                    ,   other_range_type        other_range
+                    ,   set_policy_type const & set_policy  = set_policy_type ()
+                )
+                :   range               (std::move (range))
+                ,   other_range         (std::move (other_range))
+                ,   set                 (set_policy.template make_set<value_type> (get_memory_resource (this->range)))
+                ,   start               (true)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD except_range (except_range const & v) CPPLINQ_NOEXCEPT
+                :   range               (v.range)
+                ,   other_range         (v.other_range)
+                ,   set                 (v.set)
+                ,   current             (v.current)
+                ,   start               (v.start)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD except_range (except_range && v) CPPLINQ_NOEXCEPT
+                :   range               (std::move (v.range))
+                ,   other_range         (std::move (v.other_range))
+                ,   set                 (std::move (v.set))
+                ,   current             (std::move (v.current))
+                ,   start               (std::move (v.start))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            {
+                return range_builder.build (*this);
+            }
+
+            CPPLINQ_INLINEMETHOD memory_resource * resource () const CPPLINQ_NOEXCEPT
+            {
+                return get_memory_resource (range);
+            }
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                return *current;
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                if (start)
+                {
+                    start = false;
+                    while (pull (query_except, other_range))
+                    {
+                        if (set.insert (move_front (other_range)).second)
+                        {
+                            count_store<decltype (move_front (other_range))> (query_except);
+                        }
+                    }
+                }
+
+                while (pull (query_except, range))
+                {
+                    auto result = set.insert (move_front (range));
+                    if (result.second)
+                    {
+                        count_store<decltype (move_front (range))> (query_except);
+                        current = result.first;
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+        };
+
+        template <typename TOtherRange, typename TSetPolicy = ordered_set_policy>
+        struct except_builder : base_builder
+        {
+            typedef                 except_builder<TOtherRange, TSetPolicy>     this_type       ;
+            typedef                 TOtherRange                             other_range_type;
+            typedef                 TSetPolicy                              set_policy_type ;
+
+            other_range_type        other_range         ;
+            set_policy_type         set_policy          ;
+
+            CPPLINQ_INLINEMETHOD except_builder (TOtherRange other_range, set_policy_type set_policy = set_policy_type ()) CPPLINQ_NOEXCEPT
+                : other_range (std::move (other_range))
+                , set_policy  (std::move (set_policy))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD except_builder (except_builder const & v) CPPLINQ_NOEXCEPT
+                : other_range (v.other_range)
+                , set_policy  (v.set_policy)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD except_builder (except_builder && v) CPPLINQ_NOEXCEPT
+                : other_range (std::move (v.other_range))
+                , set_policy  (std::move (v.set_policy))
+            {
+            }
+
+            template <typename TRange>
+            CPPLINQ_INLINEMETHOD except_range<TRange, TOtherRange, TSetPolicy> build (TRange range) const
+            {
+                return except_range<TRange, TOtherRange, TSetPolicy> (std::move (range), std::move (other_range), set_policy);
+            }
+        };
+
+        // -------------------------------------------------------------------------
+
+        template<typename TRange, typename TOtherRange>
+        struct concat_range : base_range
+        {
+            typedef             concat_range<TRange, TOtherRange>                       this_type           ;
+            typedef             TRange                                                  range_type          ;
+            typedef             TOtherRange                                             other_range_type    ;
+
+            typedef typename    cleanup_type<typename TRange::value_type>::type         value_type          ;
+            typedef typename    cleanup_type<typename TOtherRange::value_type>::type    other_value_type    ;
+
+            // References are forwarded when both ranges return the same
+            // reference type, otherwise values are returned
+            typedef typename    std::conditional<
+                        std::is_reference<typename TRange::return_type>::value
+                    &&  std::is_same<typename TRange::return_type, typename TOtherRange::return_type>::value
+                ,   typename TRange::return_type
+                ,   value_type
+                >::type                                                                 return_type         ;
+
+            enum
+            {
+                returns_reference   = std::is_reference<return_type>::value ,
+                instrumented_as     = query_concat ,
+            };
+
+            enum state
+            {
+                state_initial                   ,
+                state_iterating_range           ,
+                state_iterating_other_range     ,
+                state_end                       ,
+            };
+
+            range_type                  range               ;
+            other_range_type            other_range         ;
+            state                       state               ;
+
+            CPPLINQ_INLINEMETHOD concat_range (
+                        range_type          range
+                    ,   other_range_type    other_range
+                ) CPPLINQ_NOEXCEPT
+                :   range               (std::move (range))
+                ,   other_range         (std::move (other_range))
+                ,   state               (state_initial)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD concat_range (concat_range const & v) CPPLINQ_NOEXCEPT
+                :   range               (v.range)
+                ,   other_range         (v.other_range)
+                ,   state               (v.state)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD concat_range (concat_range && v) CPPLINQ_NOEXCEPT
+                :   range               (std::move (v.range))
+                ,   other_range         (std::move (v.other_range))
+                ,   state               (std::move (v.state))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            {
+                return range_builder.build (*this);
+            }
+
+            CPPLINQ_INLINEMETHOD memory_resource * resource () const CPPLINQ_NOEXCEPT
+            {
+                return get_memory_resource (range);
+            }
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                switch (state)
+                {
+                case state_initial:
+                case state_end:
+                default:
+                    CPPLINQ_ASSERT (false);       // Intentionally falls through
+                case state_iterating_range:
+                    return range.front ();
+                case state_iterating_other_range:
+                    return other_range.front ();
+                };
+            }
+
+            CPPLINQ_INLINEMETHOD size_type size_hint () const
+            {
+                switch (state)
+                {
+                case state_initial:
+                case state_iterating_range:
+                    {
+                        auto hint       = get_size_hint (range);
+                        auto other_hint = get_size_hint (other_range);
+                        return hint == invalid_size || other_hint == invalid_size
+                            ?   invalid_size
+                            :   hint + other_hint
+                            ;
+                    }
+                case state_iterating_other_range:
+                    return get_size_hint (other_range);
+                case state_end:
+                default:
+                    return 0U;
+                }
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                switch (state)
+                {
+                case state_initial:
+                    if (pull (query_concat, range))
+                    {
+                        state = state_iterating_range;
+                        return true;
+                    }
+
+                    if (pull (query_concat, other_range))
+                    {
+                        state = state_iterating_other_range;
+                        return true;
+                    }
+
+                    state = state_end;
+                    return false;
+                case state_iterating_range:
+                    if (pull (query_concat, range))
+                    {
+                        return true;
+                    }
+
+                    if (pull (query_concat, other_range))
+                    {
+                        state = state_iterating_other_range;
+                        return true;
+                    }
+
+                    state = state_end;
+                    return false;
+                case state_iterating_other_range:
+                    if (pull (query_concat, other_range))
+                    {
+                        return true;
+                    }
+
+                    state = state_end;
+                    return false;
+                case state_end:
+                default:
+                    return false;
+                }
+            }
+        };
+
+        template <typename TOtherRange>
+        struct concat_builder : base_builder
+        {
+            typedef                 concat_builder<TOtherRange>             this_type       ;
+            typedef                 TOtherRange                             other_range_type;
+
+            other_range_type        other_range         ;
+
+            CPPLINQ_INLINEMETHOD concat_builder (TOtherRange other_range) CPPLINQ_NOEXCEPT
+                : other_range (std::move (other_range))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD concat_builder (concat_builder const & v) CPPLINQ_NOEXCEPT
+                : other_range (v.other_range)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD concat_builder (concat_builder && v) CPPLINQ_NOEXCEPT
+                : other_range (std::move (v.other_range))
+            {
+            }
+
+            template <typename TRange>
+            CPPLINQ_INLINEMETHOD concat_range<TRange, TOtherRange> build (TRange range) const
+            {
+                return concat_range<TRange, TOtherRange> (std::move (range), std::move (other_range));
+            }
+        };
+
+        template<typename TRange, typename TOtherRange>
+        struct is_stable_reference_range<concat_range<TRange, TOtherRange>>
+            :   std::integral_constant<
+                        bool
+                    ,       concat_range<TRange, TOtherRange>::returns_reference
+                        &&  is_stable_reference_range<TRange>::value
+                        &&  is_stable_reference_range<TOtherRange>::value
+                    >
+        {
+        };
+
+        template<typename TRange, typename TOtherRange>
+        struct is_repeatable_range<concat_range<TRange, TOtherRange>>
+            :   std::integral_constant<
+                        bool
+                    ,       is_repeatable_range<TRange>::value
+                        &&  is_repeatable_range<TOtherRange>::value
+                    >
+        {
+        };
+
+        // -------------------------------------------------------------------------
+        // Parallel execution
+        // -------------------------------------------------------------------------
+        // parallel () marks a source range as partitionable. Aggregators that
+        // follow a partitionable range split it into chunks, evaluate each chunk
+        // on an executor and combine the partial results.
+        //
+        // Only stages that look at one element at a time (where, select, ref)
+        // keep a range partitionable. Predicates are invoked concurrently and
+        // must therefore be thread-safe.
+        //
+        // An executor is any type that provides
+        //      size_type   concurrency () const    // Number of threads executing tasks, including the caller
+        //      void        submit (std::function<void ()> task)
+        // Unless told otherwise parallel operators share one process wide
+        // work-stealing thread_pool so that concurrent queries don't
+        // oversubscribe the cores.
+        // -------------------------------------------------------------------------
+
+        struct executor_ref
+        {
+            typedef                 executor_ref                this_type   ;
+            typedef                 std::function<void ()>      task_type   ;
+
+            template<typename TExecutor>
+            CPPLINQ_INLINEMETHOD explicit executor_ref (TExecutor * executor) CPPLINQ_NOEXCEPT
+                :   executor            (executor)
+                ,   concurrency_function(&concurrency_of<TExecutor>)
+                ,   submit_function     (&submit_to<TExecutor>)
+            {
+                CPPLINQ_ASSERT (executor);
+            }
+
+            CPPLINQ_INLINEMETHOD size_type concurrency () const
+            {
+                return concurrency_function (executor);
+            }
+
+            CPPLINQ_INLINEMETHOD void submit (task_type task) const
+            {
+                submit_function (executor, std::move (task));
+            }
+
+        private:
+            template<typename TExecutor>
+            static CPPLINQ_INLINEMETHOD size_type concurrency_of (void * executor)
+            {
+                return static_cast<TExecutor *> (executor)->concurrency ();
+            }
+
+            template<typename TExecutor>
+            static CPPLINQ_INLINEMETHOD void submit_to (void * executor, task_type task)
+            {
+                static_cast<TExecutor *> (executor)->submit (std::move (task));
+            }
+
+            void *                  executor                                    ;
+            size_type               (*concurrency_function) (void *)            ;
+            void                    (*submit_function) (void *, task_type)      ;
+        };
+
+#ifndef CPPLINQ_NO_THREADS
+        // Chase-Lev deque: the owning worker pushes and pops tasks at the bottom
+        // while other workers steal from the top without taking a lock
+        struct work_stealing_deque
+        {
+            typedef                 work_stealing_deque         this_type   ;
+            typedef                 std::function<void ()>      task_type   ;
+
+            CPPLINQ_METHOD work_stealing_deque ()
+                :   top     (0)
+                ,   bottom  (0)
+                ,   buffer  (new buffer_type (64U, nullptr))
+            {
+            }
+
+            CPPLINQ_METHOD ~work_stealing_deque () CPPLINQ_NOEXCEPT
+            {
+                delete buffer.load ();
+            }
+
+            // Only invoked by the owning worker
+            CPPLINQ_METHOD void push (task_type * task)
+            {
+                auto b      = bottom.load ();
+                auto t      = top.load ();
+                auto a      = buffer.load ();
+
+                if (b - t >= static_cast<long long> (a->capacity))
+                {
+                    a = a->grow (t, b);
+                    buffer.store (a);
+                }
+
+                a->put (b, task);
+                bottom.store (b + 1);
+            }
+
+            // Only invoked by the owning worker
+            CPPLINQ_METHOD task_type * pop () CPPLINQ_NOEXCEPT
+            {
+                auto b      = bottom.load () - 1;
+                auto a      = buffer.load ();
+                bottom.store (b);
+                auto t      = top.load ();
+
+                if (t > b)
+                {
+                    bottom.store (b + 1);
+                    return nullptr;
+                }
+
+                auto task   = a->get (b);
+                if (t == b)
+                {
+                    // Last task, race the thieves for it
+                    if (!top.compare_exchange_strong (t, t + 1))
+                    {
+                        task = nullptr;
+                    }
+                    bottom.store (b + 1);
+                }
+
+                return task;
+            }
+
+            CPPLINQ_METHOD task_type * steal () CPPLINQ_NOEXCEPT
+            {
+                auto t      = top.load ();
+                auto b      = bottom.load ();
+
+                if (t >= b)
+                {
+                    return nullptr;
+                }
+
+                auto task   = buffer.load ()->get (t);
+                if (!top.compare_exchange_strong (t, t + 1))
+                {
+                    return nullptr;
+                }
+
+                return task;
+            }
+
+        private:
+            CPPLINQ_INLINEMETHOD work_stealing_deque (work_stealing_deque const &);
+            CPPLINQ_INLINEMETHOD work_stealing_deque & operator= (work_stealing_deque const &);
+
+            struct buffer_type
+            {
+                size_type                                       capacity    ;
+                std::unique_ptr<std::atomic<task_type *> []>    slots       ;
+                // A thief might still read from a buffer that has been
+                // replaced so retired buffers live as long as the deque
+                std::unique_ptr<buffer_type>                    retired     ;
+
+                CPPLINQ_METHOD buffer_type (size_type capacity, buffer_type * retired)
+                    :   capacity    (capacity)
+                    ,   slots       (new std::atomic<task_type *> [capacity])
+                    ,   retired     (retired)
+                {
+                }
+
+                CPPLINQ_INLINEMETHOD task_type * get (long long index) const CPPLINQ_NOEXCEPT
+                {
+                    return slots[static_cast<size_type> (index) & (capacity - 1U)].load (std::memory_order_relaxed);
+                }
+
+                CPPLINQ_INLINEMETHOD void put (long long index, task_type * task) CPPLINQ_NOEXCEPT
+                {
+                    slots[static_cast<size_type> (index) & (capacity - 1U)].store (task, std::memory_order_relaxed);
+                }
+
+                CPPLINQ_METHOD buffer_type * grow (long long t, long long b)
+                {
+                    auto grown = new buffer_type (2U * capacity, this);
+                    for (auto index = t; index < b; ++index)
+                    {
+                        grown->put (index, get (index));
+                    }
+                    return grown;
+                }
+            };
+
+            std::atomic<long long>      top     ;
+            std::atomic<long long>      bottom  ;
+            std::atomic<buffer_type *>  buffer  ;
+        };
+
+        struct thread_pool
+        {
+            typedef                 thread_pool                 this_type   ;
+            typedef                 std::function<void ()>      task_type   ;
+
+            // worker_count threads are started, the thread waiting for a
+            // parallel operator to complete helps out executing its tasks
+            CPPLINQ_METHOD explicit thread_pool (size_type worker_count)
+                :   queued      (0U)
+                ,   sleeping    (0U)
+                ,   stopping    (false)
+            {
+                workers.reserve (worker_count);
+                for (auto iter = 0U; iter < worker_count; ++iter)
+                {
+                    workers.push_back (std::unique_ptr<worker_type> (new worker_type (this, iter)));
+                }
+
+                for (auto & worker : workers)
+                {
+                    auto w = worker.get ();
+                    worker->thread = std::thread ([this, w] () { this->work (*w); });
+                }
+            }
+
+            // Tasks still queued are executed before the workers are joined
+            CPPLINQ_METHOD ~thread_pool () CPPLINQ_NOEXCEPT
+            {
+                {
+                    std::unique_lock<std::mutex> lock (mutex);
+                    stopping = true;
+                }
+
+                wakeup.notify_all ();
+
+                for (auto & worker : workers)
+                {
+                    worker->thread.join ();
+                }
+            }
+
+            CPPLINQ_INLINEMETHOD size_type concurrency () const CPPLINQ_NOEXCEPT
+            {
+                return workers.size () + 1U;
+            }
+
+            // Tasks submitted by a worker go to the worker's own deque, other
+            // tasks are injected through a shared queue. Tasks must not throw.
+            CPPLINQ_METHOD void submit (task_type task)
+            {
+                if (workers.empty ())
+                {
+                    task ();
+                    return;
+                }
+
+                std::unique_ptr<task_type> owner (new task_type (std::move (task)));
+
+                auto current = current_worker ();
+                if (current && current->pool == this)
+                {
+                    current->tasks.push (owner.get ());
+                    owner.release ();
+                }
+                else
+                {
+                    std::unique_lock<std::mutex> lock (mutex);
+                    injected.push_back (owner.get ());
+                    owner.release ();
+                }
+
+                queued.fetch_add (1U);
+
+                if (sleeping.load () > 0U)
+                {
+                    std::unique_lock<std::mutex> lock (mutex);
+                    wakeup.notify_one ();
+                }
+            }
+
+        private:
+            CPPLINQ_INLINEMETHOD thread_pool (thread_pool const &);
+            CPPLINQ_INLINEMETHOD thread_pool & operator= (thread_pool const &);
+
+            struct worker_type
+            {
+                this_type *             pool    ;
+                size_type               index   ;
+                std::uint_fast32_t      seed    ;
+                work_stealing_deque     tasks   ;
+                std::thread             thread  ;
+
+                CPPLINQ_INLINEMETHOD worker_type (this_type * pool, size_type index)
+                    :   pool    (pool)
+                    ,   index   (index)
+                    ,   seed    (static_cast<std::uint_fast32_t> (index) * 2654435761U + 1U)
+                {
+                }
+            };
+
+            static CPPLINQ_INLINEMETHOD worker_type * & current_worker () CPPLINQ_NOEXCEPT
+            {
+                static CPPLINQ_THREAD_LOCAL worker_type * current = nullptr;
+                return current;
+            }
+
+            CPPLINQ_METHOD task_type * find_task (worker_type & worker)
+            {
+                if (auto task = worker.tasks.pop ())
+                {
+                    return task;
+                }
+
+                {
+                    std::unique_lock<std::mutex> lock (mutex);
+                    if (!injected.empty ())
+                    {
+                        auto task = injected.front ();
+                        injected.pop_front ();
+                        return task;
+                    }
+                }
+
+                // Start stealing from a random victim so that idle workers
+                // don't all contend for the top of the same deque
+                auto count  = workers.size ();
+                worker.seed ^= worker.seed << 13;
+                worker.seed ^= worker.seed >> 17;
+                worker.seed ^= worker.seed << 5;
+                auto start  = static_cast<size_type> (worker.seed) % count;
+
+                for (auto iter = 0U; iter < count; ++iter)
+                {
+                    auto & victim = *workers[(start + iter) % count];
+                    if (&victim == &worker)
+                    {
+                        continue;
+                    }
+
+                    if (auto task = victim.tasks.steal ())
+                    {
+                        return task;
+                    }
+                }
+
+                return nullptr;
+            }
+
+            CPPLINQ_METHOD void work (worker_type & worker)
+            {
+                current_worker () = &worker;
+
+                for (;;)
+                {
+                    if (auto task = find_task (worker))
+                    {
+                        queued.fetch_sub (1U);
+                        std::unique_ptr<task_type> owner (task);
+                        (*owner) ();
+                        continue;
+                    }
+
+                    std::unique_lock<std::mutex> lock (mutex);
+                    sleeping.fetch_add (1U);
+                    if (!stopping && queued.load () > 0U)
+                    {
+                        // The queued tasks are claimed by workers that have yet
+                        // to count them or a steal lost a race, either way
+                        // the worker waits a moment instead of spinning
+                        wakeup.wait_for (lock, std::chrono::microseconds (50));
+                    }
+                    while (!stopping && queued.load () == 0U)
+                    {
+                        wakeup.wait (lock);
+                    }
+                    sleeping.fetch_sub (1U);
+
+                    if (stopping && queued.load () == 0U)
+                    {
+                        return;
+                    }
+                }
+            }
+
+            std::vector<std::unique_ptr<worker_type>>   workers     ;
+            std::mutex                                  mutex       ;
+            std::condition_variable                     wakeup      ;
+            std::deque<task_type *>                     injected    ;
+            std::atomic<size_type>                      queued      ;   // Tasks submitted but not yet picked up
+            std::atomic<size_type>                      sleeping    ;
+            bool                                        stopping    ;
+        };
+        struct parallel_for_state
+        {
+            typedef                 std::function<void (size_type)> body_type   ;
+
+            size_type                   count   ;
+            body_type                   body    ;
+            std::atomic<size_type>      upcoming;
+            std::atomic<size_type>      pending ;
+            std::mutex                  mutex   ;
+            std::condition_variable     done    ;
+            std::exception_ptr          error   ;
+
+            CPPLINQ_INLINEMETHOD parallel_for_state (size_type count, body_type body)
+                :   count   (count)
+                ,   body    (std::move (body))
+                ,   upcoming(0U)
+                ,   pending (count)
+            {
+            }
+
+            // Claims chunk indices until there are none left. Tasks that start
+            // after all chunks are claimed exit immediately which is why the
+            // state is shared with the tasks.
+            CPPLINQ_METHOD void run () CPPLINQ_NOEXCEPT
+            {
+                for (;;)
+                {
+                    auto index = upcoming.fetch_add (1U);
+                    if (index >= count)
+                    {
+                        return;
+                    }
+
+                    try
+                    {
+                        body (index);
+                    }
+                    catch (...)
+                    {
+                        std::unique_lock<std::mutex> lock (mutex);
+                        if (!error)
+                        {
+                            error = std::current_exception ();
+                        }
+                    }
+
+                    if (pending.fetch_sub (1U) == 1U)
+                    {
+                        std::unique_lock<std::mutex> lock (mutex);
+                        done.notify_all ();
+                    }
+                }
+            }
+
+            CPPLINQ_METHOD void wait ()
+            {
+                {
+                    std::unique_lock<std::mutex> lock (mutex);
+                    while (pending.load () != 0U)
+                    {
+                        done.wait (lock);
+                    }
+                }
+
+                if (error)
+                {
+                    std::rethrow_exception (error);
+                }
+            }
+        };
+
+        CPPLINQ_INLINEMETHOD size_type default_worker_count ()
+        {
+#ifdef CPPLINQ_WORKER_COUNT
+            return CPPLINQ_WORKER_COUNT;
+#else
+            return std::max (std::thread::hardware_concurrency (), 1U) - 1U;
+#endif
+        }
+
+        CPPLINQ_INLINEMETHOD thread_pool & default_thread_pool ()
+        {
+            static thread_pool pool (default_worker_count ());
+            return pool;
+        }
+
+        CPPLINQ_INLINEMETHOD void parallel_for (
+                executor_ref                    executor
+            ,   size_type                       count
+            ,   std::function<void (size_type)> body
+            )
+        {
+            if (count == 0U)
+            {
+                return;
+            }
+
+            auto state      = std::make_shared<parallel_for_state> (count, std::move (body));
+            auto helpers    = std::min (executor.concurrency (), count) - 1U;
+
+            for (auto iter = 0U; iter < helpers; ++iter)
+            {
+                executor.submit ([state] () { state->run (); });
+            }
+
+            state->run ();
+            state->wait ();
+        }
+#else
+        struct thread_pool
+        {
+            typedef                 thread_pool                 this_type   ;
+            typedef                 std::function<void ()>      task_type   ;
+
+            CPPLINQ_INLINEMETHOD explicit thread_pool (size_type = 0U) CPPLINQ_NOEXCEPT
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD size_type concurrency () const CPPLINQ_NOEXCEPT
+            {
+                return 1U;
+            }
+
+            CPPLINQ_INLINEMETHOD void submit (task_type task)
+            {
+                task ();
+            }
+        };
+
+        CPPLINQ_INLINEMETHOD thread_pool & default_thread_pool ()
+        {
+            static thread_pool pool;
+            return pool;
+        }
+
+        // Without threads chunks are evaluated in order on the calling thread
+        CPPLINQ_INLINEMETHOD void parallel_for (
+                executor_ref                    executor
+            ,   size_type                       count
+            ,   std::function<void (size_type)> body
+            )
+        {
+            for (auto index = 0U; index < count; ++index)
+            {
+                body (index);
+            }
+        }
+#endif
+
+        // -------------------------------------------------------------------------
+
+        struct partition_options
+        {
+            executor_ref            executor    ;
+            size_type               chunk_count ;   // 0 lets the executor decide
+        };
+
+        CPPLINQ_INLINEMETHOD size_type chunk_offset (size_type size, size_type index, size_type count) CPPLINQ_NOEXCEPT
+        {
+            return (size / count) * index + std::min (index, size % count);
+        }
+
+        // -------------------------------------------------------------------------
+        // partition_source_traits<TRange> describes the ranges parallel may follow
+        // partition_traits<TRange> describes ranges that can be evaluated in chunks
+        //      enum { is_partitionable = 0|1 };
+        //      typedef                 ...         chunk_type      ;
+        //      static partition_options    options_of  (TRange const &)
+        //      static size_type            size_of     (TRange const &)
+        //      static chunk_type           chunk       (TRange const &, size_type index, size_type count)
+        // -------------------------------------------------------------------------
+
+        template<typename TRange>
+        struct partition_source_traits
+        {
+            typedef                 TRange                              chunk_type      ;
+            enum
+            {
+                is_partitionable = 0    ,
+            };
+        };
+
+        template<typename TValueIterator>
+        struct partition_source_traits<from_range<TValueIterator>>
+        {
+            typedef                 from_range<TValueIterator>          range_type      ;
+            typedef                 range_type                          chunk_type      ;
+            typedef        typename std::iterator_traits<TValueIterator>::iterator_category
+                                                                        iterator_category;
+            typedef        typename std::iterator_traits<TValueIterator>::difference_type
+                                                                        difference_type ;
+            enum
+            {
+                is_partitionable = std::is_convertible<iterator_category, std::random_access_iterator_tag>::value ,
+            };
+
+            static CPPLINQ_INLINEMETHOD size_type size_of (range_type const & range)
+            {
+                return static_cast<size_type> (std::distance (range.upcoming, range.end));
+            }
+
+            static CPPLINQ_INLINEMETHOD chunk_type chunk (range_type const & range, size_type index, size_type count)
+            {
+                auto size = size_of (range);
+                return chunk_type (
+                        range.upcoming + static_cast<difference_type> (chunk_offset (size, index     , count))
+                    ,   range.upcoming + static_cast<difference_type> (chunk_offset (size, index + 1U, count))
+                    );
+            }
+        };
+
+        template<>
+        struct partition_source_traits<int_range>
+        {
+            typedef                 int_range                           range_type      ;
+            typedef                 int_range                           chunk_type      ;
+            enum
+            {
+                is_partitionable = 1    ,
+            };
+
+            static CPPLINQ_INLINEMETHOD size_type size_of (range_type const & range)
+            {
+                return static_cast<size_type> (static_cast<long long> (range.end) - range.current);
+            }
+
+            static CPPLINQ_INLINEMETHOD chunk_type chunk (range_type const & range, size_type index, size_type count)
+            {
+                auto size   = size_of (range);
+                auto first  = static_cast<long long> (range.current) + 1;
+                return chunk_type (
+                        static_cast<int> (first + static_cast<long long> (chunk_offset (size, index     , count)))
+                    ,   static_cast<int> (first + static_cast<long long> (chunk_offset (size, index + 1U, count)))
+                    );
+            }
+        };
+
+        template<typename TRange>
+        struct partition_traits
+        {
+            typedef                 TRange                              chunk_type      ;
+            enum
+            {
+                is_partitionable = 0    ,
+            };
+        };
+
+        template<typename TRange>
+        struct is_partitionable
+            :   std::integral_constant<bool, partition_traits<TRange>::is_partitionable != 0>
+        {
+        };
+
+        // -------------------------------------------------------------------------
+
+        template<typename TRange>
+        struct parallel_range : base_range
+        {
+            typedef                 parallel_range<TRange>              this_type       ;
+            typedef                 TRange                              range_type      ;
+
+            typedef                 typename TRange::value_type         value_type      ;
+            typedef                 typename TRange::return_type        return_type     ;
+            enum
+            {
+                returns_reference   = TRange::returns_reference   ,
+                instrumented_as     = query_parallel ,
+            };
+
+            range_type              range       ;
+            partition_options       options     ;
+
+            CPPLINQ_INLINEMETHOD parallel_range (
+                    range_type          range
+                ,   partition_options   options
+                ) CPPLINQ_NOEXCEPT
+                :   range       (std::move (range))
+                ,   options     (options)
+            {
+                static_assert (
+                        partition_source_traits<TRange>::is_partitionable
+                    ,   "parallel may only follow a range over random access iterators or range"
+                    );
+            }
+
+            CPPLINQ_INLINEMETHOD parallel_range (parallel_range const & v)
+                :   range       (v.range)
+                ,   options     (v.options)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD parallel_range (parallel_range && v) CPPLINQ_NOEXCEPT
+                :   range       (std::move (v.range))
+                ,   options     (std::move (v.options))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            {
+                return range_builder.build (*this);
+            }
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                return range.front ();
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                return pull (query_parallel, range);
+            }
+        };
+
+        struct parallel_builder : base_builder
+        {
+            typedef                 parallel_builder    this_type       ;
+
+            executor_ref            executor    ;
+            size_type               chunk_count ;
+
+            CPPLINQ_INLINEMETHOD parallel_builder (executor_ref executor, size_type chunk_count) CPPLINQ_NOEXCEPT
+                :   executor    (executor)
+                ,   chunk_count (chunk_count)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD parallel_builder (parallel_builder const & v) CPPLINQ_NOEXCEPT
+                :   executor    (v.executor)
+                ,   chunk_count (v.chunk_count)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD parallel_builder (parallel_builder && v) CPPLINQ_NOEXCEPT
+                :   executor    (std::move (v.executor))
+                ,   chunk_count (std::move (v.chunk_count))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD parallel_range<TRange> build (TRange range) const
+            {
+                partition_options options = { executor, chunk_count };
+                return parallel_range<TRange> (std::move (range), options);
+            }
+        };
+
+        // -------------------------------------------------------------------------
+
+        template<typename TRange>
+        struct partition_traits<parallel_range<TRange>>
+        {
+            typedef                 parallel_range<TRange>                              range_type  ;
+            typedef                 partition_source_traits<TRange>                     source_traits;
+            typedef        typename source_traits::chunk_type                           chunk_type  ;
+            enum
+            {
+                is_partitionable = 1    ,
+            };
+
+            static CPPLINQ_INLINEMETHOD partition_options options_of (range_type const & range)
+            {
+                return range.options;
+            }
+
+            static CPPLINQ_INLINEMETHOD size_type size_of (range_type const & range)
+            {
+                return source_traits::size_of (range.range);
+            }
+
+            static CPPLINQ_INLINEMETHOD chunk_type chunk (range_type const & range, size_type index, size_type count)
+            {
+                return source_traits::chunk (range.range, index, count);
+            }
+        };
+
+        template<typename TRange, typename TPredicate>
+        struct partition_traits<where_range<TRange, TPredicate>>
+        {
+            typedef                 where_range<TRange, TPredicate>                     range_type  ;
+            typedef                 partition_traits<TRange>                            base_traits ;
+            typedef                 where_range<typename base_traits::chunk_type, TPredicate>
+                                                                                        chunk_type  ;
+            enum
+            {
+                is_partitionable = base_traits::is_partitionable    ,
+            };
+
+            static CPPLINQ_INLINEMETHOD partition_options options_of (range_type const & range)
+            {
+                return base_traits::options_of (range.range);
+            }
+
+            static CPPLINQ_INLINEMETHOD size_type size_of (range_type const & range)
+            {
+                return base_traits::size_of (range.range);
+            }
+
+            static CPPLINQ_INLINEMETHOD chunk_type chunk (range_type const & range, size_type index, size_type count)
+            {
+                return chunk_type (base_traits::chunk (range.range, index, count), range.predicate);
+            }
+        };
+
+        template<typename TRange, typename TPredicate>
+        struct partition_traits<select_range<TRange, TPredicate>>
+        {
+            typedef                 select_range<TRange, TPredicate>                    range_type  ;
+            typedef                 partition_traits<TRange>                            base_traits ;
+            typedef                 select_range<typename base_traits::chunk_type, TPredicate>
+                                                                                        chunk_type  ;
+            enum
+            {
+                is_partitionable = base_traits::is_partitionable    ,
+            };
+
+            static CPPLINQ_INLINEMETHOD partition_options options_of (range_type const & range)
+            {
+                return base_traits::options_of (range.range);
+            }
+
+            static CPPLINQ_INLINEMETHOD size_type size_of (range_type const & range)
+            {
+                return base_traits::size_of (range.range);
+            }
+
+            static CPPLINQ_INLINEMETHOD chunk_type chunk (range_type const & range, size_type index, size_type count)
+            {
+                return chunk_type (base_traits::chunk (range.range, index, count), range.predicate);
+            }
+        };
+
+        template<typename TRange>
+        struct partition_traits<ref_range<TRange>>
+        {
+            typedef                 ref_range<TRange>                                   range_type  ;
+            typedef                 partition_traits<TRange>                            base_traits ;
+            typedef                 ref_range<typename base_traits::chunk_type>         chunk_type  ;
+            enum
+            {
+                is_partitionable = base_traits::is_partitionable    ,
+            };
+
+            static CPPLINQ_INLINEMETHOD partition_options options_of (range_type const & range)
+            {
+                return base_traits::options_of (range.range);
+            }
+
+            static CPPLINQ_INLINEMETHOD size_type size_of (range_type const & range)
+            {
+                return base_traits::size_of (range.range);
+            }
+
+            static CPPLINQ_INLINEMETHOD chunk_type chunk (range_type const & range, size_type index, size_type count)
+            {
+                return chunk_type (base_traits::chunk (range.range, index, count));
+            }
+        };
+
+        // -------------------------------------------------------------------------
+
+        // Evaluates builder on every chunk of range and folds the partial results
+        // left to right, ie in the same order as a sequential evaluation
+        template<typename TRange, typename TBuilder, typename TCombiner>
+        CPPLINQ_METHOD typename get_builtup_type<TBuilder, typename partition_traits<TRange>::chunk_type>::type parallel_reduce (
+                TRange const &      range
+            ,   TBuilder const &    builder
+            ,   TCombiner const &   combiner
+            )
+        {
+            typedef                 partition_traits<TRange>                            traits      ;
+            typedef        typename get_builtup_type<TBuilder, typename traits::chunk_type>::type
+                                                                                        result_type ;
+
+            auto options    = traits::options_of (range);
+            auto size       = traits::size_of (range);
+            auto chunks     = options.chunk_count > 0U
+                ?   options.chunk_count
+                :   4U * options.executor.concurrency ()   // Oversplit to balance uneven chunks
+                ;
+            chunks          = std::min (chunks, std::max (size, size_type (1U)));
+
+            if (chunks < 2U)
+            {
+                return builder.build (traits::chunk (range, 0U, 1U));
+            }
+
+            std::vector<opt<result_type>> results (chunks);
+
+            parallel_for (
+                    options.executor
+                ,   chunks
+                ,   [&] (size_type index)
+                    {
+                        results[index] = builder.build (traits::chunk (range, index, chunks));
+                    }
+                );
+
+            auto result = std::move (results[0].get ());
+            for (auto index = 1U; index < chunks; ++index)
+            {
+                result = combiner (std::move (result), std::move (results[index].get ()));
+            }
+
+            return result;
+        }
+
+        // -------------------------------------------------------------------------
+        // sum, min and max over a contiguous from_range of int, long long, float
+        // or double fold the values directly from memory with SSE2 or AVX2,
+        // picking AVX2 at runtime when the CPU supports it and a plain loop
+        // on other platforms. Like parallel, the
+        // vectorized sum adds floating point values in a different order than
+        // a sequential loop. Define CPPLINQ_NO_SIMD to opt out.
+        // -------------------------------------------------------------------------
+
+        template<typename TValue>
+        struct is_simd_value
+            :   std::integral_constant<
+                    bool
+                ,       (std::is_integral<TValue>::value && std::is_signed<TValue>::value && (sizeof (TValue) == 4U || sizeof (TValue) == 8U))
+                    ||  std::is_same<TValue, float>::value
+                    ||  std::is_same<TValue, double>::value
+                >
+        {
+        };
+
+        enum simd_fold
+        {
+            simd_fold_sum   ,
+            simd_fold_min   ,
+            simd_fold_max   ,
+        };
+
+        template<simd_fold fold, typename TValue>
+        CPPLINQ_INLINEMETHOD TValue simd_fold_seed () CPPLINQ_NOEXCEPT
+        {
+            return fold == simd_fold_sum
+                ?   TValue ()
+                :   fold == simd_fold_min
+                ?   std::numeric_limits<TValue>::max ()
+                :   std::numeric_limits<TValue>::lowest ()
+                ;
+        }
+
+        // Matches the sequential sum, min and max builders, NaN values never
+        // replace the current min or max
+        template<simd_fold fold, typename TValue>
+        CPPLINQ_INLINEMETHOD TValue simd_fold_value (TValue current, TValue v) CPPLINQ_NOEXCEPT
+        {
+            return fold == simd_fold_sum
+                ?   current + v
+                :   fold == simd_fold_min
+                ?   (v < current ? v : current)
+                :   (current < v ? v : current)
+                ;
+        }
+
+        template<simd_fold fold, typename TValue>
+        CPPLINQ_METHOD TValue scalar_fold (TValue const * values, size_type count) CPPLINQ_NOEXCEPT
+        {
+            auto current = simd_fold_seed<fold, TValue> ();
+            for (auto index = size_type (0U); index < count; ++index)
+            {
+                current = simd_fold_value<fold> (current, values[index]);
+            }
+
+            return current;
+        }
+
+#ifdef CPPLINQ_SIMD_SSE2
+        // simd_ops describe a vector of lanes values:
+        //      typedef ... vector_type;
+        //      enum { lanes = ... };
+        //      static vector_type  load    (value_type const *)
+        //      static vector_type  splat   (value_type)
+        //      static void         store   (value_type *, vector_type)
+        //      static vector_type  add     (vector_type, vector_type)
+        //      // Returns current when v is NaN
+        //      static vector_type  min     (vector_type current, vector_type v)
+        //      static vector_type  max     (vector_type current, vector_type v)
+
+        template<typename TValue, size_type size = sizeof (TValue), bool is_integral = std::is_integral<TValue>::value>
+        struct sse2_ops
+        {
+        };
+
+        template<typename TValue>
+        struct sse2_ops<TValue, 4U, true>
+        {
+            typedef                 TValue                  value_type      ;
+            typedef                 __m128i                 vector_type     ;
+            enum
+            {
+                lanes           = 4 ,
+            };
+
+            static CPPLINQ_INLINEMETHOD vector_type load (value_type const * p)             { return _mm_loadu_si128 (reinterpret_cast<__m128i const *> (p)); }
+            static CPPLINQ_INLINEMETHOD vector_type splat (value_type v)                    { return _mm_set1_epi32 (v); }
+            static CPPLINQ_INLINEMETHOD void        store (value_type * p, vector_type v)   { _mm_storeu_si128 (reinterpret_cast<__m128i *> (p), v); }
+            static CPPLINQ_INLINEMETHOD vector_type add (vector_type l, vector_type r)      { return _mm_add_epi32 (l, r); }
+
+            static CPPLINQ_INLINEMETHOD vector_type min (vector_type current, vector_type v)
+            {
+                auto less = _mm_cmplt_epi32 (v, current);
+                return _mm_or_si128 (_mm_and_si128 (less, v), _mm_andnot_si128 (less, current));
+            }
+
+            static CPPLINQ_INLINEMETHOD vector_type max (vector_type current, vector_type v)
+            {
+                auto greater = _mm_cmpgt_epi32 (v, current);
+                return _mm_or_si128 (_mm_and_si128 (greater, v), _mm_andnot_si128 (greater, current));
+            }
+        };
+
+        template<typename TValue>
+        struct sse2_ops<TValue, 8U, true>
+        {
+            typedef                 TValue                  value_type      ;
+            typedef                 __m128i                 vector_type     ;
+            enum
+            {
+                lanes           = 2 ,
+            };
+
+            static CPPLINQ_INLINEMETHOD vector_type load (value_type const * p)             { return _mm_loadu_si128 (reinterpret_cast<__m128i const *> (p)); }
+            static CPPLINQ_INLINEMETHOD vector_type splat (value_type v)                    { return _mm_set1_epi64x (v); }
+            static CPPLINQ_INLINEMETHOD void        store (value_type * p, vector_type v)   { _mm_storeu_si128 (reinterpret_cast<__m128i *> (p), v); }
+            static CPPLINQ_INLINEMETHOD vector_type add (vector_type l, vector_type r)      { return _mm_add_epi64 (l, r); }
+
+            // SSE2 has no 64-bit compares
+            template<simd_fold fold>
+            static CPPLINQ_INLINEMETHOD vector_type fold_lanes (vector_type current, vector_type v)
+            {
+                value_type c[2];
+                value_type w[2];
+                store (c, current);
+                store (w, v);
+                return _mm_set_epi64x (simd_fold_value<fold> (c[1], w[1]), simd_fold_value<fold> (c[0], w[0]));
+            }
+
+            static CPPLINQ_INLINEMETHOD vector_type min (vector_type current, vector_type v) { return fold_lanes<simd_fold_min> (current, v); }
+            static CPPLINQ_INLINEMETHOD vector_type max (vector_type current, vector_type v) { return fold_lanes<simd_fold_max> (current, v); }
+        };
+
+        template<>
+        struct sse2_ops<float, 4U, false>
+        {
+            typedef                 float                   value_type      ;
+            typedef                 __m128                  vector_type     ;
+            enum
+            {
+                lanes           = 4 ,
+            };
+
+            static CPPLINQ_INLINEMETHOD vector_type load (value_type const * p)                 { return _mm_loadu_ps (p); }
+            static CPPLINQ_INLINEMETHOD vector_type splat (value_type v)                        { return _mm_set1_ps (v); }
+            static CPPLINQ_INLINEMETHOD void        store (value_type * p, vector_type v)       { _mm_storeu_ps (p, v); }
+            static CPPLINQ_INLINEMETHOD vector_type add (vector_type l, vector_type r)          { return _mm_add_ps (l, r); }
+            static CPPLINQ_INLINEMETHOD vector_type min (vector_type current, vector_type v)    { return _mm_min_ps (v, current); }
+            static CPPLINQ_INLINEMETHOD vector_type max (vector_type current, vector_type v)    { return _mm_max_ps (v, current); }
+        };
+
+        template<>
+        struct sse2_ops<double, 8U, false>
+        {
+            typedef                 double                  value_type      ;
+            typedef                 __m128d                 vector_type     ;
+            enum
+            {
+                lanes           = 2 ,
+            };
+
+            static CPPLINQ_INLINEMETHOD vector_type load (value_type const * p)                 { return _mm_loadu_pd (p); }
+            static CPPLINQ_INLINEMETHOD vector_type splat (value_type v)                        { return _mm_set1_pd (v); }
+            static CPPLINQ_INLINEMETHOD void        store (value_type * p, vector_type v)       { _mm_storeu_pd (p, v); }
+            static CPPLINQ_INLINEMETHOD vector_type add (vector_type l, vector_type r)          { return _mm_add_pd (l, r); }
+            static CPPLINQ_INLINEMETHOD vector_type min (vector_type current, vector_type v)    { return _mm_min_pd (v, current); }
+            static CPPLINQ_INLINEMETHOD vector_type max (vector_type current, vector_type v)    { return _mm_max_pd (v, current); }
+        };
+
+        template<simd_fold fold, typename TOps>
+        CPPLINQ_INLINEMETHOD typename TOps::vector_type sse2_fold_vector (typename TOps::vector_type current, typename TOps::vector_type v)
+        {
+            return fold == simd_fold_sum
+                ?   TOps::add (current, v)
+                :   fold == simd_fold_min
+                ?   TOps::min (current, v)
+                :   TOps::max (current, v)
+                ;
+        }
+
+        // Two accumulators hide the latency of the vector additions
+        template<simd_fold fold, typename TOps>
+        CPPLINQ_METHOD typename TOps::value_type sse2_fold (typename TOps::value_type const * values, size_type count)
+        {
+            typedef        typename TOps::value_type    value_type  ;
+            size_type const         lanes           = TOps::lanes   ;
+
+            auto seed   = TOps::splat (simd_fold_seed<fold, value_type> ());
+            auto first  = seed;
+            auto second = seed;
+
+            auto index = size_type (0U);
+            for (; index + 2U * lanes <= count; index += 2U * lanes)
+            {
+                first   = sse2_fold_vector<fold, TOps> (first , TOps::load (values + index));
+                second  = sse2_fold_vector<fold, TOps> (second, TOps::load (values + index + lanes));
+            }
+
+            value_type partial[2U * lanes];
+            TOps::store (partial        , first );
+            TOps::store (partial + lanes, second);
+
+            auto current = scalar_fold<fold> (partial, 2U * lanes);
+            for (; index < count; ++index)
+            {
+                current = simd_fold_value<fold> (current, values[index]);
+            }
+
+            return current;
+        }
+#endif
+
+#ifdef CPPLINQ_SIMD_AVX2
+        CPPLINQ_INLINEMETHOD bool detect_avx2 ()
+        {
+#   ifdef _MSC_VER
+            int info[4];
+            __cpuid (info, 1);
+            auto osxsave    = (info[2] & (1 << 27)) != 0;
+            auto avx        = (info[2] & (1 << 28)) != 0;
+            if (!osxsave || !avx || (_xgetbv (0) & 6U) != 6U)
+            {
+                return false;
+            }
+
+            __cpuidex (info, 7, 0);
+            return (info[1] & (1 << 5)) != 0;
+#   else
+            return __builtin_cpu_supports ("avx2") != 0;
+#   endif
+        }
+
+        CPPLINQ_INLINEMETHOD bool has_avx2 ()
+        {
+            static bool const avx2 = detect_avx2 ();
+            return avx2;
+        }
+
+        template<typename TValue, size_type size = sizeof (TValue), bool is_integral = std::is_integral<TValue>::value>
+        struct avx2_ops
+        {
+        };
+
+        template<typename TValue>
+        struct avx2_ops<TValue, 4U, true>
+        {
+            typedef                 TValue                  value_type      ;
+            typedef                 __m256i                 vector_type     ;
+            enum
+            {
+                lanes           = 8 ,
+            };
+
+            static CPPLINQ_TARGET_AVX2 CPPLINQ_INLINEMETHOD vector_type load (value_type const * p)             { return _mm256_loadu_si256 (reinterpret_cast<__m256i const *> (p)); }
+            static CPPLINQ_TARGET_AVX2 CPPLINQ_INLINEMETHOD vector_type splat (value_type v)                    { return _mm256_set1_epi32 (v); }
+            static CPPLINQ_TARGET_AVX2 CPPLINQ_INLINEMETHOD void        store (value_type * p, vector_type v)   { _mm256_storeu_si256 (reinterpret_cast<__m256i *> (p), v); }
+            static CPPLINQ_TARGET_AVX2 CPPLINQ_INLINEMETHOD vector_type add (vector_type l, vector_type r)      { return _mm256_add_epi32 (l, r); }
+            static CPPLINQ_TARGET_AVX2 CPPLINQ_INLINEMETHOD vector_type min (vector_type c, vector_type v)      { return _mm256_min_epi32 (c, v); }
+            static CPPLINQ_TARGET_AVX2 CPPLINQ_INLINEMETHOD vector_type max (vector_type c, vector_type v)      { return _mm256_max_epi32 (c, v); }
+        };
+
+        template<typename TValue>
+        struct avx2_ops<TValue, 8U, true>
+        {
+            typedef                 TValue                  value_type      ;
+            typedef                 __m256i                 vector_type     ;
+            enum
+            {
+                lanes           = 4 ,
+            };
+
+            static CPPLINQ_TARGET_AVX2 CPPLINQ_INLINEMETHOD vector_type load (value_type const * p)             { return _mm256_loadu_si256 (reinterpret_cast<__m256i const *> (p)); }
+            static CPPLINQ_TARGET_AVX2 CPPLINQ_INLINEMETHOD vector_type splat (value_type v)                    { return _mm256_set1_epi64x (v); }
+            static CPPLINQ_TARGET_AVX2 CPPLINQ_INLINEMETHOD void        store (value_type * p, vector_type v)   { _mm256_storeu_si256 (reinterpret_cast<__m256i *> (p), v); }
+            static CPPLINQ_TARGET_AVX2 CPPLINQ_INLINEMETHOD vector_type add (vector_type l, vector_type r)      { return _mm256_add_epi64 (l, r); }
+            static CPPLINQ_TARGET_AVX2 CPPLINQ_INLINEMETHOD vector_type min (vector_type c, vector_type v)      { return _mm256_blendv_epi8 (c, v, _mm256_cmpgt_epi64 (c, v)); }
+            static CPPLINQ_TARGET_AVX2 CPPLINQ_INLINEMETHOD vector_type max (vector_type c, vector_type v)      { return _mm256_blendv_epi8 (c, v, _mm256_cmpgt_epi64 (v, c)); }
+        };
+
+        template<>
+        struct avx2_ops<float, 4U, false>
+        {
+            typedef                 float                   value_type      ;
+            typedef                 __m256                  vector_type     ;
+            enum
+            {
+                lanes           = 8 ,
+            };
+
+            static CPPLINQ_TARGET_AVX2 CPPLINQ_INLINEMETHOD vector_type load (value_type const * p)             { return _mm256_loadu_ps (p); }
+            static CPPLINQ_TARGET_AVX2 CPPLINQ_INLINEMETHOD vector_type splat (value_type v)                    { return _mm256_set1_ps (v); }
+            static CPPLINQ_TARGET_AVX2 CPPLINQ_INLINEMETHOD void        store (value_type * p, vector_type v)   { _mm256_storeu_ps (p, v); }
+            static CPPLINQ_TARGET_AVX2 CPPLINQ_INLINEMETHOD vector_type add (vector_type l, vector_type r)      { return _mm256_add_ps (l, r); }
+            static CPPLINQ_TARGET_AVX2 CPPLINQ_INLINEMETHOD vector_type min (vector_type c, vector_type v)      { return _mm256_min_ps (v, c); }
+            static CPPLINQ_TARGET_AVX2 CPPLINQ_INLINEMETHOD vector_type max (vector_type c, vector_type v)      { return _mm256_max_ps (v, c); }
+        };
+
+        template<>
+        struct avx2_ops<double, 8U, false>
+        {
+            typedef                 double                  value_type      ;
+            typedef                 __m256d                 vector_type     ;
+            enum
+            {
+                lanes           = 4 ,
+            };
+
+            static CPPLINQ_TARGET_AVX2 CPPLINQ_INLINEMETHOD vector_type load (value_type const * p)             { return _mm256_loadu_pd (p); }
+            static CPPLINQ_TARGET_AVX2 CPPLINQ_INLINEMETHOD vector_type splat (value_type v)                    { return _mm256_set1_pd (v); }
+            static CPPLINQ_TARGET_AVX2 CPPLINQ_INLINEMETHOD void        store (value_type * p, vector_type v)   { _mm256_storeu_pd (p, v); }
+            static CPPLINQ_TARGET_AVX2 CPPLINQ_INLINEMETHOD vector_type add (vector_type l, vector_type r)      { return _mm256_add_pd (l, r); }
+            static CPPLINQ_TARGET_AVX2 CPPLINQ_INLINEMETHOD vector_type min (vector_type c, vector_type v)      { return _mm256_min_pd (v, c); }
+            static CPPLINQ_TARGET_AVX2 CPPLINQ_INLINEMETHOD vector_type max (vector_type c, vector_type v)      { return _mm256_max_pd (v, c); }
+        };
+
+        template<simd_fold fold, typename TOps>
+        CPPLINQ_TARGET_AVX2 CPPLINQ_INLINEMETHOD typename TOps::vector_type avx2_fold_vector (typename TOps::vector_type current, typename TOps::vector_type v)
+        {
+            return fold == simd_fold_sum
+                ?   TOps::add (current, v)
+                :   fold == simd_fold_min
+                ?   TOps::min (current, v)
+                :   TOps::max (current, v)
+                ;
+        }
+
+        template<simd_fold fold, typename TOps>
+        CPPLINQ_TARGET_AVX2 CPPLINQ_METHOD typename TOps::value_type avx2_fold (typename TOps::value_type const * values, size_type count)
+        {
+            typedef        typename TOps::value_type    value_type  ;
+            size_type const         lanes           = TOps::lanes   ;
+
+            auto seed   = TOps::splat (simd_fold_seed<fold, value_type> ());
+            auto first  = seed;
+            auto second = seed;
+
+            auto index = size_type (0U);
+            for (; index + 2U * lanes <= count; index += 2U * lanes)
+            {
+                first   = avx2_fold_vector<fold, TOps> (first , TOps::load (values + index));
+                second  = avx2_fold_vector<fold, TOps> (second, TOps::load (values + index + lanes));
+            }
+
+            value_type partial[2U * lanes];
+            TOps::store (partial        , first );
+            TOps::store (partial + lanes, second);
+
+            auto current = scalar_fold<fold> (partial, 2U * lanes);
+            for (; index < count; ++index)
+            {
+                current = simd_fold_value<fold> (current, values[index]);
+            }
+
+            return current;
+        }
+#endif
+
+        template<simd_fold fold, typename TValue>
+        CPPLINQ_METHOD TValue vectorized_fold (TValue const * values, size_type count)
+        {
+#ifdef CPPLINQ_SIMD_AVX2
+            if (has_avx2 ())
+            {
+                return avx2_fold<fold, avx2_ops<TValue>> (values, count);
+            }
+#endif
+#ifdef CPPLINQ_SIMD_SSE2
+            return sse2_fold<fold, sse2_ops<TValue>> (values, count);
+#else
+            return scalar_fold<fold> (values, count);
+#endif
+        }
+
+        template<typename TRange, typename TEnable = void>
+        struct is_vectorizable : std::false_type
+        {
+        };
+
+#ifndef CPPLINQ_NO_SIMD
+        template<typename TRange>
+        struct is_vectorizable<TRange, typename std::enable_if<contiguous_range_traits<TRange>::is_contiguous != 0>::type>
+            :   is_simd_value<typename TRange::value_type>
+        {
+        };
+#endif
+
+        // -------------------------------------------------------------------------
+
+        namespace experimental
+        {
+            // -------------------------------------------------------------------------
+
+            // TODO: Verify that container range aggregator has the right semantics
+
+            template<typename TRange>
+            struct container_iterator
+            {
+                typedef                 std::forward_iterator_tag   iterator_category   ;
+                typedef     typename    TRange::value_type          value_type          ;
+                typedef     typename    TRange::return_type         return_type         ;
+                enum
+                {
+                    returns_reference   = TRange::returns_reference   ,
+                };
+
+                typedef                 std::ptrdiff_t              difference_type     ;
+                typedef                 value_type*                 pointer             ;
+                typedef                 value_type&                 reference           ;
+
+                typedef                 container_iterator<TRange>  this_type   ;
+                typedef                 TRange                      range_type  ;
+
+                bool                    has_value                               ;
+                opt<range_type>         range                                   ;
+
+                CPPLINQ_INLINEMETHOD container_iterator ()   CPPLINQ_NOEXCEPT
+                    :   has_value   (false)
+                {
+                }
+
+                CPPLINQ_INLINEMETHOD container_iterator (range_type r)   CPPLINQ_NOEXCEPT
+                    :   range      (std::move (r))
+                {
+                    has_value = range && range->next ();
+                }
+
+                CPPLINQ_INLINEMETHOD container_iterator (container_iterator const & v) CPPLINQ_NOEXCEPT
+                    :   has_value   (v.has_value)
+                    ,   range       (v.range)
+                {
+                }
+
+                CPPLINQ_INLINEMETHOD container_iterator (container_iterator && v) CPPLINQ_NOEXCEPT
+                    :   has_value   (std::move (v.has_value))
+                    ,   range       (std::move (v.range))
+                {
+                }
+
+                CPPLINQ_INLINEMETHOD return_type        operator* () const
+                {
+                    CPPLINQ_ASSERT (has_value);
+                    CPPLINQ_ASSERT (range);
+                    return range->front ();
+                }
+
+                CPPLINQ_INLINEMETHOD value_type const * operator-> () const
+                {
+                    static_assert (
+                            returns_reference
+                        ,   "operator-> requires a range that returns a reference, typically select causes ranges to return values not references"
+                        );
+                    return &range->front ();
+                }
+
+                CPPLINQ_INLINEMETHOD this_type & operator++()
+                {
+                    if (has_value && range)
+                    {
+                        has_value = range->next ();
+                    }
+
+                    return *this;
+                }
+
+                CPPLINQ_INLINEMETHOD bool operator== (this_type const & v) const CPPLINQ_NOEXCEPT
+                {
+                    if (!has_value && !v.has_value)
+                    {
+                        return true;
+                    }
+                    else if (has_value && has_value && range.get_ptr () == v.range.get_ptr ())
+                    {
+                        return true;
+                    }
+                    else
+                    {
+                        return false;
+                    }
+                }
+
+                CPPLINQ_INLINEMETHOD bool operator!= (this_type const & v) const CPPLINQ_NOEXCEPT
+                {
+                    return !(*this == v);
+                }
+            };
+
+            template<typename TRange>
+            struct container
+            {
+                typedef                 container<TRange>   this_type                   ;
+                typedef                 TRange              range_type                  ;
+                typedef                 typename TRange::value_type     value_type      ;
+                typedef                 typename TRange::return_type    return_type     ;
+                enum
+                {
+                    returns_reference   = TRange::returns_reference   ,
+                };
+
+                range_type              range   ;
+
+                CPPLINQ_INLINEMETHOD explicit container (TRange range)
+                    :   range (std::move (range))
+                {
+                }
+
+                CPPLINQ_INLINEMETHOD container (container const & v) CPPLINQ_NOEXCEPT
+                    :   range       (v.range)
+                {
+                }
+
+                CPPLINQ_INLINEMETHOD container (container && v) CPPLINQ_NOEXCEPT
+                    :   range       (std::move (v.range))
+                {
+                }
+
+                CPPLINQ_INLINEMETHOD container_iterator<TRange>  begin () CPPLINQ_NOEXCEPT
+                {
+                    return container_iterator<TRange>(range);
+                }
+
+                CPPLINQ_INLINEMETHOD container_iterator<TRange>  end () CPPLINQ_NOEXCEPT
+                {
+                    return container_iterator<TRange>();
+                }
+
+            };
+
+            struct container_builder : base_builder
+            {
+                typedef                 container_builder       this_type       ;
+
+                CPPLINQ_INLINEMETHOD container_builder () CPPLINQ_NOEXCEPT
+                {
+                }
+
+                CPPLINQ_INLINEMETHOD container_builder (container_builder const & v) CPPLINQ_NOEXCEPT
+                {
+                }
+
+                CPPLINQ_INLINEMETHOD container_builder (container_builder && v) CPPLINQ_NOEXCEPT
+                {
+                }
+
+                template<typename TRange>
+                CPPLINQ_METHOD container<TRange> build (TRange range) const
+                {
+                    return container<TRange> (std::move (range));
+                }
+
+            };
+        }
+
+        // -------------------------------------------------------------------------
+
+        template<typename TAllocator = std::allocator<void>>
+        struct to_vector_builder : base_builder
+        {
+            typedef                 to_vector_builder<TAllocator>   this_type       ;
+
+            size_type               capacity    ;
+            TAllocator              allocator   ;
+
+            CPPLINQ_INLINEMETHOD explicit to_vector_builder (size_type capacity = 16U, TAllocator allocator = TAllocator ()) CPPLINQ_NOEXCEPT
+                :   capacity    (capacity)
+                ,   allocator   (std::move (allocator))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD to_vector_builder (to_vector_builder const & v) CPPLINQ_NOEXCEPT
+                :   capacity    (v.capacity)
+                ,   allocator   (v.allocator)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD to_vector_builder (to_vector_builder && v) CPPLINQ_NOEXCEPT
+                :   capacity    (std::move (v.capacity))
+                ,   allocator   (std::move (v.allocator))
+            {
+            }
+
+            template<typename TRange>
+            struct result
+            {
+                typedef std::vector<
+                        typename TRange::value_type
+                    ,   typename rebind_allocator<TAllocator, typename TRange::value_type>::type
+                    >   type;
+            };
+
+            template<typename TRange>
+            CPPLINQ_METHOD typename result<TRange>::type build (TRange range) const
+            {
+                typedef typename result<TRange>::type result_type;
+
+                instrument_scope scope (query_to_vector);
+
+                result_type result ((typename result_type::allocator_type (allocator)));
+                reserve_for_hint (result, get_size_hint (range), capacity);
+
+                append (result, range, is_batched<TRange> ());
+
+                return result;
+            }
+
+            template<typename TValues, typename TRange>
+            static CPPLINQ_METHOD void append (TValues & result, TRange & range, std::false_type)
             {
+                while (pull (query_to_vector, range))
+                {
+                    result.push_back (store_front (query_to_vector, range));
+                }
             }
 
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD take_while_range<TRange, TPredicate> build (TRange range) const
+            template<typename TValues, typename TRange>
+            static CPPLINQ_METHOD void append (TValues & result, TRange & range, std::true_type)
             {
-                return take_while_range<TRange, TPredicate>(std::move (range), predicate);
+                for_each_batch (
+                        query_to_vector
+                    ,   range
+                    ,   [&result] (typename TValues::value_type const * values, size_type count)
+                        {
+                            count_store<typename TValues::value_type const &> (query_to_vector, count);
+                            result.insert (result.end (), values, values + count);
+                        }
+                    );
             }
 
         };
 
-        // -------------------------------------------------------------------------
-
-        template<typename TRange>
-        struct skip_range : base_range
+        template<typename TAllocator = std::allocator<void>>
+        struct to_list_builder : base_builder
         {
-            typedef                 skip_range<TRange>              this_type       ;
-            typedef                 TRange                          range_type      ;
-
-            typedef                 typename TRange::value_type     value_type      ;
-            typedef                 typename TRange::return_type    return_type     ;
-            enum
-            {
-                returns_reference   = TRange::returns_reference   ,
-            };
+            typedef                 to_list_builder<TAllocator>     this_type       ;
 
-            range_type              range       ;
-            size_type               count       ;
-            size_type               current     ;
+            TAllocator              allocator   ;
 
-            CPPLINQ_INLINEMETHOD skip_range (
-                    range_type      range
-                ,   size_type       count
-                ) CPPLINQ_NOEXCEPT
-                :   range       (std::move (range))
-                ,   count       (std::move (count))
-                ,   current     (0)
+            CPPLINQ_INLINEMETHOD explicit to_list_builder (TAllocator allocator = TAllocator ()) CPPLINQ_NOEXCEPT
+                :   allocator   (std::move (allocator))
             {
             }
 
-            CPPLINQ_INLINEMETHOD skip_range (skip_range const & v)
-                :   range       (v.range)
-                ,   count       (v.count)
-                ,   current     (v.current)
+            CPPLINQ_INLINEMETHOD to_list_builder (to_list_builder const & v) CPPLINQ_NOEXCEPT
+                :   allocator   (v.allocator)
             {
             }
 
-            CPPLINQ_INLINEMETHOD skip_range (skip_range && v) CPPLINQ_NOEXCEPT
-                :   range       (std::move (v.range))
-                ,   count       (std::move (v.count))
-                ,   current     (std::move (v.current))
+            CPPLINQ_INLINEMETHOD to_list_builder (to_list_builder && v) CPPLINQ_NOEXCEPT
+                :   allocator   (std::move (v.allocator))
             {
             }
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            template<typename TRange>
+            struct result
             {
-                return range_builder.build (*this);
-            }
+                typedef std::list<
+                        typename TRange::value_type
+                    ,   typename rebind_allocator<TAllocator, typename TRange::value_type>::type
+                    >   type;
+            };
 
-            CPPLINQ_INLINEMETHOD return_type front () const
+            template<typename TRange>
+            CPPLINQ_METHOD typename result<TRange>::type build (TRange range) const
             {
-                return range.front ();
+                typedef typename result<TRange>::type result_type;
+
+                instrument_scope scope (query_to_list);
+
+                result_type result ((typename result_type::allocator_type (allocator)));
+
+                while (pull (query_to_list, range))
+                {
+                    result.push_back (store_front (query_to_list, range));
+                }
+
+                return result;
             }
 
-            CPPLINQ_INLINEMETHOD bool next ()
+        };
+
+        // -------------------------------------------------------------------------
+
+        // The value stored in a map is moved out of the range when the range
+        // returns by value and the value selector is the identity
+        template<typename TValueSelector, typename TValue>
+        CPPLINQ_INLINEMETHOD auto select_map_value (
+                TValueSelector const &  value_selector
+            ,   TValue &                value
+            ,   std::false_type
+            )
+            -> decltype (value_selector (value))
+        {
+            return value_selector (value);
+        }
+
+        template<typename TValue>
+        CPPLINQ_INLINEMETHOD TValue && select_map_value (
+                identity_selector const &
+            ,   TValue &                value
+            ,   std::true_type
+            ) CPPLINQ_NOEXCEPT
+        {
+            return std::move (value);
+        }
+
+        template<typename TIterator, typename TValue>
+        CPPLINQ_INLINEMETHOD void insert_duplicate_value (
+                TIterator               found
+            ,   TValue &&               value
+            ,   duplicate_key_policy    policy
+            )
+        {
+            switch (policy)
             {
-                if (current == invalid_size)
+            case first_value_wins:
+                break;
+            case last_value_wins:
+                found->second = std::forward<TValue> (value);
+                break;
+            case throw_on_duplicate_key:
+            default:
+                throw duplicate_key_exception ();
+            }
+        }
+
+        // A map target describes the container a to_map_builder fills
+        //      template<typename TKey, typename TValue> struct rebind
+        //      {
+        //          buffer_type     the container values are inserted into
+        //          result_type     the container returned by the builder
+        //          reserve         prepares the buffer for an exact size hint
+        //          insert          inserts a key/value pair honoring the policy
+        //          finish          turns the buffer into the result
+        //      };
+        //      template<typename TKey, typename TValue>
+        //      typename rebind<TKey, TValue>::buffer_type make_buffer () const
+
+        template<typename TAllocator = std::allocator<void>>
+        struct ordered_map_target
+        {
+            template<typename TKey, typename TValue>
+            struct rebind
+            {
+                typedef     std::map<
+                                    TKey
+                                ,   TValue
+                                ,   std::less<TKey>
+                                ,   typename rebind_allocator<TAllocator, std::pair<TKey const, TValue>>::type
+                                >                   buffer_type ;
+                typedef     buffer_type             result_type ;
+
+                CPPLINQ_INLINEMETHOD static void reserve (buffer_type &, size_type) CPPLINQ_NOEXCEPT
                 {
-                    return false;
                 }
 
-                while (current < count && range.next ())
+                template<typename TInsertKey, typename TInsertValue>
+                CPPLINQ_INLINEMETHOD static void insert (
+                        buffer_type &           buffer
+                    ,   TInsertKey &&           key
+                    ,   TInsertValue &&         value
+                    ,   duplicate_key_policy    policy
+                    )
                 {
-                    ++current;
+                    // lower_bound doubles as insertion hint so that each key
+                    // is only searched for once
+                    auto found = buffer.lower_bound (key);
+                    if (found != buffer.end () && !(key < found->first))
+                    {
+                        insert_duplicate_value (found, std::forward<TInsertValue> (value), policy);
+                    }
+                    else
+                    {
+                        buffer.emplace_hint (found, std::forward<TInsertKey> (key), std::forward<TInsertValue> (value));
+                    }
                 }
 
-                if (current < count)
+                CPPLINQ_INLINEMETHOD static result_type finish (buffer_type && buffer, duplicate_key_policy)
                 {
-                    current = invalid_size;
-                    return false;
+                    return std::move (buffer);
                 }
+            };
+
+            TAllocator              allocator   ;
+
+            CPPLINQ_INLINEMETHOD explicit ordered_map_target (TAllocator allocator = TAllocator ()) CPPLINQ_NOEXCEPT
+                :   allocator   (std::move (allocator))
+            {
+            }
 
-                return range.next ();
+            template<typename TKey, typename TValue>
+            CPPLINQ_INLINEMETHOD typename rebind<TKey, TValue>::buffer_type make_buffer () const
+            {
+                typedef typename rebind<TKey, TValue>::buffer_type buffer_type;
+                return buffer_type (std::less<TKey> (), typename buffer_type::allocator_type (allocator));
             }
         };
 
-        struct skip_builder : base_builder
+        template<typename TAllocator = std::allocator<void>>
+        struct unordered_map_target
         {
-            typedef                 skip_builder        this_type       ;
+            template<typename TKey, typename TValue>
+            struct rebind
+            {
+                typedef     std::unordered_map<
+                                    TKey
+                                ,   TValue
+                                ,   std::hash<TKey>
+                                ,   std::equal_to<TKey>
+                                ,   typename rebind_allocator<TAllocator, std::pair<TKey const, TValue>>::type
+                                >                               buffer_type ;
+                typedef     buffer_type                         result_type ;
+
+                CPPLINQ_INLINEMETHOD static void reserve (buffer_type & buffer, size_type hint)
+                {
+                    buffer.reserve (hint);
+                }
 
-            size_type               count       ;
+                template<typename TInsertKey, typename TInsertValue>
+                CPPLINQ_INLINEMETHOD static void insert (
+                        buffer_type &           buffer
+                    ,   TInsertKey &&           key
+                    ,   TInsertValue &&         value
+                    ,   duplicate_key_policy    policy
+                    )
+                {
+                    auto found = buffer.find (key);
+                    if (found != buffer.end ())
+                    {
+                        insert_duplicate_value (found, std::forward<TInsertValue> (value), policy);
+                    }
+                    else
+                    {
+                        buffer.emplace (std::forward<TInsertKey> (key), std::forward<TInsertValue> (value));
+                    }
+                }
 
-            CPPLINQ_INLINEMETHOD explicit skip_builder (size_type count) CPPLINQ_NOEXCEPT
-                :   count (std::move (count))
-            {
-            }
+                CPPLINQ_INLINEMETHOD static result_type finish (buffer_type && buffer, duplicate_key_policy)
+                {
+                    return std::move (buffer);
+                }
+            };
 
-            CPPLINQ_INLINEMETHOD skip_builder (skip_builder const & v) CPPLINQ_NOEXCEPT
-                :   count (v.count)
-            {
-            }
+            TAllocator              allocator   ;
 
-            CPPLINQ_INLINEMETHOD skip_builder (skip_builder && v) CPPLINQ_NOEXCEPT
-                :   count (std::move (v.count))
+            CPPLINQ_INLINEMETHOD explicit unordered_map_target (TAllocator allocator = TAllocator ()) CPPLINQ_NOEXCEPT
+                :   allocator   (std::move (allocator))
             {
             }
 
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD skip_range<TRange> build (TRange range) const
+            template<typename TKey, typename TValue>
+            CPPLINQ_INLINEMETHOD typename rebind<TKey, TValue>::buffer_type make_buffer () const
             {
-                return skip_range<TRange>(std::move (range), count);
+                typedef typename rebind<TKey, TValue>::buffer_type buffer_type;
+                return buffer_type (
+                        0U
+                    ,   std::hash<TKey> ()
+                    ,   std::equal_to<TKey> ()
+                    ,   typename buffer_type::allocator_type (allocator)
+                    );
             }
-
         };
 
+        // -------------------------------------------------------------------------
+        // flat_map is a read-only map that keeps its key/value pairs sorted by
+        // key in one contiguous vector, keys are found with a binary search
         // -------------------------------------------------------------------------
 
-        template<typename TRange, typename TPredicate>
-        struct skip_while_range : base_range
+        template<typename TKey, typename TValue, typename TAllocator = std::allocator<std::pair<TKey, TValue>>>
+        struct flat_map
         {
-            typedef                 skip_while_range<TRange, TPredicate>    this_type       ;
-            typedef                 TRange                                  range_type      ;
-            typedef                 TPredicate                              predicate_type  ;
-
-            typedef                 typename TRange::value_type     value_type      ;
-            typedef                 typename TRange::return_type    return_type     ;
-            enum
-            {
-                returns_reference   = TRange::returns_reference   ,
-            };
+            typedef             TKey                                key_type        ;
+            typedef             TValue                              mapped_type     ;
+            typedef             std::pair<key_type, mapped_type>    value_type      ;
+            typedef             std::vector<
+                                        value_type
+                                    ,   typename rebind_allocator<TAllocator, value_type>::type
+                                    >                               values_type     ;
 
-            range_type              range       ;
-            predicate_type          predicate   ;
-            bool                    skipping    ;
+            typedef typename    values_type::const_iterator         const_iterator  ;
+            typedef             const_iterator                      iterator        ;
 
-            CPPLINQ_INLINEMETHOD skip_while_range (
-                    range_type      range
-                ,   predicate_type  predicate
-                ) CPPLINQ_NOEXCEPT
-                :   range       (std::move (range))
-                ,   predicate   (std::move (predicate))
-                ,   skipping    (true)
+            CPPLINQ_INLINEMETHOD flat_map () CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD skip_while_range (skip_while_range const & v)
-                :   range       (v.range)
-                ,   predicate   (v.predicate)
-                ,   skipping    (v.skipping)
+            // values must be sorted by key and the keys must be unique
+            CPPLINQ_INLINEMETHOD explicit flat_map (values_type && values) CPPLINQ_NOEXCEPT
+                :   values (std::move (values))
             {
             }
 
-            CPPLINQ_INLINEMETHOD skip_while_range (skip_while_range && v) CPPLINQ_NOEXCEPT
-                :   range       (std::move (v.range))
-                ,   predicate   (std::move (v.predicate))
-                ,   skipping    (std::move (v.skipping))
+            CPPLINQ_INLINEMETHOD flat_map (flat_map const & v)
+                :   values (v.values)
             {
             }
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            CPPLINQ_INLINEMETHOD flat_map (flat_map && v) CPPLINQ_NOEXCEPT
+                :   values (std::move (v.values))
             {
-                return range_builder.build (*this);
             }
 
-            CPPLINQ_INLINEMETHOD return_type front () const
+            CPPLINQ_INLINEMETHOD flat_map & operator= (flat_map const & v)
             {
-                return range.front ();
+                if (this != &v)
+                {
+                    values = v.values;
+                }
+                return *this;
             }
 
-            CPPLINQ_INLINEMETHOD bool next ()
+            CPPLINQ_INLINEMETHOD flat_map & operator= (flat_map && v) CPPLINQ_NOEXCEPT
             {
-                if (!skipping)
+                if (this != &v)
                 {
-                    return range.next ();
+                    values = std::move (v.values);
                 }
+                return *this;
+            }
 
-                while (range.next ())
-                {
-                    if (!predicate (range.front ()))
-                    {
-                        skipping = false;
-                        return true;
-                    }
-                }
+            CPPLINQ_INLINEMETHOD void swap (flat_map & v) CPPLINQ_NOEXCEPT
+            {
+                values.swap (v.values);
+            }
 
-                return false;
+            CPPLINQ_INLINEMETHOD const_iterator begin () const CPPLINQ_NOEXCEPT
+            {
+                return values.begin ();
             }
-        };
 
-        template <typename TPredicate>
-        struct skip_while_builder : base_builder
-        {
-            typedef                 skip_while_builder<TPredicate>  this_type       ;
-            typedef                 TPredicate                      predicate_type  ;
+            CPPLINQ_INLINEMETHOD const_iterator end () const CPPLINQ_NOEXCEPT
+            {
+                return values.end ();
+            }
 
-            predicate_type          predicate   ;
+            CPPLINQ_INLINEMETHOD size_type size () const CPPLINQ_NOEXCEPT
+            {
+                return values.size ();
+            }
 
-            CPPLINQ_INLINEMETHOD skip_while_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
-                :   predicate (std::move (predicate))
+            CPPLINQ_INLINEMETHOD bool empty () const CPPLINQ_NOEXCEPT
             {
+                return values.empty ();
             }
 
-            CPPLINQ_INLINEMETHOD skip_while_builder (skip_while_builder const & v) CPPLINQ_NOEXCEPT
-                :   predicate (v.predicate)
+            CPPLINQ_METHOD const_iterator find (key_type const & key) const
             {
+                auto found = std::lower_bound (
+                        values.begin ()
+                    ,   values.end ()
+                    ,   key
+                    ,   [] (value_type const & l, key_type const & r)
+                        {
+                            return l.first < r;
+                        }
+                    );
+
+                return found != values.end () && !(key < found->first)
+                    ?   found
+                    :   values.end ()
+                    ;
             }
 
-            CPPLINQ_INLINEMETHOD skip_while_builder (skip_while_builder && v) CPPLINQ_NOEXCEPT
-                :   predicate (std::move (v.predicate))
+            CPPLINQ_INLINEMETHOD size_type count (key_type const & key) const
             {
+                return find (key) != values.end () ? 1U : 0U;
             }
 
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD skip_while_range<TRange, TPredicate> build (TRange range) const
+            CPPLINQ_METHOD mapped_type const & at (key_type const & key) const
             {
-                return skip_while_range<TRange, TPredicate>(std::move (range), predicate);
+                auto found = find (key);
+                if (found == values.end ())
+                {
+                    throw std::out_of_range ("flat_map::at");
+                }
+
+                return found->second;
             }
 
+        private:
+            values_type values;
         };
 
-        // -------------------------------------------------------------------------
-
-        template<typename TRange>
-        struct ref_range : base_range
+        template<typename TAllocator = std::allocator<void>>
+        struct flat_map_target
         {
-            typedef        std::reference_wrapper<
-                                typename TRange::value_type const>  value_type  ;
-            typedef                 value_type                      return_type ;
-            enum
+            template<typename TKey, typename TValue>
+            struct rebind
             {
-                returns_reference   = 0   ,
-            };
+                typedef     flat_map<TKey, TValue, TAllocator>  result_type ;
+                typedef     typename result_type::values_type   buffer_type ;
+                typedef     typename result_type::value_type    value_type  ;
 
-            typedef                 ref_range<TRange>               this_type   ;
-            typedef                 TRange                          range_type  ;
+                CPPLINQ_INLINEMETHOD static void reserve (buffer_type & buffer, size_type hint)
+                {
+                    buffer.reserve (hint);
+                }
 
-            range_type              range       ;
+                // Duplicates are resolved by finish once the pairs are sorted
+                template<typename TInsertKey, typename TInsertValue>
+                CPPLINQ_INLINEMETHOD static void insert (
+                        buffer_type &           buffer
+                    ,   TInsertKey &&           key
+                    ,   TInsertValue &&         value
+                    ,   duplicate_key_policy
+                    )
+                {
+                    buffer.emplace_back (std::forward<TInsertKey> (key), std::forward<TInsertValue> (value));
+                }
 
-            CPPLINQ_INLINEMETHOD ref_range (
-                    range_type      range
-                ) CPPLINQ_NOEXCEPT
-                :   range       (std::move (range))
-            {
-                static_assert (
-                        TRange::returns_reference
-                    ,   "ref may only follow a range that returns references"
-                    );
-            }
+                CPPLINQ_METHOD static result_type finish (buffer_type && buffer, duplicate_key_policy policy)
+                {
+                    // A stable sort keeps the pairs of a key in range order
+                    // so that first and last refer to the range
+                    std::stable_sort (
+                            buffer.begin ()
+                        ,   buffer.end ()
+                        ,   [] (value_type const & l, value_type const & r)
+                            {
+                                return l.first < r.first;
+                            }
+                        );
 
-            CPPLINQ_INLINEMETHOD ref_range (ref_range const & v)
-                :   range       (v.range)
-            {
-            }
+                    auto to     = buffer.begin ();
+                    auto from   = buffer.begin ();
+                    auto end    = buffer.end ();
+
+                    while (from != end)
+                    {
+                        auto next = from + 1;
+                        while (next != end && !(from->first < next->first))
+                        {
+                            ++next;
+                        }
+
+                        if (next - from > 1)
+                        {
+                            switch (policy)
+                            {
+                            case first_value_wins:
+                                break;
+                            case last_value_wins:
+                                from = next - 1;
+                                break;
+                            case throw_on_duplicate_key:
+                            default:
+                                throw duplicate_key_exception ();
+                            }
+                        }
+
+                        if (to != from)
+                        {
+                            *to = std::move (*from);
+                        }
+
+                        ++to;
+                        from = next;
+                    }
 
-            CPPLINQ_INLINEMETHOD ref_range (ref_range && v) CPPLINQ_NOEXCEPT
-                :   range       (std::move (v.range))
-            {
-            }
+                    buffer.erase (to, end);
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
-            {
-                return range_builder.build (*this);
-            }
+                    return result_type (std::move (buffer));
+                }
+            };
 
-            CPPLINQ_INLINEMETHOD return_type front () const
+            TAllocator              allocator   ;
+
+            CPPLINQ_INLINEMETHOD explicit flat_map_target (TAllocator allocator = TAllocator ()) CPPLINQ_NOEXCEPT
+                :   allocator   (std::move (allocator))
             {
-                return value_type (range.front ());
             }
 
-            CPPLINQ_INLINEMETHOD bool next ()
+            template<typename TKey, typename TValue>
+            CPPLINQ_INLINEMETHOD typename rebind<TKey, TValue>::buffer_type make_buffer () const
             {
-                return range.next ();
+                typedef typename rebind<TKey, TValue>::buffer_type buffer_type;
+                return buffer_type (typename buffer_type::allocator_type (allocator));
             }
         };
 
-        struct ref_builder : base_builder
+        template<typename TKeyPredicate, typename TValuePredicate = identity_selector, typename TMapTarget = ordered_map_target<>>
+        struct to_map_builder : base_builder
         {
-            typedef                 ref_builder this_type   ;
+            static TKeyPredicate get_key_predicate ();
 
-            CPPLINQ_INLINEMETHOD ref_builder () CPPLINQ_NOEXCEPT
+            typedef                     to_map_builder<TKeyPredicate, TValuePredicate, TMapTarget>  this_type               ;
+            typedef                     TKeyPredicate                                               key_predicate_type      ;
+            typedef                     TValuePredicate                                             value_predicate_type    ;
+            typedef                     TMapTarget                                                  map_target_type         ;
+
+            key_predicate_type          key_predicate   ;
+            value_predicate_type        value_predicate ;
+            duplicate_key_policy        policy          ;
+            map_target_type             map_target      ;
+
+            CPPLINQ_INLINEMETHOD explicit to_map_builder (
+                    key_predicate_type      key_predicate
+                ,   value_predicate_type    value_predicate = value_predicate_type ()
+                ,   duplicate_key_policy    policy          = first_value_wins
+                ,   map_target_type         map_target      = map_target_type ()
+                ) CPPLINQ_NOEXCEPT
+                :   key_predicate   (std::move (key_predicate))
+                ,   value_predicate (std::move (value_predicate))
+                ,   policy          (policy)
+                ,   map_target      (std::move (map_target))
             {
             }
 
-            CPPLINQ_INLINEMETHOD ref_builder (ref_builder const & v)
+            CPPLINQ_INLINEMETHOD to_map_builder (to_map_builder const & v)
+                :   key_predicate   (v.key_predicate)
+                ,   value_predicate (v.value_predicate)
+                ,   policy          (v.policy)
+                ,   map_target      (v.map_target)
             {
             }
 
-            CPPLINQ_INLINEMETHOD ref_builder (ref_builder && v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD to_map_builder (to_map_builder && v) CPPLINQ_NOEXCEPT
+                :   key_predicate   (std::move (v.key_predicate))
+                ,   value_predicate (std::move (v.value_predicate))
+                ,   policy          (std::move (v.policy))
+                ,   map_target      (std::move (v.map_target))
             {
             }
 
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD ref_range<TRange> build (TRange range) const
+            struct target
             {
-                return ref_range<TRange>(std::move (range));
+                typedef typename get_transformed_type<key_predicate_type, typename TRange::value_type>::type     key_type    ;
+                typedef typename get_transformed_type<value_predicate_type, typename TRange::value_type>::type   value_type  ;
+
+                typedef typename TMapTarget::template rebind<key_type, value_type>  type;
+
+                typedef std::integral_constant<
+                        bool
+                    ,       std::is_same<value_predicate_type, identity_selector>::value
+                        &&  !std::is_reference<typename move_front_type<TRange>::type>::value
+                    >   moves_values;
+            };
+
+            template<typename TRange>
+            CPPLINQ_METHOD typename target<TRange>::type::result_type build (TRange range) const
+            {
+                typedef typename target<TRange>::type           target_type     ;
+                typedef typename target<TRange>::moves_values   moves_values    ;
+                typedef typename target<TRange>::key_type       key_type        ;
+                typedef typename target<TRange>::value_type     value_type      ;
+
+                instrument_scope scope (query_to_map);
+
+                auto buffer = map_target.template make_buffer<key_type, value_type> ();
+                auto hint = get_size_hint (range);
+                if (hint != invalid_size)
+                {
+                    target_type::reserve (buffer, hint);
+                }
+
+                while (pull (query_to_map, range))
+                {
+                    // Binds to the value taken from range without copying it
+                    auto && v = move_front (range);
+                    auto k = key_predicate (v);
+
+                    count_store<decltype (select_map_value (value_predicate, v, moves_values ()))> (query_to_map);
+                    target_type::insert (
+                            buffer
+                        ,   std::move (k)
+                        ,   select_map_value (value_predicate, v, moves_values ())
+                        ,   policy
+                        );
+                }
+
+                return target_type::finish (std::move (buffer), policy);
             }
 
         };
 
         // -------------------------------------------------------------------------
 
-        // -------------------------------------------------------------------------
-
-        template<typename TRange, typename TPredicate>
-        struct select_range : base_range
+        template<typename TKey, typename TValue>
+        struct lookup
         {
-            static typename TRange::value_type get_source ();
-            static          TPredicate get_predicate ();
+            typedef             TKey    key_type    ;
+            typedef             TValue  value_type  ;
 
+            typedef typename    resource_vector<std::pair<key_type, size_type>>::type   keys_type           ;
+            typedef typename    resource_vector<value_type>::type                       values_type         ;
 
-            typedef        decltype (get_predicate ()(get_source ()))   raw_value_type  ;
-            typedef        typename cleanup_type<raw_value_type>::type  value_type      ;
-            typedef                 value_type const &                  return_type     ;
-            enum
+            typedef typename    values_type::const_iterator                     values_iterator_type;
+
+            template<typename TRange, typename TSelector>
+            CPPLINQ_METHOD lookup (size_type capacity, TRange range, TSelector selector)
+                :   values  (get_memory_resource (range))
+                ,   keys    (get_memory_resource (range))
             {
-                returns_reference   = 1   ,
-            };
+                instrument_scope scope (query_to_lookup);
 
-            typedef                 select_range<TRange, TPredicate>    this_type       ;
-            typedef                 TRange                              range_type      ;
-            typedef                 TPredicate                          predicate_type  ;
+                auto hint = get_size_hint (range);
 
-            range_type              range       ;
-            predicate_type          predicate   ;
+                keys_type   k (get_memory_resource (range));
+                values_type v (get_memory_resource (range));
+                reserve_for_hint (k, hint, capacity);
+                reserve_for_hint (v, hint, capacity);
 
-            opt<value_type>         cache_value ;
+                auto index = 0U;
+                while (pull (query_to_lookup, range))
+                {
+                    // Values returned by value are moved, references are
+                    // copied once
+                    auto && value   = store_front (query_to_lookup, range);
+                    auto key        = selector (value);
+                    v.push_back (std::forward<decltype (value)> (value));
+                    k.push_back (typename keys_type::value_type (std::move (key), index));
+                    ++index;
+                }
 
-            CPPLINQ_INLINEMETHOD select_range (
-                    range_type      range
-                ,   predicate_type  predicate
-                ) CPPLINQ_NOEXCEPT
-                :   range       (std::move (range))
-                ,   predicate   (std::move (predicate))
-            {
-            }
+                if (v.size () == 0)
+                {
+                    return;
+                }
 
-            CPPLINQ_INLINEMETHOD select_range (select_range const & v)
-                :   range       (v.range)
-                ,   predicate   (v.predicate)
-                ,   cache_value (v.cache_value)
-            {
+                std::sort (
+                        k.begin ()
+                    ,   k.end ()
+                    ,   [] (typename keys_type::value_type const & l, typename keys_type::value_type const & r)
+                        {
+                            return l.first < r.first;
+                        }
+                    );
+
+                keys.reserve (k.size ());
+                values.reserve (v.size ());
+
+                auto iter       = k.begin ();
+                auto end        = k.end ();
+
+                index = 0U;
+
+                if (iter != end)
+                {
+                    values.push_back (std::move (v[iter->second]));
+                    keys.push_back (typename keys_type::value_type (iter->first, index));
+                }
+
+                auto previous   = iter;
+                ++iter;
+                ++index;
+
+                while (iter != end)
+                {
+                    values.push_back (std::move (v[iter->second]));
+
+                    if (previous->first < iter->first)
+                    {
+                        keys.push_back (typename keys_type::value_type (iter->first, index));
+                    }
+
+                    previous = iter;
+                    ++iter;
+                    ++index;
+                }
             }
 
-            CPPLINQ_INLINEMETHOD select_range (select_range && v) CPPLINQ_NOEXCEPT
-                :   range       (std::move (v.range))
-                ,   predicate   (std::move (v.predicate))
-                ,   cache_value (std::move (v.cache_value))
+            CPPLINQ_INLINEMETHOD lookup (lookup const & v)
+                :   values  (v.values)
+                ,   keys    (v.keys)
             {
             }
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            CPPLINQ_INLINEMETHOD lookup (lookup && v) CPPLINQ_NOEXCEPT
+                :   values  (std::move (v.values))
+                ,   keys    (std::move (v.keys))
             {
-                return range_builder.build (*this);
             }
 
-            CPPLINQ_INLINEMETHOD return_type front () const
+            CPPLINQ_INLINEMETHOD void swap (lookup & v) CPPLINQ_NOEXCEPT
             {
-                CPPLINQ_ASSERT (cache_value);
-                return *cache_value;
+                values.swap (v.values);
+                keys.swap (v.keys);
             }
 
-            CPPLINQ_INLINEMETHOD bool next ()
+            CPPLINQ_INLINEMETHOD lookup & operator= (lookup const & v)
             {
-                if (range.next ())
+                if (this == std::addressof (v))
                 {
-                    cache_value = predicate (range.front ());
-                    return true;
+                    return *this;
                 }
 
-                cache_value.clear ();
+                lookup tmp (v);
 
-                return false;
+                swap (tmp);
+
+                return *this;
             }
-        };
 
-        template<typename TPredicate>
-        struct select_builder : base_builder
-        {
-            typedef                 select_builder<TPredicate>  this_type       ;
-            typedef                 TPredicate                  predicate_type  ;
+            CPPLINQ_INLINEMETHOD lookup & operator= (lookup && v) CPPLINQ_NOEXCEPT
+            {
+                if (this == std::addressof (v))
+                {
+                    return *this;
+                }
 
-            predicate_type          predicate   ;
+                swap (v);
 
-            CPPLINQ_INLINEMETHOD explicit select_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
-                :   predicate (std::move (predicate))
-            {
+                return *this;
             }
 
-            CPPLINQ_INLINEMETHOD select_builder (select_builder const & v)
-                :   predicate (v.predicate)
+            struct lookup_range : base_range
             {
-            }
+                typedef         lookup_range                this_type       ;
 
-            CPPLINQ_INLINEMETHOD select_builder (select_builder && v) CPPLINQ_NOEXCEPT
-                :   predicate (std::move (v.predicate))
-            {
-            }
+                enum
+                {
+                    returns_reference = 1 ,
+                    random_access     = 1 ,
+                    instrumented_as   = query_to_lookup ,
+                };
 
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD select_range<TRange, TPredicate> build (TRange range) const
-            {
-                return select_range<TRange, TPredicate>(std::move (range), predicate);
-            }
+                typedef         TValue                      value_type      ;
+                typedef         value_type const &          return_type     ;
 
-        };
+                enum state
+                {
+                    state_initial   ,
+                    state_iterating ,
+                    state_end       ,
+                };
+
+                values_type const *     values  ;
+                size_type               iter    ;
+                size_type               end     ;
+                state                   state   ;
+
+                CPPLINQ_INLINEMETHOD lookup_range (
+                        values_type const *     values
+                    ,   size_type               iter
+                    ,   size_type               end
+                    ) CPPLINQ_NOEXCEPT
+                    :   values  (values)
+                    ,   iter    (iter)
+                    ,   end     (end)
+                    ,   state   (state_initial)
+                {
+                    CPPLINQ_ASSERT (values);
+                }
+
+                CPPLINQ_INLINEMETHOD lookup_range (lookup_range const & v) CPPLINQ_NOEXCEPT
+                    :   values  (v.values)
+                    ,   iter    (v.iter)
+                    ,   end     (v.end)
+                    ,   state   (v.state)
+                {
+                }
+
+                CPPLINQ_INLINEMETHOD lookup_range (lookup_range && v) CPPLINQ_NOEXCEPT
+                    :   values  (std::move (v.values))
+                    ,   iter    (std::move (v.iter))
+                    ,   end     (std::move (v.end))
+                    ,   state   (std::move (v.state))
+                {
+                }
+
+                template<typename TRangeBuilder>
+                CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+                {
+                    return range_builder.build (*this);
+                }
+
+                CPPLINQ_INLINEMETHOD return_type front () const CPPLINQ_NOEXCEPT
+                {
+                    CPPLINQ_ASSERT (state == state_iterating);
+                    CPPLINQ_ASSERT (iter < end);
 
-        // -------------------------------------------------------------------------
+                    return (*values)[iter];
+                }
 
-        // Some trickery in order to force the code to compile on VS2012
-        template<typename TRange, typename TPredicate>
-        struct select_many_range_helper
-        {
-            static typename TRange::value_type get_source ();
-            static          TPredicate get_predicate ();
+                CPPLINQ_INLINEMETHOD bool next () CPPLINQ_NOEXCEPT
+                {
+                    switch (state)
+                    {
+                    case state_initial:
+                        {
+                            auto has_elements = iter < end;
+                            state = has_elements ? state_iterating : state_end;
+                            return has_elements;
+                        }
+                        break;
+                    case state_iterating:
+                        {
+                            ++iter;
 
-            typedef        decltype (get_predicate ()(get_source ()))           raw_inner_range_type    ;
-            typedef        typename cleanup_type<raw_inner_range_type>::type    inner_range_type        ;
+                            auto has_elements = iter < end;
+                            state = has_elements ? state_iterating : state_end;
+                            return has_elements;
+                        }
+                        break;
+                    case state_end:
+                    default:
+                        return false;
+                    }
+                }
 
-            static         inner_range_type get_inner_range ();
+                // Index of the next value
+                CPPLINQ_INLINEMETHOD size_type get_upcoming () const CPPLINQ_NOEXCEPT
+                {
+                    switch (state)
+                    {
+                    case state_initial:
+                        return iter;
+                    case state_iterating:
+                        return iter + 1U;
+                    case state_end:
+                    default:
+                        return end;
+                    }
+                }
 
-            typedef        decltype (get_inner_range ().front ())               raw_value_type          ;
-            typedef        typename cleanup_type<raw_value_type>::type          value_type              ;
+                CPPLINQ_INLINEMETHOD size_type size () const CPPLINQ_NOEXCEPT
+                {
+                    return end - std::min (end, get_upcoming ());
+                }
 
-        };
+                CPPLINQ_INLINEMETHOD void advance (size_type count) CPPLINQ_NOEXCEPT
+                {
+                    if (state != state_end)
+                    {
+                        iter += std::min (count, size ());
+                    }
+                }
 
-        template<typename TRange, typename TPredicate>
-        struct select_many_range : base_range
-        {
-            typedef select_many_range_helper<TRange, TPredicate>    helper_type         ;
+                CPPLINQ_INLINEMETHOD return_type at (size_type index) const CPPLINQ_NOEXCEPT
+                {
+                    CPPLINQ_ASSERT (index < size ());
+                    return (*values)[get_upcoming () + index];
+                }
 
-            typedef        typename helper_type::inner_range_type   inner_range_type    ;
-            typedef        typename helper_type::value_type         value_type          ;
-            typedef                 value_type                      return_type         ;
-            enum
-            {
-                returns_reference   = 0   ,
             };
 
-            typedef                 select_many_range<TRange, TPredicate>       this_type               ;
-            typedef                 TRange                                      range_type              ;
-            typedef                 TPredicate                                  predicate_type          ;
-
-            range_type              range       ;
-            predicate_type          predicate   ;
+            CPPLINQ_METHOD lookup_range operator[](key_type const & key) const CPPLINQ_NOEXCEPT
+            {
+                if (values.empty ())
+                {
+                    return lookup_range (std::addressof (values), 0U, 0U);
+                }
 
-            opt<inner_range_type>   inner_range ;
+                auto find = std::lower_bound (
+                        keys.begin ()
+                    ,   keys.end  ()
+                    ,   typename keys_type::value_type (key, 0U)
+                    ,   [](typename keys_type::value_type const & l, typename keys_type::value_type const & r)
+                        {
+                            return l.first < r.first;
+                        });
 
+                if (find == keys.end ())
+                {
+                    return lookup_range (std::addressof (values), 0U, 0U);
+                }
 
-            CPPLINQ_INLINEMETHOD select_many_range (
-                    range_type      range
-                ,   predicate_type  predicate
-                ) CPPLINQ_NOEXCEPT
-                :   range       (std::move (range))
-                ,   predicate   (std::move (predicate))
-            {
-            }
+                auto next = find + 1;
+                if (next == keys.end ())
+                {
+                    return lookup_range (std::addressof (values), find->second, values.size ());
+                }
 
-            CPPLINQ_INLINEMETHOD select_many_range (select_many_range const & v)
-                :   range       (v.range)
-                ,   predicate   (v.predicate)
-                ,   inner_range (v.inner_range)
-            {
+                return lookup_range (std::addressof (values), find->second, next->second);
             }
 
-            CPPLINQ_INLINEMETHOD select_many_range (select_many_range && v) CPPLINQ_NOEXCEPT
-                :   range       (std::move (v.range))
-                ,   predicate   (std::move (v.predicate))
-                ,   inner_range (std::move (v.inner_range))
+            CPPLINQ_INLINEMETHOD size_type size_of_keys () const CPPLINQ_NOEXCEPT
             {
+                return keys.size ();
             }
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            CPPLINQ_INLINEMETHOD size_type size_of_values () const CPPLINQ_NOEXCEPT
             {
-                return range_builder.build (*this);
+                return values.size ();
             }
 
-            CPPLINQ_INLINEMETHOD return_type front () const
+            CPPLINQ_INLINEMETHOD from_range<values_iterator_type> range_of_values () const CPPLINQ_NOEXCEPT
             {
-                CPPLINQ_ASSERT (inner_range);
-                return inner_range->front ();
+                return from_range<values_iterator_type> (
+                        values.begin ()
+                    ,   values.end ()
+                    );
             }
 
-            CPPLINQ_INLINEMETHOD bool next ()
-            {
-                if (inner_range && inner_range->next ())
-                {
-                    return true;
-                }
-
-                if (range.next ())
-                {
-                    inner_range = predicate (range.front ());
-                    return inner_range && inner_range->next ();
-                }
-
-                inner_range.clear ();
-
-                return false;
-            }
+        private:
+            values_type values  ;
+            keys_type   keys    ;
         };
 
-        template<typename TPredicate>
-        struct select_many_builder : base_builder
+        template<typename TKeyPredicate>
+        struct to_lookup_builder : base_builder
         {
-            typedef                 select_many_builder<TPredicate> this_type       ;
-            typedef                 TPredicate                      predicate_type  ;
+            static TKeyPredicate get_key_predicate ();
 
-            predicate_type          predicate   ;
+            typedef                     to_lookup_builder<TKeyPredicate>    this_type           ;
+            typedef                     TKeyPredicate                       key_predicate_type  ;
 
-            CPPLINQ_INLINEMETHOD explicit select_many_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
-                :   predicate (std::move (predicate))
+            key_predicate_type          key_predicate   ;
+
+            CPPLINQ_INLINEMETHOD explicit to_lookup_builder (key_predicate_type key_predicate) CPPLINQ_NOEXCEPT
+                :   key_predicate   (std::move (key_predicate))
             {
             }
 
-            CPPLINQ_INLINEMETHOD select_many_builder (select_many_builder const & v)
-                :   predicate (v.predicate)
+            CPPLINQ_INLINEMETHOD to_lookup_builder (to_lookup_builder const & v)
+                :   key_predicate (v.key_predicate)
             {
             }
 
-            CPPLINQ_INLINEMETHOD select_many_builder (select_many_builder && v) CPPLINQ_NOEXCEPT
-                :   predicate (std::move (v.predicate))
+            CPPLINQ_INLINEMETHOD to_lookup_builder (to_lookup_builder && v) CPPLINQ_NOEXCEPT
+                :   key_predicate (std::move (v.key_predicate))
             {
             }
 
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD select_many_range<TRange, TPredicate> build (TRange range) const
+            CPPLINQ_INLINEMETHOD lookup<
+                    typename get_transformed_type<key_predicate_type, typename TRange::value_type>::type
+                ,   typename TRange::value_type
+                > build (TRange range) const
             {
-                return select_many_range<TRange, TPredicate>(std::move (range), predicate);
+                typedef lookup<
+                    typename get_transformed_type<key_predicate_type, typename TRange::value_type>::type
+                ,   typename TRange::value_type
+                >   result_type;
+
+                result_type result (16U, range, key_predicate);
+
+                return result;
             }
 
         };
 
+        // -------------------------------------------------------------------------
+        // hash_lookup groups the values by key like lookup but finds keys in a
+        // flat_hash_set in O(1). The values are counting sorted on the index of
+        // their key into one contiguous buffer, offsets[key] is where the
+        // values of a key start. Values are moved, never copied, so move-only
+        // values can be looked up when the source yields them by value.
         // -------------------------------------------------------------------------
 
-        template<
-                typename TRange
-            ,   typename TOtherRange
-            ,   typename TKeySelector
-            ,   typename TOtherKeySelector
-            ,   typename TCombiner
-            >
-        struct join_range : base_range
+        template<typename TKey, typename TValue, typename THash, typename TEqual>
+        struct hash_lookup
         {
-            static typename TRange::value_type      get_source ()               ;
-            static typename TOtherRange::value_type get_other_source ()         ;
-            static          TKeySelector            get_key_selector ()         ;
-            static          TOtherKeySelector       get_other_key_selector ()   ;
-            static          TCombiner               get_combiner ()             ;
+            typedef             TKey                                    key_type            ;
+            typedef             TValue                                  value_type          ;
 
-            typedef         decltype (get_key_selector () (get_source ()))      raw_key_type    ;
-            typedef         typename cleanup_type<raw_key_type>::type           key_type        ;
+            typedef             flat_hash_set<key_type, THash, TEqual>  keys_type           ;
+            typedef typename    resource_vector<value_type>::type       values_type         ;
+            typedef typename    resource_vector<size_type>::type        indices_type        ;
 
-            typedef         decltype (get_other_key_selector () (get_other_source ()))
-                                                                                raw_other_key_type  ;
-            typedef         typename cleanup_type<raw_other_key_type>::type     other_key_type      ;
+            typedef             from_range<value_type const *>          values_range_type   ;
 
-            typedef         decltype (get_combiner () (get_source (), get_other_source ()))
-                                                                                raw_value_type  ;
-            typedef         typename cleanup_type<raw_value_type>::type         value_type      ;
-            typedef                 value_type                                  return_type     ;
-            enum
+            template<typename TRange, typename TSelector>
+            CPPLINQ_METHOD hash_lookup (TRange range, TSelector selector, THash hash, TEqual equal)
+                :   keys    (std::move (hash), std::move (equal), get_memory_resource (range))
+                ,   offsets (get_memory_resource (range))
+                ,   values  (get_memory_resource (range))
             {
-                returns_reference   = 0   ,
-            };
+                instrument_scope scope (query_to_hash_lookup);
 
-            typedef                 join_range<
-                    TRange
-                ,   TOtherRange
-                ,   TKeySelector
-                ,   TOtherKeySelector
-                ,   TCombiner
-                >                                               this_type               ;
-            typedef                 TRange                      range_type              ;
-            typedef                 TOtherRange                 other_range_type        ;
-            typedef                 TKeySelector                key_selector_type       ;
-            typedef                 TOtherKeySelector           other_key_selector_type ;
-            typedef                 TCombiner                   combiner_type           ;
-            typedef                 std::multimap<
-                                            other_key_type
-                                        ,   typename TOtherRange::value_type
-                                        >                       map_type                ;
-            typedef     typename    map_type::const_iterator    map_iterator_type       ;
+                auto memory = get_memory_resource (range);
 
-            range_type                  range               ;
-            other_range_type            other_range         ;
-            key_selector_type           key_selector        ;
-            other_key_selector_type     other_key_selector  ;
-            combiner_type               combiner            ;
+                // First pass moves the values aside with the index of their key
+                values_type             pending (memory);
+                indices_type            key_of  (memory);
 
-            bool                        start               ;
-            map_type                    map                 ;
-            map_iterator_type           current             ;
+                auto hint = get_size_hint (range);
+                reserve_for_hint (pending, hint, 16U);
+                reserve_for_hint (key_of, hint, 16U);
 
-            CPPLINQ_INLINEMETHOD join_range (
-                    range_type              range
-                ,   other_range_type        other_range
-                ,   key_selector_type       key_selector
-                ,   other_key_selector_type other_key_selector
-                ,   combiner_type           combiner
-                ) CPPLINQ_NOEXCEPT
-                :   range              (std::move (range))
-                ,   other_range        (std::move (other_range))
-                ,   key_selector       (std::move (key_selector))
-                ,   other_key_selector (std::move (other_key_selector))
-                ,   combiner           (std::move (combiner))
-                ,   start              (true)
-            {
+                while (pull (query_to_hash_lookup, range))
+                {
+                    pending.push_back (store_front (query_to_hash_lookup, range));
+
+                    auto inserted = keys.insert (selector (pending.back ()));
+                    key_of.push_back (keys.index_of (inserted.first));
+                }
+
+                offsets.assign (keys.size () + 1U, 0U);
+                for (auto key : key_of)
+                {
+                    ++offsets[key + 1U];
+                }
+
+                for (auto key = 1U; key < offsets.size (); ++key)
+                {
+                    offsets[key] += offsets[key - 1U];
+                }
+
+                // Second pass places the values, source order is kept within a key
+                indices_type order (pending.size (), 0U, memory);
+                indices_type positions (offsets.begin (), offsets.end () - 1, memory);
+                for (auto index = 0U; index < key_of.size (); ++index)
+                {
+                    order[positions[key_of[index]]++] = index;
+                }
+
+                values.reserve (pending.size ());
+                for (auto index : order)
+                {
+                    values.push_back (std::move (pending[index]));
+                }
             }
 
-            CPPLINQ_INLINEMETHOD join_range (join_range const & v)
-                :   range              (v.range)
-                ,   other_range        (v.other_range)
-                ,   key_selector       (v.key_selector)
-                ,   other_key_selector (v.other_key_selector)
-                ,   combiner           (v.combiner)
-                ,   start              (v.start)
-                ,   map                (v.map)
-                ,   current            (v.current)
+            CPPLINQ_INLINEMETHOD hash_lookup (hash_lookup const & v)
+                :   keys    (v.keys)
+                ,   offsets (v.offsets)
+                ,   values  (v.values)
             {
             }
 
-            CPPLINQ_INLINEMETHOD join_range (join_range && v) CPPLINQ_NOEXCEPT
-                :   range              (std::move (v.range))
-                ,   other_range        (std::move (v.other_range))
-                ,   key_selector       (std::move (v.key_selector))
-                ,   other_key_selector (std::move (v.other_key_selector))
-                ,   combiner           (std::move (v.combiner))
-                ,   start              (std::move (v.start))
-                ,   map                (std::move (v.map))
-                ,   current            (std::move (v.current))
+            CPPLINQ_INLINEMETHOD hash_lookup (hash_lookup && v) CPPLINQ_NOEXCEPT
+                :   keys    (std::move (v.keys))
+                ,   offsets (std::move (v.offsets))
+                ,   values  (std::move (v.values))
             {
             }
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            CPPLINQ_INLINEMETHOD void swap (hash_lookup & v)
             {
-                return range_builder.build (*this);
+                keys.swap (v.keys);
+                offsets.swap (v.offsets);
+                values.swap (v.values);
             }
 
-            CPPLINQ_INLINEMETHOD return_type front () const
+            CPPLINQ_INLINEMETHOD hash_lookup & operator= (hash_lookup const & v)
             {
-                CPPLINQ_ASSERT (current != map.end ());
-                return combiner (range.front (), current->second);
+                if (this == std::addressof (v))
+                {
+                    return *this;
+                }
+
+                hash_lookup tmp (v);
+
+                swap (tmp);
+
+                return *this;
             }
 
-            CPPLINQ_INLINEMETHOD bool next ()
+            CPPLINQ_INLINEMETHOD hash_lookup & operator= (hash_lookup && v)
             {
-                if (start)
+                if (this == std::addressof (v))
                 {
-                    start = false;
-                    while (other_range.next ())
-                    {
-                        auto other_value    = other_range.front ();
-                        auto other_key      = other_key_selector (other_value);
-                        map.insert (typename map_type::value_type (std::move (other_key), std::move (other_value)));
-                    }
-
-                    current = map.end ();
-                    if (map.size () == 0U)
-                    {
-                        return false;
-                    }
+                    return *this;
                 }
 
-                if (current != map.end ())
+                swap (v);
+
+                return *this;
+            }
+
+            CPPLINQ_METHOD values_range_type operator[](key_type const & key) const
+            {
+                auto found = keys.find (key);
+                if (found == keys.end ())
                 {
-                    auto previous = current;
-                    ++current;
-                    if (current != map.end () && !(previous->first < current->first))
-                    {
-                        return true;
-                    }
+                    return values_range_type (nullptr, nullptr);
                 }
 
-                while (range.next ())
-                {
-                    auto value  = range.front ();
-                    auto key    = key_selector (value);
+                auto index = keys.index_of (found);
+                return values_range_type (
+                        values.data () + offsets[index]
+                    ,   values.data () + offsets[index + 1U]
+                    );
+            }
 
-                    current     = map.find (key);
-                    if (current != map.end ())
-                    {
-                        return true;
-                    }
-                }
+            CPPLINQ_INLINEMETHOD size_type size_of_keys () const CPPLINQ_NOEXCEPT
+            {
+                return keys.size ();
+            }
 
-                return false;
+            CPPLINQ_INLINEMETHOD size_type size_of_values () const CPPLINQ_NOEXCEPT
+            {
+                return values.size ();
+            }
+
+            CPPLINQ_INLINEMETHOD values_range_type range_of_values () const CPPLINQ_NOEXCEPT
+            {
+                return values_range_type (
+                        values.data ()
+                    ,   values.data () + values.size ()
+                    );
             }
+
+        private:
+            keys_type                   keys    ;
+            indices_type                offsets ;   // Per key and one past the last key
+            values_type                 values  ;
         };
 
-        template<
-                typename TOtherRange
-            ,   typename TKeySelector
-            ,   typename TOtherKeySelector
-            ,   typename TCombiner
-            >
-        struct join_builder : base_builder
+        template<typename TKeyPredicate, typename THash, typename TEqual>
+        struct to_hash_lookup_builder : base_builder
         {
-            typedef                 join_builder<
-                    TOtherRange
-                ,   TKeySelector
-                ,   TOtherKeySelector
-                ,   TCombiner
-                >                                               this_type               ;
+            static TKeyPredicate get_key_predicate ();
 
-            typedef                 TOtherRange                 other_range_type        ;
-            typedef                 TKeySelector                key_selector_type       ;
-            typedef                 TOtherKeySelector           other_key_selector_type ;
-            typedef                 TCombiner                   combiner_type           ;
+            typedef                     to_hash_lookup_builder<TKeyPredicate, THash, TEqual>
+                                                                            this_type           ;
+            typedef                     TKeyPredicate                       key_predicate_type  ;
 
-            other_range_type        other_range         ;
-            key_selector_type       key_selector        ;
-            other_key_selector_type other_key_selector  ;
-            combiner_type           combiner            ;
+            key_predicate_type          key_predicate   ;
+            THash                       hash            ;
+            TEqual                      equal           ;
 
-            CPPLINQ_INLINEMETHOD join_builder (
-                    other_range_type        other_range
-                ,   key_selector_type       key_selector
-                ,   other_key_selector_type other_key_selector
-                ,   combiner_type           combiner
-                ) CPPLINQ_NOEXCEPT
-                :   other_range        (std::move (other_range))
-                ,   key_selector       (std::move (key_selector))
-                ,   other_key_selector (std::move (other_key_selector))
-                ,   combiner           (std::move (combiner))
+            CPPLINQ_INLINEMETHOD to_hash_lookup_builder (key_predicate_type key_predicate, THash hash, TEqual equal) CPPLINQ_NOEXCEPT
+                :   key_predicate   (std::move (key_predicate))
+                ,   hash            (std::move (hash))
+                ,   equal           (std::move (equal))
             {
             }
 
-            CPPLINQ_INLINEMETHOD join_builder (join_builder const & v)
-                :   other_range        (v.other_range)
-                ,   key_selector       (v.key_selector)
-                ,   other_key_selector (v.other_key_selector)
-                ,   combiner           (v.combiner)
+            CPPLINQ_INLINEMETHOD to_hash_lookup_builder (to_hash_lookup_builder const & v)
+                :   key_predicate   (v.key_predicate)
+                ,   hash            (v.hash)
+                ,   equal           (v.equal)
             {
             }
 
-            CPPLINQ_INLINEMETHOD join_builder (join_builder && v) CPPLINQ_NOEXCEPT
-                :   other_range        (std::move (v.other_range))
-                ,   key_selector       (std::move (v.key_selector))
-                ,   other_key_selector (std::move (v.other_key_selector))
-                ,   combiner           (std::move (v.combiner))
+            CPPLINQ_INLINEMETHOD to_hash_lookup_builder (to_hash_lookup_builder && v) CPPLINQ_NOEXCEPT
+                :   key_predicate   (std::move (v.key_predicate))
+                ,   hash            (std::move (v.hash))
+                ,   equal           (std::move (v.equal))
             {
             }
 
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD join_range<TRange, TOtherRange, TKeySelector, TOtherKeySelector, TCombiner> build (TRange range) const
+            CPPLINQ_INLINEMETHOD hash_lookup<
+                    typename get_transformed_type<key_predicate_type, typename TRange::value_type>::type
+                ,   typename TRange::value_type
+                ,   THash
+                ,   TEqual
+                > build (TRange range) const
             {
-                return join_range<TRange, TOtherRange, TKeySelector, TOtherKeySelector, TCombiner> (
-                        std::move (range)
-                    ,   other_range
-                    ,   key_selector
-                    ,   other_key_selector
-                    ,   combiner
-                    );
+                typedef hash_lookup<
+                    typename get_transformed_type<key_predicate_type, typename TRange::value_type>::type
+                ,   typename TRange::value_type
+                ,   THash
+                ,   TEqual
+                >   result_type;
+
+                return result_type (std::move (range), key_predicate, hash, equal);
             }
-        };
 
+        };
 
+        // -------------------------------------------------------------------------
+        // group<TKey, TValues> is the value type of group_by, values is a range
+        // over the elements of the group in source order
         // -------------------------------------------------------------------------
 
-        template<typename TRange>
-        struct distinct_range : base_range
+        template<typename TKey, typename TValues>
+        struct group
         {
-            typedef             distinct_range<TRange>                          this_type           ;
-            typedef             TRange                                          range_type          ;
+            typedef                 TKey                                key_type        ;
+            typedef                 TValues                             values_type     ;
 
-            typedef    typename cleanup_type<typename TRange::value_type>::type value_type          ;
-            typedef             value_type const &                              return_type         ;
-            enum
+            key_type                key     ;
+            values_type             values  ;
+
+            CPPLINQ_INLINEMETHOD group (
+                    key_type        key
+                ,   values_type     values
+                )
+                :   key     (std::move (key))
+                ,   values  (std::move (values))
             {
-                returns_reference   = 1 ,
-            };
+            }
 
-            typedef             std::set<value_type>               set_type                         ;
-            typedef    typename set_type::const_iterator           set_iterator_type                ;
+            CPPLINQ_INLINEMETHOD group (group const & v)
+                :   key     (v.key)
+                ,   values  (v.values)
+            {
+            }
 
-            range_type                  range               ;
-            set_type                    set                 ;
-            set_iterator_type           current             ;
+            CPPLINQ_INLINEMETHOD group (group && v) CPPLINQ_NOEXCEPT
+                :   key     (std::move (v.key))
+                ,   values  (std::move (v.values))
+            {
+            }
+        };
 
-            CPPLINQ_INLINEMETHOD distinct_range (
-                        range_type          range
-                ) CPPLINQ_NOEXCEPT
+        // The source shared by a group_by range and the values of its groups
+        template<typename TRange, typename TKeySelector, typename TElementSelector>
+        struct group_source
+        {
+            static typename TRange::value_type  get_source ()   ;
+            static          TKeySelector        get_selector () ;
+
+            typedef                 TRange                              range_type          ;
+            typedef                 TKeySelector                        key_selector_type   ;
+            typedef                 TElementSelector                    element_selector_type;
+            typedef        typename cleanup_type<decltype (get_selector () (get_source ()))>::type
+                                                                        key_type            ;
+
+            range_type              range           ;
+            key_selector_type       key_selector    ;
+            element_selector_type   element_selector;
+
+            opt<key_type>           upcoming_key    ;   // Key of range.front (), cleared at the end of range
+            opt<key_type>           group_key       ;
+            size_type               generation      ;   // Incremented for every group
+
+            CPPLINQ_INLINEMETHOD group_source (
+                    range_type              range
+                ,   key_selector_type       key_selector
+                ,   element_selector_type   element_selector
+                )
                 :   range               (std::move (range))
+                ,   key_selector        (std::move (key_selector))
+                ,   element_selector    (std::move (element_selector))
+                ,   generation          (0U)
             {
             }
 
-            CPPLINQ_INLINEMETHOD distinct_range (distinct_range const & v) CPPLINQ_NOEXCEPT
-                :   range               (v.range)
-                ,   set                 (v.set)
-                ,   current             (v.current)
+            CPPLINQ_METHOD void advance ()
             {
+                if (pull (query_group_by, range))
+                {
+                    upcoming_key = key_selector (range.front ());
+                }
+                else
+                {
+                    upcoming_key.clear ();
+                }
             }
 
-            CPPLINQ_INLINEMETHOD distinct_range (distinct_range && v) CPPLINQ_NOEXCEPT
-                :   range               (std::move (v.range))
-                ,   set                 (std::move (v.set))
-                ,   current             (std::move (v.current))
+            CPPLINQ_INLINEMETHOD bool in_group () const
             {
+                return upcoming_key && group_key && *upcoming_key == *group_key;
             }
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+        private:
+            CPPLINQ_INLINEMETHOD group_source (group_source const &);
+            CPPLINQ_INLINEMETHOD group_source & operator= (group_source const &);
+        };
+
+        // The values of a group can only be iterated once and only until the
+        // group_by range moves to the next group, after that they are empty
+        template<typename TSource>
+        struct group_values_range : base_range
+        {
+            static typename TSource::range_type::value_type get_source ()   ;
+            static typename TSource::element_selector_type  get_selector () ;
+
+            typedef                 group_values_range<TSource>         this_type       ;
+            typedef                 TSource                             source_type     ;
+
+            typedef        typename cleanup_type<decltype (get_selector () (get_source ()))>::type
+                                                                        value_type      ;
+            typedef                 value_type                          return_type     ;
+            enum
             {
-                return range_builder.build (*this);
-            }
+                returns_reference   = 0 ,
+                instrumented_as     = query_group_by ,
+            };
 
-            CPPLINQ_INLINEMETHOD return_type front () const
+            std::shared_ptr<source_type>    source      ;
+            size_type                       generation  ;
+            bool                            start       ;
+
+            CPPLINQ_INLINEMETHOD group_values_range (
+                    std::shared_ptr<source_type>    source
+                ,   size_type                       generation
+                ) CPPLINQ_NOEXCEPT
+                :   source      (std::move (source))
+                ,   generation  (generation)
+                ,   start       (true)
             {
-                return *current;
             }
 
-            CPPLINQ_INLINEMETHOD bool next ()
+            CPPLINQ_INLINEMETHOD group_values_range (group_values_range const & v) CPPLINQ_NOEXCEPT
+                :   source      (v.source)
+                ,   generation  (v.generation)
+                ,   start       (v.start)
             {
-                while (range.next ())
-                {
-                    auto result = set.insert (range.front ());
-                    if (result.second)
-                    {
-                        current = result.first;
-                        return true;
-                    }
-                }
+            }
 
-                return false;
+            CPPLINQ_INLINEMETHOD group_values_range (group_values_range && v) CPPLINQ_NOEXCEPT
+                :   source      (std::move (v.source))
+                ,   generation  (std::move (v.generation))
+                ,   start       (std::move (v.start))
+            {
             }
-        };
 
-        struct distinct_builder : base_builder
-        {
-            typedef                 distinct_builder                    this_type               ;
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            {
+                return range_builder.build (*this);
+            }
 
-            CPPLINQ_INLINEMETHOD distinct_builder () CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD memory_resource * resource () const CPPLINQ_NOEXCEPT
             {
+                CPPLINQ_ASSERT (source);
+                return get_memory_resource (source->range);
             }
 
-            CPPLINQ_INLINEMETHOD distinct_builder (distinct_builder const & v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD return_type front () const
             {
+                CPPLINQ_ASSERT (source);
+                return source->element_selector (source->range.front ());
             }
 
-            CPPLINQ_INLINEMETHOD distinct_builder (distinct_builder && v) CPPLINQ_NOEXCEPT
-            {
-            }
+            CPPLINQ_METHOD bool next ()
+            {
+                if (!source || source->generation != generation || !source->in_group ())
+                {
+                    return false;
+                }
+
+                // The first value of the group has already been pulled by the group_by range
+                if (start)
+                {
+                    start = false;
+                    return true;
+                }
+
+                source->advance ();
 
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD distinct_range<TRange> build (TRange range) const
-            {
-                return distinct_range<TRange> (std::move (range));
+                return source->in_group ();
             }
         };
 
-        // -------------------------------------------------------------------------
-
-        template<typename TRange, typename TOtherRange>
-        struct union_range : base_range
+        // Yields a group for every run of values with equal keys without
+        // buffering any values, copies of a started range share the source
+        template<typename TRange, typename TKeySelector, typename TElementSelector>
+        struct group_by_sorted_range : base_range
         {
-            typedef             union_range<TRange, TOtherRange>                this_type           ;
-            typedef             TRange                                          range_type          ;
-            typedef             TOtherRange                                     other_range_type    ;
-
-            typedef    typename cleanup_type<typename TRange::value_type>::type value_type          ;
-            typedef             value_type const &                              return_type         ;
+            typedef                 group_by_sorted_range<TRange, TKeySelector, TElementSelector>
+                                                                        this_type       ;
+            typedef                 TRange                              range_type      ;
+            typedef                 TKeySelector                        key_selector_type   ;
+            typedef                 TElementSelector                    element_selector_type;
+
+            typedef                 group_source<TRange, TKeySelector, TElementSelector>
+                                                                        source_type     ;
+            typedef        typename source_type::key_type               key_type        ;
+            typedef                 group_values_range<source_type>     values_type     ;
+            typedef                 group<key_type, values_type>        value_type      ;
+            typedef                 value_type const &                  return_type     ;
             enum
             {
                 returns_reference   = 1 ,
+                instrumented_as     = query_group_by ,
             };
 
-            typedef             std::set<value_type>               set_type                         ;
-            typedef    typename set_type::const_iterator           set_iterator_type                ;
-
+            range_type                      range           ;
+            key_selector_type               key_selector    ;
+            element_selector_type           element_selector;
 
-            range_type                  range               ;
-            other_range_type            other_range         ;
-            set_type                    set                 ;
-            set_iterator_type           current             ;
+            std::shared_ptr<source_type>    source          ;
+            opt<value_type>                 current         ;
 
-            CPPLINQ_INLINEMETHOD union_range (
-                        range_type          range
-                    ,   other_range_type    other_range
+            CPPLINQ_INLINEMETHOD group_by_sorted_range (
+                    range_type              range
+                ,   key_selector_type       key_selector
+                ,   element_selector_type   element_selector
                 ) CPPLINQ_NOEXCEPT
                 :   range               (std::move (range))
-                ,   other_range         (std::move (other_range))
+                ,   key_selector        (std::move (key_selector))
+                ,   element_selector    (std::move (element_selector))
             {
             }
 
-            CPPLINQ_INLINEMETHOD union_range (union_range const & v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD group_by_sorted_range (group_by_sorted_range const & v)
                 :   range               (v.range)
-                ,   other_range         (v.other_range)
-                ,   set                 (v.set)
+                ,   key_selector        (v.key_selector)
+                ,   element_selector    (v.element_selector)
+                ,   source              (v.source)
                 ,   current             (v.current)
             {
             }
 
-            CPPLINQ_INLINEMETHOD union_range (union_range && v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD group_by_sorted_range (group_by_sorted_range && v) CPPLINQ_NOEXCEPT
                 :   range               (std::move (v.range))
-                ,   other_range         (std::move (v.other_range))
-                ,   set                 (std::move (v.set))
+                ,   key_selector        (std::move (v.key_selector))
+                ,   element_selector    (std::move (v.element_selector))
+                ,   source              (std::move (v.source))
                 ,   current             (std::move (v.current))
             {
             }
@@ -2531,1615 +9991,1907 @@ namespace cpplinq
                 return range_builder.build (*this);
             }
 
+            // The source range is moved into source by the first next ()
+            CPPLINQ_INLINEMETHOD memory_resource * resource () const CPPLINQ_NOEXCEPT
+            {
+                return source
+                    ?   get_memory_resource (source->range)
+                    :   get_memory_resource (range)
+                    ;
+            }
+
             CPPLINQ_INLINEMETHOD return_type front () const
             {
+                CPPLINQ_ASSERT (current);
                 return *current;
             }
 
-            CPPLINQ_INLINEMETHOD bool next ()
+            CPPLINQ_METHOD bool next ()
             {
-                while (range.next ())
+                if (!source)
                 {
-                    auto result = set.insert (range.front ());
-                    if (result.second)
+                    source = std::make_shared<source_type> (std::move (range), key_selector, element_selector);
+                    source->advance ();
+                }
+                else
+                {
+                    // Skips what is left of the current group
+                    while (source->in_group ())
                     {
-                        current = result.first;
-                        return true;
+                        source->advance ();
                     }
                 }
 
-                while (other_range.next ())
+                if (!source->upcoming_key)
                 {
-                    auto result = set.insert (other_range.front ());
-                    if (result.second)
-                    {
-                        current = result.first;
-                        return true;
-                    }
+                    current.clear ();
+                    return false;
                 }
 
-                return false;
+                source->group_key = *source->upcoming_key;
+                ++source->generation;
+
+                current = value_type (*source->group_key, values_type (source, source->generation));
+
+                return true;
             }
         };
 
-        template <typename TOtherRange>
-        struct union_builder : base_builder
+        template<typename TKeySelector, typename TElementSelector>
+        struct group_by_sorted_builder : base_builder
         {
-            typedef                 union_builder<TOtherRange>              this_type       ;
-            typedef                 TOtherRange                             other_range_type;
+            typedef                 group_by_sorted_builder<TKeySelector, TElementSelector>
+                                                                        this_type           ;
+            typedef                 TKeySelector                        key_selector_type   ;
+            typedef                 TElementSelector                    element_selector_type;
 
-            other_range_type        other_range         ;
+            key_selector_type       key_selector    ;
+            element_selector_type   element_selector;
 
-            CPPLINQ_INLINEMETHOD union_builder (TOtherRange other_range) CPPLINQ_NOEXCEPT
-                : other_range (std::move (other_range))
+            CPPLINQ_INLINEMETHOD group_by_sorted_builder (
+                    key_selector_type       key_selector
+                ,   element_selector_type   element_selector
+                ) CPPLINQ_NOEXCEPT
+                :   key_selector        (std::move (key_selector))
+                ,   element_selector    (std::move (element_selector))
             {
             }
 
-            CPPLINQ_INLINEMETHOD union_builder (union_builder const & v) CPPLINQ_NOEXCEPT
-                : other_range (v.other_range)
+            CPPLINQ_INLINEMETHOD group_by_sorted_builder (group_by_sorted_builder const & v)
+                :   key_selector        (v.key_selector)
+                ,   element_selector    (v.element_selector)
             {
             }
 
-            CPPLINQ_INLINEMETHOD union_builder (union_builder && v) CPPLINQ_NOEXCEPT
-                : other_range (std::move (v.other_range))
+            CPPLINQ_INLINEMETHOD group_by_sorted_builder (group_by_sorted_builder && v) CPPLINQ_NOEXCEPT
+                :   key_selector        (std::move (v.key_selector))
+                ,   element_selector    (std::move (v.element_selector))
             {
             }
 
-            template <typename TRange>
-            CPPLINQ_INLINEMETHOD union_range<TRange, TOtherRange> build (TRange range) const
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD group_by_sorted_range<TRange, TKeySelector, TElementSelector> build (TRange range) const
             {
-                return union_range<TRange, TOtherRange> (std::move (range), std::move (other_range));
+                return group_by_sorted_range<TRange, TKeySelector, TElementSelector> (std::move (range), key_selector, element_selector);
             }
         };
 
-        // -------------------------------------------------------------------------
-
-        template<typename TRange, typename TOtherRange>
-        struct intersect_range : base_range
+        // Unsorted values are stable sorted on the key first, groups are
+        // yielded in key order like the keys of a lookup
+        template<typename TKeySelector, typename TElementSelector>
+        struct group_by_builder : base_builder
         {
-            typedef             intersect_range<TRange, TOtherRange>            this_type           ;
-            typedef             TRange                                          range_type          ;
-            typedef             TOtherRange                                     other_range_type    ;
-
-            typedef    typename cleanup_type<typename TRange::value_type>::type value_type          ;
-            typedef             value_type const &                              return_type         ;
-            enum
-            {
-                returns_reference   = 1 ,
-            };
-
-            typedef             std::set<value_type>               set_type                         ;
-            typedef    typename set_type::const_iterator           set_iterator_type                ;
+            typedef                 group_by_builder<TKeySelector, TElementSelector>
+                                                                        this_type           ;
+            typedef                 TKeySelector                        key_selector_type   ;
+            typedef                 TElementSelector                    element_selector_type;
 
+            key_selector_type       key_selector    ;
+            element_selector_type   element_selector;
 
-            range_type                  range               ;
-            other_range_type            other_range         ;
-            set_type                    set                 ;
-            set_iterator_type           current             ;
-            bool                        start               ;
-
-            CPPLINQ_INLINEMETHOD intersect_range (
-                        range_type          range
-                    ,   other_range_type    other_range
+            CPPLINQ_INLINEMETHOD group_by_builder (
+                    key_selector_type       key_selector
+                ,   element_selector_type   element_selector
                 ) CPPLINQ_NOEXCEPT
-                :   range               (std::move (range))
-                ,   other_range         (std::move (other_range))
-                ,   start               (true)
+                :   key_selector        (std::move (key_selector))
+                ,   element_selector    (std::move (element_selector))
             {
             }
 
-            CPPLINQ_INLINEMETHOD intersect_range (intersect_range const & v) CPPLINQ_NOEXCEPT
-                :   range               (v.range)
-                ,   other_range         (v.other_range)
-                ,   set                 (v.set)
-                ,   current             (v.current)
-                ,   start               (v.start)
-            {
-            }
-
-            CPPLINQ_INLINEMETHOD intersect_range (intersect_range && v) CPPLINQ_NOEXCEPT
-                :   range               (std::move (v.range))
-                ,   other_range         (std::move (v.other_range))
-                ,   set                 (std::move (v.set))
-                ,   current             (std::move (v.current))
-                ,   start               (std::move (v.start))
+            CPPLINQ_INLINEMETHOD group_by_builder (group_by_builder const & v)
+                :   key_selector        (v.key_selector)
+                ,   element_selector    (v.element_selector)
             {
             }
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            CPPLINQ_INLINEMETHOD group_by_builder (group_by_builder && v) CPPLINQ_NOEXCEPT
+                :   key_selector        (std::move (v.key_selector))
+                ,   element_selector    (std::move (v.element_selector))
             {
-                return range_builder.build (*this);
             }
 
-            CPPLINQ_INLINEMETHOD return_type front () const
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD group_by_sorted_range<orderby_range<TRange, TKeySelector>, TKeySelector, TElementSelector> build (TRange range) const
             {
-                CPPLINQ_ASSERT (!start);
-                return *current;
+                return group_by_sorted_range<orderby_range<TRange, TKeySelector>, TKeySelector, TElementSelector> (
+                        orderby_range<TRange, TKeySelector> (std::move (range), key_selector, true)
+                    ,   key_selector
+                    ,   element_selector
+                    );
             }
+        };
 
-            CPPLINQ_INLINEMETHOD bool next ()
-            {
-                if (start)
-                {
-                    start = false;
+        // -------------------------------------------------------------------------
 
-                    while (other_range.next ())
-                    {
-                        set.insert (other_range.front ());
-                    }
+        template<typename TPredicate>
+        struct for_each_builder : base_builder
+        {
+            typedef                 for_each_builder<TPredicate>    this_type       ;
+            typedef                 TPredicate                      predicate_type  ;
 
-                    while (range.next ())
-                    {
-                        current = set.find (range.front ());
-                        if (current != set.end ())
-                        {
-                            return true;
-                        }
-                    }
+            predicate_type          predicate;
 
-                    set.clear ();
+            CPPLINQ_INLINEMETHOD explicit for_each_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
+                :   predicate    (std::move (predicate))
+            {
+            }
 
-                    return false;
-                }
+            CPPLINQ_INLINEMETHOD for_each_builder (for_each_builder const & v) CPPLINQ_NOEXCEPT
+                :   predicate (v.predicate)
+            {
+            }
 
-                if (set.empty ())
-                {
-                    return false;
-                }
+            CPPLINQ_INLINEMETHOD for_each_builder (for_each_builder && v) CPPLINQ_NOEXCEPT
+                :   predicate (std::move (v.predicate))
+            {
+            }
 
-                set.erase (current);
 
-                while (range.next ())
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD void build (TRange range) const
+            {
+                while (pull (query_for_each, range))
                 {
-                    current = set.find (range.front ());
-                    if (current != set.end ())
-                    {
-                        return true;
-                    }
+                    predicate (range.front ());
                 }
-
-                return false;
             }
+
         };
 
-        template <typename TOtherRange>
-        struct intersect_builder : base_builder
+        // -------------------------------------------------------------------------
+
+        template<typename TPredicate>
+        struct first_predicate_builder : base_builder
         {
-            typedef                 intersect_builder<TOtherRange>          this_type       ;
-            typedef                 TOtherRange                             other_range_type;
+            typedef                 first_predicate_builder<TPredicate>     this_type           ;
+            typedef                 TPredicate                              predicate_type      ;
 
-            other_range_type        other_range         ;
+            predicate_type          predicate   ;
 
-            CPPLINQ_INLINEMETHOD intersect_builder (TOtherRange other_range) CPPLINQ_NOEXCEPT
-                : other_range (std::move (other_range))
+            CPPLINQ_INLINEMETHOD first_predicate_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
+                :   predicate (std::move (predicate))
             {
             }
 
-            CPPLINQ_INLINEMETHOD intersect_builder (intersect_builder const & v) CPPLINQ_NOEXCEPT
-                : other_range (v.other_range)
+            CPPLINQ_INLINEMETHOD first_predicate_builder (first_predicate_builder const & v) CPPLINQ_NOEXCEPT
+                :   predicate (v.predicate)
             {
             }
 
-            CPPLINQ_INLINEMETHOD intersect_builder (intersect_builder && v) CPPLINQ_NOEXCEPT
-                : other_range (std::move (v.other_range))
+            CPPLINQ_INLINEMETHOD first_predicate_builder (first_predicate_builder && v) CPPLINQ_NOEXCEPT
+                : predicate (std::move (v.predicate))
             {
             }
 
-            template <typename TRange>
-            CPPLINQ_INLINEMETHOD intersect_range<TRange, TOtherRange> build (TRange range) const
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range)
             {
-                return intersect_range<TRange, TOtherRange> (std::move (range), std::move (other_range));
+                while (pull (query_first, range))
+                {
+                    if (predicate (range.front ()))
+                    {
+                        return range.front ();
+                    }
+                }
+
+                throw sequence_empty_exception ();
             }
+
         };
 
         // -------------------------------------------------------------------------
 
-        template<typename TRange, typename TOtherRange>
-        struct except_range : base_range
+        struct first_builder : base_builder
         {
-            typedef             except_range<TRange, TOtherRange>               this_type           ;
-            typedef             TRange                                          range_type          ;
-            typedef             TOtherRange                                     other_range_type    ;
-
-            typedef    typename cleanup_type<typename TRange::value_type>::type value_type          ;
-            typedef             value_type const &                              return_type         ;
-            enum
-            {
-                returns_reference   = 1 ,
-            };
-
-            typedef             std::set<value_type>               set_type                         ;
-            typedef    typename set_type::const_iterator           set_iterator_type                ;
-
-            range_type                  range               ;
-            other_range_type            other_range         ;
-            set_type                    set                 ;
-            set_iterator_type           current             ;
-            bool                        start               ;
-
-            CPPLINQ_INLINEMETHOD except_range (
-                        range_type          range
-                    ,   other_range_type    other_range
-                ) CPPLINQ_NOEXCEPT
-                :   range               (std::move (range))
-                ,   other_range         (std::move (other_range))
-                ,   start               (true)
-            {
-            }
-
-            CPPLINQ_INLINEMETHOD except_range (except_range const & v) CPPLINQ_NOEXCEPT
-                :   range               (v.range)
-                ,   other_range         (v.other_range)
-                ,   set                 (v.set)
-                ,   current             (v.current)
-                ,   start               (v.start)
-            {
-            }
+            typedef                 first_builder                   this_type       ;
 
-            CPPLINQ_INLINEMETHOD except_range (except_range && v) CPPLINQ_NOEXCEPT
-                :   range               (std::move (v.range))
-                ,   other_range         (std::move (v.other_range))
-                ,   set                 (std::move (v.set))
-                ,   current             (std::move (v.current))
-                ,   start               (std::move (v.start))
+            CPPLINQ_INLINEMETHOD first_builder () CPPLINQ_NOEXCEPT
             {
             }
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            CPPLINQ_INLINEMETHOD first_builder (first_builder const & v) CPPLINQ_NOEXCEPT
             {
-                return range_builder.build (*this);
             }
 
-            CPPLINQ_INLINEMETHOD return_type front () const
+            CPPLINQ_INLINEMETHOD first_builder (first_builder && v) CPPLINQ_NOEXCEPT
             {
-                return *current;
             }
 
-            CPPLINQ_INLINEMETHOD bool next ()
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range)
             {
-                if (start)
-                {
-                    start = false;
-                    while (other_range.next ())
-                    {
-                        set.insert (other_range.front ());
-                    }
-                }
+                limit_range (range, 1U);
 
-                while (range.next ())
+                if (pull (query_first, range))
                 {
-                    auto result = set.insert (range.front ());
-                    if (result.second)
-                    {
-                        current = result.first;
-                        return true;
-                    }
+                    return range.front ();
                 }
 
-                return false;
+                throw sequence_empty_exception ();
             }
+
         };
 
-        template <typename TOtherRange>
-        struct except_builder : base_builder
+        // -------------------------------------------------------------------------
+
+        template<typename TPredicate>
+        struct first_or_default_predicate_builder : base_builder
         {
-            typedef                 union_builder<TOtherRange>              this_type       ;
-            typedef                 TOtherRange                             other_range_type;
+            typedef                 first_or_default_predicate_builder<TPredicate>  this_type       ;
+            typedef                 TPredicate                                      predicate_type  ;
 
-            other_range_type        other_range         ;
+            predicate_type          predicate;
 
-            CPPLINQ_INLINEMETHOD except_builder (TOtherRange other_range) CPPLINQ_NOEXCEPT
-                : other_range (std::move (other_range))
+            CPPLINQ_INLINEMETHOD first_or_default_predicate_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
+                :   predicate (std::move (predicate))
             {
             }
 
-            CPPLINQ_INLINEMETHOD except_builder (except_builder const & v) CPPLINQ_NOEXCEPT
-                : other_range (v.other_range)
+            CPPLINQ_INLINEMETHOD first_or_default_predicate_builder (first_or_default_predicate_builder const & v) CPPLINQ_NOEXCEPT
+                :   predicate (v.predicate)
             {
             }
 
-            CPPLINQ_INLINEMETHOD except_builder (except_builder && v) CPPLINQ_NOEXCEPT
-                : other_range (std::move (v.other_range))
+            CPPLINQ_INLINEMETHOD first_or_default_predicate_builder (first_or_default_predicate_builder && v) CPPLINQ_NOEXCEPT
+                : predicate (std::move (v.predicate))
             {
             }
 
-            template <typename TRange>
-            CPPLINQ_INLINEMETHOD except_range<TRange, TOtherRange> build (TRange range) const
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range) const
             {
-                return except_range<TRange, TOtherRange> (std::move (range), std::move (other_range));
+                while (pull (query_first_or_default, range))
+                {
+                    if (predicate (range.front ()))
+                    {
+                        return range.front ();
+                    }
+                }
+
+                return typename TRange::value_type ();
             }
+
         };
 
-        // -------------------------------------------------------------------------
 
-        template<typename TRange, typename TOtherRange>
-        struct concat_range : base_range
+        struct first_or_default_builder : base_builder
         {
-            typedef             concat_range<TRange, TOtherRange>                       this_type           ;
-            typedef             TRange                                                  range_type          ;
-            typedef             TOtherRange                                             other_range_type    ;
-
-            typedef typename    cleanup_type<typename TRange::value_type>::type         value_type          ;
-            typedef typename    cleanup_type<typename TOtherRange::value_type>::type    other_value_type    ;
-            typedef             value_type                                              return_type         ;
+            typedef                 first_or_default_builder                   this_type       ;
 
-            enum
+            CPPLINQ_INLINEMETHOD first_or_default_builder () CPPLINQ_NOEXCEPT
             {
-                returns_reference   = 0         ,
-            };
+            }
 
-            enum state
+            CPPLINQ_INLINEMETHOD first_or_default_builder (first_or_default_builder const & v) CPPLINQ_NOEXCEPT
             {
-                state_initial                   ,
-                state_iterating_range           ,
-                state_iterating_other_range     ,
-                state_end                       ,
-            };
-
-            range_type                  range               ;
-            other_range_type            other_range         ;
-            state                       state               ;
+            }
 
-            CPPLINQ_INLINEMETHOD concat_range (
-                        range_type          range
-                    ,   other_range_type    other_range
-                ) CPPLINQ_NOEXCEPT
-                :   range               (std::move (range))
-                ,   other_range         (std::move (other_range))
-                ,   state               (state_initial)
+            CPPLINQ_INLINEMETHOD first_or_default_builder (first_or_default_builder && v) CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD concat_range (concat_range const & v) CPPLINQ_NOEXCEPT
-                :   range               (v.range)
-                ,   other_range         (v.other_range)
-                ,   state               (v.state)
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range) const
             {
+                limit_range (range, 1U);
+
+                if (pull (query_first_or_default, range))
+                {
+                    return range.front ();
+                }
+
+                return typename TRange::value_type ();
             }
 
-            CPPLINQ_INLINEMETHOD concat_range (concat_range && v) CPPLINQ_NOEXCEPT
-                :   range               (std::move (v.range))
-                ,   other_range         (std::move (v.other_range))
-                ,   state               (std::move (v.state))
+        };
+
+        // -------------------------------------------------------------------------
+        template<typename TPredicate>
+        struct last_or_default_predicate_builder : base_builder
+        {
+            typedef                 last_or_default_predicate_builder<TPredicate>   this_type       ;
+            typedef                 TPredicate                                      predicate_type  ;
+
+            predicate_type          predicate;
+
+            CPPLINQ_INLINEMETHOD last_or_default_predicate_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
+                :   predicate (std::move (predicate))
             {
             }
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            CPPLINQ_INLINEMETHOD last_or_default_predicate_builder (last_or_default_predicate_builder const & v) CPPLINQ_NOEXCEPT
+                :   predicate (v.predicate)
             {
-                return range_builder.build (*this);
             }
 
-            CPPLINQ_INLINEMETHOD return_type front () const
+            CPPLINQ_INLINEMETHOD last_or_default_predicate_builder (last_or_default_predicate_builder && v) CPPLINQ_NOEXCEPT
+                :   predicate (std::move (v.predicate))
             {
-                switch (state)
-                {
-                case state_initial:
-                case state_end:
-                default:
-                    CPPLINQ_ASSERT (false);       // Intentionally falls through
-                case state_iterating_range:
-                    return range.front ();
-                case state_iterating_other_range:
-                    return other_range.front ();
-                };
             }
 
-            CPPLINQ_INLINEMETHOD bool next ()
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range) const
             {
-                switch (state)
+                auto current = typename TRange::value_type ();
+
+                while (pull (query_last_or_default, range))
                 {
-                case state_initial:
-                    if (range.next ())
+                    if (predicate (range.front ()))
                     {
-                        state = state_iterating_range;
-                        return true;
+                        current = store_front (query_last_or_default, range);
                     }
+                }
 
-                    if (other_range.next ())
-                    {
-                        state = state_iterating_other_range;
-                        return true;
-                    }
+                return current;
+            }
 
-                    state = state_end;
-                    return false;
-                case state_iterating_range:
-                    if (range.next ())
-                    {
-                        return true;
-                    }
+        };
 
-                    if (other_range.next ())
-                    {
-                        state = state_iterating_other_range;
-                        return true;
-                    }
+        struct last_or_default_builder : base_builder
+        {
+            typedef                 last_or_default_builder                   this_type       ;
 
-                    state = state_end;
-                    return false;
-                case state_iterating_other_range:
-                    if (other_range.next ())
-                    {
-                        return true;
-                    }
+            CPPLINQ_INLINEMETHOD last_or_default_builder () CPPLINQ_NOEXCEPT
+            {
+            }
 
-                    state = state_end;
-                    return false;
-                case state_end:
-                default:
-                    return false;
-                }
+            CPPLINQ_INLINEMETHOD last_or_default_builder (last_or_default_builder const & v) CPPLINQ_NOEXCEPT
+            {
             }
-        };
 
-        template <typename TOtherRange>
-        struct concat_builder : base_builder
-        {
-            typedef                 concat_builder<TOtherRange>             this_type       ;
-            typedef                 TOtherRange                             other_range_type;
+            CPPLINQ_INLINEMETHOD last_or_default_builder (last_or_default_builder && v) CPPLINQ_NOEXCEPT
+            {
+            }
 
-            other_range_type        other_range         ;
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range) const
+            {
+                return build (
+                        std::move (range)
+                    ,   std::integral_constant<bool, reverse_traits<TRange>::is_reversible != 0> ()
+                    );
+            }
 
-            CPPLINQ_INLINEMETHOD concat_builder (TOtherRange other_range) CPPLINQ_NOEXCEPT
-                : other_range (std::move (other_range))
+            // The first value of the reversed range is the last value
+            template<typename TRange>
+            CPPLINQ_METHOD typename TRange::value_type build (TRange range, std::true_type) const
             {
+                auto reversed = reverse_traits<TRange>::reverse_of (range);
+                if (pull (query_last_or_default, reversed))
+                {
+                    return reversed.front ();
+                }
+
+                return typename TRange::value_type ();
             }
 
-            CPPLINQ_INLINEMETHOD concat_builder (concat_builder const & v) CPPLINQ_NOEXCEPT
-                : other_range (v.other_range)
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range, std::false_type) const
             {
+                return build_forward (range, is_random_access_range<TRange> ());
             }
 
-            CPPLINQ_INLINEMETHOD concat_builder (concat_builder && v) CPPLINQ_NOEXCEPT
-                : other_range (std::move (v.other_range))
+            template<typename TRange>
+            static CPPLINQ_METHOD typename TRange::value_type build_forward (TRange & range, std::false_type)
             {
+                auto current = typename TRange::value_type ();
+
+                while (pull (query_last_or_default, range))
+                {
+                    current = store_front (query_last_or_default, range);
+                }
+
+                return current;
             }
 
-            template <typename TRange>
-            CPPLINQ_INLINEMETHOD concat_range<TRange, TOtherRange> build (TRange range) const
+            template<typename TRange>
+            static CPPLINQ_METHOD typename TRange::value_type build_forward (TRange & range, std::true_type)
             {
-                return concat_range<TRange, TOtherRange> (std::move (range), std::move (other_range));
+                auto size = range.size ();
+                if (size > 0U)
+                {
+                    return range.at (size - 1U);
+                }
+
+                return typename TRange::value_type ();
             }
+
         };
 
         // -------------------------------------------------------------------------
 
-        namespace experimental
+        template <typename TPredicate>
+        struct count_predicate_builder : base_builder
         {
-            // -------------------------------------------------------------------------
+            typedef                 count_predicate_builder<TPredicate>     this_type       ;
+            typedef                 TPredicate                              predicate_type  ;
 
-            // TODO: Verify that container range aggregator has the right semantics
+            predicate_type          predicate   ;
 
-            template<typename TRange>
-            struct container_iterator
+            CPPLINQ_INLINEMETHOD count_predicate_builder (predicate_type  predicate) CPPLINQ_NOEXCEPT
+                :   predicate   (std::move (predicate))
             {
-                typedef                 std::forward_iterator_tag   iterator_category   ;
-                typedef     typename    TRange::value_type          value_type          ;
-                typedef     typename    TRange::return_type         return_type         ;
-                enum
-                {
-                    returns_reference   = TRange::returns_reference   ,
-                };
+            }
+
+            CPPLINQ_INLINEMETHOD count_predicate_builder (count_predicate_builder const & v) CPPLINQ_NOEXCEPT
+                :   predicate   (v.predicate)
+            {
+            }
 
-                typedef                 std::ptrdiff_t              difference_type     ;
-                typedef                 value_type*                 pointer             ;
-                typedef                 value_type&                 reference           ;
+            CPPLINQ_INLINEMETHOD count_predicate_builder (count_predicate_builder && v) CPPLINQ_NOEXCEPT
+                :   predicate   (std::move (v.predicate))
+            {
+            }
 
-                typedef                 container_iterator<TRange>  this_type   ;
-                typedef                 TRange                      range_type  ;
 
-                bool                    has_value                               ;
-                opt<range_type>         range                                   ;
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD size_type build (TRange range) const
+            {
+                return build (std::move (range), is_partitionable<TRange> ());
+            }
 
-                CPPLINQ_INLINEMETHOD container_iterator ()   CPPLINQ_NOEXCEPT
-                    :   has_value   (false)
+            template<typename TRange>
+            CPPLINQ_METHOD size_type build (TRange range, std::false_type) const
+            {
+                size_type count = 0U;
+                while (pull (query_count, range))
                 {
+                    if (predicate (range.front ()))
+                    {
+                        ++count;
+                    }
                 }
+                return count;
+            }
 
-                CPPLINQ_INLINEMETHOD container_iterator (range_type r)   CPPLINQ_NOEXCEPT
-                    :   range      (std::move (r))
-                {
-                    has_value = range && range->next ();
-                }
+            template<typename TRange>
+            CPPLINQ_METHOD size_type build (TRange range, std::true_type) const
+            {
+                return parallel_reduce (
+                        range
+                    ,   *this
+                    ,   [] (size_type l, size_type r) { return l + r; }
+                    );
+            }
 
-                CPPLINQ_INLINEMETHOD container_iterator (container_iterator const & v) CPPLINQ_NOEXCEPT
-                    :   has_value   (v.has_value)
-                    ,   range       (v.range)
-                {
-                }
+        };
 
-                CPPLINQ_INLINEMETHOD container_iterator (container_iterator && v) CPPLINQ_NOEXCEPT
-                    :   has_value   (std::move (v.has_value))
-                    ,   range       (std::move (v.range))
-                {
-                }
+        struct count_builder : base_builder
+        {
+            typedef                 count_builder                   this_type       ;
 
-                CPPLINQ_INLINEMETHOD return_type        operator* () const
-                {
-                    CPPLINQ_ASSERT (has_value);
-                    CPPLINQ_ASSERT (range);
-                    return range->front ();
-                }
+            CPPLINQ_INLINEMETHOD count_builder () CPPLINQ_NOEXCEPT
+            {
+            }
 
-                CPPLINQ_INLINEMETHOD value_type const * operator-> () const
-                {
-                    static_assert (
-                            returns_reference
-                        ,   "operator-> requires a range that returns a reference, typically select causes ranges to return values not references"
-                        );
-                    return &range->front ();
-                }
+            CPPLINQ_INLINEMETHOD count_builder (count_builder const & v) CPPLINQ_NOEXCEPT
+            {
+            }
 
-                CPPLINQ_INLINEMETHOD this_type & operator++()
-                {
-                    if (has_value && range)
-                    {
-                        has_value = range->next ();
-                    }
+            CPPLINQ_INLINEMETHOD count_builder (count_builder && v) CPPLINQ_NOEXCEPT
+            {
+            }
 
-                    return *this;
-                }
 
-                CPPLINQ_INLINEMETHOD bool operator== (this_type const & v) const CPPLINQ_NOEXCEPT
-                {
-                    if (!has_value && !v.has_value)
-                    {
-                        return true;
-                    }
-                    else if (has_value && has_value && range.get_ptr () == v.range.get_ptr ())
-                    {
-                        return true;
-                    }
-                    else
-                    {
-                        return false;
-                    }
-                }
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD size_type build (TRange range) const
+            {
+                return build (std::move (range), is_partitionable<TRange> ());
+            }
 
-                CPPLINQ_INLINEMETHOD bool operator!= (this_type const & v) const CPPLINQ_NOEXCEPT
+            template<typename TRange>
+            CPPLINQ_METHOD size_type build (TRange range, std::false_type) const
+            {
+                return build_sequential (range, is_random_access_range<TRange> ());
+            }
+
+            template<typename TRange>
+            static CPPLINQ_METHOD size_type build_sequential (TRange & range, std::false_type)
+            {
+                size_type count = 0U;
+                while (pull (query_count, range))
                 {
-                    return !(*this == v);
+                    ++count;
                 }
-            };
+                return count;
+            }
 
+            // Random access ranges know their size
             template<typename TRange>
-            struct container
+            static CPPLINQ_INLINEMETHOD size_type build_sequential (TRange & range, std::true_type)
             {
-                typedef                 container<TRange>   this_type                   ;
-                typedef                 TRange              range_type                  ;
-                typedef                 typename TRange::value_type     value_type      ;
-                typedef                 typename TRange::return_type    return_type     ;
-                enum
-                {
-                    returns_reference   = TRange::returns_reference   ,
-                };
+                return range.size ();
+            }
 
-                range_type              range   ;
+            template<typename TRange>
+            CPPLINQ_METHOD size_type build (TRange range, std::true_type) const
+            {
+                return parallel_reduce (
+                        range
+                    ,   *this
+                    ,   [] (size_type l, size_type r) { return l + r; }
+                    );
+            }
 
-                CPPLINQ_INLINEMETHOD explicit container (TRange range)
-                    :   range (std::move (range))
-                {
-                }
+        };
 
-                CPPLINQ_INLINEMETHOD container (container const & v) CPPLINQ_NOEXCEPT
-                    :   range       (v.range)
-                {
-                }
+        // -------------------------------------------------------------------------
 
-                CPPLINQ_INLINEMETHOD container (container && v) CPPLINQ_NOEXCEPT
-                    :   range       (std::move (v.range))
-                {
-                }
+        template <typename TSelector>
+        struct sum_selector_builder : base_builder
+        {
+            typedef                 sum_selector_builder<TSelector>     this_type       ;
+            typedef                 TSelector                           selector_type   ;
 
-                CPPLINQ_INLINEMETHOD container_iterator<TRange>  begin () CPPLINQ_NOEXCEPT
-                {
-                    return container_iterator<TRange>(range);
-                }
+            selector_type           selector;
 
-                CPPLINQ_INLINEMETHOD container_iterator<TRange>  end () CPPLINQ_NOEXCEPT
-                {
-                    return container_iterator<TRange>();
-                }
+            CPPLINQ_INLINEMETHOD sum_selector_builder (selector_type selector) CPPLINQ_NOEXCEPT
+                :   selector (std::move (selector))
+            {
+            }
 
-            };
+            CPPLINQ_INLINEMETHOD sum_selector_builder (sum_selector_builder const & v) CPPLINQ_NOEXCEPT
+                :   selector (v.selector)
+            {
+            }
 
-            struct container_builder : base_builder
+            CPPLINQ_INLINEMETHOD sum_selector_builder (sum_selector_builder && v) CPPLINQ_NOEXCEPT
+                :   selector (std::move (v.selector))
             {
-                typedef                 container_builder       this_type       ;
+            }
 
-                CPPLINQ_INLINEMETHOD container_builder () CPPLINQ_NOEXCEPT
-                {
-                }
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD typename get_transformed_type<selector_type, typename TRange::value_type>::type build (TRange range) const
+            {
+                return build (std::move (range), is_partitionable<TRange> ());
+            }
 
-                CPPLINQ_INLINEMETHOD container_builder (container_builder const & v) CPPLINQ_NOEXCEPT
-                {
-                }
+            template<typename TRange>
+            CPPLINQ_METHOD typename get_transformed_type<selector_type, typename TRange::value_type>::type build (TRange range, std::false_type) const
+            {
+                typedef typename get_transformed_type<selector_type, typename TRange::value_type>::type value_type;
 
-                CPPLINQ_INLINEMETHOD container_builder (container_builder && v) CPPLINQ_NOEXCEPT
+                auto sum = value_type ();
+                while (pull (query_sum, range))
                 {
+                    sum += selector (range.front ());
                 }
+                return sum;
+            }
 
-                template<typename TRange>
-                CPPLINQ_METHOD container<TRange> build (TRange range) const
-                {
-                    return container<TRange> (std::move (range));
-                }
+            template<typename TRange>
+            CPPLINQ_METHOD typename get_transformed_type<selector_type, typename TRange::value_type>::type build (TRange range, std::true_type) const
+            {
+                typedef typename get_transformed_type<selector_type, typename TRange::value_type>::type value_type;
 
-            };
-        }
+                return parallel_reduce (
+                        range
+                    ,   *this
+                    ,   [] (value_type l, value_type r) -> value_type { return l + r; }
+                    );
+            }
 
-        // -------------------------------------------------------------------------
+        };
 
-        struct to_vector_builder : base_builder
+        struct sum_builder : base_builder
         {
-            typedef                 to_vector_builder       this_type       ;
+            typedef                 sum_builder                     this_type       ;
 
-            size_type               capacity;
+            CPPLINQ_INLINEMETHOD sum_builder () CPPLINQ_NOEXCEPT
+            {
+            }
 
-            CPPLINQ_INLINEMETHOD explicit to_vector_builder (size_type capacity = 16U) CPPLINQ_NOEXCEPT
-                :   capacity    (capacity)
+            CPPLINQ_INLINEMETHOD sum_builder (sum_builder const & v) CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD to_vector_builder (to_vector_builder const & v) CPPLINQ_NOEXCEPT
-                :   capacity (v.capacity)
+            CPPLINQ_INLINEMETHOD sum_builder (sum_builder && v) CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD to_vector_builder (to_vector_builder && v) CPPLINQ_NOEXCEPT
-                :   capacity (std::move (v.capacity))
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range) const
             {
+                return build (std::move (range), is_partitionable<TRange> ());
             }
 
             template<typename TRange>
-            CPPLINQ_METHOD std::vector<typename TRange::value_type> build (TRange range) const
+            CPPLINQ_METHOD typename TRange::value_type build (TRange range, std::false_type) const
             {
-                std::vector<typename TRange::value_type> result;
-                result.reserve (capacity);
+                return build_sequential (range, is_vectorizable<TRange> ());
+            }
 
-                while (range.next ())
+            template<typename TRange>
+            static CPPLINQ_METHOD typename TRange::value_type build_sequential (TRange & range, std::false_type)
+            {
+                auto sum = typename TRange::value_type ();
+                while (pull (query_sum, range))
                 {
-                    result.push_back (range.front ());
+                    sum += range.front ();
                 }
+                return sum;
+            }
 
-                return result;
+            template<typename TRange>
+            static CPPLINQ_INLINEMETHOD typename TRange::value_type build_sequential (TRange & range, std::true_type)
+            {
+                typedef                 contiguous_range_traits<TRange> traits  ;
+                return vectorized_fold<simd_fold_sum> (traits::data_of (range), traits::size_of (range));
+            }
+
+            template<typename TRange>
+            CPPLINQ_METHOD typename TRange::value_type build (TRange range, std::true_type) const
+            {
+                typedef typename TRange::value_type value_type;
+
+                return parallel_reduce (
+                        range
+                    ,   *this
+                    ,   [] (value_type l, value_type r) -> value_type { return l + r; }
+                    );
             }
 
         };
 
-        struct to_list_builder : base_builder
+        // -------------------------------------------------------------------------
+
+        template <typename TSelector>
+        struct max_selector_builder : base_builder
         {
-            typedef                 to_list_builder       this_type       ;
+            typedef                 max_selector_builder<TSelector>     this_type       ;
+            typedef                 TSelector                           selector_type   ;
+
+            selector_type           selector;
+
+            CPPLINQ_INLINEMETHOD max_selector_builder (selector_type selector) CPPLINQ_NOEXCEPT
+                :   selector (std::move (selector))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD max_selector_builder (max_selector_builder const & v) CPPLINQ_NOEXCEPT
+                :   selector (v.selector)
+            {
+            }
 
-            CPPLINQ_INLINEMETHOD explicit to_list_builder () CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD max_selector_builder (max_selector_builder && v) CPPLINQ_NOEXCEPT
+                :   selector (std::move (v.selector))
             {
             }
 
-            CPPLINQ_INLINEMETHOD to_list_builder (to_list_builder const & v) CPPLINQ_NOEXCEPT
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD typename get_transformed_type<selector_type, typename TRange::value_type>::type build (TRange range) const
             {
+                return build (std::move (range), is_partitionable<TRange> ());
             }
 
-            CPPLINQ_INLINEMETHOD to_list_builder (to_list_builder && v) CPPLINQ_NOEXCEPT
+            template<typename TRange>
+            CPPLINQ_METHOD typename get_transformed_type<selector_type, typename TRange::value_type>::type build (TRange range, std::true_type) const
             {
+                typedef typename get_transformed_type<selector_type, typename TRange::value_type>::type value_type;
+
+                return parallel_reduce (
+                        range
+                    ,   *this
+                    ,   [] (value_type l, value_type r) -> value_type { return l < r ? r : l; }
+                    );
             }
 
             template<typename TRange>
-            CPPLINQ_METHOD std::list<typename TRange::value_type> build (TRange range) const
+            CPPLINQ_METHOD typename get_transformed_type<selector_type, typename TRange::value_type>::type build (TRange range, std::false_type) const
             {
-                std::list<typename TRange::value_type> result;
+                typedef typename get_transformed_type<selector_type, typename TRange::value_type>::type value_type;
 
-                while (range.next ())
+                auto current = std::numeric_limits<value_type>::lowest ();
+                while (pull (query_max, range))
                 {
-                    result.push_back (range.front ());
+                    auto v = selector (range.front ());
+                    if (current < v)
+                    {
+                        current = std::move (v);
+                    }
                 }
 
-                return result;
+                return current;
             }
 
         };
 
-        // -------------------------------------------------------------------------
-
-        template<typename TKeyPredicate>
-        struct to_map_builder : base_builder
+        struct max_builder : base_builder
         {
-            static TKeyPredicate get_key_predicate ();
-
-            typedef                     to_map_builder<TKeyPredicate>   this_type           ;
-            typedef                     TKeyPredicate                   key_predicate_type  ;
+            typedef                 max_builder                         this_type       ;
 
-            key_predicate_type          key_predicate   ;
+            CPPLINQ_INLINEMETHOD max_builder () CPPLINQ_NOEXCEPT
+            {
+            }
 
-            CPPLINQ_INLINEMETHOD explicit to_map_builder (key_predicate_type key_predicate) CPPLINQ_NOEXCEPT
-                :   key_predicate   (std::move (key_predicate))
+            CPPLINQ_INLINEMETHOD max_builder (max_builder const & v) CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD to_map_builder (to_map_builder const & v)
-                :   key_predicate (v.key_predicate)
+            CPPLINQ_INLINEMETHOD max_builder (max_builder && v) CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD to_map_builder (to_map_builder && v) CPPLINQ_NOEXCEPT
-                :   key_predicate (std::move (v.key_predicate))
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range) const
             {
+                return build (std::move (range), is_partitionable<TRange> ());
             }
 
             template<typename TRange>
-            CPPLINQ_METHOD std::map<
-                    typename get_transformed_type<key_predicate_type, typename TRange::value_type>::type
-                ,   typename TRange::value_type
-                > build (TRange range) const
+            CPPLINQ_METHOD typename TRange::value_type build (TRange range, std::true_type) const
             {
-                typedef std::map<
-                    typename get_transformed_type<key_predicate_type, typename TRange::value_type>::type
-                ,   typename TRange::value_type
-                >   result_type;
+                typedef typename TRange::value_type value_type;
 
-                result_type result;
+                return parallel_reduce (
+                        range
+                    ,   *this
+                    ,   [] (value_type l, value_type r) -> value_type { return l < r ? r : l; }
+                    );
+            }
 
-                while (range.next ())
+            template<typename TRange>
+            CPPLINQ_METHOD typename TRange::value_type build (TRange range, std::false_type) const
+            {
+                return build_sequential (range, is_vectorizable<TRange> ());
+            }
+
+            template<typename TRange>
+            static CPPLINQ_METHOD typename TRange::value_type build_sequential (TRange & range, std::false_type)
+            {
+                auto current = std::numeric_limits<typename TRange::value_type>::lowest ();
+                while (pull (query_max, range))
                 {
                     auto v = range.front ();
-                    auto k = key_predicate (v);
-
-                    result.insert (typename result_type::value_type (std::move (k), std::move (v)));
+                    if (current < v)
+                    {
+                        current = std::move (v);
+                    }
                 }
 
-                return result;
+                return current;
+            }
+
+            template<typename TRange>
+            static CPPLINQ_INLINEMETHOD typename TRange::value_type build_sequential (TRange & range, std::true_type)
+            {
+                typedef                 contiguous_range_traits<TRange> traits  ;
+                return vectorized_fold<simd_fold_max> (traits::data_of (range), traits::size_of (range));
             }
 
         };
 
         // -------------------------------------------------------------------------
 
-        template<typename TKey, typename TValue>
-        struct lookup
+        template <typename TSelector>
+        struct min_selector_builder : base_builder
         {
-            typedef             TKey    key_type    ;
-            typedef             TValue  value_type  ;
+            typedef                 min_selector_builder<TSelector>     this_type       ;
+            typedef                 TSelector                           selector_type   ;
 
-            typedef             std::vector<std::pair<key_type, size_type>>     keys_type           ;
-            typedef             std::vector<value_type>                         values_type         ;
+            selector_type           selector;
 
-            typedef typename    values_type::const_iterator                     values_iterator_type;
+            CPPLINQ_INLINEMETHOD min_selector_builder (selector_type selector) CPPLINQ_NOEXCEPT
+                :   selector (std::move (selector))
+            {
+            }
 
-            template<typename TRange, typename TSelector>
-            CPPLINQ_METHOD lookup (size_type capacity, TRange range, TSelector selector)
+            CPPLINQ_INLINEMETHOD min_selector_builder (min_selector_builder const & v) CPPLINQ_NOEXCEPT
+                :   selector (v.selector)
             {
-                keys_type   k;
-                values_type v;
-                k.reserve (capacity);
-                v.reserve (capacity);
+            }
 
-                auto index = 0U;
-                while (range.next ())
-                {
-                    auto value  = range.front ();
-                    auto key    = selector (value);
-                    v.push_back (std::move (value));
-                    k.push_back (typename keys_type::value_type (std::move (key), index));
-                    ++index;
-                }
+            CPPLINQ_INLINEMETHOD min_selector_builder (min_selector_builder && v) CPPLINQ_NOEXCEPT
+                :   selector (std::move (v.selector))
+            {
+            }
 
-                if (v.size () == 0)
-                {
-                    return;
-                }
 
-                std::sort (
-                        k.begin ()
-                    ,   k.end ()
-                    ,   [] (typename keys_type::value_type const & l, typename keys_type::value_type const & r)
-                        {
-                            return l.first < r.first;
-                        }
-                    );
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD typename get_transformed_type<selector_type, typename TRange::value_type>::type build (TRange range) const
+            {
+                return build (std::move (range), is_partitionable<TRange> ());
+            }
 
-                keys.reserve (k.size ());
-                values.reserve (v.size ());
+            template<typename TRange>
+            CPPLINQ_METHOD typename get_transformed_type<selector_type, typename TRange::value_type>::type build (TRange range, std::true_type) const
+            {
+                typedef typename get_transformed_type<selector_type, typename TRange::value_type>::type value_type;
 
-                auto iter       = k.begin ();
-                auto end        = k.end ();
+                return parallel_reduce (
+                        range
+                    ,   *this
+                    ,   [] (value_type l, value_type r) -> value_type { return r < l ? r : l; }
+                    );
+            }
 
-                index = 0U;
+            template<typename TRange>
+            CPPLINQ_METHOD typename get_transformed_type<selector_type, typename TRange::value_type>::type build (TRange range, std::false_type) const
+            {
+                typedef typename get_transformed_type<selector_type, typename TRange::value_type>::type value_type;
 
-                if (iter != end)
+                auto current = std::numeric_limits<value_type>::max ();
+                while (pull (query_min, range))
                 {
-                    values.push_back (std::move (v[iter->second]));
-                    keys.push_back (typename keys_type::value_type (iter->first, index));
+                    auto v = selector (range.front ());
+                    if (v < current)
+                    {
+                        current = std::move (v);
+                    }
                 }
 
-                auto previous   = iter;
-                ++iter;
-                ++index;
+                return current;
+            }
 
-                while (iter != end)
-                {
-                    values.push_back (v[iter->second]);
+        };
 
-                    if (previous->first < iter->first)
-                    {
-                        keys.push_back (typename keys_type::value_type (iter->first, index));
-                    }
+        struct min_builder : base_builder
+        {
+            typedef                 min_builder                         this_type       ;
 
-                    previous = iter;
-                    ++iter;
-                    ++index;
-                }
+            CPPLINQ_INLINEMETHOD min_builder () CPPLINQ_NOEXCEPT
+            {
             }
 
-            CPPLINQ_INLINEMETHOD lookup (lookup const & v)
-                :   values  (v.values)
-                ,   keys    (v.keys)
+            CPPLINQ_INLINEMETHOD min_builder (min_builder const & v) CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD lookup (lookup && v) CPPLINQ_NOEXCEPT
-                :   values  (std::move (v.values))
-                ,   keys    (std::move (v.keys))
+            CPPLINQ_INLINEMETHOD min_builder (min_builder && v) CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD void swap (lookup & v) CPPLINQ_NOEXCEPT
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range) const
             {
-                values.swap (v.values);
-                keys.swap (v.keys);
+                return build (std::move (range), is_partitionable<TRange> ());
             }
 
-            CPPLINQ_INLINEMETHOD lookup & operator= (lookup const & v)
+            template<typename TRange>
+            CPPLINQ_METHOD typename TRange::value_type build (TRange range, std::true_type) const
             {
-                if (this == std::addressof (v))
-                {
-                    return *this;
-                }
-
-                lookup tmp (v);
+                typedef typename TRange::value_type value_type;
 
-                swap (tmp);
+                return parallel_reduce (
+                        range
+                    ,   *this
+                    ,   [] (value_type l, value_type r) -> value_type { return r < l ? r : l; }
+                    );
+            }
 
-                return *this;
+            template<typename TRange>
+            CPPLINQ_METHOD typename TRange::value_type build (TRange range, std::false_type) const
+            {
+                return build_sequential (range, is_vectorizable<TRange> ());
             }
 
-            CPPLINQ_INLINEMETHOD lookup & operator= (lookup && v) CPPLINQ_NOEXCEPT
+            template<typename TRange>
+            static CPPLINQ_METHOD typename TRange::value_type build_sequential (TRange & range, std::false_type)
             {
-                if (this == std::addressof (v))
+                auto current = std::numeric_limits<typename TRange::value_type>::max ();
+                while (pull (query_min, range))
                 {
-                    return *this;
+                    auto v = range.front ();
+                    if (v < current)
+                    {
+                        current = std::move (v);
+                    }
                 }
 
-                swap (v);
-
-                return *this;
+                return current;
             }
 
-            struct lookup_range : base_range
+            template<typename TRange>
+            static CPPLINQ_INLINEMETHOD typename TRange::value_type build_sequential (TRange & range, std::true_type)
             {
-                typedef         lookup_range                this_type       ;
-
-                enum
-                {
-                    returns_reference = 1 ,
-                };
+                typedef                 contiguous_range_traits<TRange> traits  ;
+                return vectorized_fold<simd_fold_min> (traits::data_of (range), traits::size_of (range));
+            }
 
-                typedef         TValue                      value_type      ;
-                typedef         value_type const &          return_type     ;
+        };
 
-                enum state
-                {
-                    state_initial   ,
-                    state_iterating ,
-                    state_end       ,
-                };
+        // -------------------------------------------------------------------------
 
-                values_type const *     values  ;
-                size_type               iter    ;
-                size_type               end     ;
-                state                   state   ;
+        // Computes the partial results avg is derived from
+        template <typename TSelector>
+        struct sum_and_count_builder : base_builder
+        {
+            typedef                 sum_and_count_builder<TSelector>    this_type       ;
+            typedef                 TSelector                           selector_type   ;
 
-                CPPLINQ_INLINEMETHOD lookup_range (
-                        values_type const *     values
-                    ,   size_type               iter
-                    ,   size_type               end
-                    ) CPPLINQ_NOEXCEPT
-                    :   values  (values)
-                    ,   iter    (iter)
-                    ,   end     (end)
-                    ,   state   (state_initial)
-                {
-                    CPPLINQ_ASSERT (values);
-                }
+            selector_type           selector;
 
-                CPPLINQ_INLINEMETHOD lookup_range (lookup_range const & v) CPPLINQ_NOEXCEPT
-                    :   values  (v.values)
-                    ,   iter    (v.iter)
-                    ,   end     (v.end)
-                    ,   state   (v.state)
-                {
-                }
+            CPPLINQ_INLINEMETHOD sum_and_count_builder (selector_type selector) CPPLINQ_NOEXCEPT
+                :   selector (std::move (selector))
+            {
+            }
 
-                CPPLINQ_INLINEMETHOD lookup_range (lookup_range && v) CPPLINQ_NOEXCEPT
-                    :   values  (std::move (v.values))
-                    ,   iter    (std::move (v.iter))
-                    ,   end     (std::move (v.end))
-                    ,   state   (std::move (v.state))
-                {
-                }
+            CPPLINQ_INLINEMETHOD sum_and_count_builder (sum_and_count_builder const & v) CPPLINQ_NOEXCEPT
+                :   selector (v.selector)
+            {
+            }
 
-                template<typename TRangeBuilder>
-                CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
-                {
-                    return range_builder.build (*this);
-                }
+            CPPLINQ_INLINEMETHOD sum_and_count_builder (sum_and_count_builder && v) CPPLINQ_NOEXCEPT
+                :   selector (std::move (v.selector))
+            {
+            }
 
-                CPPLINQ_INLINEMETHOD return_type front () const CPPLINQ_NOEXCEPT
-                {
-                    CPPLINQ_ASSERT (state == state_iterating);
-                    CPPLINQ_ASSERT (iter < end);
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD std::pair<typename get_transformed_type<selector_type, typename TRange::value_type>::type, int> build (TRange range) const
+            {
+                return build (std::move (range), is_partitionable<TRange> ());
+            }
 
-                    return (*values)[iter];
-                }
+            template<typename TRange>
+            CPPLINQ_METHOD std::pair<typename get_transformed_type<selector_type, typename TRange::value_type>::type, int> build (TRange range, std::false_type) const
+            {
+                typedef typename get_transformed_type<selector_type, typename TRange::value_type>::type value_type;
 
-                CPPLINQ_INLINEMETHOD bool next () CPPLINQ_NOEXCEPT
+                auto sum = value_type ();
+                int count = 0;
+                while (pull (query_avg, range))
                 {
-                    switch (state)
-                    {
-                    case state_initial:
-                        {
-                            auto has_elements = iter < end;
-                            state = has_elements ? state_iterating : state_end;
-                            return has_elements;
-                        }
-                        break;
-                    case state_iterating:
-                        {
-                            ++iter;
-
-                            auto has_elements = iter < end;
-                            state = has_elements ? state_iterating : state_end;
-                            return has_elements;
-                        }
-                        break;
-                    case state_end:
-                    default:
-                        return false;
-                    }
+                    sum += selector (range.front ());
+                    ++count;
                 }
 
-            };
+                return std::make_pair (std::move (sum), count);
+            }
 
-            CPPLINQ_METHOD lookup_range operator[](key_type const & key) const CPPLINQ_NOEXCEPT
+            template<typename TRange>
+            CPPLINQ_METHOD std::pair<typename get_transformed_type<selector_type, typename TRange::value_type>::type, int> build (TRange range, std::true_type) const
             {
-                if (values.empty ())
-                {
-                    return lookup_range (std::addressof (values), 0U, 0U);
-                }
+                typedef typename get_transformed_type<selector_type, typename TRange::value_type>::type value_type;
+                typedef std::pair<value_type, int>                                                      result_type;
 
-                auto find = std::lower_bound (
-                        keys.begin ()
-                    ,   keys.end  ()
-                    ,   typename keys_type::value_type (key, 0U)
-                    ,   [](typename keys_type::value_type const & l, typename keys_type::value_type const & r)
+                return parallel_reduce (
+                        range
+                    ,   *this
+                    ,   [] (result_type l, result_type r) -> result_type
                         {
-                            return l.first < r.first;
-                        });
+                            return result_type (l.first + r.first, l.second + r.second);
+                        }
+                    );
+            }
 
-                if (find == keys.end ())
-                {
-                    return lookup_range (std::addressof (values), 0U, 0U);
-                }
+        };
 
-                auto next = find + 1;
-                if (next == keys.end ())
-                {
-                    return lookup_range (std::addressof (values), find->second, values.size ());
-                }
+        template <typename TSelector>
+        struct avg_selector_builder : base_builder
+        {
+            typedef                 avg_selector_builder<TSelector>     this_type       ;
+            typedef                 TSelector                           selector_type   ;
 
-                return lookup_range (std::addressof (values), find->second, next->second);
+            selector_type           selector;
+
+            CPPLINQ_INLINEMETHOD avg_selector_builder (selector_type selector) CPPLINQ_NOEXCEPT
+                :   selector (std::move (selector))
+            {
             }
 
-            CPPLINQ_INLINEMETHOD size_type size_of_keys () const CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD avg_selector_builder (avg_selector_builder const & v) CPPLINQ_NOEXCEPT
+                :   selector (v.selector)
             {
-                return keys.size ();
             }
 
-            CPPLINQ_INLINEMETHOD size_type size_of_values () const CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD avg_selector_builder (avg_selector_builder && v) CPPLINQ_NOEXCEPT
+                :   selector (std::move (v.selector))
             {
-                return values.size ();
             }
 
-            CPPLINQ_INLINEMETHOD from_range<values_iterator_type> range_of_values () const CPPLINQ_NOEXCEPT
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD typename get_transformed_type<selector_type, typename TRange::value_type>::type build (TRange range) const
             {
-                return from_range<values_iterator_type> (
-                        values.begin ()
-                    ,   values.end ()
-                    );
+                auto sum_and_count = sum_and_count_builder<selector_type> (selector).build (std::move (range));
+
+                if (sum_and_count.second == 0)
+                {
+                    return sum_and_count.first;
+                }
+
+                return sum_and_count.first/sum_and_count.second;
             }
 
-        private:
-            values_type values  ;
-            keys_type   keys    ;
         };
 
-        template<typename TKeyPredicate>
-        struct to_lookup_builder : base_builder
+        struct avg_builder : base_builder
         {
-            static TKeyPredicate get_key_predicate ();
-
-            typedef                     to_lookup_builder<TKeyPredicate>    this_type           ;
-            typedef                     TKeyPredicate                       key_predicate_type  ;
-
-            key_predicate_type          key_predicate   ;
+            typedef                 avg_builder                         this_type       ;
 
-            CPPLINQ_INLINEMETHOD explicit to_lookup_builder (key_predicate_type key_predicate) CPPLINQ_NOEXCEPT
-                :   key_predicate   (std::move (key_predicate))
+            CPPLINQ_INLINEMETHOD avg_builder () CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD to_lookup_builder (to_lookup_builder const & v)
-                :   key_predicate (v.key_predicate)
+            CPPLINQ_INLINEMETHOD avg_builder (avg_builder const & v) CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD to_lookup_builder (to_lookup_builder && v) CPPLINQ_NOEXCEPT
-                :   key_predicate (std::move (v.key_predicate))
+            CPPLINQ_INLINEMETHOD avg_builder (avg_builder && v) CPPLINQ_NOEXCEPT
             {
             }
 
+
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD lookup<
-                    typename get_transformed_type<key_predicate_type, typename TRange::value_type>::type
-                ,   typename TRange::value_type
-                > build (TRange range) const
+            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range) const
             {
-                typedef lookup<
-                    typename get_transformed_type<key_predicate_type, typename TRange::value_type>::type
-                ,   typename TRange::value_type
-                >   result_type;
+                auto sum_and_count = sum_and_count_builder<identity_selector> (identity_selector ()).build (std::move (range));
 
-                result_type result (16U, range, key_predicate);
+                if (sum_and_count.second == 0)
+                {
+                    return sum_and_count.first;
+                }
 
-                return result;
+                return sum_and_count.first/sum_and_count.second;
             }
 
         };
 
         // -------------------------------------------------------------------------
 
-        template<typename TPredicate>
-        struct for_each_builder : base_builder
+        template <typename TAccumulate, typename TAccumulator>
+        struct aggregate_builder : base_builder
         {
-            typedef                 for_each_builder<TPredicate>    this_type       ;
-            typedef                 TPredicate                      predicate_type  ;
+            typedef                 aggregate_builder<TAccumulate, TAccumulator>    this_type       ;
+            typedef                 TAccumulator                                    accumulator_type;
+            typedef                 TAccumulate                                     seed_type;
 
-            predicate_type          predicate;
+            seed_type               seed;
+            accumulator_type        accumulator;
 
-            CPPLINQ_INLINEMETHOD explicit for_each_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
-                :   predicate    (std::move (predicate))
+            CPPLINQ_INLINEMETHOD aggregate_builder (seed_type seed, accumulator_type accumulator) CPPLINQ_NOEXCEPT
+                :   seed        (std::move (seed))
+                ,   accumulator (std::move (accumulator))
             {
             }
 
-            CPPLINQ_INLINEMETHOD for_each_builder (for_each_builder const & v) CPPLINQ_NOEXCEPT
-                :   predicate (v.predicate)
+            CPPLINQ_INLINEMETHOD aggregate_builder (aggregate_builder const & v) CPPLINQ_NOEXCEPT
+                :   seed        (v.seed)
+                ,   accumulator (v.accumulator)
             {
             }
 
-            CPPLINQ_INLINEMETHOD for_each_builder (for_each_builder && v) CPPLINQ_NOEXCEPT
-                :   predicate (std::move (v.predicate))
+            CPPLINQ_INLINEMETHOD aggregate_builder (aggregate_builder && v) CPPLINQ_NOEXCEPT
+                :   seed        (std::move (v.seed))
+                ,   accumulator (std::move (v.accumulator))
             {
             }
 
-
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD void build (TRange range) const
+            CPPLINQ_INLINEMETHOD seed_type build (TRange range) const
             {
-                while (range.next ())
+                auto sum = seed;
+                while (pull (query_aggregate, range))
                 {
-                    predicate (range.front ());
+                    sum = accumulator (sum, range.front ());
                 }
+                return sum;
             }
 
         };
 
-        // -------------------------------------------------------------------------
-
-        template<typename TPredicate>
-        struct first_predicate_builder : base_builder
+        template <typename TAccumulate, typename TAccumulator, typename TSelector>
+        struct aggregate_result_selector_builder : base_builder
         {
-            typedef                 first_predicate_builder<TPredicate>     this_type           ;
-            typedef                 TPredicate                              predicate_type      ;
+            typedef                 aggregate_result_selector_builder<TAccumulate, TAccumulator, TSelector> this_type       ;
+            typedef                 TAccumulator                                                            accumulator_type;
+            typedef                 TAccumulate                                                             seed_type;
+            typedef                 TSelector                                                               result_selector_type;
 
-            predicate_type          predicate   ;
+            seed_type               seed;
+            accumulator_type        accumulator;
+            result_selector_type    result_selector;
 
-            CPPLINQ_INLINEMETHOD first_predicate_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
-                :   predicate (std::move (predicate))
+            CPPLINQ_INLINEMETHOD aggregate_result_selector_builder (seed_type seed, accumulator_type accumulator, result_selector_type result_selector) CPPLINQ_NOEXCEPT
+                :   seed            (std::move (seed))
+                ,   accumulator     (std::move (accumulator))
+                ,   result_selector (std::move (result_selector))
             {
             }
 
-            CPPLINQ_INLINEMETHOD first_predicate_builder (first_predicate_builder const & v) CPPLINQ_NOEXCEPT
-                :   predicate (v.predicate)
+            CPPLINQ_INLINEMETHOD aggregate_result_selector_builder (aggregate_result_selector_builder const & v) CPPLINQ_NOEXCEPT
+                :   seed            (v.seed)
+                ,   accumulator     (v.accumulator)
+                ,   result_selector (v.result_selector)
             {
             }
 
-            CPPLINQ_INLINEMETHOD first_predicate_builder (first_predicate_builder && v) CPPLINQ_NOEXCEPT
-                : predicate (std::move (v.predicate))
+            CPPLINQ_INLINEMETHOD aggregate_result_selector_builder (aggregate_result_selector_builder && v) CPPLINQ_NOEXCEPT
+                :   seed            (std::move (v.seed))
+                ,   accumulator     (std::move (v.accumulator))
+                ,   result_selector (std::move (v.result_selector))
             {
             }
 
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range)
+            CPPLINQ_INLINEMETHOD auto build (TRange range) const -> decltype (result_selector (seed))
             {
-                while (range.next ())
+                auto sum = seed;
+                while (pull (query_aggregate, range))
                 {
-                    if (predicate (range.front ()))
-                    {
-                        return range.front ();
-                    }
+                    sum = accumulator (sum, range.front ());
                 }
 
-                throw sequence_empty_exception ();
+                return result_selector (sum);
             }
 
         };
 
-        // -------------------------------------------------------------------------
-
-        struct first_builder : base_builder
+        template <typename TAccumulate, typename TAccumulator, typename TCombiner>
+        struct parallel_aggregate_builder : base_builder
         {
-            typedef                 first_builder                   this_type       ;
+            typedef                 parallel_aggregate_builder<TAccumulate, TAccumulator, TCombiner>    this_type       ;
+            typedef                 TAccumulator                                                        accumulator_type;
+            typedef                 TAccumulate                                                         seed_type;
+            typedef                 TCombiner                                                           combiner_type;
 
-            CPPLINQ_INLINEMETHOD first_builder () CPPLINQ_NOEXCEPT
+            seed_type               seed;
+            accumulator_type        accumulator;
+            combiner_type           combiner;
+
+            CPPLINQ_INLINEMETHOD parallel_aggregate_builder (seed_type seed, accumulator_type accumulator, combiner_type combiner) CPPLINQ_NOEXCEPT
+                :   seed        (std::move (seed))
+                ,   accumulator (std::move (accumulator))
+                ,   combiner    (std::move (combiner))
             {
             }
 
-            CPPLINQ_INLINEMETHOD first_builder (first_builder const & v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD parallel_aggregate_builder (parallel_aggregate_builder const & v) CPPLINQ_NOEXCEPT
+                :   seed        (v.seed)
+                ,   accumulator (v.accumulator)
+                ,   combiner    (v.combiner)
             {
             }
 
-            CPPLINQ_INLINEMETHOD first_builder (first_builder && v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD parallel_aggregate_builder (parallel_aggregate_builder && v) CPPLINQ_NOEXCEPT
+                :   seed        (std::move (v.seed))
+                ,   accumulator (std::move (v.accumulator))
+                ,   combiner    (std::move (v.combiner))
             {
             }
 
+            // Every chunk starts from seed so seed should be the identity of combiner
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range)
+            CPPLINQ_INLINEMETHOD seed_type build (TRange range) const
             {
-                if (range.next ())
-                {
-                    return range.front ();
-                }
+                return build (std::move (range), is_partitionable<TRange> ());
+            }
 
-                throw sequence_empty_exception ();
+            template<typename TRange>
+            CPPLINQ_METHOD seed_type build (TRange range, std::false_type) const
+            {
+                return aggregate_builder<seed_type, accumulator_type> (seed, accumulator).build (std::move (range));
+            }
+
+            template<typename TRange>
+            CPPLINQ_METHOD seed_type build (TRange range, std::true_type) const
+            {
+                return parallel_reduce (
+                        range
+                    ,   aggregate_builder<seed_type, accumulator_type> (seed, accumulator)
+                    ,   combiner
+                    );
             }
 
         };
 
         // -------------------------------------------------------------------------
 
-        template<typename TPredicate>
-        struct first_or_default_predicate_builder : base_builder
+        template <typename TOtherRange, typename TComparer>
+        struct sequence_equal_predicate_builder : base_builder
         {
-            typedef                 first_or_default_predicate_builder<TPredicate>  this_type       ;
-            typedef                 TPredicate                                      predicate_type  ;
+            typedef                 sequence_equal_predicate_builder<TOtherRange,TComparer>     this_type       ;
+            typedef                 TOtherRange                                                 other_range_type;
+            typedef                 TComparer                                                   comparer_type   ;
 
-            predicate_type          predicate;
+            other_range_type        other_range         ;
+            comparer_type           comparer            ;
 
-            CPPLINQ_INLINEMETHOD first_or_default_predicate_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
-                :   predicate (std::move (predicate))
+            CPPLINQ_INLINEMETHOD sequence_equal_predicate_builder (
+                    TOtherRange     other_range
+                ,   comparer_type   comparer) CPPLINQ_NOEXCEPT
+                :   other_range (std::move (other_range))
+                ,   comparer    (std::move (comparer))
             {
             }
 
-            CPPLINQ_INLINEMETHOD first_or_default_predicate_builder (first_or_default_predicate_builder const & v) CPPLINQ_NOEXCEPT
-                :   predicate (v.predicate)
+            CPPLINQ_INLINEMETHOD sequence_equal_predicate_builder (sequence_equal_predicate_builder const & v) CPPLINQ_NOEXCEPT
+                :   other_range (v.other_range)
+                ,   comparer    (v.comparer)
             {
             }
 
-            CPPLINQ_INLINEMETHOD first_or_default_predicate_builder (first_or_default_predicate_builder && v) CPPLINQ_NOEXCEPT
-                : predicate (std::move (v.predicate))
+            CPPLINQ_INLINEMETHOD sequence_equal_predicate_builder (sequence_equal_predicate_builder && v) CPPLINQ_NOEXCEPT
+                :   other_range (std::move (v.other_range))
+                ,   comparer    (std::move (v.comparer))
             {
             }
 
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range) const
+            template <typename TRange>
+            CPPLINQ_INLINEMETHOD bool build (TRange range) const
             {
-                while (range.next ())
+                auto copy = other_range;
+                for (;;)
                 {
-                    if (predicate (range.front ()))
+                    bool next1 = pull (query_sequence_equal, range);
+                    bool next2 = pull (query_sequence_equal, copy);
+
+                    // sequences are not of same length
+                    if (next1 != next2)
                     {
-                        return range.front ();
+                        return false;
+                    }
+
+                    // both sequences are over, next1 = next2 = false
+                    if (!next1)
+                    {
+                        return true;
+                    }
+
+                    if (!comparer (range.front (), copy.front ()))
+                    {
+                        return false;
                     }
                 }
+            }
+        };
 
-                return typename TRange::value_type ();
+        // Compares the values left in two random access ranges of the same size
+        template <typename TRange, typename TOtherRange>
+        CPPLINQ_METHOD bool equal_values (TRange const & range, TOtherRange const & other_range, size_type size)
+        {
+            for (auto index = size_type (0U); index < size; ++index)
+            {
+                if (range.at (index) != other_range.at (index))
+                {
+                    return false;
+                }
             }
 
-        };
+            return true;
+        }
 
+        // std::equal compares contiguous integral values with memcmp
+        template <typename TValueIterator, typename TOtherValueIterator>
+        CPPLINQ_METHOD bool equal_values (from_range<TValueIterator> const & range, from_range<TOtherValueIterator> const & other_range, size_type)
+        {
+            return std::equal (range.upcoming, range.end, other_range.upcoming);
+        }
 
-        struct first_or_default_builder : base_builder
+        template <typename TOtherRange>
+        struct sequence_equal_builder : base_builder
         {
-            typedef                 first_or_default_builder                   this_type       ;
+            typedef                 sequence_equal_builder<TOtherRange>     this_type       ;
+            typedef                 TOtherRange                             other_range_type;
 
-            CPPLINQ_INLINEMETHOD first_or_default_builder () CPPLINQ_NOEXCEPT
+            other_range_type        other_range         ;
+
+            CPPLINQ_INLINEMETHOD sequence_equal_builder (TOtherRange other_range) CPPLINQ_NOEXCEPT
+                : other_range (std::move (other_range))
             {
             }
 
-            CPPLINQ_INLINEMETHOD first_or_default_builder (first_or_default_builder const & v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD sequence_equal_builder (sequence_equal_builder const & v) CPPLINQ_NOEXCEPT
+                : other_range (v.other_range)
             {
             }
 
-            CPPLINQ_INLINEMETHOD first_or_default_builder (first_or_default_builder && v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD sequence_equal_builder (sequence_equal_builder && v) CPPLINQ_NOEXCEPT
+                : other_range (std::move (v.other_range))
             {
             }
 
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range) const
+            template <typename TRange>
+            CPPLINQ_INLINEMETHOD bool build (TRange range) const
+            {
+                return build (
+                        std::move (range)
+                    ,   std::integral_constant<
+                                bool
+                            ,   is_random_access_range<TRange>::value
+                            &&  is_random_access_range<other_range_type>::value
+                            > ()
+                    );
+            }
+
+            // Different lengths are detected up front
+            template <typename TRange>
+            CPPLINQ_METHOD bool build (TRange range, std::true_type) const
             {
-                if (range.next ())
+                auto copy = other_range;
+                auto size = range.size ();
+                if (size != copy.size ())
                 {
-                    return range.front ();
+                    return false;
                 }
 
-                return typename TRange::value_type ();
+                return equal_values (range, copy, size);
             }
 
+            template <typename TRange>
+            CPPLINQ_METHOD bool build (TRange range, std::false_type) const
+            {
+                auto copy = other_range;
+                for (;;)
+                {
+                    bool next1 = pull (query_sequence_equal, range);
+                    bool next2 = pull (query_sequence_equal, copy);
+
+                    // sequences are not of same length
+                    if (next1 != next2)
+                    {
+                        return false;
+                    }
+
+                    // both sequences are over, next1 = next2 = false
+                    if (!next1)
+                    {
+                        return true;
+                    }
+
+                    if (range.front () != copy.front ())
+                    {
+                        return false;
+                    }
+                }
+            }
         };
 
         // -------------------------------------------------------------------------
-        template<typename TPredicate>
-        struct last_or_default_predicate_builder : base_builder
+
+        // Values of concatenate are appended as text without copying them,
+        // strings, string refs and C strings are appended through a string ref
+        // while any other value is appended as a sequence of characters
+        template<typename TCharType>
+        CPPLINQ_INLINEMETHOD basic_string_ref<TCharType> get_concatenate_text (
+                TCharType const *                       value
+            )
         {
-            typedef                 last_or_default_predicate_builder<TPredicate>   this_type       ;
-            typedef                 TPredicate                                      predicate_type  ;
+            return value
+                ?   basic_string_ref<TCharType> (value)
+                :   basic_string_ref<TCharType> ()
+                ;
+        }
 
-            predicate_type          predicate;
+        template<typename TCharType>
+        CPPLINQ_INLINEMETHOD basic_string_ref<TCharType> get_concatenate_text (
+                basic_string_ref<TCharType> const &     value
+            ) CPPLINQ_NOEXCEPT
+        {
+            return value;
+        }
 
-            CPPLINQ_INLINEMETHOD last_or_default_predicate_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
-                :   predicate (std::move (predicate))
+        template<typename TCharType, typename TValue>
+        CPPLINQ_INLINEMETHOD size_type get_concatenate_size (
+                TValue const &                          value
+            ,   std::true_type
+            )
+        {
+            return get_concatenate_text<TCharType> (value).size ();
+        }
+
+        template<typename TCharType, typename TValue>
+        CPPLINQ_INLINEMETHOD size_type get_concatenate_size (
+                TValue const &                          value
+            ,   std::false_type
+            )
+        {
+            return static_cast<size_type> (std::distance (value.begin (), value.end ()));
+        }
+
+        template<typename TCharType, typename TValue>
+        CPPLINQ_INLINEMETHOD void append_concatenate_text (
+                std::basic_string<TCharType> &          result
+            ,   TValue const &                          value
+            ,   std::true_type
+            )
+        {
+            auto text = get_concatenate_text<TCharType> (value);
+            result.append (text.data (), text.size ());
+        }
+
+        template<typename TCharType, typename TValue>
+        CPPLINQ_INLINEMETHOD void append_concatenate_text (
+                std::basic_string<TCharType> &          result
+            ,   TValue const &                          value
+            ,   std::false_type
+            )
+        {
+            result.append (value.begin (), value.end ());
+        }
+
+        template<typename TCharType>
+        struct concatenate_builder : base_builder
+        {
+            typedef                         concatenate_builder<TCharType>  this_type       ;
+
+            std::basic_string<TCharType>    separator   ;
+            size_type                       capacity    ;
+
+            CPPLINQ_INLINEMETHOD concatenate_builder (
+                    std::basic_string<TCharType>    separator
+                ,   size_type capacity
+                ) CPPLINQ_NOEXCEPT
+                :   separator   (std::move (separator))
+                ,   capacity    (capacity)
             {
             }
 
-            CPPLINQ_INLINEMETHOD last_or_default_predicate_builder (last_or_default_predicate_builder const & v) CPPLINQ_NOEXCEPT
-                :   predicate (v.predicate)
+            CPPLINQ_INLINEMETHOD concatenate_builder (concatenate_builder const & v) CPPLINQ_NOEXCEPT
+                :   separator   (v.separator)
+                ,   capacity    (v.capacity)
             {
             }
 
-            CPPLINQ_INLINEMETHOD last_or_default_predicate_builder (last_or_default_predicate_builder && v) CPPLINQ_NOEXCEPT
-                :   predicate (std::move (v.predicate))
+            CPPLINQ_INLINEMETHOD concatenate_builder (concatenate_builder && v) CPPLINQ_NOEXCEPT
+                :   separator   (std::move (v.separator))
+                ,   capacity    (std::move (v.capacity))
             {
             }
 
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range) const
+            struct is_text
+                :   std::is_convertible<typename TRange::value_type, basic_string_ref<TCharType>>
             {
-                auto current = typename TRange::value_type ();
+            };
+
+            // A repeatable range is cheap to traverse twice so the length of
+            // the result is computed up front, other ranges may run predicates
+            // with side effects and start from capacity instead
+            template<typename TRange>
+            CPPLINQ_METHOD size_type get_length (TRange range, std::true_type) const
+            {
+                auto        first   = true  ;
+                size_type   length  = 0U    ;
 
                 while (range.next ())
                 {
-                    if (predicate (range.front ()))
+                    if (first)
+                    {
+                        first = false;
+                    }
+                    else
                     {
-                        current = std::move (range.front ());
+                        length += separator.size ();
                     }
+
+                    length += get_concatenate_size<TCharType> (range.front (), is_text<TRange> ());
                 }
 
-                return current;
+                return length;
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD size_type get_length (TRange const &, std::false_type) const CPPLINQ_NOEXCEPT
+            {
+                return capacity;
+            }
+
+            template<typename TRange>
+            CPPLINQ_METHOD typename std::basic_string<TCharType> build (TRange range) const
+            {
+                auto                            first   =   true    ;
+                std::basic_string<TCharType>    result              ;
+
+                result.reserve (get_length (range, is_repeatable_range<TRange> ()));
+
+                while (pull (query_concatenate, range))
+                {
+                    if (first)
+                    {
+                        first = false;
+                    }
+                    else
+                    {
+                        result.append (separator);
+                    }
+
+                    // Binds to the value returned by front () without copying it
+                    auto && v = range.front ();
+
+                    append_concatenate_text (result, v, is_text<TRange> ());
+                }
+
+                return result;
             }
 
         };
 
-        struct last_or_default_builder : base_builder
+        // -------------------------------------------------------------------------
+
+        template<typename TOutputIterator>
+        struct to_output_iterator_builder : base_builder
         {
-            typedef                 last_or_default_builder                   this_type       ;
+            typedef                 to_output_iterator_builder<TOutputIterator> this_type       ;
+            typedef                 TOutputIterator                             iterator_type   ;
 
-            CPPLINQ_INLINEMETHOD last_or_default_builder () CPPLINQ_NOEXCEPT
+            iterator_type           iterator    ;
+
+            CPPLINQ_INLINEMETHOD explicit to_output_iterator_builder (iterator_type iterator) CPPLINQ_NOEXCEPT
+                :   iterator    (std::move (iterator))
             {
             }
 
-            CPPLINQ_INLINEMETHOD last_or_default_builder (last_or_default_builder const & v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD to_output_iterator_builder (to_output_iterator_builder const & v)
+                :   iterator    (v.iterator)
             {
             }
 
-            CPPLINQ_INLINEMETHOD last_or_default_builder (last_or_default_builder && v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD to_output_iterator_builder (to_output_iterator_builder && v) CPPLINQ_NOEXCEPT
+                :   iterator    (std::move (v.iterator))
             {
             }
 
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range) const
+            CPPLINQ_METHOD iterator_type build (TRange range) const
             {
-                auto current = typename TRange::value_type ();
-
-                while (range.next ())
+                auto output = iterator;
+                while (pull (query_to_output_iterator, range))
                 {
-                    current = std::move (range.front ());
+                    *output = store_front (query_to_output_iterator, range);
+                    ++output;
                 }
 
-                return current;
+                return output;
             }
-
         };
 
-        // -------------------------------------------------------------------------
-
-        template <typename TPredicate>
-        struct count_predicate_builder : base_builder
+        template<typename TStream>
+        struct to_ostream_builder : base_builder
         {
-            typedef                 count_predicate_builder<TPredicate>     this_type       ;
-            typedef                 TPredicate                              predicate_type  ;
+            typedef                 to_ostream_builder<TStream>                 this_type       ;
+            typedef                 TStream                                     stream_type     ;
+            typedef                 std::basic_string<typename TStream::char_type>
+                                                                                separator_type  ;
 
-            predicate_type          predicate   ;
+            stream_type *           stream      ;
+            separator_type          separator   ;
 
-            CPPLINQ_INLINEMETHOD count_predicate_builder (predicate_type  predicate) CPPLINQ_NOEXCEPT
-                :   predicate   (std::move (predicate))
+            CPPLINQ_INLINEMETHOD to_ostream_builder (stream_type & stream, separator_type separator) CPPLINQ_NOEXCEPT
+                :   stream      (std::addressof (stream))
+                ,   separator   (std::move (separator))
             {
             }
 
-            CPPLINQ_INLINEMETHOD count_predicate_builder (count_predicate_builder const & v) CPPLINQ_NOEXCEPT
-                :   predicate   (v.predicate)
+            CPPLINQ_INLINEMETHOD to_ostream_builder (to_ostream_builder const & v)
+                :   stream      (v.stream)
+                ,   separator   (v.separator)
             {
             }
 
-            CPPLINQ_INLINEMETHOD count_predicate_builder (count_predicate_builder && v) CPPLINQ_NOEXCEPT
-                :   predicate   (std::move (v.predicate))
+            CPPLINQ_INLINEMETHOD to_ostream_builder (to_ostream_builder && v) CPPLINQ_NOEXCEPT
+                :   stream      (std::move (v.stream))
+                ,   separator   (std::move (v.separator))
             {
             }
 
-
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD size_type build (TRange range) const
+            CPPLINQ_METHOD stream_type & build (TRange range) const
             {
-                size_type count = 0U;
-                while (range.next ())
+                auto first = true;
+                while (pull (query_to_ostream, range))
                 {
-                    if (predicate (range.front ()))
+                    if (first)
                     {
-                        ++count;
+                        first = false;
+                    }
+                    else
+                    {
+                        *stream << separator;
                     }
+
+                    *stream << range.front ();
                 }
-                return count;
+
+                return *stream;
             }
+        };
 
+        // Writes each value as a line, values must convert to string_ref
+        struct line_formatter
+        {
+            template<typename TValue>
+            CPPLINQ_INLINEMETHOD void operator() (buffered_writer & writer, TValue const & value) const
+            {
+                writer.write (string_ref (value));
+                writer.put ('\n');
+            }
         };
 
-        struct count_builder : base_builder
+        template<typename TFormatter>
+        struct to_file_builder : base_builder
         {
-            typedef                 count_builder                   this_type       ;
+            typedef                 to_file_builder<TFormatter>     this_type       ;
+            typedef                 TFormatter                      formatter_type  ;
 
-            CPPLINQ_INLINEMETHOD count_builder () CPPLINQ_NOEXCEPT
+            std::string             path        ;
+            formatter_type          formatter   ;
+            size_type               capacity    ;
+
+            CPPLINQ_INLINEMETHOD to_file_builder (std::string path, formatter_type formatter, size_type capacity) CPPLINQ_NOEXCEPT
+                :   path        (std::move (path))
+                ,   formatter   (std::move (formatter))
+                ,   capacity    (capacity)
             {
             }
 
-            CPPLINQ_INLINEMETHOD count_builder (count_builder const & v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD to_file_builder (to_file_builder const & v)
+                :   path        (v.path)
+                ,   formatter   (v.formatter)
+                ,   capacity    (v.capacity)
             {
             }
 
-            CPPLINQ_INLINEMETHOD count_builder (count_builder && v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD to_file_builder (to_file_builder && v) CPPLINQ_NOEXCEPT
+                :   path        (std::move (v.path))
+                ,   formatter   (std::move (v.formatter))
+                ,   capacity    (std::move (v.capacity))
             {
             }
 
-
+            // Returns the number of values written
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD size_type build (TRange range) const
+            CPPLINQ_METHOD size_type build (TRange range) const
             {
-                size_type count = 0U;
-                while (range.next ())
+                std::unique_ptr<std::FILE, int (*) (std::FILE *)> file (std::fopen (path.c_str (), "wb"), &std::fclose);
+                if (!file)
+                {
+                    throw io_exception ();
+                }
+
+                instrument_scope scope (query_to_file);
+
+                buffered_writer writer (file.get (), capacity);
+
+                auto count = size_type (0U);
+                while (pull (query_to_file, range))
                 {
+                    formatter (writer, range.front ());
                     ++count;
                 }
+
+                writer.flush ();
+
+                if (std::fclose (file.release ()) != 0)
+                {
+                    throw io_exception ();
+                }
+
                 return count;
             }
-
         };
 
         // -------------------------------------------------------------------------
-
-        template <typename TSelector>
-        struct sum_selector_builder : base_builder
+        template <typename TPredicate>
+        struct any_predicate_builder : base_builder
         {
-            typedef                 sum_selector_builder<TSelector>     this_type       ;
-            typedef                 TSelector                           selector_type   ;
+            typedef                 any_predicate_builder<TPredicate>   this_type       ;
+            typedef                 TPredicate                          predicate_type  ;
 
-            selector_type           selector;
+            predicate_type          predicate   ;
 
-            CPPLINQ_INLINEMETHOD sum_selector_builder (selector_type selector) CPPLINQ_NOEXCEPT
-                :   selector (std::move (selector))
+            CPPLINQ_INLINEMETHOD any_predicate_builder (predicate_type  predicate) CPPLINQ_NOEXCEPT
+                :   predicate   (std::move (predicate))
             {
             }
 
-            CPPLINQ_INLINEMETHOD sum_selector_builder (sum_selector_builder const & v) CPPLINQ_NOEXCEPT
-                :   selector (v.selector)
+            CPPLINQ_INLINEMETHOD any_predicate_builder (any_predicate_builder const & v) CPPLINQ_NOEXCEPT
+                :   predicate   (v.predicate)
             {
             }
 
-            CPPLINQ_INLINEMETHOD sum_selector_builder (sum_selector_builder && v) CPPLINQ_NOEXCEPT
-                :   selector (std::move (v.selector))
+            CPPLINQ_INLINEMETHOD any_predicate_builder (any_predicate_builder && v) CPPLINQ_NOEXCEPT
+                :   predicate   (std::move (v.predicate))
             {
             }
 
+
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD typename get_transformed_type<selector_type, typename TRange::value_type>::type build (TRange range) const
+            CPPLINQ_INLINEMETHOD bool build (TRange range) const
             {
-                typedef typename get_transformed_type<selector_type, typename TRange::value_type>::type value_type;
-
-                auto sum = value_type ();
-                while (range.next ())
+                bool any = false;
+                while (pull (query_any, range) && !any)
                 {
-                    sum += selector (range.front ());
+                    any = predicate (range.front ());
                 }
-                return sum;
+                return any;
             }
-
         };
 
-        struct sum_builder : base_builder
+        struct any_builder : base_builder
         {
-            typedef                 sum_builder                     this_type       ;
+            typedef                 any_builder                   this_type       ;
 
-            CPPLINQ_INLINEMETHOD sum_builder () CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD any_builder () CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD sum_builder (sum_builder const & v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD any_builder (any_builder const & v) CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD sum_builder (sum_builder && v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD any_builder (any_builder && v) CPPLINQ_NOEXCEPT
             {
             }
 
+
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range) const
+            CPPLINQ_INLINEMETHOD bool build (TRange range) const
             {
-                auto sum = typename TRange::value_type ();
-                while (range.next ())
-                {
-                    sum += range.front ();
-                }
-                return sum;
+                return pull (query_any, range);
             }
 
         };
 
         // -------------------------------------------------------------------------
 
-        template <typename TSelector>
-        struct max_selector_builder : base_builder
+        template <typename TPredicate>
+        struct all_predicate_builder : base_builder
         {
-            typedef                 max_selector_builder<TSelector>     this_type       ;
-            typedef                 TSelector                           selector_type   ;
+            typedef                 all_predicate_builder<TPredicate>   this_type       ;
+            typedef                 TPredicate                          predicate_type  ;
 
-            selector_type           selector;
+            predicate_type          predicate   ;
 
-            CPPLINQ_INLINEMETHOD max_selector_builder (selector_type selector) CPPLINQ_NOEXCEPT
-                :   selector (std::move (selector))
+            CPPLINQ_INLINEMETHOD all_predicate_builder (predicate_type  predicate) CPPLINQ_NOEXCEPT
+                :   predicate   (std::move (predicate))
             {
             }
 
-            CPPLINQ_INLINEMETHOD max_selector_builder (max_selector_builder const & v) CPPLINQ_NOEXCEPT
-                :   selector (v.selector)
+            CPPLINQ_INLINEMETHOD all_predicate_builder (all_predicate_builder const & v) CPPLINQ_NOEXCEPT
+                :   predicate   (v.predicate)
             {
             }
 
-            CPPLINQ_INLINEMETHOD max_selector_builder (max_selector_builder && v) CPPLINQ_NOEXCEPT
-                :   selector (std::move (v.selector))
+            CPPLINQ_INLINEMETHOD all_predicate_builder (all_predicate_builder && v) CPPLINQ_NOEXCEPT
+                :   predicate   (std::move (v.predicate))
             {
             }
 
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD typename get_transformed_type<selector_type, typename TRange::value_type>::type build (TRange range) const
+            CPPLINQ_INLINEMETHOD bool build (TRange range) const
             {
-                typedef typename get_transformed_type<selector_type, typename TRange::value_type>::type value_type;
-
-                auto current = std::numeric_limits<value_type>::lowest ();
-                while (range.next ())
+                while (pull (query_all, range))
                 {
-                    auto v = selector (range.front ());
-                    if (current < v)
+                    if (!predicate (range.front ()))
                     {
-                        current = std::move (v);
+                        return false;
                     }
                 }
 
-                return current;
+                return true;
             }
-
         };
 
-        struct max_builder : base_builder
+        // -------------------------------------------------------------------------
+
+        template <typename TValue>
+        struct contains_builder : base_builder
         {
-            typedef                 max_builder                         this_type       ;
+            typedef                 contains_builder<TValue>        this_type       ;
+            typedef                 TValue                          value_type      ;
 
-            CPPLINQ_INLINEMETHOD max_builder () CPPLINQ_NOEXCEPT
+            value_type              value;
+
+            CPPLINQ_INLINEMETHOD contains_builder (value_type value) CPPLINQ_NOEXCEPT
+                :   value (std::move (value))
             {
             }
 
-            CPPLINQ_INLINEMETHOD max_builder (max_builder const & v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD contains_builder (contains_builder const & v) CPPLINQ_NOEXCEPT
+                :   value (v.value)
             {
             }
 
-            CPPLINQ_INLINEMETHOD max_builder (max_builder && v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD contains_builder (contains_builder && v) CPPLINQ_NOEXCEPT
+                :   value (std::move (v.value))
             {
             }
 
 
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range) const
+            CPPLINQ_INLINEMETHOD bool build (TRange range) const
             {
-                auto current = std::numeric_limits<typename TRange::value_type>::lowest ();
-                while (range.next ())
+                while (pull (query_contains, range))
                 {
-                    auto v = range.front ();
-                    if (current < v)
+                    if (range.front () == value)
                     {
-                        current = std::move (v);
+                        return true;
                     }
                 }
 
-                return current;
+                return false;
             }
 
         };
 
-        // -------------------------------------------------------------------------
-
-        template <typename TSelector>
-        struct min_selector_builder : base_builder
+        template <typename TValue, typename TPredicate>
+        struct contains_predicate_builder : base_builder
         {
-            typedef                 min_selector_builder<TSelector>     this_type       ;
-            typedef                 TSelector                           selector_type   ;
+            typedef                 contains_predicate_builder<TValue, TPredicate>  this_type       ;
+            typedef                 TValue                                          value_type      ;
+            typedef                 TPredicate                                      predicate_type  ;
 
-            selector_type           selector;
+            value_type              value;
+            predicate_type          predicate   ;
 
-            CPPLINQ_INLINEMETHOD min_selector_builder (selector_type selector) CPPLINQ_NOEXCEPT
-                :   selector (std::move (selector))
+            CPPLINQ_INLINEMETHOD contains_predicate_builder (value_type value, predicate_type predicate) CPPLINQ_NOEXCEPT
+                :   value       (std::move (value))
+                ,   predicate   (std::move (predicate))
             {
             }
 
-            CPPLINQ_INLINEMETHOD min_selector_builder (min_selector_builder const & v) CPPLINQ_NOEXCEPT
-                :   selector (v.selector)
+            CPPLINQ_INLINEMETHOD contains_predicate_builder (contains_predicate_builder const & v) CPPLINQ_NOEXCEPT
+                :   value       (v.value)
+                ,   predicate   (v.predicate)
             {
             }
 
-            CPPLINQ_INLINEMETHOD min_selector_builder (min_selector_builder && v) CPPLINQ_NOEXCEPT
-                :   selector (std::move (v.selector))
+            CPPLINQ_INLINEMETHOD contains_predicate_builder (contains_predicate_builder && v) CPPLINQ_NOEXCEPT
+                :   value       (std::move (v.value))
+                ,   predicate   (std::move (v.predicate))
             {
             }
 
 
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD typename get_transformed_type<selector_type, typename TRange::value_type>::type build (TRange range) const
+            CPPLINQ_INLINEMETHOD bool build (TRange range) const
             {
-                typedef typename get_transformed_type<selector_type, typename TRange::value_type>::type value_type;
-
-                auto current = std::numeric_limits<value_type>::max ();
-                while (range.next ())
+                while (pull (query_contains, range))
                 {
-                    auto v = selector (range.front ());
-                    if (v < current)
+                    if (predicate (range.front (), value))
                     {
-                        current = std::move (v);
+                        return true;
                     }
                 }
 
-                return current;
+                return false;
             }
 
         };
 
-        struct min_builder : base_builder
+        // -------------------------------------------------------------------------
+
+        struct element_at_or_default_builder : base_builder
         {
-            typedef                 min_builder                         this_type       ;
+            typedef                 element_at_or_default_builder   this_type       ;
 
-            CPPLINQ_INLINEMETHOD min_builder () CPPLINQ_NOEXCEPT
+            size_type               index;
+
+            CPPLINQ_INLINEMETHOD element_at_or_default_builder (size_type index) CPPLINQ_NOEXCEPT
+                :   index (std::move (index))
             {
             }
 
-            CPPLINQ_INLINEMETHOD min_builder (min_builder const & v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD element_at_or_default_builder (element_at_or_default_builder const & v) CPPLINQ_NOEXCEPT
+                :   index (v.index)
             {
             }
 
-            CPPLINQ_INLINEMETHOD min_builder (min_builder && v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD element_at_or_default_builder (element_at_or_default_builder && v) CPPLINQ_NOEXCEPT
+                :   index (std::move (v.index))
             {
             }
 
@@ -4147,766 +11899,963 @@ namespace cpplinq
             template<typename TRange>
             CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range) const
             {
-                auto current = std::numeric_limits<typename TRange::value_type>::max ();
-                while (range.next ())
+                return build (std::move (range), is_random_access_range<TRange> ());
+            }
+
+            template<typename TRange>
+            CPPLINQ_METHOD typename TRange::value_type build (TRange range, std::true_type) const
+            {
+                if (index < range.size ())
                 {
-                    auto v = range.front ();
-                    if (v < current)
+                    return range.at (index);
+                }
+
+                return typename TRange::value_type ();
+            }
+
+            template<typename TRange>
+            CPPLINQ_METHOD typename TRange::value_type build (TRange range, std::false_type) const
+            {
+                if (index < invalid_size)
+                {
+                    limit_range (range, index + 1U);
+                }
+
+                size_type current = 0U;
+
+                while (pull (query_element_at_or_default, range))
+                {
+                    if (current < index)
                     {
-                        current = std::move (v);
+                        ++current;
+                    }
+                    else
+                    {
+                        return range.front ();
                     }
                 }
 
-                return current;
+                return typename TRange::value_type ();
+
             }
 
         };
 
         // -------------------------------------------------------------------------
 
-        template <typename TSelector>
-        struct avg_selector_builder : base_builder
+        template<typename TRange>
+        struct pairwise_range : base_range
         {
-            typedef                 avg_selector_builder<TSelector>     this_type       ;
-            typedef                 TSelector                           selector_type   ;
+            typedef                 pairwise_range<TRange>                      this_type           ;
+            typedef                 TRange                                      range_type          ;
 
-            selector_type           selector;
+            typedef                 typename TRange::value_type                 element_type        ;
+            typedef                 std::pair<element_type,element_type>        value_type          ;
+            typedef                 value_type                                  return_type         ;
+
+            enum
+            {
+                returns_reference   = 0     ,
+                instrumented_as     = query_pairwise ,
+            };
+
+
+            // The current element is read from range, only the previous
+            // element is kept
+            range_type                   range               ;
+            opt<element_type>            previous            ;
+
+            CPPLINQ_INLINEMETHOD pairwise_range (
+                    range_type          range
+                ) CPPLINQ_NOEXCEPT
+                :   range               (std::move (range))
+            {
+            }
 
-            CPPLINQ_INLINEMETHOD avg_selector_builder (selector_type selector) CPPLINQ_NOEXCEPT
-                :   selector (std::move (selector))
+            CPPLINQ_INLINEMETHOD pairwise_range (pairwise_range const & v)
+                :   range               (v.range)
+                ,   previous            (copy_cache (v.previous))
             {
             }
 
-            CPPLINQ_INLINEMETHOD avg_selector_builder (avg_selector_builder const & v) CPPLINQ_NOEXCEPT
-                :   selector (v.selector)
+            CPPLINQ_INLINEMETHOD pairwise_range (pairwise_range && v) CPPLINQ_NOEXCEPT
+                :   range               (std::move (v.range))
+                ,   previous            (std::move (v.previous))
             {
             }
 
-            CPPLINQ_INLINEMETHOD avg_selector_builder (avg_selector_builder && v) CPPLINQ_NOEXCEPT
-                :   selector (std::move (v.selector))
+            template<typename TPairwiseBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TPairwiseBuilder, this_type>::type operator>>(TPairwiseBuilder pairwise_builder) const
             {
+                return pairwise_builder.build (*this);
             }
 
+            CPPLINQ_INLINEMETHOD memory_resource * resource () const CPPLINQ_NOEXCEPT
+            {
+                return get_memory_resource (range);
+            }
 
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD typename get_transformed_type<selector_type, typename TRange::value_type>::type build (TRange range) const
+            CPPLINQ_INLINEMETHOD return_type front () const
             {
-                typedef typename get_transformed_type<selector_type, typename TRange::value_type>::type value_type;
+                CPPLINQ_ASSERT (previous.has_value ());
+                return value_type (previous.get (), range.front ());
+            }
 
-                auto sum = value_type ();
-                int count = 0;
-                while (range.next ())
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                if (!previous.has_value () && !pull (query_pairwise, range))
                 {
-                    sum += selector (range.front ());
-                    ++count;
+                    return false;
                 }
 
-                if (count == 0)
+                previous = store_front (query_pairwise, range);
+
+                if (pull (query_pairwise, range))
                 {
-                    return sum;
+                    return true;
                 }
 
-                return sum/count;
-            }
+                previous.clear ();
 
+                return false;
+            }
         };
 
-        struct avg_builder : base_builder
+        struct pairwise_builder : base_builder
         {
-            typedef                 avg_builder                         this_type       ;
+            typedef             pairwise_builder     this_type   ;
 
-            CPPLINQ_INLINEMETHOD avg_builder () CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD pairwise_builder () CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD avg_builder (avg_builder const & v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD pairwise_builder (pairwise_builder const & v) CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD avg_builder (avg_builder && v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD pairwise_builder (pairwise_builder && v) CPPLINQ_NOEXCEPT
             {
             }
 
-
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range) const
+            CPPLINQ_INLINEMETHOD pairwise_range<TRange> build (TRange range) const
             {
-                auto sum = typename TRange::value_type ();
-                int  count = 0;
-                while (range.next ())
-                {
-                    sum += range.front ();
-                    ++count;
-                }
-
-                if (count == 0)
-                {
-                    return sum;
-                }
-
-                return sum/count;
+                return pairwise_range<TRange> (std::move (range));
             }
-
         };
 
         // -------------------------------------------------------------------------
 
-        template <typename TAccumulate, typename TAccumulator>
-        struct aggregate_builder : base_builder
+        template<typename TRange, typename TOtherRange>
+        struct zip_with_range : base_range
         {
-            typedef                 aggregate_builder<TAccumulate, TAccumulator>    this_type       ;
-            typedef                 TAccumulator                                    accumulator_type;
-            typedef                 TAccumulate                                     seed_type;
+            typedef             zip_with_range<TRange, TOtherRange>                     this_type          ;
+            typedef             TRange                                                  range_type         ;
+            typedef             TOtherRange                                             other_range_type   ;
 
-            seed_type               seed;
-            accumulator_type        accumulator;
+            typedef    typename cleanup_type<typename TRange::value_type>::type         left_element_type  ;
+            typedef    typename cleanup_type<typename TOtherRange::value_type>::type    right_element_type ;
+            typedef             std::pair<left_element_type,right_element_type>         value_type         ;
+            typedef             value_type                                              return_type        ;
+            enum
+            {
+                returns_reference   = 0 ,
+                instrumented_as     = query_zip_with ,
+            };
 
-            CPPLINQ_INLINEMETHOD aggregate_builder (seed_type seed, accumulator_type accumulator) CPPLINQ_NOEXCEPT
-                :   seed        (std::move (seed))
-                ,   accumulator (std::move (accumulator))
+            range_type                  range               ;
+            other_range_type            other_range         ;
+
+            CPPLINQ_INLINEMETHOD zip_with_range (
+                        range_type          range
+                    ,   other_range_type    other_range
+                ) CPPLINQ_NOEXCEPT
+                :   range               (std::move (range))
+                ,   other_range         (std::move (other_range))
             {
             }
 
-            CPPLINQ_INLINEMETHOD aggregate_builder (aggregate_builder const & v) CPPLINQ_NOEXCEPT
-                :   seed        (v.seed)
-                ,   accumulator (v.accumulator)
+            CPPLINQ_INLINEMETHOD zip_with_range (zip_with_range const & v) CPPLINQ_NOEXCEPT
+                :   range               (v.range)
+                ,   other_range         (v.other_range)
             {
             }
 
-            CPPLINQ_INLINEMETHOD aggregate_builder (aggregate_builder && v) CPPLINQ_NOEXCEPT
-                :   seed        (std::move (v.seed))
-                ,   accumulator (std::move (v.accumulator))
+            CPPLINQ_INLINEMETHOD zip_with_range (zip_with_range && v) CPPLINQ_NOEXCEPT
+                :   range               (std::move (v.range))
+                ,   other_range         (std::move (v.other_range))
             {
             }
 
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD seed_type build (TRange range) const
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
             {
-                auto sum = seed;
-                while (range.next ())
-                {
-                    sum = accumulator (sum, range.front ());
-                }
-                return sum;
+                return range_builder.build (*this);
+            }
+
+            CPPLINQ_INLINEMETHOD memory_resource * resource () const CPPLINQ_NOEXCEPT
+            {
+                return get_memory_resource (range);
+            }
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                return std::make_pair (range.front (), other_range.front ());
+            }
+
+            CPPLINQ_INLINEMETHOD size_type size_hint () const
+            {
+                auto hint       = get_size_hint (range);
+                auto other_hint = get_size_hint (other_range);
+                return hint == invalid_size || other_hint == invalid_size
+                    ?   invalid_size
+                    :   std::min (hint, other_hint)
+                    ;
             }
 
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                return pull (query_zip_with, range) && pull (query_zip_with, other_range);
+            }
         };
 
-        template <typename TAccumulate, typename TAccumulator, typename TSelector>
-        struct aggregate_result_selector_builder : base_builder
+        template <typename TOtherRange>
+        struct zip_with_builder : base_builder
         {
-            typedef                 aggregate_result_selector_builder<TAccumulate, TAccumulator, TSelector> this_type       ;
-            typedef                 TAccumulator                                                            accumulator_type;
-            typedef                 TAccumulate                                                             seed_type;
-            typedef                 TSelector                                                               result_selector_type;
+            typedef                 zip_with_builder<TOtherRange>         this_type       ;
+            typedef                 TOtherRange                           other_range_type;
 
-            seed_type               seed;
-            accumulator_type        accumulator;
-            result_selector_type    result_selector;
+            other_range_type        other_range         ;
 
-            CPPLINQ_INLINEMETHOD aggregate_result_selector_builder (seed_type seed, accumulator_type accumulator, result_selector_type result_selector) CPPLINQ_NOEXCEPT
-                :   seed            (std::move (seed))
-                ,   accumulator     (std::move (accumulator))
-                ,   result_selector (std::move (result_selector))
+            CPPLINQ_INLINEMETHOD zip_with_builder (TOtherRange other_range) CPPLINQ_NOEXCEPT
+                : other_range (std::move (other_range))
             {
             }
 
-            CPPLINQ_INLINEMETHOD aggregate_result_selector_builder (aggregate_result_selector_builder const & v) CPPLINQ_NOEXCEPT
-                :   seed            (v.seed)
-                ,   accumulator     (v.accumulator)
-                ,   result_selector (v.result_selector)
+            CPPLINQ_INLINEMETHOD zip_with_builder (zip_with_builder const & v) CPPLINQ_NOEXCEPT
+                : other_range (v.other_range)
             {
             }
 
-            CPPLINQ_INLINEMETHOD aggregate_result_selector_builder (aggregate_result_selector_builder && v) CPPLINQ_NOEXCEPT
-                :   seed            (std::move (v.seed))
-                ,   accumulator     (std::move (v.accumulator))
-                ,   result_selector (std::move (v.result_selector))
+            CPPLINQ_INLINEMETHOD zip_with_builder (zip_with_builder && v) CPPLINQ_NOEXCEPT
+                : other_range (std::move (v.other_range))
             {
             }
 
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD auto build (TRange range) const -> decltype (result_selector (seed))
+            template <typename TRange>
+            CPPLINQ_INLINEMETHOD zip_with_range<TRange, TOtherRange> build (TRange range) const
             {
-                auto sum = seed;
-                while (range.next ())
-                {
-                    sum = accumulator (sum, range.front ());
-                }
-
-                return result_selector (sum);
+                return zip_with_range<TRange, TOtherRange> (std::move (range), std::move (other_range));
             }
-
         };
 
         // -------------------------------------------------------------------------
 
-        template <typename TOtherRange, typename TComparer>
-        struct sequence_equal_predicate_builder : base_builder
+        template<typename TPredicate>
+        struct generate_range : base_range
         {
-            typedef                 sequence_equal_predicate_builder<TOtherRange,TComparer>     this_type       ;
-            typedef                 TOtherRange                                                 other_range_type;
-            typedef                 TComparer                                                   comparer_type   ;
+            static         TPredicate get_predicate ();
 
-            other_range_type        other_range         ;
-            comparer_type           comparer            ;
+            typedef        decltype (get_predicate ()())                    raw_opt_value_type  ;
+            typedef        typename cleanup_type<raw_opt_value_type>::type  opt_value_type      ;
 
-            CPPLINQ_INLINEMETHOD sequence_equal_predicate_builder (
-                    TOtherRange     other_range
-                ,   comparer_type   comparer) CPPLINQ_NOEXCEPT
-                :   other_range (std::move (other_range))
-                ,   comparer    (std::move (comparer))
+            typedef        decltype (*(get_predicate ()()))                 raw_value_type      ;
+            typedef        typename cleanup_type<raw_value_type>::type      value_type          ;
+
+            typedef                 generate_range<TPredicate>      this_type           ;
+            typedef                 TPredicate                      predicate_type      ;
+            typedef                 value_type const &              return_type         ;
+
+            enum
+            {
+                returns_reference = 1,
+                instrumented_as   = query_generate,
+            };
+
+            TPredicate              predicate       ;
+            opt_value_type          current_value   ;
+
+            CPPLINQ_INLINEMETHOD generate_range (
+                    TPredicate predicate
+                ) CPPLINQ_NOEXCEPT
+                :   predicate   (std::move (predicate))
             {
             }
 
-            CPPLINQ_INLINEMETHOD sequence_equal_predicate_builder (sequence_equal_predicate_builder const & v) CPPLINQ_NOEXCEPT
-                :   other_range (v.other_range)
-                ,   comparer    (v.comparer)
+            CPPLINQ_INLINEMETHOD generate_range (generate_range const & v)
+                :   predicate       (v.predicate)
+                ,   current_value   (copy_cache (v.current_value))
             {
             }
 
-            CPPLINQ_INLINEMETHOD sequence_equal_predicate_builder (sequence_equal_predicate_builder && v) CPPLINQ_NOEXCEPT
-                :   other_range (std::move (v.other_range))
-                ,   comparer    (std::move (v.comparer))
+            CPPLINQ_INLINEMETHOD generate_range (generate_range && v) CPPLINQ_NOEXCEPT
+                :   predicate       (std::move (v.predicate))
+                ,   current_value   (std::move (v.current_value))
             {
             }
 
-            template <typename TRange>
-            CPPLINQ_INLINEMETHOD bool build (TRange range) const
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
             {
-                auto copy = other_range;
-                for (;;)
+                return range_builder.build (*this);
+            }
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                CPPLINQ_ASSERT (current_value);
+                return *current_value;
+            }
+
+            CPPLINQ_INLINEMETHOD value_type take_front ()
+            {
+                CPPLINQ_ASSERT (current_value);
+                return std::move (*current_value);
+            }
+
+            CPPLINQ_INLINEMETHOD bool next () CPPLINQ_NOEXCEPT
+            {
+                current_value = predicate ();
+                return current_value;
+            }
+        };
+
+        // -------------------------------------------------------------------------
+
+        // -------------------------------------------------------------------------
+        // file_text holds the contents of a file. Regular files are memory
+        // mapped when CPPLINQ_MMAP_POSIX is defined, other files are read into
+        // a buffer.
+        // -------------------------------------------------------------------------
+
+        struct file_text
+        {
+            CPPLINQ_METHOD explicit file_text (char const * path)
+                :   first   (nullptr)
+                ,   last    (nullptr)
+                ,   mapping (nullptr)
+                ,   mapped  (0U)
+            {
+#ifdef CPPLINQ_MMAP_POSIX
+                auto file = ::open (path, O_RDONLY);
+                if (file < 0)
+                {
+                    throw io_exception ();
+                }
+
+                struct stat status;
+                if (::fstat (file, &status) != 0)
                 {
-                    bool next1 = range.next ();
-                    bool next2 = copy.next ();
+                    ::close (file);
+                    throw io_exception ();
+                }
 
-                    // sequences are not of same length
-                    if (next1 != next2)
+                if (S_ISREG (status.st_mode))
+                {
+                    mapped = static_cast<size_type> (status.st_size);
+                    if (mapped > 0U)
                     {
-                        return false;
+                        mapping = ::mmap (nullptr, mapped, PROT_READ, MAP_PRIVATE, file, 0);
                     }
 
-                    // both sequences are over, next1 = next2 = false
-                    if (!next1)
+                    ::close (file);
+
+                    if (mapping == MAP_FAILED)
                     {
-                        return true;
+                        mapping = nullptr;
+                        mapped  = 0U;
+                        throw io_exception ();
                     }
 
-                    if (!comparer (range.front (), copy.front ()))
+                    if (mapping)
                     {
-                        return false;
+                        // Lines are scanned front to back once, readahead
+                        // can be aggressive and pages dropped early
+                        ::posix_madvise (mapping, mapped, POSIX_MADV_SEQUENTIAL);
+
+                        first   = static_cast<char const *> (mapping);
+                        last    = first + mapped;
                     }
-                }
-            }
-        };
 
-        template <typename TOtherRange>
-        struct sequence_equal_builder : base_builder
-        {
-            typedef                 sequence_equal_builder<TOtherRange>     this_type       ;
-            typedef                 TOtherRange                             other_range_type;
+                    return;
+                }
 
-            other_range_type        other_range         ;
+                ::close (file);
+#endif
+                read (path);
+            }
 
-            CPPLINQ_INLINEMETHOD sequence_equal_builder (TOtherRange other_range) CPPLINQ_NOEXCEPT
-                : other_range (std::move (other_range))
+            CPPLINQ_INLINEMETHOD ~file_text () CPPLINQ_NOEXCEPT
             {
+#ifdef CPPLINQ_MMAP_POSIX
+                if (mapping)
+                {
+                    ::munmap (mapping, mapped);
+                }
+#endif
             }
 
-            CPPLINQ_INLINEMETHOD sequence_equal_builder (sequence_equal_builder const & v) CPPLINQ_NOEXCEPT
-                : other_range (v.other_range)
+            CPPLINQ_INLINEMETHOD char const * begin () const CPPLINQ_NOEXCEPT
             {
+                return first;
             }
 
-            CPPLINQ_INLINEMETHOD sequence_equal_builder (sequence_equal_builder && v) CPPLINQ_NOEXCEPT
-                : other_range (std::move (v.other_range))
+            CPPLINQ_INLINEMETHOD char const * end () const CPPLINQ_NOEXCEPT
             {
+                return last;
             }
 
-            template <typename TRange>
-            CPPLINQ_INLINEMETHOD bool build (TRange range) const
+        private:
+            char const *        first   ;
+            char const *        last    ;
+            void *              mapping ;
+            size_type           mapped  ;
+            std::vector<char>   buffer  ;
+
+            CPPLINQ_INLINEMETHOD file_text (file_text const &);
+            CPPLINQ_INLINEMETHOD file_text & operator= (file_text const &);
+
+            CPPLINQ_METHOD void read (char const * path)
             {
-                auto copy = other_range;
-                for (;;)
+                auto file = std::fopen (path, "rb");
+                if (!file)
                 {
-                    bool next1 = range.next ();
-                    bool next2 = copy.next ();
+                    throw io_exception ();
+                }
 
-                    // sequences are not of same length
-                    if (next1 != next2)
-                    {
-                        return false;
-                    }
+                char chunk[64U * 1024U];
+                size_type count;
+                while ((count = std::fread (chunk, 1U, sizeof (chunk), file)) > 0U)
+                {
+                    buffer.insert (buffer.end (), chunk, chunk + count);
+                }
 
-                    // both sequences are over, next1 = next2 = false
-                    if (!next1)
-                    {
-                        return true;
-                    }
+                auto failed = std::ferror (file) != 0;
+                std::fclose (file);
 
-                    if (range.front () != copy.front ())
-                    {
-                        return false;
-                    }
+                if (failed)
+                {
+                    throw io_exception ();
                 }
+
+                first   = buffer.data ();
+                last    = first + buffer.size ();
             }
         };
 
-        // -------------------------------------------------------------------------
-
-        template<typename TCharType>
-        struct concatenate_builder : base_builder
+        // Yields the lines of a file as views into file_text, the line
+        // terminator ("\n" or "\r\n") is not part of the line. Copies of the
+        // range and of the lines share the file_text which lives as long as
+        // any of them. front () returns a reference so that consumers that
+        // only look at a line don't touch the reference count.
+        struct lines_range : base_range
         {
-            typedef                         concatenate_builder<TCharType>  this_type       ;
+            typedef                 lines_range                         this_type       ;
+            typedef                 shared_string_ref                   value_type      ;
+            typedef                 value_type const &                  return_type     ;
 
-            std::basic_string<TCharType>    separator   ;
-            size_type                       capacity    ;
+            enum
+            {
+                returns_reference   = 1 ,
+                instrumented_as     = query_from_lines ,
+            };
 
-            CPPLINQ_INLINEMETHOD concatenate_builder (
-                    std::basic_string<TCharType>    separator
-                ,   size_type capacity
-                ) CPPLINQ_NOEXCEPT
-                :   separator   (std::move (separator))
-                ,   capacity    (capacity)
+            std::shared_ptr<file_text const>    text    ;
+            char const *                        current ;   // Start of the next line
+            shared_string_ref                   line    ;
+
+            CPPLINQ_INLINEMETHOD explicit lines_range (std::shared_ptr<file_text const> text) CPPLINQ_NOEXCEPT
+                :   text    (std::move (text))
+                ,   current (this->text->begin ())
+                ,   line    (this->text, string_ref ())
             {
             }
 
-            CPPLINQ_INLINEMETHOD concatenate_builder (concatenate_builder const & v) CPPLINQ_NOEXCEPT
-                :   separator   (v.separator)
-                ,   capacity    (v.capacity)
+            CPPLINQ_INLINEMETHOD lines_range (lines_range const & v) CPPLINQ_NOEXCEPT
+                :   text    (v.text)
+                ,   current (v.current)
+                ,   line    (v.line)
             {
             }
 
-            CPPLINQ_INLINEMETHOD concatenate_builder (concatenate_builder && v) CPPLINQ_NOEXCEPT
-                :   separator   (std::move (v.separator))
-                ,   capacity    (std::move (v.capacity))
+            CPPLINQ_INLINEMETHOD lines_range (lines_range && v) CPPLINQ_NOEXCEPT
+                :   text    (std::move (v.text))
+                ,   current (std::move (v.current))
+                ,   line    (std::move (v.line))
             {
             }
 
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD typename std::basic_string<TCharType> build (TRange range) const
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
             {
-                auto                    first  =   true ;
-                std::vector<TCharType>  buffer          ;
-
-                buffer.reserve (capacity);
+                return range_builder.build (*this);
+            }
 
+            CPPLINQ_INLINEMETHOD return_type front () const CPPLINQ_NOEXCEPT
+            {
+                return line;
+            }
 
-                while (range.next ())
+            CPPLINQ_INLINEMETHOD bool next () CPPLINQ_NOEXCEPT
+            {
+                auto end = text->end ();
+                if (current == end)
                 {
-                    if (first)
-                    {
-                        first = false;
-                    }
-                    else
-                    {
-                        buffer.insert (
-                                buffer.end ()
-                            ,   separator.begin ()
-                            ,   separator.end ()
-                            );
-                    }
+                    return false;
+                }
 
-                    auto v = range.front ();
+                // memchr is vectorized by the C runtime
+                auto newline    = static_cast<char const *> (std::memchr (current, '\n', static_cast<size_type> (end - current)));
+                auto stop       = newline ? newline : end;
+                auto length     = static_cast<size_type> (stop - current);
 
-                    buffer.insert (
-                            buffer.end ()
-                        ,   v.begin ()
-                        ,   v.end ()
-                        );
+                if (length > 0U && current[length - 1U] == '\r')
+                {
+                    --length;
                 }
 
-                return std::basic_string<TCharType> (
-                        buffer.begin ()
-                    ,   buffer.end ()
-                    );
-            }
+                line.assign (text, string_ref (current, length));
+                current = newline ? newline + 1 : end;
 
+                return true;
+            }
         };
 
         // -------------------------------------------------------------------------
-        template <typename TPredicate>
-        struct any_predicate_builder : base_builder
+
+        // Exposes a file of fixed size records as a contiguous range of
+        // references into file_text. Copies of the range share the file_text
+        // which lives as long as any of them.
+        template<typename TRecord>
+        struct records_range : base_range
         {
-            typedef                 any_predicate_builder<TPredicate>   this_type       ;
-            typedef                 TPredicate                          predicate_type  ;
+            typedef                 records_range<TRecord>              this_type       ;
+            typedef                 from_range<TRecord const *>         records_type    ;
 
-            predicate_type          predicate   ;
+            typedef                 TRecord                             value_type      ;
+            typedef                 value_type const &                  return_type     ;
 
-            CPPLINQ_INLINEMETHOD any_predicate_builder (predicate_type  predicate) CPPLINQ_NOEXCEPT
-                :   predicate   (std::move (predicate))
+            enum
             {
-            }
+                returns_reference   = 1 ,
+                batched             = records_type::batched ,
+                random_access       = 1 ,
+                instrumented_as     = query_from_records ,
+            };
 
-            CPPLINQ_INLINEMETHOD any_predicate_builder (any_predicate_builder const & v) CPPLINQ_NOEXCEPT
-                :   predicate   (v.predicate)
+            std::shared_ptr<file_text const>    text    ;
+            records_type                        records ;
+
+            CPPLINQ_INLINEMETHOD explicit records_range (std::shared_ptr<file_text const> text) CPPLINQ_NOEXCEPT
+                :   text    (std::move (text))
+                ,   records (
+                            reinterpret_cast<value_type const *> (this->text->begin ())
+                        ,   reinterpret_cast<value_type const *> (this->text->end ())
+                        )
             {
             }
 
-            CPPLINQ_INLINEMETHOD any_predicate_builder (any_predicate_builder && v) CPPLINQ_NOEXCEPT
-                :   predicate   (std::move (v.predicate))
+            CPPLINQ_INLINEMETHOD records_range (records_range const & v) CPPLINQ_NOEXCEPT
+                :   text    (v.text)
+                ,   records (v.records)
             {
             }
 
-
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD bool build (TRange range) const
+            CPPLINQ_INLINEMETHOD records_range (records_range && v) CPPLINQ_NOEXCEPT
+                :   text    (std::move (v.text))
+                ,   records (std::move (v.records))
             {
-                bool any = false;
-                while (range.next () && !any)
-                {
-                    any = predicate (range.front ());
-                }
-                return any;
             }
-        };
-
-        struct any_builder : base_builder
-        {
-            typedef                 any_builder                   this_type       ;
 
-            CPPLINQ_INLINEMETHOD any_builder () CPPLINQ_NOEXCEPT
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
             {
+                return range_builder.build (*this);
             }
 
-            CPPLINQ_INLINEMETHOD any_builder (any_builder const & v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD return_type front () const
             {
+                return records.front ();
             }
 
-            CPPLINQ_INLINEMETHOD any_builder (any_builder && v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD bool next () CPPLINQ_NOEXCEPT
             {
+                return records.next ();
             }
 
-
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD bool build (TRange range) const
+            CPPLINQ_INLINEMETHOD size_type size_hint () const CPPLINQ_NOEXCEPT
             {
-                return range.next ();
+                return records.size ();
             }
 
-        };
-
-        // -------------------------------------------------------------------------
-
-        template <typename TPredicate>
-        struct all_predicate_builder : base_builder
-        {
-            typedef                 all_predicate_builder<TPredicate>   this_type       ;
-            typedef                 TPredicate                          predicate_type  ;
-
-            predicate_type          predicate   ;
-
-            CPPLINQ_INLINEMETHOD all_predicate_builder (predicate_type  predicate) CPPLINQ_NOEXCEPT
-                :   predicate   (std::move (predicate))
+            CPPLINQ_INLINEMETHOD size_type size () const CPPLINQ_NOEXCEPT
             {
+                return records.size ();
             }
 
-            CPPLINQ_INLINEMETHOD all_predicate_builder (all_predicate_builder const & v) CPPLINQ_NOEXCEPT
-                :   predicate   (v.predicate)
+            CPPLINQ_INLINEMETHOD void advance (size_type count) CPPLINQ_NOEXCEPT
             {
+                records.advance (count);
             }
 
-            CPPLINQ_INLINEMETHOD all_predicate_builder (all_predicate_builder && v) CPPLINQ_NOEXCEPT
-                :   predicate   (std::move (v.predicate))
+            CPPLINQ_INLINEMETHOD return_type at (size_type index) const
             {
+                return records.at (index);
             }
 
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD bool build (TRange range) const
+            CPPLINQ_INLINEMETHOD size_type next_batch (value_type * values, size_type capacity)
             {
-                while (range.next ())
-                {
-                    if (!predicate (range.front ()))
-                    {
-                        return false;
-                    }
-                }
-
-                return true;
+                return records.next_batch (values, capacity);
             }
         };
 
-        // -------------------------------------------------------------------------
-
-        template <typename TValue>
-        struct contains_builder : base_builder
+        template<typename TRecord>
+        struct contiguous_range_traits<records_range<TRecord>>
         {
-            typedef                 contains_builder<TValue>        this_type       ;
-            typedef                 TValue                          value_type      ;
+            typedef                 records_range<TRecord>              range_type      ;
+            typedef                 TRecord                             value_type      ;
+            typedef                 contiguous_range_traits<typename range_type::records_type>
+                                                                        records_traits  ;
 
-            value_type              value;
-
-            CPPLINQ_INLINEMETHOD contains_builder (value_type value) CPPLINQ_NOEXCEPT
-                :   value (std::move (value))
-            {
-            }
-
-            CPPLINQ_INLINEMETHOD contains_builder (contains_builder const & v) CPPLINQ_NOEXCEPT
-                :   value (v.value)
+            enum
             {
-            }
+                is_contiguous = 1   ,
+            };
 
-            CPPLINQ_INLINEMETHOD contains_builder (contains_builder && v) CPPLINQ_NOEXCEPT
-                :   value (std::move (v.value))
+            static CPPLINQ_INLINEMETHOD value_type const * data_of (range_type const & range)
             {
+                return records_traits::data_of (range.records);
             }
 
-
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD bool build (TRange range) const
+            static CPPLINQ_INLINEMETHOD size_type size_of (range_type const & range)
             {
-                while (range.next ())
-                {
-                    if (range.front () == value)
-                    {
-                        return true;
-                    }
-                }
-
-                return false;
+                return records_traits::size_of (range.records);
             }
+        };
 
+        template<typename TRecord>
+        struct is_stable_reference_range<records_range<TRecord>> : std::true_type
+        {
         };
 
-        template <typename TValue, typename TPredicate>
-        struct contains_predicate_builder : base_builder
+        template<typename TRecord>
+        struct is_repeatable_range<records_range<TRecord>> : std::true_type
         {
-            typedef                 contains_predicate_builder<TValue, TPredicate>  this_type       ;
-            typedef                 TValue                                          value_type      ;
-            typedef                 TPredicate                                      predicate_type  ;
+        };
 
-            value_type              value;
-            predicate_type          predicate   ;
+        // The chunks refer to the file_text of range which parallel keeps alive
+        template<typename TRecord>
+        struct partition_source_traits<records_range<TRecord>>
+        {
+            typedef                 records_range<TRecord>              range_type      ;
+            typedef                 partition_source_traits<typename range_type::records_type>
+                                                                        records_traits  ;
+            typedef        typename records_traits::chunk_type          chunk_type      ;
 
-            CPPLINQ_INLINEMETHOD contains_predicate_builder (value_type value, predicate_type predicate) CPPLINQ_NOEXCEPT
-                :   value       (std::move (value))
-                ,   predicate   (std::move (predicate))
+            enum
             {
-            }
+                is_partitionable = 1    ,
+            };
 
-            CPPLINQ_INLINEMETHOD contains_predicate_builder (contains_predicate_builder const & v) CPPLINQ_NOEXCEPT
-                :   value       (v.value)
-                ,   predicate   (v.predicate)
+            static CPPLINQ_INLINEMETHOD size_type size_of (range_type const & range)
             {
+                return records_traits::size_of (range.records);
             }
 
-            CPPLINQ_INLINEMETHOD contains_predicate_builder (contains_predicate_builder && v) CPPLINQ_NOEXCEPT
-                :   value       (std::move (v.value))
-                ,   predicate   (std::move (v.predicate))
+            static CPPLINQ_INLINEMETHOD chunk_type chunk (range_type const & range, size_type index, size_type count)
             {
+                return records_traits::chunk (range.records, index, count);
             }
+        };
 
-
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD bool build (TRange range) const
-            {
-                while (range.next ())
-                {
-                    if (predicate (range.front (), value))
-                    {
-                        return true;
-                    }
-                }
-
-                return false;
+        template<typename TRecord>
+        CPPLINQ_METHOD records_range<TRecord> make_records_range (std::string const & path)
+        {
+            auto text = std::make_shared<file_text> (path.c_str ());
+            if (static_cast<size_type> (text->end () - text->begin ()) % sizeof (TRecord) != 0U)
+            {
+                throw io_exception ();
             }
 
-        };
+            return records_range<TRecord> (std::move (text));
+        }
 
         // -------------------------------------------------------------------------
 
-        struct element_at_or_default_builder : base_builder
+        // -------------------------------------------------------------------------
+        // csv_field_traits<TField>::parse converts the text of a field, it
+        // returns false when the text isn't a valid TField
+        // -------------------------------------------------------------------------
+
+        struct csv_field
         {
-            typedef                 element_at_or_default_builder   this_type       ;
+            string_ref                                  text    ;
+            bool                                        quoted  ;
+            std::shared_ptr<file_text const> const *    owner   ;
+        };
 
-            size_type               index;
+        // string_ref columns are stored as shared_string_ref so that rows
+        // don't outlive the file their views point into
+        template<typename TField>
+        struct csv_value_type
+        {
+            typedef     TField              type    ;
+        };
 
-            CPPLINQ_INLINEMETHOD element_at_or_default_builder (size_type index) CPPLINQ_NOEXCEPT
-                :   index (std::move (index))
-            {
-            }
+        template<>
+        struct csv_value_type<string_ref>
+        {
+            typedef     shared_string_ref   type    ;
+        };
 
-            CPPLINQ_INLINEMETHOD element_at_or_default_builder (element_at_or_default_builder const & v) CPPLINQ_NOEXCEPT
-                :   index (v.index)
-            {
-            }
+        template<typename TField, typename TEnable = void>
+        struct csv_field_traits;
 
-            CPPLINQ_INLINEMETHOD element_at_or_default_builder (element_at_or_default_builder && v) CPPLINQ_NOEXCEPT
-                :   index (std::move (v.index))
+        template<>
+        struct csv_field_traits<shared_string_ref>
+        {
+            static CPPLINQ_INLINEMETHOD bool parse (csv_field const & field, shared_string_ref & value) CPPLINQ_NOEXCEPT
             {
+                value.assign (*field.owner, field.text);
+                return true;
             }
+        };
 
-
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range) const
+        template<>
+        struct csv_field_traits<std::string>
+        {
+            static CPPLINQ_METHOD bool parse (csv_field const & field, std::string & value)
             {
-                size_type current = 0U;
+                if (!field.quoted)
+                {
+                    value.assign (field.text.begin (), field.text.end ());
+                    return true;
+                }
 
-                while (range.next ())
+                // "" within quotes is a single "
+                value.clear ();
+                value.reserve (field.text.size ());
+                for (auto iter = field.text.begin (); iter != field.text.end (); ++iter)
                 {
-                    if (current < index)
-                    {
-                        ++current;
-                    }
-                    else
+                    value.push_back (*iter);
+                    if (*iter == '"')
                     {
-                        return range.front ();
+                        ++iter;
                     }
                 }
 
-                return typename TRange::value_type ();
-
+                return true;
             }
-
         };
 
-        // -------------------------------------------------------------------------
-
-        template<typename TRange>
-        struct pairwise_range : base_range
+        template<typename TField>
+        struct csv_field_traits<
+                TField
+            ,   typename std::enable_if<std::is_integral<TField>::value && !std::is_same<TField, bool>::value>::type
+            >
         {
-            typedef                 pairwise_range<TRange>                      this_type           ;
-            typedef                 TRange                                      range_type          ;
+            static CPPLINQ_METHOD bool parse (csv_field const & field, TField & value) CPPLINQ_NOEXCEPT
+            {
+                auto iter       = field.text.begin ();
+                auto end        = field.text.end ();
+                auto negative   = false;
 
-            typedef                 typename TRange::value_type                 element_type        ;
-            typedef                 std::pair<element_type,element_type>        value_type          ;
-            typedef                 value_type                                  return_type         ;
+                if (iter != end && (*iter == '-' || *iter == '+'))
+                {
+                    negative = *iter == '-';
+                    ++iter;
+                }
 
-            enum
-            {
-                returns_reference   = 0     ,
-            };
+                if (iter == end || (negative && !std::is_signed<TField>::value))
+                {
+                    return false;
+                }
 
+                // Accumulates the magnitude, the limit of a negative value is
+                // one more than the limit of a positive value
+                typedef typename std::make_unsigned<TField>::type unsigned_type;
+                auto limit = static_cast<unsigned long long> (std::numeric_limits<TField>::max ()) + (negative ? 1U : 0U);
 
-            range_type                   range               ;
-            opt<element_type>            previous            ;
-            opt<element_type>            current             ;
+                unsigned long long magnitude = 0U;
+                for (; iter != end; ++iter)
+                {
+                    auto digit = static_cast<unsigned> (*iter - '0');
+                    if (digit > 9U || magnitude > (limit - digit) / 10U)
+                    {
+                        return false;
+                    }
 
-            CPPLINQ_INLINEMETHOD pairwise_range (
-                    range_type          range
-                ) CPPLINQ_NOEXCEPT
-                :   range               (std::move (range))
-            {
-            }
+                    magnitude = magnitude * 10U + digit;
+                }
 
-            CPPLINQ_INLINEMETHOD pairwise_range (pairwise_range const & v) CPPLINQ_NOEXCEPT
-                :   range               (v.range)
-                ,   previous            (v.previous)
-                ,   current             (v.current)
-            {
-            }
+                value = negative
+                    ?   static_cast<TField> (static_cast<unsigned_type> (0U - magnitude))
+                    :   static_cast<TField> (magnitude)
+                    ;
 
-            CPPLINQ_INLINEMETHOD pairwise_range (pairwise_range && v) CPPLINQ_NOEXCEPT
-                :   range               (std::move (v.range))
-                ,   previous            (std::move (v.previous))
-                ,   current             (std::move (v.current))
-            {
+                return true;
             }
+        };
 
-            template<typename TPairwiseBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TPairwiseBuilder, this_type>::type operator>>(TPairwiseBuilder pairwise_builder) const
+        template<typename TField>
+        struct csv_field_traits<TField, typename std::enable_if<std::is_floating_point<TField>::value>::type>
+        {
+            static CPPLINQ_METHOD bool parse (csv_field const & field, TField & value)
             {
-                return pairwise_builder.build (*this);
-            }
+                auto size = field.text.size ();
+                if (size == 0U)
+                {
+                    return false;
+                }
 
-            CPPLINQ_INLINEMETHOD return_type front () const
-            {
-                CPPLINQ_ASSERT (previous.has_value ());
-                CPPLINQ_ASSERT (current.has_value ());
-                return std::make_pair (previous.get (), current.get ());
-            }
+                // strtod needs a null terminated string, long fields don't
+                // fit the local buffer and are copied to the heap
+                char            local[64]   ;
+                std::string     heap        ;
+                auto            buffer      = local;
+                if (size >= sizeof (local))
+                {
+                    heap.resize (size + 1U);
+                    buffer = &heap[0];
+                }
 
-            CPPLINQ_INLINEMETHOD bool next ()
-            {
-                if (!previous.has_value ())
+                // '.' is replaced by the decimal point strtod expects
+                auto point = get_decimal_point ();
+                for (auto index = 0U; index < size; ++index)
                 {
-                    if (range.next ())
-                    {
-                        current = range.front ();
-                    }
-                    else
+                    auto ch = field.text[index];
+                    if (ch == point && point != '.')
                     {
                         return false;
                     }
-                }
 
-                previous.swap (current);
+                    buffer[index] = ch == '.' ? point : ch;
+                }
+                buffer[size] = 0;
 
-                if (range.next ())
+                char * stop = nullptr;
+                auto result = to_floating (buffer, &stop, value);
+                if (stop != buffer + size)
                 {
-                    current = range.front ();
-                    return true;
+                    return false;
                 }
 
-                previous.clear ();
-                current.clear ();
-
-                return false;
+                value = static_cast<TField> (result);
+                return true;
             }
-        };
-
-        struct pairwise_builder : base_builder
-        {
-            typedef             pairwise_builder     this_type   ;
 
-            CPPLINQ_INLINEMETHOD pairwise_builder () CPPLINQ_NOEXCEPT
+        private:
+            static CPPLINQ_INLINEMETHOD double to_floating (char const * text, char ** stop, double) CPPLINQ_NOEXCEPT
             {
+                return std::strtod (text, stop);
             }
 
-            CPPLINQ_INLINEMETHOD pairwise_builder (pairwise_builder const & v) CPPLINQ_NOEXCEPT
+            static CPPLINQ_INLINEMETHOD double to_floating (char const * text, char ** stop, float) CPPLINQ_NOEXCEPT
             {
+                return std::strtod (text, stop);
             }
 
-            CPPLINQ_INLINEMETHOD pairwise_builder (pairwise_builder && v) CPPLINQ_NOEXCEPT
+            static CPPLINQ_INLINEMETHOD long double to_floating (char const * text, char ** stop, long double) CPPLINQ_NOEXCEPT
             {
+                return std::strtold (text, stop);
             }
+        };
 
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD pairwise_range<TRange> build (TRange range) const
+        template<size_type index, typename TRow, bool done = (index == std::tuple_size<TRow>::value)>
+        struct csv_parse_fields
+        {
+            static CPPLINQ_INLINEMETHOD void parse (csv_field const * fields, TRow & row)
             {
-                return pairwise_range<TRange> (std::move (range));
+                typedef typename std::tuple_element<index, TRow>::type field_type;
+
+                if (!csv_field_traits<field_type>::parse (fields[index], std::get<index> (row)))
+                {
+                    throw parse_exception ();
+                }
+
+                csv_parse_fields<index + 1U, TRow>::parse (fields, row);
             }
         };
 
-        // -------------------------------------------------------------------------
+        template<size_type index, typename TRow>
+        struct csv_parse_fields<index, TRow, true>
+        {
+            static CPPLINQ_INLINEMETHOD void parse (csv_field const *, TRow &) CPPLINQ_NOEXCEPT
+            {
+            }
+        };
 
-        template<typename TRange, typename TOtherRange>
-        struct zip_with_range : base_range
+        // Yields the records of delimited text (RFC 4180) as tuples of the
+        // projected columns. The text is scanned one record at a time and
+        // only the projected columns are converted. Copies of the range share
+        // the file_text which lives as long as any of them.
+        template<typename... TFields>
+        struct csv_range : base_range
         {
-            typedef             zip_with_range<TRange, TOtherRange>                     this_type          ;
-            typedef             TRange                                                  range_type         ;
-            typedef             TOtherRange                                             other_range_type   ;
+            typedef                 csv_range<TFields...>               this_type       ;
+            typedef                 std::tuple<typename csv_value_type<TFields>::type...>
+                                                                        value_type      ;
+            typedef                 value_type const &                  return_type     ;
 
-            typedef    typename cleanup_type<typename TRange::value_type>::type         left_element_type  ;
-            typedef    typename cleanup_type<typename TOtherRange::value_type>::type    right_element_type ;
-            typedef             std::pair<left_element_type,right_element_type>         value_type         ;
-            typedef             value_type                                              return_type        ;
             enum
             {
-                returns_reference   = 0 ,
+                returns_reference   = 1 ,
+                column_count        = sizeof... (TFields) ,
+                instrumented_as     = query_from_csv ,
             };
 
-            range_type                  range               ;
-            other_range_type            other_range         ;
+            typedef                 std::array<size_type, column_count> indices_type    ;
+            typedef                 std::array<csv_field, column_count> fields_type     ;
 
-            CPPLINQ_INLINEMETHOD zip_with_range (
-                        range_type          range
-                    ,   other_range_type    other_range
-                ) CPPLINQ_NOEXCEPT
-                :   range               (std::move (range))
-                ,   other_range         (std::move (other_range))
+            std::shared_ptr<file_text const>    text    ;
+            csv_options                         options ;
+            indices_type                        indices ;
+            size_type                           last    ;   // Largest projected index
+            char const *                        current ;   // Start of the next record
+            value_type                          row     ;
+
+            CPPLINQ_INLINEMETHOD csv_range (
+                    std::shared_ptr<file_text const>    text
+                ,   csv_options                         options
+                ,   indices_type                        indices
+                )
+                :   text    (std::move (text))
+                ,   options (std::move (options))
+                ,   indices (std::move (indices))
+                ,   last    (0U)
+                ,   current (this->text->begin ())
             {
+                for (auto index : this->indices)
+                {
+                    last = std::max (last, index);
+                }
+
+                if (this->options.has_header)
+                {
+                    // Empty lines before the header are skipped
+                    fields_type fields = {};
+                    while (current != this->text->end () && scan_record (fields) == 0U)
+                    {
+                    }
+                }
             }
 
-            CPPLINQ_INLINEMETHOD zip_with_range (zip_with_range const & v) CPPLINQ_NOEXCEPT
-                :   range               (v.range)
-                ,   other_range         (v.other_range)
+            CPPLINQ_INLINEMETHOD csv_range (csv_range const & v)
+                :   text    (v.text)
+                ,   options (v.options)
+                ,   indices (v.indices)
+                ,   last    (v.last)
+                ,   current (v.current)
+                ,   row     (v.row)
             {
             }
 
-            CPPLINQ_INLINEMETHOD zip_with_range (zip_with_range && v) CPPLINQ_NOEXCEPT
-                :   range               (std::move (v.range))
-                ,   other_range         (std::move (v.other_range))
+            CPPLINQ_INLINEMETHOD csv_range (csv_range && v) CPPLINQ_NOEXCEPT
+                :   text    (std::move (v.text))
+                ,   options (std::move (v.options))
+                ,   indices (std::move (v.indices))
+                ,   last    (std::move (v.last))
+                ,   current (std::move (v.current))
+                ,   row     (std::move (v.row))
             {
             }
 
@@ -4916,107 +12865,153 @@ namespace cpplinq
                 return range_builder.build (*this);
             }
 
-            CPPLINQ_INLINEMETHOD return_type front () const
+            CPPLINQ_INLINEMETHOD return_type front () const CPPLINQ_NOEXCEPT
             {
-                return std::make_pair (range.front (), other_range.front ());
+                return row;
             }
 
-            CPPLINQ_INLINEMETHOD bool next ()
+            CPPLINQ_INLINEMETHOD value_type take_front ()
             {
-                return range.next () && other_range.next ();
+                return std::move (row);
             }
-        };
 
-        template <typename TOtherRange>
-        struct zip_with_builder : base_builder
-        {
-            typedef                 zip_with_builder<TOtherRange>         this_type       ;
-            typedef                 TOtherRange                           other_range_type;
+            CPPLINQ_METHOD bool next ()
+            {
+                fields_type fields = {};
+                size_type   count;
 
-            other_range_type        other_range         ;
+                do
+                {
+                    if (current == text->end ())
+                    {
+                        return false;
+                    }
 
-            CPPLINQ_INLINEMETHOD zip_with_builder (TOtherRange other_range) CPPLINQ_NOEXCEPT
-                : other_range (std::move (other_range))
-            {
-            }
+                    count = scan_record (fields);
+                }
+                while (count == 0U);    // Empty lines are skipped
 
-            CPPLINQ_INLINEMETHOD zip_with_builder (zip_with_builder const & v) CPPLINQ_NOEXCEPT
-                : other_range (v.other_range)
-            {
-            }
+                if (count <= last)
+                {
+                    throw parse_exception ();
+                }
 
-            CPPLINQ_INLINEMETHOD zip_with_builder (zip_with_builder && v) CPPLINQ_NOEXCEPT
-                : other_range (std::move (v.other_range))
-            {
+                csv_parse_fields<0U, value_type>::parse (fields.data (), row);
+
+                return true;
             }
 
-            template <typename TRange>
-            CPPLINQ_INLINEMETHOD zip_with_range<TRange, TOtherRange> build (TRange range) const
+        private:
+            // Scans the record at current into the projected fields, returns
+            // the number of fields in the record, 0 for an empty line
+            CPPLINQ_METHOD size_type scan_record (fields_type & fields)
             {
-                return zip_with_range<TRange, TOtherRange> (std::move (range), std::move (other_range));
-            }
-        };
+                auto end = text->end ();
 
-        // -------------------------------------------------------------------------
+                if (*current == '\n' || (*current == '\r' && current + 1 != end && current[1] == '\n'))
+                {
+                    current += *current == '\n' ? 1 : 2;
+                    return 0U;
+                }
 
-        template<typename TPredicate>
-        struct generate_range : base_range
-        {
-            static         TPredicate get_predicate ();
+                auto index = size_type (0U);
+                for (;;)
+                {
+                    csv_field field = {};
+                    field.owner = &text;
 
-            typedef        decltype (get_predicate ()())                    raw_opt_value_type  ;
-            typedef        typename cleanup_type<raw_opt_value_type>::type  opt_value_type      ;
+                    if (current != end && *current == '"')
+                    {
+                        auto first = ++current;
+                        while (current != end && (*current != '"' || (current + 1 != end && current[1] == '"')))
+                        {
+                            current += *current == '"' ? 2 : 1;
+                        }
 
-            typedef        decltype (*(get_predicate ()()))                 raw_value_type      ;
-            typedef        typename cleanup_type<raw_value_type>::type      value_type          ;
+                        if (current == end)
+                        {
+                            // Unterminated quote
+                            throw parse_exception ();
+                        }
 
-            typedef                 generate_range<TPredicate>      this_type           ;
-            typedef                 TPredicate                      predicate_type      ;
-            typedef                 value_type const &              return_type         ;
+                        field.text      = string_ref (first, static_cast<size_type> (current - first));
+                        field.quoted    = true;
+                        ++current;
+                    }
+                    else
+                    {
+                        auto first = current;
+                        while (current != end && *current != options.delimiter && *current != '\n')
+                        {
+                            ++current;
+                        }
+
+                        field.text = string_ref (first, static_cast<size_type> (current - first));
+                    }
+
+                    if (index <= last)
+                    {
+                        for (auto column = 0U; column < indices.size (); ++column)
+                        {
+                            if (indices[column] == index)
+                            {
+                                fields[column] = field;
+                            }
+                        }
+                    }
+
+                    ++index;
+
+                    if (current == end)
+                    {
+                        break;
+                    }
 
-            enum
-            {
-                returns_reference = 1,
-            };
+                    if (*current == options.delimiter)
+                    {
+                        ++current;
+                        continue;
+                    }
 
-            TPredicate              predicate       ;
-            opt_value_type          current_value   ;
+                    if (*current == '\r' && (current + 1 == end || current[1] == '\n'))
+                    {
+                        ++current;
 
-            CPPLINQ_INLINEMETHOD generate_range (
-                    TPredicate predicate
-                ) CPPLINQ_NOEXCEPT
-                :   predicate   (std::move (predicate))
-            {
-            }
+                        if (current == end)
+                        {
+                            break;
+                        }
+                    }
 
-            CPPLINQ_INLINEMETHOD generate_range (generate_range const & v) CPPLINQ_NOEXCEPT
-                :   predicate       (v.predicate)
-                ,   current_value   (v.current_value)
-            {
-            }
+                    if (current != end && *current == '\n')
+                    {
+                        ++current;
+                        break;
+                    }
 
-            CPPLINQ_INLINEMETHOD generate_range (generate_range && v) CPPLINQ_NOEXCEPT
-                :   predicate       (std::move (v.predicate))
-                ,   current_value   (std::move (v.current_value))
-            {
-            }
+                    if (current != end)
+                    {
+                        // Text after a closing quote
+                        throw parse_exception ();
+                    }
+                }
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
-            {
-                return range_builder.build (*this);
-            }
+                strip_carriage_return (fields, index - 1U);
 
-            CPPLINQ_INLINEMETHOD return_type front () const
-            {
-                CPPLINQ_ASSERT (current_value);
-                return *current_value;
+                return index;
             }
 
-            CPPLINQ_INLINEMETHOD bool next () CPPLINQ_NOEXCEPT
+            // An unquoted last field of a "\r\n" terminated record ends with '\r'
+            CPPLINQ_INLINEMETHOD void strip_carriage_return (fields_type & fields, size_type index) CPPLINQ_NOEXCEPT
             {
-                current_value = predicate ();
-                return current_value;
+                for (auto column = 0U; column < indices.size (); ++column)
+                {
+                    auto & field = fields[column];
+                    if (indices[column] == index && !field.quoted && !field.text.empty () && field.text[field.text.size () - 1U] == '\r')
+                    {
+                        field.text = field.text.substr (0U, field.text.size () - 1U);
+                    }
+                }
             }
         };
 
@@ -5040,13 +13035,15 @@ namespace cpplinq
     }
 
     template<typename TContainer>
-    CPPLINQ_INLINEMETHOD detail::from_range<typename TContainer::const_iterator> from (
+    CPPLINQ_INLINEMETHOD detail::from_range<typename detail::from_container_traits<TContainer>::iterator_type> from (
             TContainer  const & container
         )
     {
-        return detail::from_range<typename TContainer::const_iterator> (
-                container.begin ()
-            ,   container.end ()
+        typedef detail::from_container_traits<TContainer>   container_traits;
+
+        return detail::from_range<typename container_traits::iterator_type> (
+                container_traits::begin_of (container)
+            ,   container_traits::end_of (container)
             );
     }
 
@@ -5087,6 +13084,62 @@ namespace cpplinq
         return detail::generate_range<TPredicate> (std::move (predicate));
     }
 
+    // Yields the lines of the file at path as shared_string_ref views into
+    // the file, memory mapped where supported. The file stays open as long
+    // as the range, a range built from it or a line is alive, use str ()
+    // to copy a line instead. Throws io_exception when the file can't be
+    // read.
+    CPPLINQ_INLINEMETHOD detail::lines_range from_lines (std::string const & path)
+    {
+        return detail::lines_range (std::make_shared<detail::file_text> (path.c_str ()));
+    }
+
+    // Yields the records of a file of trivially copyable TRecord values as
+    // references into the file, memory mapped where supported. The range
+    // is contiguous and random access like from () over a std::vector and
+    // the references are valid as long as the range or a range built from
+    // it is alive. Throws io_exception when the file can't be read or its
+    // size isn't a multiple of sizeof (TRecord).
+    template<typename TRecord>
+    CPPLINQ_INLINEMETHOD detail::records_range<TRecord> from_records (std::string const & path)
+    {
+        static_assert (std::is_trivially_copyable<TRecord>::value, "from_records requires trivially copyable records");
+
+        return detail::make_records_range<TRecord> (path);
+    }
+
+    // Yields the records of the delimited text file at path as
+    // std::tuple<TFields...> of the projected columns, see csv_column.
+    // Like from_lines the file stays open as long as a row with a
+    // string_ref column is alive.
+    // Throws io_exception when the file can't be read and parse_exception
+    // when a record lacks a projected column or a field doesn't parse.
+    template<typename... TFields>
+    CPPLINQ_INLINEMETHOD detail::csv_range<TFields...> from_csv (
+            std::string const &         path
+        ,   csv_options                 options
+        ,   csv_column<TFields> ...     columns
+        )
+    {
+        typedef typename detail::csv_range<TFields...>::indices_type indices_type;
+
+        indices_type indices = {{columns.index...}};
+        return detail::csv_range<TFields...> (
+                std::make_shared<detail::file_text> (path.c_str ())
+            ,   std::move (options)
+            ,   std::move (indices)
+            );
+    }
+
+    template<typename... TFields>
+    CPPLINQ_INLINEMETHOD detail::csv_range<TFields...> from_csv (
+            std::string const &         path
+        ,   csv_column<TFields> ...     columns
+        )
+    {
+        return from_csv (path, csv_options (), std::move (columns)...);
+    }
+
     // Restriction operators
 
     template<typename TPredicate>
@@ -5152,6 +13205,94 @@ namespace cpplinq
             );
     }
 
+    // hash_join yields the same sequence as join but matches keys through a
+    // hash table instead of a std::multimap. Keys from range are converted
+    // to the key type of other_range before they are looked up.
+    template<
+                typename TOtherRange
+            ,   typename TKeySelector
+            ,   typename TOtherKeySelector
+            ,   typename TCombiner
+            ,   typename THash  = detail::default_hash
+            ,   typename TEqual = detail::default_equal_to
+            >
+    CPPLINQ_INLINEMETHOD detail::hash_join_builder<
+                TOtherRange
+            ,   TKeySelector
+            ,   TOtherKeySelector
+            ,   TCombiner
+            ,   THash
+            ,   TEqual
+            > hash_join (
+                TOtherRange         other_range
+            ,   TKeySelector        key_selector
+            ,   TOtherKeySelector   other_key_selector
+            ,   TCombiner           combiner
+            ,   THash               hash    = THash ()
+            ,   TEqual              equal   = TEqual ()
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::hash_join_builder<
+                TOtherRange
+            ,   TKeySelector
+            ,   TOtherKeySelector
+            ,   TCombiner
+            ,   THash
+            ,   TEqual
+            >
+            (
+                std::move (other_range)
+            ,   std::move (key_selector)
+            ,   std::move (other_key_selector)
+            ,   std::move (combiner)
+            ,   std::move (hash)
+            ,   std::move (equal)
+            );
+    }
+
+    // Parallel operators
+
+    typedef detail::thread_pool thread_pool;
+
+    CPPLINQ_INLINEMETHOD detail::parallel_builder parallel (
+            size_type   chunk_count = 0U
+        )
+    {
+        return detail::parallel_builder (
+                detail::executor_ref (std::addressof (detail::default_thread_pool ()))
+            ,   chunk_count
+            );
+    }
+
+    // executor must outlive the evaluation of the query
+    template<typename TExecutor>
+    CPPLINQ_INLINEMETHOD typename std::enable_if<std::is_class<TExecutor>::value, detail::parallel_builder>::type parallel (
+            TExecutor & executor
+        ,   size_type   chunk_count = 0U
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::parallel_builder (detail::executor_ref (std::addressof (executor)), chunk_count);
+    }
+
+    // Memory operators
+
+    // The buffering operators that follow (orderby, thenby, reverse, the set
+    // operators, join, hash_join, group_by, to_lookup and to_hash_lookup)
+    // draw their buffers from memory. memory must outlive the query and the
+    // lookups built from it.
+    CPPLINQ_INLINEMETHOD detail::memory_resource_builder with_memory_resource (memory_resource & memory) CPPLINQ_NOEXCEPT
+    {
+        return detail::memory_resource_builder (std::addressof (memory));
+    }
+
+    // Like with_memory_resource, call reset () on scratch once the results
+    // of the query are no longer used to run the next query without heap
+    // allocations
+    CPPLINQ_INLINEMETHOD detail::memory_resource_builder with_arena (arena & scratch) CPPLINQ_NOEXCEPT
+    {
+        return detail::memory_resource_builder (std::addressof (scratch));
+    }
+
     // Concatenation operators
 
     template <typename TOtherRange>
@@ -5250,6 +13391,46 @@ namespace cpplinq
     }
 
 
+    // Grouping operators
+    //  group_by yields a group (key, values) for every distinct key in key
+    //  order, the values keep their source order. group_by_sorted expects
+    //  the values clustered by key (for instance sorted) and streams the
+    //  groups without buffering. The values of a group may only be iterated
+    //  once and only before the next group is pulled
+    template<typename TKeySelector>
+    CPPLINQ_INLINEMETHOD detail::group_by_builder<TKeySelector, detail::identity_selector> group_by (
+            TKeySelector    key_selector
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::group_by_builder<TKeySelector, detail::identity_selector> (std::move (key_selector), detail::identity_selector ());
+    }
+
+    template<typename TKeySelector, typename TElementSelector>
+    CPPLINQ_INLINEMETHOD detail::group_by_builder<TKeySelector, TElementSelector> group_by (
+            TKeySelector        key_selector
+        ,   TElementSelector    element_selector
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::group_by_builder<TKeySelector, TElementSelector> (std::move (key_selector), std::move (element_selector));
+    }
+
+    template<typename TKeySelector>
+    CPPLINQ_INLINEMETHOD detail::group_by_sorted_builder<TKeySelector, detail::identity_selector> group_by_sorted (
+            TKeySelector    key_selector
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::group_by_sorted_builder<TKeySelector, detail::identity_selector> (std::move (key_selector), detail::identity_selector ());
+    }
+
+    template<typename TKeySelector, typename TElementSelector>
+    CPPLINQ_INLINEMETHOD detail::group_by_sorted_builder<TKeySelector, TElementSelector> group_by_sorted (
+            TKeySelector        key_selector
+        ,   TElementSelector    element_selector
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::group_by_sorted_builder<TKeySelector, TElementSelector> (std::move (key_selector), std::move (element_selector));
+    }
+
     // Conversion operators
 
     namespace experimental
@@ -5272,14 +13453,28 @@ namespace cpplinq
         return detail::opt<TValue> ();
     }
 
-    CPPLINQ_INLINEMETHOD detail::to_vector_builder to_vector (size_type capacity = 16U) CPPLINQ_NOEXCEPT
+    CPPLINQ_INLINEMETHOD detail::to_vector_builder<> to_vector (size_type capacity = 16U) CPPLINQ_NOEXCEPT
+    {
+        return detail::to_vector_builder<> (capacity);
+    }
+
+    // The materializing operators optionally take the allocator of the
+    // container they return, it's rebound to the value type of the container
+    template<typename TAllocator>
+    CPPLINQ_INLINEMETHOD detail::to_vector_builder<TAllocator> to_vector (size_type capacity, TAllocator allocator) CPPLINQ_NOEXCEPT
     {
-        return detail::to_vector_builder (capacity);
+        return detail::to_vector_builder<TAllocator> (capacity, std::move (allocator));
     }
 
-    CPPLINQ_INLINEMETHOD detail::to_list_builder to_list () CPPLINQ_NOEXCEPT
+    CPPLINQ_INLINEMETHOD detail::to_list_builder<> to_list () CPPLINQ_NOEXCEPT
     {
-        return detail::to_list_builder ();
+        return detail::to_list_builder<> ();
+    }
+
+    template<typename TAllocator>
+    CPPLINQ_INLINEMETHOD detail::to_list_builder<TAllocator> to_list (TAllocator allocator) CPPLINQ_NOEXCEPT
+    {
+        return detail::to_list_builder<TAllocator> (std::move (allocator));
     }
 
     template<typename TKeyPredicate>
@@ -5288,12 +13483,148 @@ namespace cpplinq
         return detail::to_map_builder<TKeyPredicate>(std::move (key_predicate));
     }
 
+    template<typename TKeyPredicate>
+    CPPLINQ_INLINEMETHOD detail::to_map_builder<TKeyPredicate> to_map (
+            TKeyPredicate           key_predicate
+        ,   duplicate_key_policy    policy
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::to_map_builder<TKeyPredicate> (std::move (key_predicate), detail::identity_selector (), policy);
+    }
+
+    // Stores value_predicate (value) under key_predicate (value), policy
+    // decides what happens to the values of a key that is seen again
+    template<typename TKeyPredicate, typename TValuePredicate>
+    CPPLINQ_INLINEMETHOD detail::to_map_builder<TKeyPredicate, TValuePredicate> to_map (
+            TKeyPredicate           key_predicate
+        ,   TValuePredicate         value_predicate
+        ,   duplicate_key_policy    policy          = first_value_wins
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::to_map_builder<TKeyPredicate, TValuePredicate> (std::move (key_predicate), std::move (value_predicate), policy);
+    }
+
+    template<typename TKeyPredicate, typename TValuePredicate, typename TAllocator>
+    CPPLINQ_INLINEMETHOD detail::to_map_builder<TKeyPredicate, TValuePredicate, detail::ordered_map_target<TAllocator>> to_map (
+            TKeyPredicate           key_predicate
+        ,   TValuePredicate         value_predicate
+        ,   duplicate_key_policy    policy
+        ,   TAllocator              allocator
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::to_map_builder<TKeyPredicate, TValuePredicate, detail::ordered_map_target<TAllocator>> (
+                std::move (key_predicate)
+            ,   std::move (value_predicate)
+            ,   policy
+            ,   detail::ordered_map_target<TAllocator> (std::move (allocator))
+            );
+    }
+
+    template<typename TKeyPredicate>
+    CPPLINQ_INLINEMETHOD detail::to_map_builder<TKeyPredicate, detail::identity_selector, detail::unordered_map_target<>> to_unordered_map (
+            TKeyPredicate           key_predicate
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::to_map_builder<TKeyPredicate, detail::identity_selector, detail::unordered_map_target<>> (std::move (key_predicate));
+    }
+
+    template<typename TKeyPredicate>
+    CPPLINQ_INLINEMETHOD detail::to_map_builder<TKeyPredicate, detail::identity_selector, detail::unordered_map_target<>> to_unordered_map (
+            TKeyPredicate           key_predicate
+        ,   duplicate_key_policy    policy
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::to_map_builder<TKeyPredicate, detail::identity_selector, detail::unordered_map_target<>> (std::move (key_predicate), detail::identity_selector (), policy);
+    }
+
+    template<typename TKeyPredicate, typename TValuePredicate>
+    CPPLINQ_INLINEMETHOD detail::to_map_builder<TKeyPredicate, TValuePredicate, detail::unordered_map_target<>> to_unordered_map (
+            TKeyPredicate           key_predicate
+        ,   TValuePredicate         value_predicate
+        ,   duplicate_key_policy    policy          = first_value_wins
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::to_map_builder<TKeyPredicate, TValuePredicate, detail::unordered_map_target<>> (std::move (key_predicate), std::move (value_predicate), policy);
+    }
+
+    template<typename TKeyPredicate, typename TValuePredicate, typename TAllocator>
+    CPPLINQ_INLINEMETHOD detail::to_map_builder<TKeyPredicate, TValuePredicate, detail::unordered_map_target<TAllocator>> to_unordered_map (
+            TKeyPredicate           key_predicate
+        ,   TValuePredicate         value_predicate
+        ,   duplicate_key_policy    policy
+        ,   TAllocator              allocator
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::to_map_builder<TKeyPredicate, TValuePredicate, detail::unordered_map_target<TAllocator>> (
+                std::move (key_predicate)
+            ,   std::move (value_predicate)
+            ,   policy
+            ,   detail::unordered_map_target<TAllocator> (std::move (allocator))
+            );
+    }
+
+    // Builds a read-only map sorted by key in one contiguous vector
+    template<typename TKeyPredicate>
+    CPPLINQ_INLINEMETHOD detail::to_map_builder<TKeyPredicate, detail::identity_selector, detail::flat_map_target<>> to_flat_map (
+            TKeyPredicate           key_predicate
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::to_map_builder<TKeyPredicate, detail::identity_selector, detail::flat_map_target<>> (std::move (key_predicate));
+    }
+
+    template<typename TKeyPredicate>
+    CPPLINQ_INLINEMETHOD detail::to_map_builder<TKeyPredicate, detail::identity_selector, detail::flat_map_target<>> to_flat_map (
+            TKeyPredicate           key_predicate
+        ,   duplicate_key_policy    policy
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::to_map_builder<TKeyPredicate, detail::identity_selector, detail::flat_map_target<>> (std::move (key_predicate), detail::identity_selector (), policy);
+    }
+
+    template<typename TKeyPredicate, typename TValuePredicate>
+    CPPLINQ_INLINEMETHOD detail::to_map_builder<TKeyPredicate, TValuePredicate, detail::flat_map_target<>> to_flat_map (
+            TKeyPredicate           key_predicate
+        ,   TValuePredicate         value_predicate
+        ,   duplicate_key_policy    policy          = first_value_wins
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::to_map_builder<TKeyPredicate, TValuePredicate, detail::flat_map_target<>> (std::move (key_predicate), std::move (value_predicate), policy);
+    }
+
+    template<typename TKeyPredicate, typename TValuePredicate, typename TAllocator>
+    CPPLINQ_INLINEMETHOD detail::to_map_builder<TKeyPredicate, TValuePredicate, detail::flat_map_target<TAllocator>> to_flat_map (
+            TKeyPredicate           key_predicate
+        ,   TValuePredicate         value_predicate
+        ,   duplicate_key_policy    policy
+        ,   TAllocator              allocator
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::to_map_builder<TKeyPredicate, TValuePredicate, detail::flat_map_target<TAllocator>> (
+                std::move (key_predicate)
+            ,   std::move (value_predicate)
+            ,   policy
+            ,   detail::flat_map_target<TAllocator> (std::move (allocator))
+            );
+    }
+
     template<typename TKeyPredicate>
     CPPLINQ_INLINEMETHOD detail::to_lookup_builder<TKeyPredicate> to_lookup (TKeyPredicate key_predicate) CPPLINQ_NOEXCEPT
     {
         return detail::to_lookup_builder<TKeyPredicate>(std::move (key_predicate));
     }
 
+    // Same as to_lookup but keys are found in O(1) through a flat hash set,
+    // hash (key) and equal (key, key) default to std::hash and operator==
+    template<typename TKeyPredicate, typename THash = detail::default_hash, typename TEqual = detail::default_equal_to>
+    CPPLINQ_INLINEMETHOD detail::to_hash_lookup_builder<TKeyPredicate, THash, TEqual> to_hash_lookup (
+            TKeyPredicate   key_predicate
+        ,   THash           hash    = THash ()
+        ,   TEqual          equal   = TEqual ()
+        )
+    {
+        return detail::to_hash_lookup_builder<TKeyPredicate, THash, TEqual> (std::move (key_predicate), std::move (hash), std::move (equal));
+    }
+
     // Equality operators
     template <typename TOtherRange>
     CPPLINQ_INLINEMETHOD detail::sequence_equal_builder<TOtherRange> sequence_equal (TOtherRange other_range) CPPLINQ_NOEXCEPT
@@ -5517,10 +13848,20 @@ namespace cpplinq
         return detail::aggregate_result_selector_builder<TAccumulate, TAccumulator, TSelector> (seed, accumulator, result_selector);
     }
 
+    template <typename TAccumulate, typename TAccumulator, typename TCombiner>
+    CPPLINQ_INLINEMETHOD detail::parallel_aggregate_builder<TAccumulate, TAccumulator, TCombiner> parallel_aggregate (
+            TAccumulate seed
+        ,   TAccumulator accumulator
+        ,   TCombiner combiner
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::parallel_aggregate_builder<TAccumulate, TAccumulator, TCombiner> (seed, accumulator, combiner);
+    }
+
     // set operators
-    CPPLINQ_INLINEMETHOD detail::distinct_builder distinct () CPPLINQ_NOEXCEPT
+    CPPLINQ_INLINEMETHOD detail::distinct_builder<> distinct () CPPLINQ_NOEXCEPT
     {
-        return detail::distinct_builder ();
+        return detail::distinct_builder<> ();
     }
 
     template <typename TOtherRange>
@@ -5541,6 +13882,61 @@ namespace cpplinq
         return detail::except_builder<TOtherRange> (std::move (other_range));
     }
 
+    // hashed set operators
+    //  Same results as the set operators above but the values seen are kept in
+    //  a flat hash set instead of a std::set. hash (value) and
+    //  equal (value, value) default to std::hash and operator==
+
+    template <typename THash = detail::default_hash, typename TEqual = detail::default_equal_to>
+    CPPLINQ_INLINEMETHOD detail::distinct_builder<detail::hashed_set_policy<THash, TEqual>> hash_distinct (
+            THash       hash    = THash ()
+        ,   TEqual      equal   = TEqual ()
+        )
+    {
+        return detail::distinct_builder<detail::hashed_set_policy<THash, TEqual>> (
+                detail::hashed_set_policy<THash, TEqual> (std::move (hash), std::move (equal))
+            );
+    }
+
+    template <typename TOtherRange, typename THash = detail::default_hash, typename TEqual = detail::default_equal_to>
+    CPPLINQ_INLINEMETHOD detail::union_builder<TOtherRange, detail::hashed_set_policy<THash, TEqual>> hash_union_with (
+            TOtherRange other_range
+        ,   THash       hash    = THash ()
+        ,   TEqual      equal   = TEqual ()
+        )
+    {
+        return detail::union_builder<TOtherRange, detail::hashed_set_policy<THash, TEqual>> (
+                std::move (other_range)
+            ,   detail::hashed_set_policy<THash, TEqual> (std::move (hash), std::move (equal))
+            );
+    }
+
+    template <typename TOtherRange, typename THash = detail::default_hash, typename TEqual = detail::default_equal_to>
+    CPPLINQ_INLINEMETHOD detail::intersect_builder<TOtherRange, detail::hashed_set_policy<THash, TEqual>> hash_intersect_with (
+            TOtherRange other_range
+        ,   THash       hash    = THash ()
+        ,   TEqual      equal   = TEqual ()
+        )
+    {
+        return detail::intersect_builder<TOtherRange, detail::hashed_set_policy<THash, TEqual>> (
+                std::move (other_range)
+            ,   detail::hashed_set_policy<THash, TEqual> (std::move (hash), std::move (equal))
+            );
+    }
+
+    template <typename TOtherRange, typename THash = detail::default_hash, typename TEqual = detail::default_equal_to>
+    CPPLINQ_INLINEMETHOD detail::except_builder<TOtherRange, detail::hashed_set_policy<THash, TEqual>> hash_except (
+            TOtherRange other_range
+        ,   THash       hash    = THash ()
+        ,   TEqual      equal   = TEqual ()
+        )
+    {
+        return detail::except_builder<TOtherRange, detail::hashed_set_policy<THash, TEqual>> (
+                std::move (other_range)
+            ,   detail::hashed_set_policy<THash, TEqual> (std::move (hash), std::move (equal))
+            );
+    }
+
     // other operators
 
     template<typename TPredicate>
@@ -5573,6 +13969,48 @@ namespace cpplinq
             );
     }
 
+    // Assigns the values to *iterator++ and returns the iterator past the
+    // last value, values returned by value are moved
+    template<typename TOutputIterator>
+    CPPLINQ_INLINEMETHOD detail::to_output_iterator_builder<TOutputIterator> to_output_iterator (
+            TOutputIterator iterator
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::to_output_iterator_builder<TOutputIterator> (std::move (iterator));
+    }
+
+    // Streams the values to stream with operator<< and separator between
+    // them, returns stream
+    template<typename TStream>
+    CPPLINQ_INLINEMETHOD detail::to_ostream_builder<TStream> to_ostream (
+            TStream &                                               stream
+        ,   std::basic_string<typename TStream::char_type>          separator = std::basic_string<typename TStream::char_type> ()
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::to_ostream_builder<TStream> (stream, std::move (separator));
+    }
+
+    // Writes the values to the file at path through a buffer of capacity
+    // bytes, formatter (buffered_writer &, value) formats a value. By default
+    // each value is written as a line. Returns the number of values written,
+    // throws io_exception when the file can't be written.
+    template<typename TFormatter>
+    CPPLINQ_INLINEMETHOD detail::to_file_builder<TFormatter> to_file (
+            std::string     path
+        ,   TFormatter      formatter
+        ,   size_type       capacity    = 64U * 1024U
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::to_file_builder<TFormatter> (std::move (path), std::move (formatter), capacity);
+    }
+
+    CPPLINQ_INLINEMETHOD detail::to_file_builder<detail::line_formatter> to_file (
+            std::string     path
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::to_file_builder<detail::line_formatter> (std::move (path), detail::line_formatter (), 64U * 1024U);
+    }
+
     CPPLINQ_INLINEMETHOD detail::pairwise_builder pairwise () CPPLINQ_NOEXCEPT
     {
         return detail::pairwise_builder ();
@@ -5588,6 +14026,32 @@ namespace cpplinq
 
 }
 // ----------------------------------------------------------------------------
+namespace std
+{
+    // FNV-1a over the characters so that string_ref can key hash containers
+    // like to_hash_lookup, hash_join and the hash_ set operators
+    template<typename TCharType>
+    struct hash<cpplinq::basic_string_ref<TCharType>>
+    {
+        CPPLINQ_INLINEMETHOD std::size_t operator() (cpplinq::basic_string_ref<TCharType> value) const CPPLINQ_NOEXCEPT
+        {
+            std::uint64_t result = 14695981039346656037ULL;
+            for (auto ch : value)
+            {
+                result ^= static_cast<std::uint64_t> (ch);
+                result *= 1099511628211ULL;
+            }
+            return static_cast<std::size_t> (result);
+        }
+    };
+
+    template<typename TCharType>
+    struct hash<cpplinq::basic_shared_string_ref<TCharType>>
+        :   hash<cpplinq::basic_string_ref<TCharType>>
+    {
+    };
+}
+// ----------------------------------------------------------------------------
 #ifdef _MSC_VER
 #   pragma warning (pop)
 #endif
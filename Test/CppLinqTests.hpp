@@ -22,12 +22,14 @@
 // ----------------------------------------------------------------------------------------------
 #include <algorithm>
 #include <chrono>
+#include <clocale>
 #include <cstdint>
 #include <map>
 #include <numeric>
 #include <set>
 #include <string>
 #include <sstream>
+#include <unordered_map>
 #include <vector>
 // ----------------------------------------------------------------------------------------------
 #include <limits.h>
@@ -125,12 +127,108 @@ namespace
         std::set<player*>   players ;
     };
 
+    // Counts the memory drawn from it
+    struct counting_memory_resource : cpplinq::memory_resource
+    {
+        std::size_t     allocations ;
+        std::size_t     live_bytes  ;
+
+        counting_memory_resource ()
+            :   allocations (0U)
+            ,   live_bytes  (0U)
+        {
+        }
+
+    protected:
+        virtual void * do_allocate (std::size_t bytes, std::size_t)
+        {
+            ++allocations;
+            live_bytes += bytes;
+            return ::operator new (bytes);
+        }
+
+        virtual void do_deallocate (void * p, std::size_t bytes, std::size_t)
+        {
+            live_bytes -= bytes;
+            ::operator delete (p);
+        }
+    };
+
+    // Counts how often it is copied, moving it is cheap
+    struct expensive_copy
+    {
+        int                 key     ;
+        std::vector<int>    payload ;
+
+        static std::size_t & copies ()
+        {
+            static std::size_t count = 0U;
+            return count;
+        }
+
+        expensive_copy ()
+            :   key     (0)
+        {
+        }
+
+        expensive_copy (int key, std::size_t size)
+            :   key     (key)
+            ,   payload (size, key)
+        {
+        }
+
+        expensive_copy (expensive_copy const & v)
+            :   key     (v.key)
+            ,   payload (v.payload)
+        {
+            ++copies ();
+        }
+
+        expensive_copy (expensive_copy && v) CPPLINQ_NOEXCEPT
+            :   key     (v.key)
+            ,   payload (std::move (v.payload))
+        {
+        }
+
+        expensive_copy & operator= (expensive_copy const & v)
+        {
+            key     = v.key;
+            payload = v.payload;
+            ++copies ();
+            return *this;
+        }
+
+        expensive_copy & operator= (expensive_copy && v) CPPLINQ_NOEXCEPT
+        {
+            key     = v.key;
+            payload = std::move (v.payload);
+            return *this;
+        }
+    };
+
     template <typename T>
     void ignore (T && v) CPPLINQ_NOEXCEPT
     {
 
     }
 
+    // Ranges that hold move-only values they have already cached or
+    // buffered can't be copied
+    template<typename TRange>
+    bool throws_on_copy (TRange const & range)
+    {
+        try
+        {
+            auto copy = range;
+            ignore (copy);
+        }
+        catch (cpplinq::programming_error_exception const &)
+        {
+            return true;
+        }
+        return false;
+    }
+
     template<typename TValueArray>
     std::size_t get_array_size (TValueArray & a)
     {
@@ -728,6 +826,28 @@ namespace
                 ,   "front () must return non-reference when value_type = customer"
                 );
         }
+
+        {
+            // Contiguous containers are read through pointers
+            std::vector<int>        v (ints, ints + count_of_ints);
+            std::string             str ("cpplinq");
+            std::array<double, 3>   a = {{1.0, 2.0, 3.0}};
+            std::list<int>          l (ints, ints + count_of_ints);
+            std::vector<bool>       bits (3, true);
+
+            static_assert (std::is_same<decltype (from (v)), detail::from_range<int const *>>::value, "from (vector) reads pointers");
+            static_assert (std::is_same<decltype (from (str)), detail::from_range<char const *>>::value, "from (string) reads pointers");
+            static_assert (std::is_same<decltype (from (a)), detail::from_range<double const *>>::value, "from (array) reads pointers");
+            static_assert (detail::contiguous_range_traits<decltype (from_array (ints))>::is_contiguous, "from_array is contiguous");
+            static_assert (!detail::contiguous_range_traits<decltype (from (l))>::is_contiguous, "from (list) is not contiguous");
+            static_assert (!detail::contiguous_range_traits<decltype (from (bits))>::is_contiguous, "from (vector<bool>) is not contiguous");
+
+            TEST_ASSERT (true, (v == (from (v) >> to_vector ())));
+            TEST_ASSERT ("cpplinq", from (str) >> select ([] (char c) {return std::string (1, c);}) >> concatenate (""));
+            TEST_ASSERT (6.0, from (a) >> sum ());
+            TEST_ASSERT (3U, from (bits) >> count ());
+            TEST_ASSERT (0U, from (std::string ()) >> count ());
+        }
     }
 
     void test_range ()
@@ -1127,6 +1247,24 @@ namespace
             int first_result = from_array (ints) >> last_or_default (is_even);
             TEST_ASSERT (2, first_result);
         }
+
+        {
+            std::list<int> list_values (ints, ints + count_of_ints);
+            int last_result = from (list_values) >> select (double_it) >> last_or_default ();
+            TEST_ASSERT (10, last_result);
+        }
+
+        {
+            auto calls = 0;
+            int last_result = range (0, 100) >> select ([&calls] (int i) {++calls; return i;}) >> last_or_default ();
+            TEST_ASSERT (99, last_result);
+            TEST_ASSERT (1, calls);
+        }
+
+        {
+            int last_result = from_array (ints) >> where (is_even) >> last_or_default ();
+            TEST_ASSERT (2, last_result);
+        }
     }
 
     void test_sum ()
@@ -1271,6 +1409,98 @@ namespace
 
     }
 
+    template<typename TValue>
+    void test_vectorized_values (std::vector<TValue> const & values)
+    {
+        using namespace cpplinq;
+
+        for (auto count = 0U; count <= values.size (); ++count)
+        {
+            auto expected_sum = TValue ();
+            auto expected_min = std::numeric_limits<TValue>::max ();
+            auto expected_max = std::numeric_limits<TValue>::lowest ();
+            for (auto index = 0U; index < count; ++index)
+            {
+                auto v = values[index];
+                expected_sum += v;
+                expected_min = v < expected_min ? v : expected_min;
+                expected_max = expected_max < v ? v : expected_max;
+            }
+
+            auto first = values.data ();
+            auto last  = values.data () + count;
+
+            if (!TEST_ASSERT (true, (expected_sum == (from_iterators (first, last) >> sum ()))))
+            {
+                PRINT_INDEX (count);
+            }
+
+            if (!TEST_ASSERT (true, (expected_min == (from_iterators (first, last) >> min ()))))
+            {
+                PRINT_INDEX (count);
+            }
+
+            if (!TEST_ASSERT (true, (expected_max == (from_iterators (first, last) >> max ()))))
+            {
+                PRINT_INDEX (count);
+            }
+
+#ifdef CPPLINQ_SIMD_SSE2
+            // Also covers SSE2 on machines that support AVX2
+            TEST_ASSERT (true, (expected_sum == detail::sse2_fold<detail::simd_fold_sum, detail::sse2_ops<TValue>> (first, count)));
+            TEST_ASSERT (true, (expected_min == detail::sse2_fold<detail::simd_fold_min, detail::sse2_ops<TValue>> (first, count)));
+            TEST_ASSERT (true, (expected_max == detail::sse2_fold<detail::simd_fold_max, detail::sse2_ops<TValue>> (first, count)));
+#endif
+        }
+    }
+
+    void test_vectorized ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        static_assert (detail::is_vectorizable<detail::from_range<std::vector<int>::const_iterator>>::value == detail::is_vectorizable<detail::from_range<int const *>>::value, "vector iterators are contiguous");
+        static_assert (!detail::is_vectorizable<detail::from_range<std::list<int>::const_iterator>>::value, "list iterators are not contiguous");
+        static_assert (!detail::is_vectorizable<detail::from_range<unsigned const *>>::value, "unsigned values are not vectorized");
+
+        // Small integral values so that floating point sums are exact in any order
+        std::vector<int>        ints;
+        std::vector<long long>  longs;
+        std::vector<float>      floats;
+        std::vector<double>     doubles;
+        for (auto i = 0; i < 67; ++i)
+        {
+            auto v = (i * 37) % 41 - 20;
+            ints.push_back (v);
+            longs.push_back (v * 10000000000LL);
+            floats.push_back (static_cast<float> (v));
+            doubles.push_back (v / 4.0);
+        }
+
+        test_vectorized_values (ints);
+        test_vectorized_values (longs);
+        test_vectorized_values (floats);
+        test_vectorized_values (doubles);
+
+        {
+            // NaN values never become the min or max
+            std::vector<double> values (doubles);
+            values[5]  = std::numeric_limits<double>::quiet_NaN ();
+            values[40] = std::numeric_limits<double>::quiet_NaN ();
+
+            TEST_ASSERT (-5.0, from (values) >> min ());
+            TEST_ASSERT (5.0, from (values) >> max ());
+        }
+
+        {
+            std::vector<int> values (ints);
+            TEST_ASSERT (values.size (), from (values) >> count ());
+            TEST_ASSERT (values.size () - 3U, from (values) >> skip (3) >> count ());
+            TEST_ASSERT (100U, range (-50, 100) >> count ());
+        }
+    }
+
     void test_concatenate ()
     {
         using namespace cpplinq;
@@ -1295,6 +1525,76 @@ namespace
 
             TEST_ASSERT ("Gates, Jobs, Stallman, Torvalds, Ballmer, Cook, Gates", concatenate_result);
         }
+
+        {
+            std::vector<std::string> names;
+            names.push_back ("Gates");
+            names.push_back ("Jobs");
+            names.push_back ("");
+            names.push_back ("Stallman");
+
+            std::string concatenate_result =
+                    from (names)
+                >>  where ([](std::string const & name){return !name.empty ();})
+                >>  concatenate ("; ")
+                ;
+
+            TEST_ASSERT ("Gates; Jobs; Stallman", concatenate_result);
+        }
+
+        {
+            std::vector<string_ref> names;
+            names.push_back ("Torvalds");
+            names.push_back (string_ref ("Ballmer").substr (0U, 4U));
+            names.push_back ("Cook");
+
+            std::string concatenate_result = from (names) >> concatenate ("-");
+
+            TEST_ASSERT ("Torvalds-Ball-Cook", concatenate_result);
+        }
+
+        {
+            char const * names[] = {"Gates", nullptr, "Jobs"};
+
+            std::string concatenate_result = from_array (names) >> concatenate (",");
+
+            TEST_ASSERT ("Gates,,Jobs", concatenate_result);
+        }
+
+        {
+            std::wstring concatenate_result =
+                    from_array (ints)
+                >>  take (3)
+                >>  select ([](int i){return std::vector<wchar_t> (i, L'x');})
+                >>  concatenate (L"|")
+                ;
+
+            TEST_ASSERT (true, (concatenate_result == L"xxx|x|xxxx"));
+        }
+
+        {
+            std::vector<std::string> names (5U, "ab");
+
+            auto calls = 0;
+            std::string where_result =
+                    from (names)
+                >>  where ([&](std::string const &){return ++calls % 2 == 1;})
+                >>  concatenate (",")
+                ;
+
+            TEST_ASSERT ("ab,ab,ab", where_result);
+            TEST_ASSERT (5, calls);
+
+            auto taken = 0;
+            std::string take_while_result =
+                    from (names)
+                >>  take_while ([&](std::string const &){return ++taken <= 3;})
+                >>  concatenate (",")
+                ;
+
+            TEST_ASSERT ("ab,ab,ab", take_while_result);
+            TEST_ASSERT (4, taken);
+        }
     }
 
     void test_for_each ()
@@ -1405,1485 +1705,3945 @@ namespace
                 }
             }
         }
-    }
-
-    void test_to_lookup ()
-    {
-        using namespace cpplinq;
-        using namespace cpplinq::detail;
-
-        TEST_PRELUDE ();
 
         {
-            auto lookup = from (empty_customers) >> to_lookup ([] (customer const & c){return c.id;});
+            auto to_map_result = from_array (customers) >> to_map (
+                    [](customer const & c){return c.id;}
+                ,   [](customer const & c){return c.last_name;}
+                );
+            TEST_ASSERT (count_of_customers, to_map_result.size ());
 
-            TEST_ASSERT (0U, lookup.size_of_keys ());
-            TEST_ASSERT (0U, lookup.size_of_values ());
+            for (auto index = 0U; index < count_of_customers; ++index)
+            {
+                auto c = customers[index];
+                auto find_c = to_map_result.find (c.id);
+                if (TEST_ASSERT (true, (find_c != to_map_result.end ())))
+                {
+                    TEST_ASSERT (c.last_name, find_c->second);
+                }
+            }
         }
 
         {
-            auto lookup = from_array (customers) >> to_lookup ([] (customer const & c){return c.id;});
+            auto key    = [](int i){return i % 3;};
+            auto value  = [](int i){return i;};
 
-            TEST_ASSERT (count_of_customers, lookup.size_of_keys ());
-            TEST_ASSERT (count_of_customers, lookup.size_of_values ());
+            auto first  = from_array (ints) >> to_map (key, value);
+            auto last   = from_array (ints) >> to_map (key, value, last_value_wins);
 
-            for (auto customer : customers)
+            if (TEST_ASSERT (3U, first.size ()) && TEST_ASSERT (3U, last.size ()))
             {
-                auto results = lookup[customer.id] >> to_vector ();
-                if (TEST_ASSERT (1U, results.size ()))
-                {
-                    auto result = results.front ();
+                TEST_ASSERT (3, first[0]);
+                TEST_ASSERT (1, first[1]);
+                TEST_ASSERT (5, first[2]);
 
-                    if (!TEST_ASSERT (customer.id, result.id))
-                    {
-                        PRINT_INDEX (customer.id);
-                    }
-                }
-                else
-                {
-                    PRINT_INDEX (customer.id);
-                }
+                TEST_ASSERT (9, last[0]);
+                TEST_ASSERT (7, last[1]);
+                TEST_ASSERT (5, last[2]);
+            }
+
+            auto thrown = false;
+            try
+            {
+                from_array (ints) >> to_map (key, value, throw_on_duplicate_key);
+            }
+            catch (duplicate_key_exception const &)
+            {
+                thrown = true;
+            }
+            TEST_ASSERT (true, thrown);
+
+            auto unique = range (0, 10) >> to_map (value, value, throw_on_duplicate_key);
+            TEST_ASSERT (10U, unique.size ());
+
+            // The policy is passed without a value selector
+            auto last_values = from_array (ints) >> to_map (key, last_value_wins);
+            if (TEST_ASSERT (3U, last_values.size ()))
+            {
+                TEST_ASSERT (9, last_values[0]);
             }
         }
 
         {
-            auto lookup = from_array (customer_addresses) >> to_lookup ([] (customer_address const & ca){return ca.customer_id;});
+            std::unordered_map<int,int> to_unordered_map_result = from (empty_vector) >> to_unordered_map ([](int i){return i;});
+            TEST_ASSERT (0U, to_unordered_map_result.size ());
+        }
 
-            TEST_ASSERT (2U, lookup.size_of_keys ());
-            TEST_ASSERT (count_of_customer_addresses, lookup.size_of_values ());
+        {
+            auto key    = [](int i){return i % 3;};
+            auto value  = [](int i){return i * 10;};
 
+            auto first  = from_array (ints) >> to_unordered_map (key, value);
+            auto last   = from_array (ints) >> to_unordered_map (key, value, last_value_wins);
+
+            if (TEST_ASSERT (3U, first.size ()) && TEST_ASSERT (3U, last.size ()))
             {
-                auto results = lookup[1] >> to_vector ();
-                if (TEST_ASSERT (1U, results.size ()))
-                {
-                    auto result = results.front ();
-                    TEST_ASSERT (1U, result.id);
-                }
+                TEST_ASSERT (30, first[0]);
+                TEST_ASSERT (10, first[1]);
+                TEST_ASSERT (50, first[2]);
+
+                TEST_ASSERT (90, last[0]);
+                TEST_ASSERT (70, last[1]);
+                TEST_ASSERT (50, last[2]);
             }
 
+            auto thrown = false;
+            try
             {
-                auto results = lookup[4] >> to_vector ();
-                if (TEST_ASSERT (2U, results.size ()))
-                {
-                    auto result1 = results[0];
-                    TEST_ASSERT (2U, result1.id);
-
-                    auto result2 = results[1];
-                    TEST_ASSERT (3U, result2.id);
-                }
+                from_array (ints) >> to_unordered_map (key, value, throw_on_duplicate_key);
             }
+            catch (duplicate_key_exception const &)
+            {
+                thrown = true;
+            }
+            TEST_ASSERT (true, thrown);
 
+            auto ids = from_array (customers) >> to_unordered_map ([](customer const & c){return c.id;});
+            TEST_ASSERT (count_of_customers, ids.size ());
+            TEST_ASSERT (1U, ids.count (customers[0].id));
+
+            auto last_values = from_array (ints) >> to_unordered_map (key, last_value_wins);
+            if (TEST_ASSERT (3U, last_values.size ()))
             {
-                auto results = lookup[999] >> to_vector ();
-                TEST_ASSERT (0U, results.size ());
+                TEST_ASSERT (9, last_values[0]);
             }
         }
 
-        // code coverage test
         {
-            auto lookup = empty<int>() >> to_lookup ([] (int i) {return i;});
+            auto to_flat_map_result = from (empty_vector) >> to_flat_map ([](int i){return i;});
+            TEST_ASSERT (true, to_flat_map_result.empty ());
+            TEST_ASSERT (0U, to_flat_map_result.count (0));
+        }
 
-            auto q = lookup[999];
+        {
+            auto key    = [](int i){return i % 3;};
+            auto value  = [](int i){return i;};
 
-            TEST_ASSERT (false, q.next ());
-            TEST_ASSERT (false, q.next ());
-        }
-    }
+            auto first  = from_array (ints) >> to_flat_map (key, value);
+            auto last   = from_array (ints) >> to_flat_map (key, value, last_value_wins);
 
-    void test_to_list ()
-    {
-        using namespace cpplinq;
+            if (TEST_ASSERT (3U, first.size ()) && TEST_ASSERT (3U, last.size ()))
+            {
+                TEST_ASSERT (3, first.at (0));
+                TEST_ASSERT (1, first.at (1));
+                TEST_ASSERT (5, first.at (2));
 
-        TEST_PRELUDE ();
+                TEST_ASSERT (9, last.at (0));
+                TEST_ASSERT (7, last.at (1));
+                TEST_ASSERT (5, last.at (2));
+            }
 
-        {
-            std::list<int> to_list_result = from (empty_vector) >> to_list ();
-            TEST_ASSERT (0U, to_list_result.size ());
+            TEST_ASSERT (true, (first.find (3) == first.end ()));
+
+            auto thrown = false;
+            try
+            {
+                from_array (ints) >> to_flat_map (key, value, throw_on_duplicate_key);
+            }
+            catch (duplicate_key_exception const &)
+            {
+                thrown = true;
+            }
+            TEST_ASSERT (true, thrown);
+
+            auto keys = from (last) >> select ([](std::pair<int,int> const & p){return p.first;}) >> to_vector ();
+            int expected[] = {0, 1, 2};
+            TEST_ASSERT (true, (from (keys) >> sequence_equal (from_array (expected))));
+
+            auto last_values = from_array (ints) >> to_flat_map (key, last_value_wins);
+            if (TEST_ASSERT (3U, last_values.size ()))
+            {
+                TEST_ASSERT (9, last_values.at (0));
+            }
         }
 
         {
-            std::list<int> to_list_result = from_array (ints) >> to_list ();
-            TEST_ASSERT (count_of_ints, to_list_result.size ());
+            // Move-only values are moved into the map
+            auto values = [] (int i) {return std::unique_ptr<int> (new int (i * 10));};
+            auto key    = [] (std::unique_ptr<int> const & p) {return *p / 10;};
 
-            auto pos = to_list_result.begin ();
-            for (auto index = 0U; index < to_list_result.size (); ++index)
+            auto to_flat_map_result = range (0, 4) >> select (values) >> to_flat_map (key);
+
+            if (TEST_ASSERT (4U, to_flat_map_result.size ()))
             {
-                test_int_at (index, *pos++);
+                TEST_ASSERT (30, *to_flat_map_result.at (3));
+            }
+
+            auto to_map_result = range (0, 4) >> select (values) >> to_unordered_map (key);
+
+            if (TEST_ASSERT (4U, to_map_result.size ()))
+            {
+                TEST_ASSERT (20, *to_map_result[2]);
+            }
+
+            auto ordered_result = range (0, 4) >> select (values) >> to_map (key);
+
+            if (TEST_ASSERT (4U, ordered_result.size ()))
+            {
+                TEST_ASSERT (10, *ordered_result[1]);
             }
         }
     }
 
-    void test_container ()
+    void test_memory_resource ()
     {
         using namespace cpplinq;
-        using namespace cpplinq::experimental;
 
         TEST_PRELUDE ();
 
-        {
-            auto container_result = from (empty_vector) >> container ();
-            std::vector<int> v (container_result.begin (), container_result.end ());
-            TEST_ASSERT (0U, v.size ());
-        }
+        auto key        = [](int i) {return i;};
+        auto is_odd     = [](int i) {return i % 2 == 1;};
+        auto combine    = [](int i, int j) {return i * 100 + j;};
 
         {
-            auto container_result = from_iterators (ints, ints + count_of_ints) >> container ();
-            std::vector<int> v (container_result.begin (), container_result.end ());
-            if (TEST_ASSERT (count_of_ints, v.size ()))
-            {
-                for (auto index = 0U; index < count_of_ints; ++index)
-                {
-                    test_int_at (index, v[index]);
-                }
-            }
-        }
-        {
-            auto container_result   = from_array (customers) >> container ();
-            auto begin              = container_result.begin ();
-            auto end                = container_result.end ();
+            // with_memory_resource keeps the fast paths of its source
+            typedef detail::memory_resource_range<detail::from_range<int const *>>  resource_range_type;
+            typedef detail::memory_resource_range<detail::int_range>                resource_int_range_type;
 
-            TEST_ASSERT (true, (begin != end));
-            TEST_ASSERT (false, (begin == end));
-
-            auto c = *begin;
+            static_assert (detail::is_batched<resource_range_type>::value, "with_memory_resource forwards batched");
+            static_assert (detail::is_random_access_range<resource_range_type>::value, "with_memory_resource forwards random_access");
+            static_assert (detail::contiguous_range_traits<resource_range_type>::is_contiguous, "with_memory_resource forwards contiguous");
+            static_assert (detail::is_random_access_range<resource_int_range_type>::value, "with_memory_resource forwards random_access");
 
-            TEST_ASSERT (1U, c.id);
-            TEST_ASSERT (1U, begin->id);
-            TEST_ASSERT (1U, (*begin).id);
+            arena scratch;
+            std::vector<int> values (ints, ints + count_of_ints);
 
+            auto copied     = from (values) >> with_memory_resource (scratch) >> to_vector ();
+            auto counted    = from (values) >> with_arena (scratch) >> skip (2U) >> count ();
+            auto summed     = from (values) >> with_arena (scratch) >> sum ();
+            auto selected   = range (0, 10) >> select (key) >> with_arena (scratch) >> element_at_or_default (3U);
 
+            TEST_ASSERT (true, (copied == values));
+            TEST_ASSERT (count_of_ints - 2U, counted);
+            TEST_ASSERT ((from (values) >> sum ()), summed);
+            TEST_ASSERT (3, selected);
         }
-    }
 
-    void test_where ()
-    {
-        using namespace cpplinq;
+        {
+            // Buffers of over-aligned values are aligned
+            struct alignas (64) aligned_value
+            {
+                int key;
+            };
 
-        TEST_PRELUDE ();
+            auto make       = [](int i) {aligned_value v; v.key = (i * 37) % 100; return v;};
+            auto key_of     = [](aligned_value const & v) {return v.key;};
+            auto misaligned = [](aligned_value const & v) {return reinterpret_cast<std::uintptr_t> (&v) % 64U == 0U ? 0 : 1;};
 
-        {
-            auto c = from (empty_vector) >> where (is_even) >> count ();
-            TEST_ASSERT (0U, c);
-        }
+            auto memory = new_delete_resource ();
+            auto p      = memory->allocate (100U, 64U);
+            TEST_ASSERT (0U, static_cast<std::size_t> (reinterpret_cast<std::uintptr_t> (p) % 64U));
+            memory->deallocate (p, 100U, 64U);
 
-        {
-            auto c = from_array (ints) >> where (is_even) >> count ();
-            TEST_ASSERT (even_count_of_ints, c);
+            auto sorted     = range (0, 100) >> select (make) >> orderby_ascending (key_of) >> select (misaligned) >> sum ();
+            auto reversed   = range (0, 100) >> select (make) >> reverse () >> select (misaligned) >> sum ();
+            auto first      = range (0, 100) >> select (make) >> orderby_ascending (key_of) >> select (key_of) >> first_or_default ();
+
+            TEST_ASSERT (0, sorted);
+            TEST_ASSERT (0, reversed);
+            TEST_ASSERT (0, first);
         }
 
         {
-            auto v = from_array (ints) >> where (is_even) >> first_or_default ();
-            TEST_ASSERT (4, v);
-        }
-    }
+            counting_memory_resource memory;
 
-    void test_ref ()
-    {
-        using namespace cpplinq;
+            {
+                auto expected   = from_array (ints) >> where (is_odd) >> orderby_ascending (key) >> to_vector ();
+                auto sorted     = from_array (ints) >> with_memory_resource (memory) >> where (is_odd) >> orderby_ascending (key) >> to_vector ();
 
-        TEST_PRELUDE ();
+                TEST_ASSERT (true, (memory.allocations > 0U));
+                TEST_ASSERT (true, (expected == sorted));
+            }
 
-        {
-            std::vector<std::reference_wrapper<int const>> ref_result =
-                    from (empty_vector)
-                >>  ref ()
-                >>  to_vector ()
-                ;
-            TEST_ASSERT (0U, ref_result.size ());
+            TEST_ASSERT (0U, memory.live_bytes);
         }
 
         {
-            std::vector<std::reference_wrapper<customer const>> ref_result =
-                    from_array (customers)
-                >>  ref ()
-                >>  to_vector ()
-                ;
+            counting_memory_resource memory;
 
-            auto index = 0U;
-            for (auto customer : ref_result)
             {
-                if (!TEST_ASSERT (customers[index].id, customer.get ().id))
-                {
-                    PRINT_INDEX (index);
-                }
-
-                ++index;
+                auto q = from_array (ints) >> with_memory_resource (memory) >> orderby_ascending (key) >> thenby_descending (key);
+                auto first = q >> first_or_default ();
+                TEST_ASSERT (1, first);
             }
 
-            TEST_ASSERT (count_of_customers, ref_result.size ());
+            TEST_ASSERT (true, (memory.allocations > 0U));
+            TEST_ASSERT (0U, memory.live_bytes);
         }
-    }
 
-    void test_select ()
-    {
-        using namespace cpplinq;
+        {
+            counting_memory_resource memory;
 
-        TEST_PRELUDE ();
+            {
+                auto last = from_array (ints) >> select (key) >> with_memory_resource (memory) >> select (key) >> reverse () >> first_or_default ();
+                TEST_ASSERT (5, last);
+            }
 
-        {
-            std::vector<double> select_result = from (empty_vector) >> select ([](int i){return 1.0*i;}) >> to_vector ();
-            TEST_ASSERT (0U, select_result.size ());
+            TEST_ASSERT (true, (memory.allocations > 0U));
+            TEST_ASSERT (0U, memory.live_bytes);
         }
 
         {
-            std::vector<std::size_t> select_result =
-                    from_array (customers)
-                >>  select ([](customer const & c){return c.id;})
-                >>  to_vector ()
-                ;
+            counting_memory_resource memory;
 
-            std::size_t index = 0U;
-            for (auto sz : select_result)
             {
-                if (!TEST_ASSERT (customers[index].id, sz))
-                {
-                    PRINT_INDEX (index);
-                }
+                auto expected   = from_array (ints) >> distinct () >> to_vector ();
+                auto ordered    = from_array (ints) >> with_memory_resource (memory) >> distinct () >> to_vector ();
+                auto hashed     = from_array (ints) >> with_memory_resource (memory) >> hash_distinct () >> to_vector ();
 
-                ++index;
+                TEST_ASSERT (true, (expected == ordered));
+                TEST_ASSERT (true, (expected == hashed));
+
+                auto unions     = from_array (ints) >> with_memory_resource (memory) >> union_with (range (0, 20)) >> count ();
+                auto intersects = from_array (ints) >> with_memory_resource (memory) >> intersect_with (range (0, 5)) >> count ();
+                auto excepts    = from_array (ints) >> with_memory_resource (memory) >> except (range (0, 5)) >> count ();
+
+                TEST_ASSERT (20U, unions);
+                TEST_ASSERT (4U, intersects);
+                TEST_ASSERT (5U, excepts);
             }
 
-            TEST_ASSERT (count_of_customers, select_result.size ());
+            TEST_ASSERT (true, (memory.allocations > 0U));
+            TEST_ASSERT (0U, memory.live_bytes);
         }
 
-    }
+        {
+            counting_memory_resource memory;
 
-    void test_join ()
-    {
-        using namespace cpplinq;
+            {
+                auto expected   = range (0, 10) >> join (from_array (ints), key, key, combine) >> to_vector ();
+                auto joined     = range (0, 10) >> with_memory_resource (memory) >> join (from_array (ints), key, key, combine) >> to_vector ();
+                auto hashed     = range (0, 10) >> with_memory_resource (memory) >> hash_join (from_array (ints), key, key, combine) >> to_vector ();
 
-        TEST_PRELUDE ();
+                TEST_ASSERT (true, (expected == joined));
+                TEST_ASSERT (true, (expected == hashed));
+            }
+
+            TEST_ASSERT (true, (memory.allocations > 0U));
+            TEST_ASSERT (0U, memory.live_bytes);
+        }
 
         {
-            auto cs     = empty<customer> ();
-            auto cas    = empty<customer_address> ();
+            counting_memory_resource memory;
 
-            auto join_result = cs
-                >> join (
-                        cas
-                    ,   [](customer const & c) {return c.id;}
-                    ,   [](customer_address const & ca) {return ca.customer_id;}
-                    ,   [](customer const & c, customer_address const & ca) {return std::make_pair (c, ca);}
-                    )
-                >> to_vector ()
-                ;
+            {
+                auto parity         = [](int i) {return i % 2;};
+                auto lookup         = from_array (ints) >> with_memory_resource (memory) >> to_lookup (parity);
+                auto hash_lookup    = from_array (ints) >> with_memory_resource (memory) >> to_hash_lookup (parity);
 
-            TEST_ASSERT (0U, join_result.size ());
-        }
-        {
-            auto cas    = empty<customer_address> ();
+                auto odd_count      = from_array (ints) >> where (is_odd) >> count ();
+                auto lookup_count   = lookup[1] >> count ();
+                auto hash_count     = hash_lookup[1] >> count ();
 
-            auto join_result = from_array (customers)
-                >> join (
-                        cas
-                    ,   [](customer const & c) {return c.id;}
-                    ,   [](customer_address const & ca) {return ca.customer_id;}
-                    ,   [](customer const & c, customer_address const & ca) {return std::make_pair (c, ca);}
-                    )
-                >> to_vector ()
-                ;
+                TEST_ASSERT (odd_count, lookup_count);
+                TEST_ASSERT (odd_count, hash_count);
+            }
 
-            TEST_ASSERT (0U, join_result.size ());
+            TEST_ASSERT (true, (memory.allocations > 0U));
+            TEST_ASSERT (0U, memory.live_bytes);
         }
+
         {
-            auto cs     = empty<customer> ();
+            counting_memory_resource memory;
 
-            auto join_result = cs
-                >> join (
-                        from_array (customer_addresses)
-                    ,   [](customer const & c) {return c.id;}
-                    ,   [](customer_address const & ca) {return ca.customer_id;}
-                    ,   [](customer const & c, customer_address const & ca) {return std::make_pair (c, ca);}
-                    )
-                >> to_vector ()
-                ;
+            {
+                auto groups = from_array (ints) >> with_memory_resource (memory) >> group_by_sorted (is_odd);
+                TEST_ASSERT (&memory, groups.resource ());
 
-            TEST_ASSERT (0U, join_result.size ());
+                auto reversed = groups >> reverse () >> count ();
+                TEST_ASSERT (true, (memory.allocations > 0U));
+                TEST_ASSERT (true, (reversed > 0U));
+
+                auto has_first = groups.next ();
+                if (TEST_ASSERT (true, has_first))
+                {
+                    TEST_ASSERT (&memory, groups.resource ());
+                    TEST_ASSERT (&memory, groups.front ().values.resource ());
+                }
+            }
+
+            TEST_ASSERT (0U, memory.live_bytes);
         }
+
         {
-            auto join_result = from_array (customers)
-                >> join (
-                        from_array (customer_addresses)
-                    ,   [](customer const & c) {return c.id;}
-                    ,   [](customer_address const & ca) {return ca.customer_id;}
-                    ,   [](customer const & c, customer_address const & ca) {return std::make_pair (c, ca);}
-                    )
-                >> to_vector ()
-                ;
+            counting_memory_resource memory;
 
-            if (TEST_ASSERT (3U, join_result.size ()))
             {
+                resource_allocator<void> allocator (&memory);
+
+                auto vector = from_array (ints) >> to_vector (16U, allocator);
+                if (TEST_ASSERT (count_of_ints, vector.size ()))
                 {
-                    auto result = join_result[0];
-                    TEST_ASSERT (1U, result.first.id);
-                    TEST_ASSERT (1U, result.second.id);
-                }
-                {
-                    auto result = join_result[1];
-                    TEST_ASSERT (4U, result.first.id);
-                    TEST_ASSERT (2U, result.second.id);
-                }
-                {
-                    auto result = join_result[2];
-                    TEST_ASSERT (4U, result.first.id);
-                    TEST_ASSERT (3U, result.second.id);
+                    TEST_ASSERT (&memory, vector.get_allocator ().resource ());
+                    TEST_ASSERT (true, (from (vector) >> sequence_equal (from_array (ints))));
                 }
+
+                auto allocations = memory.allocations;
+                auto copy = vector;
+                TEST_ASSERT (allocations + 1U, memory.allocations);
+                TEST_ASSERT (count_of_ints, copy.size ());
+
+                auto list = from_array (ints) >> to_list (allocator);
+                TEST_ASSERT (count_of_ints, list.size ());
+                TEST_ASSERT (&memory, list.get_allocator ().resource ());
+
+                auto map = from_array (ints) >> to_map (key, is_odd, first_value_wins, allocator);
+                TEST_ASSERT (&memory, map.get_allocator ().resource ());
+                TEST_ASSERT (true, map[9]);
+
+                auto unordered_map = from_array (ints) >> to_unordered_map (key, is_odd, first_value_wins, allocator);
+                TEST_ASSERT (&memory, unordered_map.get_allocator ().resource ());
+                TEST_ASSERT (false, unordered_map[8]);
+
+                auto flat_map = from_array (ints) >> to_flat_map (key, is_odd, first_value_wins, allocator);
+                TEST_ASSERT (map.size (), flat_map.size ());
+                TEST_ASSERT (true, flat_map.at (7));
             }
+
+            TEST_ASSERT (0U, memory.live_bytes);
         }
     }
 
-    void test_select_many ()
+    void test_arena ()
     {
         using namespace cpplinq;
 
         TEST_PRELUDE ();
 
-        {
-            std::vector<char> select_many_result =
-                    from_iterators (customers, customers)
-                >>  select_many ([](customer const & c){return from (c.last_name);})
-                >>  to_vector ()
-                ;
+        auto key        = [](int i) {return i;};
+        auto parity     = [](int i) {return i % 2;};
+        auto combine    = [](int i, int j) {return i * 100 + j;};
 
-            TEST_ASSERT (0U, select_many_result.size ());
-        }
         {
-            std::vector<char> expected;
-            for (auto customer : customers)
+            counting_memory_resource upstream;
+
             {
-                expected.insert (
-                        expected.end ()
-                    ,   customer.last_name.begin ()
-                    ,   customer.last_name.end ()
-                    );
+                arena scratch (64U, &upstream);
+
+                auto a = scratch.allocate (1U, 1U);
+                auto b = scratch.allocate (sizeof (double), alignof (double));
+                auto c = scratch.allocate (200U, 64U);
+
+                TEST_ASSERT (true, (a != nullptr));
+                TEST_ASSERT (0U, reinterpret_cast<std::uintptr_t> (b) % alignof (double));
+                TEST_ASSERT (0U, reinterpret_cast<std::uintptr_t> (c) % 64U);
+                TEST_ASSERT (true, (scratch.capacity () >= 264U));
+
+                // Only the last allocation is given back
+                scratch.deallocate (c, 200U, 64U);
+                auto d = scratch.allocate (200U, 64U);
+                TEST_ASSERT (c, d);
+
+                auto allocations = upstream.allocations;
+                scratch.reset ();
+                scratch.allocate (1U, 1U);
+                scratch.allocate (sizeof (double), alignof (double));
+                scratch.allocate (200U, 64U);
+                TEST_ASSERT (allocations, upstream.allocations);
+
+                scratch.release ();
+                TEST_ASSERT (0U, upstream.live_bytes);
+                TEST_ASSERT (0U, scratch.capacity ());
             }
 
-            std::vector<char> select_many_result =
-                    from_array (customers)
-                >>  select_many ([](customer const & c){return from (c.last_name);})
-                >>  to_vector ()
-                ;
+            TEST_ASSERT (0U, upstream.live_bytes);
+        }
+
+        {
+            counting_memory_resource upstream;
 
-            if (TEST_ASSERT (expected.size (), select_many_result.size ()))
             {
-                for (std::size_t index = 0U; index < expected.size (); ++index)
+                arena scratch (256U, &upstream);
+
+                auto expected_sorted    = from_array (ints) >> orderby_ascending (parity) >> thenby_descending (key) >> to_vector ();
+                auto expected_joined    = range (0, 10) >> join (from_array (ints), key, key, combine) >> to_vector ();
+
+                auto run = [&] ()
                 {
-                    if (!TEST_ASSERT (expected[index], select_many_result[index]))
-                    {
-                        PRINT_INDEX (index);
-                    }
-                }
+                    auto sorted     = from_array (ints) >> with_arena (scratch) >> orderby_ascending (parity) >> thenby_descending (key) >> to_vector ();
+                    auto reversed   = from_array (ints) >> with_arena (scratch) >> reverse () >> first_or_default ();
+                    auto distincts  = from_array (ints) >> with_arena (scratch) >> distinct () >> count ();
+                    auto unions     = from_array (ints) >> with_arena (scratch) >> union_with (range (0, 20)) >> count ();
+                    auto intersects = from_array (ints) >> with_arena (scratch) >> intersect_with (range (0, 5)) >> count ();
+                    auto excepts    = from_array (ints) >> with_arena (scratch) >> except (range (0, 5)) >> count ();
+                    auto joined     = range (0, 10) >> with_arena (scratch) >> join (from_array (ints), key, key, combine) >> to_vector ();
+                    auto lookup     = from_array (ints) >> with_arena (scratch) >> to_lookup (parity);
+                    auto odds       = lookup[1] >> count ();
+
+                    TEST_ASSERT (true, (expected_sorted == sorted));
+                    TEST_ASSERT (5, reversed);
+                    TEST_ASSERT (9U, distincts);
+                    TEST_ASSERT (20U, unions);
+                    TEST_ASSERT (4U, intersects);
+                    TEST_ASSERT (5U, excepts);
+                    TEST_ASSERT (true, (expected_joined == joined));
+                    TEST_ASSERT (true, (odds > 0U));
+                };
+
+                run ();
+                auto allocations = upstream.allocations;
+                TEST_ASSERT (true, (allocations > 0U));
+
+                scratch.reset ();
+                run ();
+                TEST_ASSERT (allocations, upstream.allocations);
+
+                scratch.reset ();
+                run ();
+                TEST_ASSERT (allocations, upstream.allocations);
             }
-        }
 
+            TEST_ASSERT (0U, upstream.live_bytes);
+        }
     }
 
-    void test_orderby ()
+    void test_to_lookup ()
     {
         using namespace cpplinq;
+        using namespace cpplinq::detail;
 
         TEST_PRELUDE ();
 
         {
-            auto c = from (empty_vector) >> orderby_ascending ([](int i){return i;}) >> count ();
-            TEST_ASSERT (0U, c);
+            auto lookup = from (empty_customers) >> to_lookup ([] (customer const & c){return c.id;});
+
+            TEST_ASSERT (0U, lookup.size_of_keys ());
+            TEST_ASSERT (0U, lookup.size_of_values ());
         }
 
         {
-            auto c =
-                    from (empty_customers)
-                >>  orderby_ascending ([] (customer const & c) {return c.last_name;})
-                >>  thenby_ascending ([] (customer const & c) {return c.first_name;})
-                >>  count ()
-                ;
-            TEST_ASSERT (0U, c);
-        }
+            auto lookup = from_array (customers) >> to_lookup ([] (customer const & c){return c.id;});
 
-        const std::size_t test_set_size = 7;
+            TEST_ASSERT (count_of_customers, lookup.size_of_keys ());
+            TEST_ASSERT (count_of_customers, lookup.size_of_values ());
 
-        auto verify = [=](
-                std::size_t expected[test_set_size]
-            ,   std::vector<customer> const & sequence
-            )
-        {
-            auto sz = sequence.size ();
-            if (TEST_ASSERT (test_set_size, sz))
+            for (auto customer : customers)
             {
-                std::size_t index = 0U;
-                for (auto c : sequence)
+                auto results = lookup[customer.id] >> to_vector ();
+                if (TEST_ASSERT (1U, results.size ()))
                 {
-                    if (!TEST_ASSERT (expected[index], c.id))
+                    auto result = results.front ();
+
+                    if (!TEST_ASSERT (customer.id, result.id))
                     {
-                        PRINT_INDEX (index);
+                        PRINT_INDEX (customer.id);
                     }
-
-                    ++index;
                 }
-
+                else
+                {
+                    PRINT_INDEX (customer.id);
+                }
             }
-        };
+        }
 
         {
-            std::size_t expected[] =
+            auto lookup = from_array (customer_addresses) >> to_lookup ([] (customer_address const & ca){return ca.customer_id;});
+
+            TEST_ASSERT (2U, lookup.size_of_keys ());
+            TEST_ASSERT (count_of_customer_addresses, lookup.size_of_values ());
+
+            {
+                auto results = lookup[1] >> to_vector ();
+                if (TEST_ASSERT (1U, results.size ()))
                 {
-                    1,
-                    2,
-                    3,
-                    4,
-                    11,
-                    12,
-                    21,
-                };
+                    auto result = results.front ();
+                    TEST_ASSERT (1U, result.id);
+                }
+            }
 
-            auto sequence =
-                    from_array (customers)
-                >>  orderby_ascending ([] (customer const & c) {return c.id;})
-                >>  to_vector ()
-                ;
+            {
+                auto results = lookup[4] >> to_vector ();
+                if (TEST_ASSERT (2U, results.size ()))
+                {
+                    auto result1 = results[0];
+                    TEST_ASSERT (2U, result1.id);
 
-            verify (expected, sequence);
+                    auto result2 = results[1];
+                    TEST_ASSERT (3U, result2.id);
+                }
+            }
+
+            {
+                auto results = lookup[999] >> to_vector ();
+                TEST_ASSERT (0U, results.size ());
+            }
         }
+
+        // code coverage test
         {
-            std::size_t expected[] =
-                {
-                    21,
-                    12,
-                    11,
-                    4,
-                    3,
-                    2,
-                    1,
-                };
+            auto lookup = empty<int>() >> to_lookup ([] (int i) {return i;});
 
-            auto sequence =
-                    from_array (customers)
-                >>  orderby_descending ([] (customer const & c) {return c.id;})
-                >>  to_vector ()
-                ;
+            auto q = lookup[999];
 
-            verify (expected, sequence);
+            TEST_ASSERT (false, q.next ());
+            TEST_ASSERT (false, q.next ());
         }
-        {
-            std::size_t expected[] =
-                {
-                    11,
-                    12,
-                    1,
-                    21,
-                    2,
-                    3,
-                    4,
-                };
+    }
 
-            auto sequence =
-                    from_array (customers)
-                >>  orderby_ascending ([] (customer const & c) {return c.last_name;})
-                >>  thenby_ascending ([] (customer const & c) {return c.first_name;})
-                >>  to_vector ()
-                ;
+    void test_to_hash_lookup ()
+    {
+        using namespace cpplinq;
 
-            verify (expected, sequence);
+        TEST_PRELUDE ();
+
+        {
+            auto lookup = from (empty_customers) >> to_hash_lookup ([] (customer const & c){return c.id;});
+
+            TEST_ASSERT (0U, lookup.size_of_keys ());
+            TEST_ASSERT (0U, lookup.size_of_values ());
+            TEST_ASSERT (0U, lookup[1] >> count ());
         }
+
         {
-            std::size_t expected[] =
+            auto lookup = from_array (customer_addresses) >> to_hash_lookup ([] (customer_address const & ca){return ca.customer_id;});
+
+            TEST_ASSERT (2U, lookup.size_of_keys ());
+            TEST_ASSERT (count_of_customer_addresses, lookup.size_of_values ());
+
+            {
+                auto results = lookup[1] >> to_vector ();
+                if (TEST_ASSERT (1U, results.size ()))
                 {
-                    4,
-                    3,
-                    2,
-                    21,
-                    1,
-                    12,
-                    11,
-                };
+                    TEST_ASSERT (1U, results.front ().id);
+                }
+            }
 
-            auto sequence =
-                    from_array (customers)
-                >>  orderby_descending ([] (customer const & c) {return c.last_name;})
-                >>  thenby_descending ([] (customer const & c) {return c.first_name;})
-                >>  to_vector ()
-                ;
+            {
+                // Values of a key keep their source order
+                auto results = lookup[4] >> to_vector ();
+                if (TEST_ASSERT (2U, results.size ()))
+                {
+                    TEST_ASSERT (2U, results[0].id);
+                    TEST_ASSERT (3U, results[1].id);
+                }
+            }
 
-            verify (expected, sequence);
+            {
+                auto results = lookup[999] >> to_vector ();
+                TEST_ASSERT (0U, results.size ());
+            }
         }
+
         {
-            std::size_t expected[] =
+            auto lookup = range (0, 1000) >> to_hash_lookup ([] (int i) {return to_string (i % 37);});
+
+            TEST_ASSERT (37U, lookup.size_of_keys ());
+            TEST_ASSERT (1000U, lookup.size_of_values ());
+
+            for (auto key = 0; key < 40; ++key)
+            {
+                std::vector<int> expected;
+                for (auto i = key; key < 37 && i < 1000; i += 37)
                 {
-                    11,
-                    12,
-                    21,
-                    1,
-                    2,
-                    3,
-                    4,
-                };
+                    expected.push_back (i);
+                }
 
-            auto sequence =
-                    from_array (customers)
-                >>  orderby ([] (customer const & c) {return c.last_name;}, true)
-                >>  thenby ([] (customer const & c) {return c.first_name;}, false)
-                >>  to_vector ()
+                auto result = lookup[to_string (key)] >> to_vector ();
+                if (!TEST_ASSERT (true, (expected == result)))
+                {
+                    PRINT_INDEX (key);
+                }
+            }
+        }
+
+        {
+            // Custom hash and equality
+            auto lookup = from_array (customers) >> to_hash_lookup (
+                    [] (customer const & c) {return c.first_name;}
+                ,   [] (std::string const & s) {return s.size ();}
+                ,   [] (std::string const & l, std::string const & r) {return l == r;}
+                );
+
+            TEST_ASSERT (6U, lookup.size_of_keys ());
+            TEST_ASSERT (2U, lookup["Steve"] >> count ());
+            TEST_ASSERT (0U, lookup["Steven"] >> count ());
+        }
+
+        {
+            // Move-only values are moved into the lookup
+            auto lookup =
+                    range (0, 10)
+                >>  select ([] (int i) {return std::unique_ptr<int> (new int (i));})
+                >>  to_hash_lookup ([] (std::unique_ptr<int> const & v) {return *v % 2;})
                 ;
 
-            verify (expected, sequence);
+            TEST_ASSERT (2U, lookup.size_of_keys ());
+
+            auto odd = lookup[1];
+            auto expected = 1;
+            while (odd.next ())
+            {
+                TEST_ASSERT (expected, *odd.front ());
+                expected += 2;
+            }
+            TEST_ASSERT (11, expected);
         }
     }
 
-    void test_reverse ()
+    void test_to_list ()
     {
         using namespace cpplinq;
 
         TEST_PRELUDE ();
 
-        // reverse an empty range
         {
-            auto result = empty<int>() >> reverse () >> to_vector ();
-            TEST_ASSERT (0U, result.size ());
+            std::list<int> to_list_result = from (empty_vector) >> to_list ();
+            TEST_ASSERT (0U, to_list_result.size ());
         }
 
-        // reverse an empty range
         {
-            auto result = from (empty_vector) >> reverse () >> to_vector ();
-            TEST_ASSERT (0U, result.size ());
+            std::list<int> to_list_result = from_array (ints) >> to_list ();
+            TEST_ASSERT (count_of_ints, to_list_result.size ());
+
+            auto pos = to_list_result.begin ();
+            for (auto index = 0U; index < to_list_result.size (); ++index)
+            {
+                test_int_at (index, *pos++);
+            }
         }
+    }
 
-        // reverse a non-empty range
-        {
-            int expected[] = {9,8,7,6,5,4,3,2,1,0};
-            auto expected_size = get_array_size (expected);
+    void test_container ()
+    {
+        using namespace cpplinq;
+        using namespace cpplinq::experimental;
 
-            auto result = range (0, 10) >> reverse () >> to_vector ();
-            TEST_ASSERT (expected_size, result.size ());
+        TEST_PRELUDE ();
 
-            for (auto i = 0U; i < expected_size && i < result.size (); ++i)
+        {
+            auto container_result = from (empty_vector) >> container ();
+            std::vector<int> v (container_result.begin (), container_result.end ());
+            TEST_ASSERT (0U, v.size ());
+        }
+
+        {
+            auto container_result = from_iterators (ints, ints + count_of_ints) >> container ();
+            std::vector<int> v (container_result.begin (), container_result.end ());
+            if (TEST_ASSERT (count_of_ints, v.size ()))
             {
-                TEST_ASSERT (expected[i], result[i]);
+                for (auto index = 0U; index < count_of_ints; ++index)
+                {
+                    test_int_at (index, v[index]);
+                }
             }
         }
-
-        // code coverage test
         {
-            auto q = empty<int>() >> reverse ();
+            auto container_result   = from_array (customers) >> container ();
+            auto begin              = container_result.begin ();
+            auto end                = container_result.end ();
+
+            TEST_ASSERT (true, (begin != end));
+            TEST_ASSERT (false, (begin == end));
+
+            auto c = *begin;
+
+            TEST_ASSERT (1U, c.id);
+            TEST_ASSERT (1U, begin->id);
+            TEST_ASSERT (1U, (*begin).id);
+
 
-            TEST_ASSERT (false, q.next ());
-            TEST_ASSERT (false, q.next ());
         }
     }
 
-    void test_skip ()
+    void test_where ()
     {
         using namespace cpplinq;
 
         TEST_PRELUDE ();
 
         {
-            auto q = from (empty_vector) >> skip (5);
-            std::size_t index = 0U;
+            auto c = from (empty_vector) >> where (is_even) >> count ();
+            TEST_ASSERT (0U, c);
+        }
 
-            while (q.next ())
+        {
+            auto c = from_array (ints) >> where (is_even) >> count ();
+            TEST_ASSERT (even_count_of_ints, c);
+        }
+
+        {
+            auto v = from_array (ints) >> where (is_even) >> first_or_default ();
+            TEST_ASSERT (4, v);
+        }
+    }
+
+    void test_ref ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        {
+            std::vector<std::reference_wrapper<int const>> ref_result =
+                    from (empty_vector)
+                >>  ref ()
+                >>  to_vector ()
+                ;
+            TEST_ASSERT (0U, ref_result.size ());
+        }
+
+        {
+            std::vector<std::reference_wrapper<customer const>> ref_result =
+                    from_array (customers)
+                >>  ref ()
+                >>  to_vector ()
+                ;
+
+            auto index = 0U;
+            for (auto customer : ref_result)
+            {
+                if (!TEST_ASSERT (customers[index].id, customer.get ().id))
+                {
+                    PRINT_INDEX (index);
+                }
+
+                ++index;
+            }
+
+            TEST_ASSERT (count_of_customers, ref_result.size ());
+        }
+    }
+
+    void test_select ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        {
+            std::vector<double> select_result = from (empty_vector) >> select ([](int i){return 1.0*i;}) >> to_vector ();
+            TEST_ASSERT (0U, select_result.size ());
+        }
+
+        {
+            std::vector<std::size_t> select_result =
+                    from_array (customers)
+                >>  select ([](customer const & c){return c.id;})
+                >>  to_vector ()
+                ;
+
+            std::size_t index = 0U;
+            for (auto sz : select_result)
+            {
+                if (!TEST_ASSERT (customers[index].id, sz))
+                {
+                    PRINT_INDEX (index);
+                }
+
+                ++index;
+            }
+
+            TEST_ASSERT (count_of_customers, select_result.size ());
+        }
+
+    }
+
+    void test_join ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        {
+            auto cs     = empty<customer> ();
+            auto cas    = empty<customer_address> ();
+
+            auto join_result = cs
+                >> join (
+                        cas
+                    ,   [](customer const & c) {return c.id;}
+                    ,   [](customer_address const & ca) {return ca.customer_id;}
+                    ,   [](customer const & c, customer_address const & ca) {return std::make_pair (c, ca);}
+                    )
+                >> to_vector ()
+                ;
+
+            TEST_ASSERT (0U, join_result.size ());
+        }
+        {
+            auto cas    = empty<customer_address> ();
+
+            auto join_result = from_array (customers)
+                >> join (
+                        cas
+                    ,   [](customer const & c) {return c.id;}
+                    ,   [](customer_address const & ca) {return ca.customer_id;}
+                    ,   [](customer const & c, customer_address const & ca) {return std::make_pair (c, ca);}
+                    )
+                >> to_vector ()
+                ;
+
+            TEST_ASSERT (0U, join_result.size ());
+        }
+        {
+            auto cs     = empty<customer> ();
+
+            auto join_result = cs
+                >> join (
+                        from_array (customer_addresses)
+                    ,   [](customer const & c) {return c.id;}
+                    ,   [](customer_address const & ca) {return ca.customer_id;}
+                    ,   [](customer const & c, customer_address const & ca) {return std::make_pair (c, ca);}
+                    )
+                >> to_vector ()
+                ;
+
+            TEST_ASSERT (0U, join_result.size ());
+        }
+        {
+            auto join_result = from_array (customers)
+                >> join (
+                        from_array (customer_addresses)
+                    ,   [](customer const & c) {return c.id;}
+                    ,   [](customer_address const & ca) {return ca.customer_id;}
+                    ,   [](customer const & c, customer_address const & ca) {return std::make_pair (c, ca);}
+                    )
+                >> to_vector ()
+                ;
+
+            if (TEST_ASSERT (3U, join_result.size ()))
+            {
+                {
+                    auto result = join_result[0];
+                    TEST_ASSERT (1U, result.first.id);
+                    TEST_ASSERT (1U, result.second.id);
+                }
+                {
+                    auto result = join_result[1];
+                    TEST_ASSERT (4U, result.first.id);
+                    TEST_ASSERT (2U, result.second.id);
+                }
+                {
+                    auto result = join_result[2];
+                    TEST_ASSERT (4U, result.first.id);
+                    TEST_ASSERT (3U, result.second.id);
+                }
+            }
+        }
+    }
+
+
+    void test_hash_join ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        {
+            auto cs     = empty<customer> ();
+
+            auto join_result = cs
+                >> hash_join (
+                        from_array (customer_addresses)
+                    ,   [](customer const & c) {return c.id;}
+                    ,   [](customer_address const & ca) {return ca.customer_id;}
+                    ,   [](customer const & c, customer_address const & ca) {return std::make_pair (c, ca);}
+                    )
+                >> to_vector ()
+                ;
+
+            TEST_ASSERT (0U, join_result.size ());
+        }
+        {
+            auto join_result = from_array (customers)
+                >> hash_join (
+                        empty<customer_address> ()
+                    ,   [](customer const & c) {return c.id;}
+                    ,   [](customer_address const & ca) {return ca.customer_id;}
+                    ,   [](customer const & c, customer_address const & ca) {return std::make_pair (c, ca);}
+                    )
+                >> to_vector ()
+                ;
+
+            TEST_ASSERT (0U, join_result.size ());
+        }
+        {
+            auto join_result = from_array (customers)
+                >> hash_join (
+                        from_array (customer_addresses)
+                    ,   [](customer const & c) {return c.id;}
+                    ,   [](customer_address const & ca) {return ca.customer_id;}
+                    ,   [](customer const & c, customer_address const & ca) {return std::make_pair (c, ca);}
+                    )
+                >> to_vector ()
+                ;
+
+            if (TEST_ASSERT (3U, join_result.size ()))
+            {
+                {
+                    auto result = join_result[0];
+                    TEST_ASSERT (1U, result.first.id);
+                    TEST_ASSERT (1U, result.second.id);
+                }
+                {
+                    auto result = join_result[1];
+                    TEST_ASSERT (4U, result.first.id);
+                    TEST_ASSERT (2U, result.second.id);
+                }
+                {
+                    auto result = join_result[2];
+                    TEST_ASSERT (4U, result.first.id);
+                    TEST_ASSERT (3U, result.second.id);
+                }
+            }
+        }
+        {
+            // The inner range yields values so the rows are copied
+            auto join_result = from_array (customers)
+                >> hash_join (
+                        from_array (customer_addresses) >> select ([](customer_address const & ca) {return ca;})
+                    ,   [](customer const & c) {return c.id;}
+                    ,   [](customer_address const & ca) {return ca.customer_id;}
+                    ,   [](customer const & c, customer_address const & ca) {return ca.id * 100 + c.id;}
+                    )
+                >> to_vector ()
+                ;
+
+            if (TEST_ASSERT (3U, join_result.size ()))
+            {
+                TEST_ASSERT (101U, join_result[0]);
+                TEST_ASSERT (204U, join_result[1]);
+                TEST_ASSERT (304U, join_result[2]);
+            }
+        }
+        {
+            auto key        = [] (int i) { return i % 97; };
+            auto combiner   = [] (int l, int r) { return l * 1000 + r; };
+
+            auto expected   = range (0, 500) >> join (range (0, 1000), key, key, combiner) >> to_vector ();
+            auto result     = range (0, 500) >> hash_join (range (0, 1000), key, key, combiner) >> to_vector ();
+
+            if (TEST_ASSERT (expected.size (), result.size ()))
+            {
+                for (auto i = 0U; i < expected.size (); ++i)
+                {
+                    TEST_ASSERT (expected[i], result[i]);
+                }
+            }
+        }
+        {
+            auto join_result = from_array (customers)
+                >> hash_join (
+                        from_array (customers)
+                    ,   [](customer const & c) {return c.last_name;}
+                    ,   [](customer const & c) {return c.first_name;}
+                    ,   [](customer const & l, customer const & r) {return l.id * 100 + r.id;}
+                    ,   [](std::string const & s) {return s.size ();}
+                    ,   [](std::string const & l, std::string const & r) {return l.size () == r.size ();}
+                    )
+                >> count ()
+                ;
+
+            auto expected = from_array (customers)
+                >> join (
+                        from_array (customers)
+                    ,   [](customer const & c) {return c.last_name.size ();}
+                    ,   [](customer const & c) {return c.first_name.size ();}
+                    ,   [](customer const & l, customer const & r) {return l.id * 100 + r.id;}
+                    )
+                >> count ()
+                ;
+
+            TEST_ASSERT (expected, join_result);
+        }
+    }
+
+    void test_select_many ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        {
+            std::vector<char> select_many_result =
+                    from_iterators (customers, customers)
+                >>  select_many ([](customer const & c){return from (c.last_name);})
+                >>  to_vector ()
+                ;
+
+            TEST_ASSERT (0U, select_many_result.size ());
+        }
+        {
+            std::vector<char> expected;
+            for (auto customer : customers)
+            {
+                expected.insert (
+                        expected.end ()
+                    ,   customer.last_name.begin ()
+                    ,   customer.last_name.end ()
+                    );
+            }
+
+            std::vector<char> select_many_result =
+                    from_array (customers)
+                >>  select_many ([](customer const & c){return from (c.last_name);})
+                >>  to_vector ()
+                ;
+
+            if (TEST_ASSERT (expected.size (), select_many_result.size ()))
+            {
+                for (std::size_t index = 0U; index < expected.size (); ++index)
+                {
+                    if (!TEST_ASSERT (expected[index], select_many_result[index]))
+                    {
+                        PRINT_INDEX (index);
+                    }
+                }
+            }
+        }
+
+    }
+
+    void test_orderby ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        {
+            auto c = from (empty_vector) >> orderby_ascending ([](int i){return i;}) >> count ();
+            TEST_ASSERT (0U, c);
+        }
+
+        {
+            auto c =
+                    from (empty_customers)
+                >>  orderby_ascending ([] (customer const & c) {return c.last_name;})
+                >>  thenby_ascending ([] (customer const & c) {return c.first_name;})
+                >>  count ()
+                ;
+            TEST_ASSERT (0U, c);
+        }
+
+        const std::size_t test_set_size = 7;
+
+        auto verify = [=](
+                std::size_t expected[test_set_size]
+            ,   std::vector<customer> const & sequence
+            )
+        {
+            auto sz = sequence.size ();
+            if (TEST_ASSERT (test_set_size, sz))
+            {
+                std::size_t index = 0U;
+                for (auto c : sequence)
+                {
+                    if (!TEST_ASSERT (expected[index], c.id))
+                    {
+                        PRINT_INDEX (index);
+                    }
+
+                    ++index;
+                }
+
+            }
+        };
+
+        {
+            std::size_t expected[] =
+                {
+                    1,
+                    2,
+                    3,
+                    4,
+                    11,
+                    12,
+                    21,
+                };
+
+            auto sequence =
+                    from_array (customers)
+                >>  orderby_ascending ([] (customer const & c) {return c.id;})
+                >>  to_vector ()
+                ;
+
+            verify (expected, sequence);
+        }
+        {
+            std::size_t expected[] =
+                {
+                    21,
+                    12,
+                    11,
+                    4,
+                    3,
+                    2,
+                    1,
+                };
+
+            auto sequence =
+                    from_array (customers)
+                >>  orderby_descending ([] (customer const & c) {return c.id;})
+                >>  to_vector ()
+                ;
+
+            verify (expected, sequence);
+        }
+        {
+            std::size_t expected[] =
+                {
+                    11,
+                    12,
+                    1,
+                    21,
+                    2,
+                    3,
+                    4,
+                };
+
+            auto sequence =
+                    from_array (customers)
+                >>  orderby_ascending ([] (customer const & c) {return c.last_name;})
+                >>  thenby_ascending ([] (customer const & c) {return c.first_name;})
+                >>  to_vector ()
+                ;
+
+            verify (expected, sequence);
+        }
+        {
+            std::size_t expected[] =
+                {
+                    4,
+                    3,
+                    2,
+                    21,
+                    1,
+                    12,
+                    11,
+                };
+
+            auto sequence =
+                    from_array (customers)
+                >>  orderby_descending ([] (customer const & c) {return c.last_name;})
+                >>  thenby_descending ([] (customer const & c) {return c.first_name;})
+                >>  to_vector ()
+                ;
+
+            verify (expected, sequence);
+        }
+        {
+            std::size_t expected[] =
+                {
+                    11,
+                    12,
+                    21,
+                    1,
+                    2,
+                    3,
+                    4,
+                };
+
+            auto sequence =
+                    from_array (customers)
+                >>  orderby ([] (customer const & c) {return c.last_name;}, true)
+                >>  thenby ([] (customer const & c) {return c.first_name;}, false)
+                >>  to_vector ()
+                ;
+
+            verify (expected, sequence);
+        }
+
+        // Integral and floating point keys are radix sorted
+
+        {
+            int expected[] = {-5,-3,-1,0,2,7,INT_MAX};
+            int values[]   = {7,-1,INT_MAX,0,-5,2,-3};
+
+            auto sequence = from_array (values) >> orderby_ascending ([] (int i) {return i;}) >> to_vector ();
+            if (TEST_ASSERT (get_array_size (expected), sequence.size ()))
+            {
+                for (auto i = 0U; i < sequence.size (); ++i)
+                {
+                    TEST_ASSERT (expected[i], sequence[i]);
+                }
+            }
+        }
+
+        {
+            double expected[] = {1E100,2.5,0.0,-0.5,-1.0,-1E100};
+            double values[]   = {-1.0,2.5,-1E100,0.0,1E100,-0.5};
+
+            auto sequence = from_array (values) >> orderby_descending ([] (double d) {return d;}) >> to_vector ();
+            if (TEST_ASSERT (get_array_size (expected), sequence.size ()))
+            {
+                for (auto i = 0U; i < sequence.size (); ++i)
+                {
+                    TEST_ASSERT (expected[i], sequence[i]);
+                }
+            }
+        }
+
+        {
+            // Equal keys keep their order
+            std::size_t expected[] = {2,12,1,21,11,3,4};
+
+            auto sequence =
+                    from_array (customers)
+                >>  orderby_ascending ([] (customer const & c) {return c.last_name.size ();})
+                >>  to_vector ()
+                ;
+
+            verify (expected, sequence);
+        }
+
+        {
+            // Large enough to split on the most significant digit first
+            std::vector<int> values;
+            for (auto i = 0; i < 50000; ++i)
+            {
+                values.push_back ((i * 7919) % 10007 - 5000);
+            }
+
+            auto expected = values;
+            std::stable_sort (
+                    expected.begin ()
+                ,   expected.end ()
+                ,   [] (int l, int r) { return l % 100 < r % 100 || (l % 100 == r % 100 && r / 3 < l / 3); }
+                );
+
+            auto by_tuple =
+                    from (values)
+                >>  orderby_ascending ([] (int i) {return std::make_tuple (static_cast<short> (i % 100), -(i / 3));})
+                >>  to_vector ()
+                ;
+
+            auto by_thenby =
+                    from (values)
+                >>  orderby_ascending ([] (int i) {return static_cast<char> (i % 100);})
+                >>  thenby_descending ([] (int i) {return static_cast<float> (i / 3);})
+                >>  to_vector ()
+                ;
+
+            auto by_comparison =
+                    from (values)
+                >>  orderby_ascending ([] (int i) {return to_string (i % 100 + 500);})
+                >>  thenby_descending ([] (int i) {return i / 3;})
+                >>  to_vector ()
+                ;
+
+            if (TEST_ASSERT (expected.size (), by_tuple.size ()))
+            {
+                for (auto i = 0U; i < expected.size (); ++i)
+                {
+                    if (!TEST_ASSERT (expected[i], by_tuple[i]))
+                    {
+                        PRINT_INDEX (i);
+                        break;
+                    }
+                }
+            }
+
+            if (TEST_ASSERT (expected.size (), by_thenby.size ()))
+            {
+                for (auto i = 0U; i < expected.size (); ++i)
+                {
+                    if (!TEST_ASSERT (expected[i], by_thenby[i]))
+                    {
+                        PRINT_INDEX (i);
+                        break;
+                    }
+                }
+            }
+
+            if (TEST_ASSERT (expected.size (), by_comparison.size ()))
+            {
+                for (auto i = 0U; i < expected.size (); ++i)
+                {
+                    if (!TEST_ASSERT (expected[i], by_comparison[i]))
+                    {
+                        PRINT_INDEX (i);
+                        break;
+                    }
+                }
+            }
+        }
+
+        {
+            // Other keys are computed once per value and compared from a cache
+            std::size_t expected[] = {11,12,21,1,2,3,4};
+
+            auto key_calls = 0U;
+            auto sequence =
+                    from_array (customers)
+                >>  orderby_ascending ([&] (customer const & c) -> std::string const & {++key_calls; return c.last_name;})
+                >>  thenby_descending ([&] (customer const & c) {++key_calls; return c.first_name + c.last_name;})
+                >>  to_vector ()
+                ;
+
+            verify (expected, sequence);
+            TEST_ASSERT (2U * count_of_customers, key_calls);
+        }
+
+        {
+            // take, first and element_at_or_default only keep the values they need
+            std::vector<int> values;
+            for (auto i = 0; i < 5000; ++i)
+            {
+                values.push_back ((i * 7919) % 10007);
+            }
+
+            auto sorted =
+                    from (values)
+                >>  orderby_ascending ([] (int i) {return i % 1000;})
+                >>  thenby_descending ([] (int i) {return to_string (i / 1000);})
+                >>  to_vector ()
+                ;
+
+            auto top =
+                    from (values)
+                >>  orderby_ascending ([] (int i) {return i % 1000;})
+                >>  thenby_descending ([] (int i) {return to_string (i / 1000);})
+                >>  take (1500)
+                >>  to_vector ()
+                ;
+
+            if (TEST_ASSERT (1500U, top.size ()))
+            {
+                for (auto i = 0U; i < top.size (); ++i)
+                {
+                    if (!TEST_ASSERT (sorted[i], top[i]))
+                    {
+                        PRINT_INDEX (i);
+                        break;
+                    }
+                }
+            }
+
+            // Equal keys keep their order
+            std::vector<int> stable (values);
+            std::stable_sort (stable.begin (), stable.end (), [] (int l, int r) {return l % 1000 < r % 1000;});
+
+            auto by_key = from (values) >> orderby_ascending ([] (int i) {return i % 1000;}) >> take (3) >> to_vector ();
+            if (TEST_ASSERT (3U, by_key.size ()))
+            {
+                TEST_ASSERT (stable[0], by_key[0]);
+                TEST_ASSERT (stable[1], by_key[1]);
+                TEST_ASSERT (stable[2], by_key[2]);
+            }
+
+            auto first_value    = from (values) >> orderby_descending ([] (int i) {return i;}) >> first ();
+            auto first_default  = from (values) >> orderby_descending ([] (int i) {return i;}) >> first_or_default ();
+            auto element        = from (values) >> orderby_descending ([] (int i) {return i;}) >> element_at_or_default (2000);
+            auto past_end       = from (values) >> orderby_descending ([] (int i) {return i;}) >> element_at_or_default (5000);
+            auto none           = from (values) >> orderby_descending ([] (int i) {return i;}) >> take (0) >> count ();
+
+            std::vector<int> descending (values);
+            std::sort (descending.begin (), descending.end (), [] (int l, int r) {return r < l;});
+
+            TEST_ASSERT (descending[0], first_value);
+            TEST_ASSERT (descending[0], first_default);
+            TEST_ASSERT (descending[2000], element);
+            TEST_ASSERT (0, past_end);
+            TEST_ASSERT (0U, none);
+        }
+    }
+
+    void test_group_by ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        {
+            auto result = from (empty_customers) >> group_by ([] (customer const & c) {return c.last_name;}) >> count ();
+            TEST_ASSERT (0U, result);
+        }
+
+        {
+            // Groups are yielded in key order, values keep their source order
+            std::string last_names[]    = {"Ballmer", "Cook", "Gates", "Jobs", "Stallman", "Torvalds"};
+            std::size_t ids[]           = {11, 12, 1, 21, 2, 3, 4};
+            std::size_t sizes[]         = {1, 1, 2, 1, 1, 1};
+
+            auto q = from_array (customers)
+                >>  group_by ([] (customer const & c) {return c.last_name;}, [] (customer const & c) {return c.id;})
+                ;
+
+            auto group_index    = 0U;
+            auto id_index       = 0U;
+            while (q.next () && group_index < get_array_size (last_names))
+            {
+                auto & g = q.front ();
+                TEST_ASSERT (last_names[group_index], g.key);
+
+                auto values = g.values >> to_vector ();
+                if (TEST_ASSERT (sizes[group_index], values.size ()))
+                {
+                    for (auto id : values)
+                    {
+                        TEST_ASSERT (ids[id_index], id);
+                        ++id_index;
+                    }
+                }
+
+                ++group_index;
+            }
+
+            TEST_ASSERT (get_array_size (last_names), group_index);
+            TEST_ASSERT (count_of_customers, id_index);
+        }
+
+        {
+            // group_by may follow orderby
+            auto q = from_array (customers)
+                >>  orderby_descending ([] (customer const & c) {return c.id;})
+                >>  group_by ([] (customer const & c) {return c.last_name;})
+                ;
+
+            auto has_value = q.next ();
+            if (TEST_ASSERT (true, has_value))
+            {
+                TEST_ASSERT ("Ballmer", q.front ().key);
+                TEST_ASSERT (11U, (q.front ().values >> first_or_default ()).id);
+            }
+        }
+
+        {
+            // Only adjacent values with equal keys are grouped
+            int values[]    = {1, 1, 2, 2, 2, 1, 3};
+            int keys[]      = {1, 2, 1, 3};
+            std::size_t counts[] = {2, 3, 1, 1};
+
+            auto q = from_array (values) >> group_by_sorted ([] (int i) {return i;}, [] (int i) {return i * 10;});
+
+            auto group_index = 0U;
+            while (q.next () && group_index < get_array_size (keys))
+            {
+                auto & g = q.front ();
+                TEST_ASSERT (keys[group_index], g.key);
+                auto result = g.values >> to_vector ();
+                if (TEST_ASSERT (counts[group_index], result.size ()))
+                {
+                    TEST_ASSERT (keys[group_index] * 10, result.front ());
+                }
+                ++group_index;
+            }
+
+            TEST_ASSERT (get_array_size (keys), group_index);
+        }
+
+        {
+            // Values left in a group are skipped and stale groups are empty
+            int values[]    = {1, 1, 1, 2, 2, 3};
+
+            auto q = from_array (values) >> group_by_sorted ([] (int i) {return i;});
+
+            q.next ();
+            auto first = q.front ();
+            auto first_values = first.values;
+            auto has_value = first_values.next ();
+            TEST_ASSERT (true, has_value);
+
+            q.next ();
+            TEST_ASSERT (2, q.front ().key);
+            auto second_count = q.front ().values >> count ();
+            TEST_ASSERT (2U, second_count);
+            TEST_ASSERT (0U, first.values >> count ());
+            TEST_ASSERT (false, first_values.next ());
+
+            q.next ();
+            TEST_ASSERT (3, q.front ().key);
+            TEST_ASSERT (false, q.next ());
+        }
+
+        {
+            // Streaming large clustered input
+            auto calls = 0;
+            auto result = range (0, 1000000)
+                >>  group_by_sorted ([&calls] (int i) {++calls; return i / 1000;})
+                >>  count ()
+                ;
+            TEST_ASSERT (1000U, result);
+            TEST_ASSERT (1000000, calls);
+        }
+    }
+
+    void test_reverse ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        // reverse an empty range
+        {
+            auto result = empty<int>() >> reverse () >> to_vector ();
+            TEST_ASSERT (0U, result.size ());
+        }
+
+        // reverse an empty range
+        {
+            auto result = from (empty_vector) >> reverse () >> to_vector ();
+            TEST_ASSERT (0U, result.size ());
+        }
+
+        // reverse a non-empty range
+        {
+            int expected[] = {9,8,7,6,5,4,3,2,1,0};
+            auto expected_size = get_array_size (expected);
+
+            auto result = range (0, 10) >> reverse () >> to_vector ();
+            TEST_ASSERT (expected_size, result.size ());
+
+            for (auto i = 0U; i < expected_size && i < result.size (); ++i)
+            {
+                TEST_ASSERT (expected[i], result[i]);
+            }
+        }
+
+        // bidirectional sources are walked backwards without buffering
+        {
+            std::list<int> list_values (ints, ints + count_of_ints);
+            std::vector<int> expected (ints, ints + count_of_ints);
+            std::reverse (expected.begin (), expected.end ());
+
+            auto calls = 0;
+            auto q = from (list_values) >> select ([&calls] (int i) {++calls; return i;}) >> reverse ();
+            // Only the last value has been selected
+            auto has_value = q.next ();
+            TEST_ASSERT (true, has_value);
+            TEST_ASSERT (1, calls);
+            TEST_ASSERT (expected.front (), q.front ());
+
+            auto result = from (list_values) >> reverse () >> to_vector ();
+            TEST_ASSERT (true, (expected == result));
+
+            auto skipped = from_array (ints) >> skip (2) >> reverse () >> to_vector ();
+            expected.pop_back ();
+            expected.pop_back ();
+            TEST_ASSERT (true, (expected == skipped));
+        }
+
+        {
+            auto result = from_array (ints) >> reverse () >> reverse () >> to_vector ();
+            TEST_ASSERT (true, (std::vector<int> (ints, ints + count_of_ints) == result));
+        }
+
+        // code coverage test
+        {
+            auto q = empty<int>() >> reverse ();
+
+            TEST_ASSERT (false, q.next ());
+            TEST_ASSERT (false, q.next ());
+        }
+    }
+
+    void test_skip ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        {
+            auto q = from (empty_vector) >> skip (5);
+            std::size_t index = 0U;
+
+            while (q.next ())
+            {
+                test_int_at (index, q.front ());
+                ++index;
+            }
+            TEST_ASSERT (0U, index);
+        }
+        {
+            auto q = from_array (ints) >> skip (5);
+
+            auto index = 5U;
+
+            while (q.next ())
+            {
+                test_int_at (index, q.front ());
+                ++index;
+            }
+            TEST_ASSERT (count_of_ints, index);
+        }
+
+        // code coverage test
+        {
+            auto q = from (empty_vector) >> skip (1);
+
+            TEST_ASSERT (false, q.next ());
+            TEST_ASSERT (false, q.next ());
+        }
+
+        {
+            // Random access sources are sliced, others are skipped one by one
+            std::list<int> l (ints, ints + count_of_ints);
+            std::vector<int> v (ints, ints + count_of_ints);
+
+            static_assert (std::is_same<decltype (from (v) >> skip (2)), detail::from_range<int const *>>::value, "skip slices random access sources");
+
+            auto from_list      = from (l) >> skip (5) >> to_vector ();
+            auto from_vector    = from (v) >> skip (5) >> to_vector ();
+            TEST_ASSERT (true, (from_list == from_vector));
+            TEST_ASSERT (count_of_ints - 5U, from_vector.size ());
+            TEST_ASSERT (0U, from (v) >> skip (count_of_ints + 1U) >> count ());
+            TEST_ASSERT (0U, from (l) >> skip (count_of_ints + 1U) >> count ());
+            TEST_ASSERT (count_of_ints - 3U, from (v) >> skip (1) >> skip (2) >> count ());
+        }
+    }
+
+    void test_skip_while ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        {
+            auto q = from (empty_vector) >> skip_while (smaller_than_five);
+            std::size_t index = 0U;
+
+            while (q.next ())
+            {
+                test_int_at (index, q.front ());
+                ++index;
+            }
+            TEST_ASSERT (0U, index);
+        }
+        {
+            auto q = from_array (ints) >> skip_while (smaller_than_five);
+            std::size_t index = 4U;
+
+            while (q.next ())
+            {
+                test_int_at (index, q.front ());
+                ++index;
+            }
+            TEST_ASSERT (count_of_ints, index);
+        }
+    }
+
+    void test_take ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        {
+            auto q = from (empty_vector) >> take (5);
+            std::size_t index = 0U;
+
+            while (q.next ())
+            {
+                test_int_at (index, q.front ());
+                ++index;
+            }
+            TEST_ASSERT (0U, index);
+        }
+        {
+            auto q = from_array (ints) >> take (5);
+
+            std::size_t index = 0U;
+
+            while (q.next ())
+            {
+                test_int_at (index, q.front ());
+                ++index;
+            }
+            TEST_ASSERT (5U, index);
+        }
+        {
+            auto c = from_array (ints) >> take (5) >> count ();
+
+            TEST_ASSERT (5U, c);
+        }
+
+        {
+            // Random access sources are sliced, others are counted one by one
+            std::list<int> l (ints, ints + count_of_ints);
+            std::vector<int> v (ints, ints + count_of_ints);
+
+            static_assert (std::is_same<decltype (from (v) >> take (2)), detail::from_range<int const *>>::value, "take slices random access sources");
+
+            auto from_list      = from (l) >> take (5) >> to_vector ();
+            auto from_vector    = from (v) >> take (5) >> to_vector ();
+            TEST_ASSERT (true, (from_list == from_vector));
+            TEST_ASSERT (5U, from_vector.size ());
+            TEST_ASSERT (count_of_ints, from (v) >> take (count_of_ints + 1U) >> count ());
+            TEST_ASSERT (count_of_ints, from (l) >> take (count_of_ints + 1U) >> count ());
+            TEST_ASSERT (2U, from (v) >> skip (3) >> take (2) >> count ());
+            TEST_ASSERT (ints[4], from (v) >> skip (3) >> take (2) >> element_at_or_default (1));
+        }
+    }
+
+    void test_take_while ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        {
+            auto q = from (empty_vector) >> take_while (smaller_than_five);
+            std::size_t index = 0U;
+
+            while (q.next ())
+            {
+                test_int_at (index, q.front ());
+                ++index;
+            }
+            TEST_ASSERT (0U, index);
+        }
+
+        {
+            auto q = from_array (ints) >> take_while (smaller_than_five);
+            std::size_t index = 0U;
+
+            while (q.next ())
+            {
+                test_int_at (index, q.front ());
+                ++index;
+            }
+            TEST_ASSERT (4U, index);
+        }
+
+        // code coverage test
+        {
+            auto q = from_array (ints) >> take_while ([] (int i) {return i < 0;});
+
+            TEST_ASSERT (false, q.next ());
+            TEST_ASSERT (false, q.next ());
+        }
+    }
+
+    void test_contains ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        {
+            bool result = from (empty_vector) >> contains (1);
+            TEST_ASSERT (false, result);
+        }
+
+        {
+            bool result = from_array (ints) >> contains (1);
+            TEST_ASSERT (true, result);
+        }
+
+        {
+            bool result =
+                from (empty_customers)
+                >> contains (
+                    customer (1, "Bill", "Gates"),
+                    [](customer const& c1, customer const& c2) {return c1.id == c2.id;});
+
+            TEST_ASSERT (false, result);
+        }
+
+        {
+            bool result =
+                from_array (customers)
+                >> contains (
+                    customer (1, "Bill", "Gates"),
+                    [](customer const& c1, customer const& c2) {return c1.id == c2.id;});
+
+            TEST_ASSERT (true, result);
+        }
+
+        {
+            bool result =
+                from_array (customers)
+                >> contains (
+                    customer (42, "Bill", "Gates"),
+                    [](customer const& c1, customer const& c2) {return c1.id == c2.id;});
+
+            TEST_ASSERT (false, result);
+        }
+    }
+
+    void test_element_at_or_default ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        {
+            auto result = from (empty_vector) >> element_at_or_default (0);
+            TEST_ASSERT (0, result);
+        }
+
+        {
+            auto result = from (empty_vector) >> element_at_or_default (1);
+            TEST_ASSERT (0, result);
+        }
+
+        {
+            auto result = from_array (ints) >> element_at_or_default (0);
+            TEST_ASSERT (3, result);
+        }
+
+        {
+            auto result = from_array (ints) >> element_at_or_default (1);
+            TEST_ASSERT (1, result);
+        }
+
+        {
+            auto result = from_array (ints) >> element_at_or_default (count_of_ints-1);
+            TEST_ASSERT (5, result);
+        }
+
+        {
+            auto result = from_array (ints) >> element_at_or_default (count_of_ints);
+            TEST_ASSERT (0, result);
+        }
+
+
+        {
+            std::list<int> l (ints, ints + count_of_ints);
+            for (auto index = 0U; index <= count_of_ints; ++index)
+            {
+                auto expected = index < count_of_ints ? ints[index] : 0;
+                TEST_ASSERT (expected, from (l) >> element_at_or_default (index));
+                TEST_ASSERT (expected, from_array (ints) >> element_at_or_default (index));
+            }
+        }
+    }
+
+    void test_aggregate ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        {
+            int sum_result = from (empty_vector) >> aggregate (0, sum_aggregator);
+            TEST_ASSERT (0, sum_result);
+        }
+
+        {
+            int sum_of_simple_ints = std::accumulate (simple_ints, simple_ints + count_of_simple_ints, 0);
+            int sum_result = from_array (simple_ints) >> aggregate (0, sum_aggregator);
+            TEST_ASSERT (sum_of_simple_ints, sum_result);
+        }
+
+        {
+            int prod_of_simple_ints = std::accumulate (simple_ints, simple_ints + count_of_simple_ints, 1, mul_aggregator);
+            int sum_result = from_array (simple_ints) >> aggregate (1, mul_aggregator);
+            TEST_ASSERT (prod_of_simple_ints, sum_result);
+        }
+
+        {
+            auto sum_result = from (empty_vector) >> aggregate (0, sum_aggregator, to_string);
+            TEST_ASSERT ("0", sum_result);
+        }
+
+        {
+            auto sum_of_simple_ints = to_string (std::accumulate (simple_ints, simple_ints + count_of_simple_ints, 0));
+            auto sum_result = from_array (simple_ints) >> aggregate (0, sum_aggregator, to_string);
+            TEST_ASSERT (sum_of_simple_ints, sum_result);
+        }
+
+        {
+            auto prod_of_simple_ints = to_string (std::accumulate (simple_ints, simple_ints + count_of_simple_ints, 1, mul_aggregator));
+            auto sum_result = from_array (simple_ints) >> aggregate (1, mul_aggregator, to_string);
+            TEST_ASSERT (prod_of_simple_ints, sum_result);
+        }
+    }
+
+    void test_parallel ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        std::vector<int> values;
+        for (auto iter = 0; iter < 100000; ++iter)
+        {
+            values.push_back ((iter * 7919) % 1000 - 500);
+        }
+
+        {
+            auto sum_result = from (empty_vector) >> parallel () >> sum ();
+            TEST_ASSERT (0, sum_result);
+        }
+
+        {
+            auto count_result = from (empty_vector) >> parallel () >> where (is_even) >> count ();
+            TEST_ASSERT (0U, count_result);
+        }
+
+        {
+            auto expected   = from (values) >> where (is_even) >> sum ();
+            auto result     = from (values) >> parallel () >> where (is_even) >> sum ();
+            TEST_ASSERT (expected, result);
+        }
+
+        {
+            auto expected   = from (values) >> select (double_it) >> sum ();
+            auto result     = from (values) >> parallel (7) >> select (double_it) >> sum ();
+            TEST_ASSERT (expected, result);
+        }
+
+        {
+            auto expected   = from (values) >> sum (double_it);
+            auto result     = from (values) >> parallel () >> sum (double_it);
+            TEST_ASSERT (expected, result);
+        }
+
+        {
+            auto expected   = from (values) >> count (is_even);
+            auto result     = from (values) >> parallel () >> count (is_even);
+            TEST_ASSERT (expected, result);
+        }
+
+        {
+            auto expected   = from (values) >> where (greater_than_five) >> count ();
+            auto result     = from (values) >> parallel () >> where (greater_than_five) >> count ();
+            TEST_ASSERT (expected, result);
+        }
+
+        {
+            auto expected   = from (values) >> min ();
+            auto result     = from (values) >> parallel () >> min ();
+            TEST_ASSERT (-500, expected);
+            TEST_ASSERT (expected, result);
+        }
+
+        {
+            auto expected   = from (values) >> max (double_it);
+            auto result     = from (values) >> parallel () >> max (double_it);
+            TEST_ASSERT (998, expected);
+            TEST_ASSERT (expected, result);
+        }
+
+        {
+            auto expected   = from (values) >> where (is_even) >> avg ();
+            auto result     = from (values) >> parallel () >> where (is_even) >> avg ();
+            TEST_ASSERT (expected, result);
+        }
+
+        {
+            auto expected   = from_array (double_set) >> avg ([] (double d) { return 2*d; });
+            auto result     = from_array (double_set) >> parallel (3) >> avg ([] (double d) { return 2*d; });
+            TEST_ASSERT (expected, result);
+        }
+
+        {
+            auto expected   = range (0, 10000) >> where (is_odd) >> sum ();
+            auto result     = range (0, 10000) >> parallel () >> where (is_odd) >> sum ();
+            TEST_ASSERT (25000000, expected);
+            TEST_ASSERT (expected, result);
+        }
+
+        {
+            auto result     = range (INT_MAX - 10, 100) >> parallel (3) >> count ();
+            TEST_ASSERT (10U, result);
+        }
+
+        {
+            auto expected   = from (values) >> aggregate (0, sum_aggregator);
+            auto result     = from (values) >> parallel () >> parallel_aggregate (0, sum_aggregator, sum_aggregator);
+            TEST_ASSERT (expected, result);
+        }
+
+        {
+            auto result     = from_array (simple_ints) >> parallel_aggregate (1, mul_aggregator, mul_aggregator);
+            TEST_ASSERT (362880, result);
+        }
+
+        {
+            auto result = from (values) >> parallel () >> select (to_string) >> to_vector ();
+            TEST_ASSERT (values.size (), result.size ());
+            TEST_ASSERT (to_string (values.back ()), result.back ());
+        }
+
+        {
+            auto caught = false;
+            try
+            {
+                from (values)
+                    >>  parallel ()
+                    >>  where ([] (int i) -> bool { if (i == 499) throw sequence_empty_exception (); return true; })
+                    >>  count ()
+                    ;
+            }
+            catch (sequence_empty_exception const &)
+            {
+                caught = true;
+            }
+            TEST_ASSERT (true, caught);
+        }
+
+        {
+            thread_pool pool (3);
+#ifndef CPPLINQ_NO_THREADS
+            TEST_ASSERT (4U, pool.concurrency ());
+#endif
+
+            auto expected   = from (values) >> where (is_even) >> sum ();
+            auto result     = from (values) >> parallel (pool) >> where (is_even) >> sum ();
+            TEST_ASSERT (expected, result);
+        }
+
+        {
+            thread_pool pool (0);
+            auto result     = from (values) >> parallel (pool, 16) >> count ();
+            TEST_ASSERT (values.size (), result);
+        }
+
+        {
+            struct counting_executor
+            {
+                thread_pool &   pool        ;
+                int             submitted   ;
+
+                size_type concurrency () const
+                {
+                    return pool.concurrency ();
+                }
+
+                void submit (std::function<void ()> task)
+                {
+                    ++submitted;
+                    pool.submit (std::move (task));
+                }
+            };
+
+            thread_pool pool (2);
+            counting_executor executor = { pool, 0 };
+
+            auto expected   = from (values) >> max ();
+            auto result     = from (values) >> parallel (executor) >> max ();
+            TEST_ASSERT (expected, result);
+#ifndef CPPLINQ_NO_THREADS
+            TEST_ASSERT (2, executor.submitted);
+#endif
+        }
+
+        {
+            // Parallel queries nested in a parallel query submit to the
+            // worker's own deque and are stolen by the other workers
+            auto expected   = from (values) >> select ([&] (int i) { return (i + (range (0, 1000) >> sum ())) % 1000; }) >> sum ();
+            auto result     = from (values)
+                >>  parallel ()
+                >>  select ([&] (int i) { return (i + (range (0, 1000) >> parallel () >> sum ())) % 1000; })
+                >>  sum ()
+                ;
+            TEST_ASSERT (expected, result);
+        }
+    }
+
+    void test_batched ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        static_assert (detail::is_batched<detail::int_range>::value, "int_range is batched");
+        static_assert (!detail::is_batched<detail::from_range<std::string const *>>::value, "non-trivial values are not batched");
+
+        {
+            // Batches of large values are kept small as they live on the stack
+            struct medium_value { char bytes[1024]; };
+            struct large_value  { char bytes[4096]; };
+
+            static_assert (detail::is_batched<detail::from_range<medium_value const *>>::value, "medium values are batched");
+            static_assert (!detail::is_batched<detail::from_range<large_value const *>>::value, "large values are not batched");
+            static_assert (16U == detail::get_batch_size<medium_value>::value, "a batch of medium values stays within the budget");
+
+            std::vector<medium_value>   medium  (100U);
+            std::vector<large_value>    large   (100U);
+            for (auto i = 0U; i < 100U; ++i)
+            {
+                medium[i].bytes[0]  = static_cast<char> (i);
+                large[i].bytes[0]   = static_cast<char> (i);
+            }
+
+            auto medium_copies = from (medium) >> to_vector ();
+            auto large_copies =
+                    from (large)
+                >>  where ([] (large_value const & v) {return v.bytes[0] % 2 == 0;})
+                >>  select ([] (large_value const & v) {return v;})
+                >>  to_vector ()
+                ;
+
+            if (TEST_ASSERT (100U, medium_copies.size ()))
+            {
+                TEST_ASSERT (99, static_cast<int> (medium_copies.back ().bytes[0]));
+            }
+
+            if (TEST_ASSERT (50U, large_copies.size ()))
+            {
+                TEST_ASSERT (98, static_cast<int> (large_copies.back ().bytes[0]));
+            }
+        }
+
+        int sizes[] = {0, 1, 1023, 1024, 1025, 5000};
+
+        for (auto size : sizes)
+        {
+            std::vector<int> values;
+            for (auto i = 0; i < size; ++i)
+            {
+                values.push_back ((i * 37) % 101);
+            }
+
+            std::list<int> list_values (values.begin (), values.end ());
+
+            std::vector<int> expected;
+            for (auto i = 0; i < size; ++i)
+            {
+                if (values[i] % 3 != 0)
+                {
+                    expected.push_back (values[i] * 2);
+                }
+            }
+
+            if (expected.size () > 1000U)
+            {
+                expected.erase (expected.begin () + 1000, expected.end ());
+            }
+
+            if (expected.size () > 10U)
+            {
+                expected.erase (expected.begin (), expected.begin () + 10);
+            }
+            else
+            {
+                expected.clear ();
+            }
+
+            auto expected_sum = 0;
+            for (auto v : expected)
+            {
+                expected_sum += v;
+            }
+
+            auto query = [] (detail::from_range<int const *> r)
+            {
+                return r
+                    >>  where ([] (int i) {return i % 3 != 0;})
+                    >>  select ([] (int i) {return i * 2;})
+                    >>  take (1000)
+                    >>  skip (10)
+                    ;
+            };
+
+            auto result         = query (from (values)) >> to_vector ();
+            auto result_sum     = query (from (values)) >> sum ();
+            auto result_count   = query (from (values)) >> count ();
+            auto from_list      =
+                    from (list_values)
+                >>  where ([] (int i) {return i % 3 != 0;})
+                >>  select ([] (int i) {return i * 2;})
+                >>  take (1000)
+                >>  skip (10)
+                >>  to_vector ()
+                ;
+
+            std::vector<int> for_each_result;
+            query (from (values)) >> for_each ([&] (int i) {for_each_result.push_back (i);});
+
+            TEST_ASSERT (expected_sum, result_sum);
+            TEST_ASSERT (expected.size (), result_count);
+
+            if (TEST_ASSERT (expected.size (), result.size ()))
+            {
+                for (auto i = 0U; i < expected.size (); ++i)
+                {
+                    if (!TEST_ASSERT (expected[i], result[i]))
+                    {
+                        PRINT_INDEX (i);
+                        break;
+                    }
+                }
+            }
+
+            TEST_ASSERT (true, (expected == from_list));
+            TEST_ASSERT (true, (expected == for_each_result));
+        }
+
+        {
+            auto result = range (-5, 2000) >> select ([] (int i) {return static_cast<double> (i);}) >> to_vector ();
+            if (TEST_ASSERT (2000U, result.size ()))
+            {
+                TEST_ASSERT (-5.0, result.front ());
+                TEST_ASSERT (1994.0, result.back ());
+            }
+        }
+
+        {
+            // Values that are not trivial are pulled one at a time
+            auto result = range (0, 1500) >> select ([] (int i) {return to_string (i);}) >> where ([] (std::string const & s) {return s.size () == 3;}) >> count ();
+            TEST_ASSERT (900U, result);
+        }
+    }
+
+    void test_size_hint ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        auto invalid = detail::invalid_size;
+
+        {
+            auto q = from_array (ints);
+            TEST_ASSERT (count_of_ints, detail::get_size_hint (q));
+            q.next ();
+            TEST_ASSERT (count_of_ints - 1U, detail::get_size_hint (q));
+        }
+
+        {
+            std::list<int> list_values (ints, ints + count_of_ints);
+            TEST_ASSERT (invalid, detail::get_size_hint (from (list_values)));
+            TEST_ASSERT (invalid, detail::get_size_hint (from_array (ints) >> where ([] (int i) {return i > 2;})));
+        }
+
+        TEST_ASSERT (10U, detail::get_size_hint (range (0, 10)));
+        TEST_ASSERT (0U, detail::get_size_hint (range (0, 0)));
+        TEST_ASSERT (7U, detail::get_size_hint (repeat (1, 7)));
+        TEST_ASSERT (10U, detail::get_size_hint (range (0, 10) >> select ([] (int i) {return i * 2;})));
+        TEST_ASSERT (4U, detail::get_size_hint (range (0, 10) >> take (4)));
+        TEST_ASSERT (10U, detail::get_size_hint (range (0, 10) >> take (40)));
+        TEST_ASSERT (6U, detail::get_size_hint (range (0, 10) >> skip (4)));
+        TEST_ASSERT (0U, detail::get_size_hint (range (0, 10) >> skip (40)));
+        TEST_ASSERT (15U, detail::get_size_hint (range (0, 10) >> concat (range (0, 5))));
+        TEST_ASSERT (5U, detail::get_size_hint (range (0, 10) >> zip_with (range (0, 5))));
+        TEST_ASSERT (10U, detail::get_size_hint (range (0, 10) >> orderby_descending ([] (int i) {return i;})));
+        TEST_ASSERT (3U, detail::get_size_hint (range (0, 10) >> orderby_descending ([] (int i) {return i;}) >> take (3)));
+
+        {
+            auto q = range (0, 10) >> take (4);
+            q.next ();
+            q.next ();
+            TEST_ASSERT (2U, detail::get_size_hint (q));
+        }
+
+        {
+            auto q = range (0, 3) >> concat (range (0, 2));
+            auto remaining = 5U;
+            while (q.next ())
+            {
+                --remaining;
+                TEST_ASSERT (remaining, detail::get_size_hint (q));
+            }
+            TEST_ASSERT (0U, detail::get_size_hint (q));
+        }
+
+        {
+            auto q = range (0, 10) >> orderby ([] (int i) {return i;}) >> thenby ([] (int i) {return -i;});
+            TEST_ASSERT (10U, detail::get_size_hint (q));
+            q.next ();
+            TEST_ASSERT (9U, detail::get_size_hint (q));
+        }
+
+        {
+            auto result = range (0, 1000) >> select ([] (int i) {return to_string (i);}) >> to_vector ();
+            TEST_ASSERT (1000U, result.size ());
+            TEST_ASSERT (1000U, result.capacity ());
+        }
+
+        {
+            auto result = from_array (ints) >> skip (2) >> concat (range (0, 3)) >> to_vector ();
+            TEST_ASSERT (count_of_ints + 1U, result.size ());
+            TEST_ASSERT (count_of_ints + 1U, result.capacity ());
+        }
+
+        {
+            auto result = range (0, 100) >> orderby_descending ([] (int i) {return i % 7;}) >> to_vector ();
+            TEST_ASSERT (100U, result.size ());
+            TEST_ASSERT (100U, result.capacity ());
+        }
+
+        {
+            auto result = range (0, 100) >> reverse () >> to_vector ();
+            if (TEST_ASSERT (100U, result.size ()))
+            {
+                TEST_ASSERT (99, result.front ());
+                TEST_ASSERT (0, result.back ());
+            }
+        }
+    }
+
+    void test_random_access ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        static_assert (detail::is_random_access_range<detail::int_range>::value, "int_range is random access");
+        static_assert (!detail::is_random_access_range<detail::from_range<std::list<int>::const_iterator>>::value, "list iterators are not random access");
+
+        auto calls = 0;
+        auto counted = [&calls] (int i) {++calls; return i * 2;};
+
+        {
+            calls = 0;
+            auto result = range (0, 1000000) >> select (counted) >> count ();
+            TEST_ASSERT (1000000U, result);
+            TEST_ASSERT (0, calls);
+        }
+
+        {
+            calls = 0;
+            auto result = range (0, 1000000) >> select (counted) >> element_at_or_default (999999);
+            TEST_ASSERT (1999998, result);
+            TEST_ASSERT (1, calls);
+        }
+
+        {
+            calls = 0;
+            auto result = range (0, 1000000) >> select (counted) >> skip (500000) >> take (3) >> to_vector ();
+            if (TEST_ASSERT (3U, result.size ()))
+            {
+                TEST_ASSERT (1000000, result[0]);
+                TEST_ASSERT (1000004, result[2]);
+            }
+            TEST_ASSERT (3, calls);
+        }
+
+        {
+            TEST_ASSERT (0U, range (0, 10) >> skip (20) >> count ());
+            TEST_ASSERT (3U, repeat (5, 10) >> skip (7) >> count ());
+            TEST_ASSERT (5, repeat (5, 10) >> element_at_or_default (9));
+            TEST_ASSERT (0, repeat (5, 10) >> element_at_or_default (10));
+        }
+
+        {
+            auto q = range (0, 10) >> reverse ();
+            TEST_ASSERT (10U, q >> count ());
+            TEST_ASSERT (7, q >> element_at_or_default (2));
+            TEST_ASSERT (0, q >> element_at_or_default (10));
+
+            auto result = q >> skip (3) >> to_vector ();
+            if (TEST_ASSERT (7U, result.size ()))
+            {
+                TEST_ASSERT (6, result.front ());
+                TEST_ASSERT (0, result.back ());
+            }
+
+            TEST_ASSERT (true, q >> sequence_equal (range (0, 10) >> orderby_descending ([] (int i) {return i;})));
+            TEST_ASSERT (false, q >> sequence_equal (range (0, 9) >> reverse ()));
+        }
+
+        {
+            auto q = from_array (customers) >> orderby ([] (customer const & c) {return c.id;});
+            TEST_ASSERT (count_of_customers, q >> count ());
+            TEST_ASSERT (11U, (q >> element_at_or_default (4)).id);
+
+            auto result = q >> skip (5) >> select ([] (customer const & c) {return c.id;}) >> to_vector ();
+            if (TEST_ASSERT (2U, result.size ()))
+            {
+                TEST_ASSERT (12U, result[0]);
+                TEST_ASSERT (21U, result[1]);
+            }
+        }
+
+        {
+            auto lookup = from_array (customer_addresses) >> to_lookup ([] (customer_address const & ca){return ca.customer_id;});
+
+            TEST_ASSERT (2U, lookup[4] >> count ());
+            TEST_ASSERT (0U, lookup[999] >> count ());
+
+            auto q = lookup[4];
+            auto has_value = q.next ();
+            if (TEST_ASSERT (true, has_value))
+            {
+                TEST_ASSERT (1U, q.size ());
+                TEST_ASSERT (3U, q.at (0).id);
+                q.advance (5);
+                TEST_ASSERT (0U, q.size ());
+                TEST_ASSERT (false, q.next ());
+            }
+
+            auto result = lookup[4] >> skip (1) >> to_vector ();
+            if (TEST_ASSERT (1U, result.size ()))
+            {
+                TEST_ASSERT (3U, result.front ().id);
+            }
+        }
+    }
+
+    void test_distinct ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        {
+            auto d = from (empty_vector) >> distinct () >> to_vector ();
+            TEST_ASSERT (0U, d.size ());
+        }
+
+        {
+            int expected[] = {5,4,3,2,1};
+            auto expected_size = get_array_size (expected);
+
+            auto result = from_array (set1) >> distinct () >> to_vector ();
+            auto result_size = result.size ();
+
+            TEST_ASSERT (expected_size, result_size);
+            for (auto i = 0U; i < expected_size && i < result_size; ++i)
+            {
+                TEST_ASSERT (expected[i], result[i]);
+            }
+        }
+
+        {
+            auto d = from_array (customers_set1) >> distinct () >> to_vector ();
+            TEST_ASSERT (4U, d.size ());
+        }
+
+        {
+            auto d = from (empty_vector) >> hash_distinct () >> to_vector ();
+            TEST_ASSERT (0U, d.size ());
+        }
+
+        {
+            int expected[] = {5,4,3,2,1};
+            auto expected_size = get_array_size (expected);
+
+            auto result = from_array (set1) >> hash_distinct () >> to_vector ();
+            auto result_size = result.size ();
+
+            TEST_ASSERT (expected_size, result_size);
+            for (auto i = 0U; i < expected_size && i < result_size; ++i)
+            {
+                TEST_ASSERT (expected[i], result[i]);
+            }
+        }
+
+        {
+            auto d = from_array (customers_set1)
+                >>  hash_distinct ([] (customer const & c) { return c.id; })
+                >>  to_vector ()
+                ;
+            TEST_ASSERT (4U, d.size ());
+            TEST_ASSERT (customers_set1[3], d[3]);
+        }
+
+        {
+            auto d = from_array (customers_set1)
+                >>  select ([] (customer const & c) { return c.last_name; })
+                >>  hash_distinct (
+                            [] (std::string const & s) { return s.size (); }
+                        ,   [] (std::string const & l, std::string const & r) { return l.size () == r.size (); }
+                        )
+                >>  to_vector ()
+                ;
+            TEST_ASSERT (3U, d.size ());
+            TEST_ASSERT (std::string ("Gates"), d[0]);
+            TEST_ASSERT (std::string ("Stallman"), d[2]);
+        }
+
+        {
+            // Enough values to force the hash set to rehash several times
+            auto expected   = range (0, 100000) >> select ([] (int i) { return (i * 7919) % 10007; }) >> distinct () >> count ();
+            auto result     = range (0, 100000) >> select ([] (int i) { return (i * 7919) % 10007; }) >> hash_distinct () >> to_vector ();
+            TEST_ASSERT (expected, result.size ());
+            TEST_ASSERT (0, result[0]);
+            TEST_ASSERT (7919, result[1]);
+        }
+    }
+
+    void test_union_with ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        // union of two empty ranges
+        {
+            auto result = from (empty_vector) >> union_with (from (empty_vector) ) >> to_vector ();
+            TEST_ASSERT (0U, result.size ());
+        }
+
+        // union of an empty range with a non-empty range
+        {
+            auto result = empty<int>() >> union_with (range (0, 10) ) >> to_vector ();
+            TEST_ASSERT (10U, result.size ());
+            for (auto i = 0U; i < 10 && i < result.size (); ++i)
+            {
+                TEST_ASSERT (static_cast<int> (i), result[i]);
+            }
+        }
+
+        // union of an empty range with a non-empty range
+        {
+            int expected[] = {5,4,3,2,1};
+            auto expected_size = get_array_size (expected);
+            auto result = from (empty_vector) >> union_with ( from_array (set1) ) >> to_vector ();
+            TEST_ASSERT (expected_size, result.size ());
+
+            for (auto i = 0U; i < result.size () && i < expected_size; ++i)
+            {
+                TEST_ASSERT (expected[i], result[i]);
+            }
+        }
+
+        // union of a non-empty range with an empty range
+        {
+            auto result = range (0, 10) >> union_with (empty<int>() ) >> to_vector ();
+            TEST_ASSERT (10U, result.size ());
+            for (auto i = 0U; i < 10 && i < result.size (); ++i)
+            {
+                TEST_ASSERT (static_cast<int> (i), result[i]);
+            }
+        }
+
+        // union of a non-empty range with an empty range
+        {
+            int expected[] = {5,4,3,2,1};
+            auto expected_size = get_array_size (expected);
+            auto result = from_array (set1) >> union_with (from (empty_vector)) >> to_vector ();
+            TEST_ASSERT (expected_size, result.size ());
+            for (auto i = 0U; i < expected_size && i < result.size (); ++i)
+            {
+                TEST_ASSERT (expected[i], result[i]);
+            }
+        }
+
+        // union of two non-empty ranges
+        {
+            int expected[] = {5,4,3,2,1,9,8,6,7};
+            auto expected_size = get_array_size (expected);
+
+            auto result = from_array (set1) >> union_with (from_array (set2)) >> to_vector ();
+            auto result_size = result.size ();
+
+            TEST_ASSERT (expected_size, result_size);
+            for (auto i = 0U; i < expected_size && i < result_size; ++i)
+            {
+                TEST_ASSERT (expected[i], result[i]);
+            }
+        }
+
+        // union of range with duplicates with itself
+        {
+            auto result = from_array (ints) >> union_with (from_array (ints)) >> to_vector ();
+            auto result_size = result.size ();
+
+            TEST_ASSERT (9U, result_size);
+        }
+
+        // hashed union of two non-empty ranges
+        {
+            int expected[] = {5,4,3,2,1,9,8,6,7};
+            auto expected_size = get_array_size (expected);
+
+            auto result = from_array (set1) >> hash_union_with (from_array (set2)) >> to_vector ();
+            auto result_size = result.size ();
+
+            TEST_ASSERT (expected_size, result_size);
+            for (auto i = 0U; i < expected_size && i < result_size; ++i)
+            {
+                TEST_ASSERT (expected[i], result[i]);
+            }
+        }
+
+        // hashed union of an empty range with a non-empty range
+        {
+            auto result = empty<int>() >> hash_union_with (range (0, 10) ) >> to_vector ();
+            TEST_ASSERT (10U, result.size ());
+        }
+    }
+
+    void test_intersect_with ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        // intersection of two empty ranges
+        {
+            auto result = from (empty_vector) >> intersect_with (from (empty_vector) ) >> to_vector ();
+            TEST_ASSERT (0U, result.size ());
+        }
+
+        // intersection of an empty range with a non-empty range
+        {
+            auto result = empty<int>() >> intersect_with (range (0, 10) ) >> to_vector ();
+            TEST_ASSERT (0U, result.size ());
+        }
+
+        // intersection of an empty range with a non-empty range
+        {
+            auto result = from (empty_vector) >> intersect_with (from_array (set1)) >> to_vector ();
+            TEST_ASSERT (0U, result.size ());
+        }
+
+        // intersection of a non-empty range with an empty range
+        {
+            auto result = range (0, 10) >> intersect_with (empty<int>() ) >> to_vector ();
+            TEST_ASSERT (0U, result.size ());
+        }
+
+        // intersection of a non-empty range with an empty range
+        {
+            auto result = from_array (set1) >> intersect_with (from (empty_vector)) >> to_vector ();
+            TEST_ASSERT (0U, result.size ());
+        }
+
+        // intersection of two non-empty ranges
+        {
+            int expected[] = {5,4,1};
+            auto expected_size = get_array_size (expected);
+
+            auto result = from_array (set1) >> intersect_with (from_array (set2)) >> to_vector ();
+            auto result_size = result.size ();
+
+            TEST_ASSERT (expected_size, result_size);
+            for (auto i = 0U; i < expected_size && i < result_size; ++i)
+            {
+                TEST_ASSERT (expected[i], result[i]);
+            }
+        }
+
+        // intersection of two non-empty ranges
+        {
+            int expected[] = {4,5,1};
+            auto expected_size = get_array_size (expected);
+
+            auto result = from_array (set2) >> intersect_with (from_array (set1)) >> to_vector ();
+            auto result_size = result.size ();
+
+            TEST_ASSERT (expected_size, result_size);
+            for (auto i = 0U; i < expected_size && i < result_size; ++i)
+            {
+                TEST_ASSERT (expected[i], result[i]);
+            }
+        }
+
+        // intersection of non-empty range with duplicates with itself
+        {
+            int numbers [] = {3,1,4,1,5,9,2,6,5,4};
+            int expected [] = {3,1,4,5,9,2,6};
+            auto expected_size = get_array_size (expected);
+
+            auto result = from_array (numbers) >> intersect_with (from_array (numbers)) >> to_vector ();
+            auto result_size = result.size ();
+
+            TEST_ASSERT (expected_size, result_size);
+            for (auto i = 0U; i < expected_size && i < result_size; ++i)
+            {
+               TEST_ASSERT (expected[i], result[i]);
+            }
+        }
+
+        // hashed intersection of non-empty range with duplicates with itself
+        {
+            int numbers [] = {3,1,4,1,5,9,2,6,5,4};
+            int expected [] = {3,1,4,5,9,2,6};
+            auto expected_size = get_array_size (expected);
+
+            auto result = from_array (numbers) >> hash_intersect_with (from_array (numbers)) >> to_vector ();
+            auto result_size = result.size ();
+
+            TEST_ASSERT (expected_size, result_size);
+            for (auto i = 0U; i < expected_size && i < result_size; ++i)
+            {
+               TEST_ASSERT (expected[i], result[i]);
+            }
+        }
+
+        // hashed intersection with an empty range
+        {
+            auto result = from_array (ints) >> hash_intersect_with (from (empty_vector)) >> to_vector ();
+            TEST_ASSERT (0U, result.size ());
+        }
+
+        // code coverage test
+        {
+            auto q = from (empty_vector) >> intersect_with (from (empty_vector) );
+
+            TEST_ASSERT (false, q.next ());
+            TEST_ASSERT (false, q.next ());
+        }
+    }
+
+    void test_except ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        // difference of two empty ranges
+        {
+            auto result = from (empty_vector) >> except (from (empty_vector)) >> to_vector ();
+            TEST_ASSERT (0U, result.size ());
+        }
+
+        // difference of an empty range with a non-empty range
+        {
+            auto result = empty<int>() >> except (range (0, 10)) >> to_vector ();
+            TEST_ASSERT (0U, result.size ());
+        }
+
+        // difference of an empty range with a non-empty range
+        {
+            auto result = from (empty_vector) >> except (from_array (set1)) >> to_vector ();
+            TEST_ASSERT (0U, result.size ());
+        }
+
+        // difference of a non-empty range with an empty range
+        {
+            auto result = range (0, 10) >> except (empty<int>()) >> to_vector ();
+            TEST_ASSERT (10U, result.size ());
+            for (auto i = 0U; i < 10 && i < result.size (); ++i)
+            {
+                TEST_ASSERT (static_cast<int> (i), result[i]);
+            }
+        }
+
+        // difference of a non-empty range with an empty range
+        {
+            int expected[] = {5,4,3,2,1};
+            auto expected_size = get_array_size (expected);
+
+            auto result = from_array (set1) >> except (from (empty_vector)) >> to_vector ();
+            TEST_ASSERT (expected_size, result.size ());
+            for (auto i = 0U; i < expected_size && i < result.size (); ++i)
+            {
+                TEST_ASSERT (expected[i], result[i]);
+            }
+        }
+
+        // difference of two non-empty ranges
+        {
+            int expected[] = {3,2};
+            auto expected_size = get_array_size (expected);
+
+            auto result = from_array (set1) >> except (from_array (set2)) >> to_vector ();
+            auto result_size = result.size ();
+
+            TEST_ASSERT (expected_size, result_size);
+            for (auto i = 0U; i < expected_size && i < result_size; ++i)
             {
-                test_int_at (index, q.front ());
-                ++index;
+                TEST_ASSERT (expected[i], result[i]);
             }
-            TEST_ASSERT (0U, index);
         }
+
+        // difference of two non-empty ranges
         {
-            auto q = from_array (ints) >> skip (5);
+            int expected[] = {9,8,6,7};
+            auto expected_size = get_array_size (expected);
 
-            auto index = 5U;
+            auto result = from_array (set2) >> except (from_array (set1)) >> to_vector ();
+            auto result_size = result.size ();
 
-            while (q.next ())
+            TEST_ASSERT (expected_size, result_size);
+            for (auto i = 0U; i < expected_size && i < result_size; ++i)
             {
-                test_int_at (index, q.front ());
-                ++index;
+                TEST_ASSERT (expected[i], result[i]);
             }
-            TEST_ASSERT (count_of_ints, index);
         }
 
-        // code coverage test
+        // difference of non-empty range with duplicates with itself
         {
-            auto q = from (empty_vector) >> skip (1);
+           int numbers [] = {3,1,4,1,5,9,2,6,5,4};
 
-            TEST_ASSERT (false, q.next ());
-            TEST_ASSERT (false, q.next ());
+           auto result = from_array (numbers) >> except (from_array (numbers)) >> to_vector ();
+           auto result_size = result.size ();
+
+           TEST_ASSERT (0U, result_size);
         }
-    }
 
-    void test_skip_while ()
-    {
-        using namespace cpplinq;
+        // difference of non-empty range with duplicates with empty set
+        {
+           auto result = from_array (ints) >> except (from (empty_vector)) >> to_vector ();
+           auto result_size = result.size ();
 
-        TEST_PRELUDE ();
+           TEST_ASSERT (9U, result_size);
+        }
 
+        // hashed difference of non-empty range with duplicates with itself
         {
-            auto q = from (empty_vector) >> skip_while (smaller_than_five);
-            std::size_t index = 0U;
+           int numbers [] = {3,1,4,1,5,9,2,6,5,4};
 
-            while (q.next ())
-            {
-                test_int_at (index, q.front ());
-                ++index;
-            }
-            TEST_ASSERT (0U, index);
+           auto result = from_array (numbers) >> hash_except (from_array (numbers)) >> to_vector ();
+           auto result_size = result.size ();
+
+           TEST_ASSERT (0U, result_size);
         }
+
+        // hashed difference of non-empty ranges
         {
-            auto q = from_array (ints) >> skip_while (smaller_than_five);
-            std::size_t index = 4U;
+           int numbers [] = {3,1,4,1,5,9,2,6,5,4};
+           int expected [] = {4,2,6};
+           auto expected_size = get_array_size (expected);
 
-            while (q.next ())
-            {
-                test_int_at (index, q.front ());
-                ++index;
-            }
-            TEST_ASSERT (count_of_ints, index);
+           auto result = from_array (numbers) >> hash_except (from_array (simple_ints) >> where (is_odd)) >> to_vector ();
+           auto result_size = result.size ();
+
+           TEST_ASSERT (expected_size, result_size);
+           for (auto i = 0U; i < expected_size && i < result_size; ++i)
+           {
+              TEST_ASSERT (expected[i], result[i]);
+           }
         }
     }
 
-    void test_take ()
+    void test_concat ()
     {
         using namespace cpplinq;
 
         TEST_PRELUDE ();
 
+        // concat two empty ranges
         {
-            auto q = from (empty_vector) >> take (5);
-            std::size_t index = 0U;
+            auto result = empty<int>() >> concat (empty<int>()) >> to_vector ();
+            TEST_ASSERT (0U, result.size ());
+        }
 
-            while (q.next ())
+        // concat two empty ranges
+        {
+            auto result = from (empty_vector) >> concat (empty<int>()) >> to_vector ();
+            TEST_ASSERT (0U, result.size ());
+        }
+
+        // concat an empty range with a non empty range
+        {
+            auto expected = range (0,10);
+            auto expected_result = expected >> to_vector ();
+            auto result = empty<int>() >> concat (expected) >> to_vector ();
+            TEST_ASSERT (expected_result.size (), result.size ());
+            for (auto i = 0U; i < expected_result.size () && i < result.size ();++i)
             {
-                test_int_at (index, q.front ());
-                ++index;
+                TEST_ASSERT (expected_result[i], result[i]);
             }
-            TEST_ASSERT (0U, index);
         }
-        {
-            auto q = from_array (ints) >> take (5);
-
-            std::size_t index = 0U;
 
-            while (q.next ())
+        // concat an empty range with a non empty range
+        {
+            auto result = empty<int>() >> concat (from_array (ints)) >> to_vector ();
+            TEST_ASSERT (count_of_ints, result.size ());
+            for (auto i = 0U; i < count_of_ints && i < result.size ();++i)
             {
-                test_int_at (index, q.front ());
-                ++index;
+                TEST_ASSERT (ints[i], result[i]);
             }
-            TEST_ASSERT (5U, index);
         }
-        {
-            auto c = from_array (ints) >> take (5) >> count ();
 
-            TEST_ASSERT (5U, c);
+        // concat a non empty range with an empty range
+        {
+            auto expected = range (0,10);
+            auto expected_result = expected >> to_vector ();
+            auto result = expected >> concat (empty<int>()) >> to_vector ();
+            TEST_ASSERT (expected_result.size (), result.size ());
+            for (auto i = 0U; i < expected_result.size () && i < result.size ();++i)
+            {
+                TEST_ASSERT (expected_result[i], result[i]);
+            }
         }
-    }
-
-    void test_take_while ()
-    {
-        using namespace cpplinq;
-
-        TEST_PRELUDE ();
 
+        // concat a non empty range with an empty range
         {
-            auto q = from (empty_vector) >> take_while (smaller_than_five);
-            std::size_t index = 0U;
-
-            while (q.next ())
+            auto result = from_array (ints) >> concat (empty<int>()) >> to_vector ();
+            TEST_ASSERT (count_of_ints, result.size ());
+            for (auto i = 0U; i < count_of_ints && i < result.size ();++i)
             {
-                test_int_at (index, q.front ());
-                ++index;
+                TEST_ASSERT (ints[i], result[i]);
             }
-            TEST_ASSERT (0U, index);
         }
 
+        // concat two non-empty ranges
         {
-            auto q = from_array (ints) >> take_while (smaller_than_five);
-            std::size_t index = 0U;
-
-            while (q.next ())
+            int set1[] = {0,1,2,3,4,5};
+            int set2[] = {6,7,8,9};
+            auto result = from_array (set1) >> concat (from_array (set2)) >> to_vector ();
+            TEST_ASSERT (10U, result.size ());
+            for (auto i = 0U; i < 10 && i < result.size (); ++i)
             {
-                test_int_at (index, q.front ());
-                ++index;
+                TEST_ASSERT (static_cast<int> (i), result[i]);
             }
-            TEST_ASSERT (4U, index);
         }
 
         // code coverage test
         {
-            auto q = from_array (ints) >> take_while ([] (int i) {return i < 0;});
+            auto q = empty<int>() >> concat (empty<int>());
 
             TEST_ASSERT (false, q.next ());
             TEST_ASSERT (false, q.next ());
         }
     }
 
-    void test_contains ()
+    void test_sequence_equal ()
     {
         using namespace cpplinq;
 
         TEST_PRELUDE ();
 
+        // test two empty sequences
         {
-            bool result = from (empty_vector) >> contains (1);
-            TEST_ASSERT (false, result);
+            auto result = empty<int>() >> sequence_equal (empty<int>());
+            TEST_ASSERT (true, result);
         }
 
+        // test two empty sequences
         {
-            bool result = from_array (ints) >> contains (1);
+            auto result = from (empty_vector) >> sequence_equal (empty<int>());
             TEST_ASSERT (true, result);
         }
 
+        // test empty sequence with non-empty sequence
         {
-            bool result =
-                from (empty_customers)
-                >> contains (
-                    customer (1, "Bill", "Gates"),
-                    [](customer const& c1, customer const& c2) {return c1.id == c2.id;});
-
+            auto result = empty<int>() >> sequence_equal (range (0,10));
             TEST_ASSERT (false, result);
         }
 
+        // test empty sequence with non-empty sequence
         {
-            bool result =
-                from_array (customers)
-                >> contains (
-                    customer (1, "Bill", "Gates"),
-                    [](customer const& c1, customer const& c2) {return c1.id == c2.id;});
-
-            TEST_ASSERT (true, result);
+            auto result = from (empty_vector) >> sequence_equal (from_array (ints));
+            TEST_ASSERT (false, result);
         }
 
+        // test non-empty sequence with empty sequence
         {
-            bool result =
-                from_array (customers)
-                >> contains (
-                    customer (42, "Bill", "Gates"),
-                    [](customer const& c1, customer const& c2) {return c1.id == c2.id;});
-
+            auto result = range (0, 10) >> sequence_equal (empty<int>());
             TEST_ASSERT (false, result);
         }
-    }
-
-    void test_element_at_or_default ()
-    {
-        using namespace cpplinq;
-
-        TEST_PRELUDE ();
 
+        // test non-empty sequence with empty sequence
         {
-            auto result = from (empty_vector) >> element_at_or_default (0);
-            TEST_ASSERT (0, result);
+            auto result = from_array (ints) >> sequence_equal (from (empty_vector));
+            TEST_ASSERT (false, result);
         }
 
+        // test non-empty inequal sequences
         {
-            auto result = from (empty_vector) >> element_at_or_default (1);
-            TEST_ASSERT (0, result);
+            auto result = range (0,5) >> sequence_equal (range (0,4));
+            TEST_ASSERT (false, result);
         }
 
+        // test non-empty inequal sequences
         {
-            auto result = from_array (ints) >> element_at_or_default (0);
-            TEST_ASSERT (3, result);
+            auto result = from_array (set1) >> sequence_equal (from_array (set2));
+            TEST_ASSERT (false, result);
         }
 
+        // test non-empty equal sequences
         {
-            auto result = from_array (ints) >> element_at_or_default (1);
-            TEST_ASSERT (1, result);
+            auto result = from_array (ints) >> sequence_equal (from_array (ints));
+            TEST_ASSERT (true, result);
         }
 
+        // test non-empty equal sequences
         {
-            auto result = from_array (ints) >> element_at_or_default (count_of_ints-1);
-            TEST_ASSERT (5, result);
+            auto result = range (0,10) >> sequence_equal (range (0,10));
+            TEST_ASSERT (true, result);
         }
 
+        // test against self
         {
-            auto result = from_array (ints) >> element_at_or_default (count_of_ints);
-            TEST_ASSERT (0, result);
+            auto seq = from_array (ints);
+            auto result = seq >> sequence_equal (seq);
+            TEST_ASSERT (true, result);
         }
 
-    }
+        auto comparer = [](customer const& c1, customer const& c2)
+        {return c1.first_name == c2.first_name && c1.last_name == c2.last_name;};
 
-    void test_aggregate ()
-    {
-        using namespace cpplinq;
+        customer customers1[] = {
+            customer (1 , "Bill"    , "Gates"   ),
+            customer (2 , "Steve"   , "Jobs"    ),
+            customer (3 , "Richard" , "Stallman"),
+        };
 
-        TEST_PRELUDE ();
+        customer customers2[] = {
+            customer (11 , "Bill"    , "Gates"   ),
+            customer (12 , "Steve"   , "Jobs"    ),
+            customer (13 , "Richard" , "Stallman"),
+        };
+
+        customer customers3[] = {
+            customer (1 , "Bill"    , "Gates"   ),
+            customer (2 , "Steve"   , "Jobs"    ),
+            customer (3 , "Steve"   , "Ballmer" ),
+        };
+
+        // test empty with comparer
+        {
+            auto result = empty<customer>() >> sequence_equal (empty<customer>(), comparer);
+            TEST_ASSERT (true, result);
+        }
 
+        // test empty with non-empty with comparer
         {
-            int sum_result = from (empty_vector) >> aggregate (0, sum_aggregator);
-            TEST_ASSERT (0, sum_result);
+            auto result = from (empty_customers) >> sequence_equal (from_array (customers), comparer);
+            TEST_ASSERT (false, result);
         }
 
+        // test non-empty with empty with comparer
         {
-            int sum_of_simple_ints = std::accumulate (simple_ints, simple_ints + count_of_simple_ints, 0);
-            int sum_result = from_array (simple_ints) >> aggregate (0, sum_aggregator);
-            TEST_ASSERT (sum_of_simple_ints, sum_result);
+            auto result = from_array (customers) >> sequence_equal (from (empty_customers), comparer);
+            TEST_ASSERT (false, result);
         }
 
+        // test two equal non-empty sequences with comparer
         {
-            int prod_of_simple_ints = std::accumulate (simple_ints, simple_ints + count_of_simple_ints, 1, mul_aggregator);
-            int sum_result = from_array (simple_ints) >> aggregate (1, mul_aggregator);
-            TEST_ASSERT (prod_of_simple_ints, sum_result);
+            auto result = from_array (customers1) >> sequence_equal (from_array (customers2), comparer);
+            TEST_ASSERT (true, result);
         }
 
+        // test two inequal non-empty sequences with comparer
         {
-            auto sum_result = from (empty_vector) >> aggregate (0, sum_aggregator, to_string);
-            TEST_ASSERT ("0", sum_result);
+            auto result = from_array (customers1) >> sequence_equal (from_array (customers3), comparer);
+            TEST_ASSERT (false, result);
         }
 
+        // test against self with comparer
         {
-            auto sum_of_simple_ints = to_string (std::accumulate (simple_ints, simple_ints + count_of_simple_ints, 0));
-            auto sum_result = from_array (simple_ints) >> aggregate (0, sum_aggregator, to_string);
-            TEST_ASSERT (sum_of_simple_ints, sum_result);
+            auto seq = from_array (customers1);
+            auto result = seq >> sequence_equal (seq, comparer);
+            TEST_ASSERT (true, result);
         }
 
+        // random access sequences are compared without pulling values
         {
-            auto prod_of_simple_ints = to_string (std::accumulate (simple_ints, simple_ints + count_of_simple_ints, 1, mul_aggregator));
-            auto sum_result = from_array (simple_ints) >> aggregate (1, mul_aggregator, to_string);
-            TEST_ASSERT (prod_of_simple_ints, sum_result);
+            std::vector<int> v (ints, ints + count_of_ints);
+            std::vector<int> shorter (ints, ints + count_of_ints - 1U);
+            std::vector<int> changed (v);
+            changed.back () += 1;
+
+            TEST_ASSERT (true, from (v) >> sequence_equal (from_array (ints)));
+            TEST_ASSERT (false, from (v) >> sequence_equal (from (shorter)));
+            TEST_ASSERT (false, from (shorter) >> sequence_equal (from (v)));
+            TEST_ASSERT (false, from (v) >> sequence_equal (from (changed)));
+            TEST_ASSERT (true, from (v) >> skip (1) >> sequence_equal (from_array (ints) >> skip (1)));
         }
     }
 
-    void test_distinct ()
+    void test_pairwise ()
     {
         using namespace cpplinq;
 
         TEST_PRELUDE ();
 
         {
-            auto d = from (empty_vector) >> distinct () >> to_vector ();
-            TEST_ASSERT (0U, d.size ());
+            auto pairwise_result =
+                    from (empty_vector)
+                >>  pairwise ()
+                >>  to_vector ()
+                ;
+            TEST_ASSERT (0U, pairwise_result.size ());
         }
 
         {
-            int expected[] = {5,4,3,2,1};
-            auto expected_size = get_array_size (expected);
-
-            auto result = from_array (set1) >> distinct () >> to_vector ();
-            auto result_size = result.size ();
-
-            TEST_ASSERT (expected_size, result_size);
-            for (auto i = 0U; i < expected_size && i < result_size; ++i)
-            {
-                TEST_ASSERT (expected[i], result[i]);
-            }
+            int single_element_vector[] = {1};
+            auto pairwise_result =
+                    from_array (single_element_vector)
+                >>  pairwise ()
+                >>  to_vector ()
+                ;
+            TEST_ASSERT (0U, pairwise_result.size ());
         }
 
         {
-            auto d = from_array (customers_set1) >> distinct () >> to_vector ();
-            TEST_ASSERT (4U, d.size ());
+            auto pairwise_result =
+                    from_array (simple_ints)
+                >>  pairwise ()
+                >>  to_vector ()
+                ;
+            TEST_ASSERT (count_of_simple_ints-1, pairwise_result.size ());
+            for (std::size_t i=0; i < pairwise_result.size (); ++i)
+            {
+                TEST_ASSERT (simple_ints[i], pairwise_result[i].first);
+                TEST_ASSERT (simple_ints[i+1], pairwise_result[i].second);
+            }
         }
-
     }
 
-    void test_union_with ()
+    void test_zip_with ()
     {
         using namespace cpplinq;
-
         TEST_PRELUDE ();
 
-        // union of two empty ranges
         {
-            auto result = from (empty_vector) >> union_with (from (empty_vector) ) >> to_vector ();
-            TEST_ASSERT (0U, result.size ());
+            auto zip_width_result =
+                    from (empty_vector)
+                >>  zip_with (from (empty_vector))
+                >>  to_vector ()
+                ;
+            TEST_ASSERT (0U, zip_width_result.size ());
         }
 
-        // union of an empty range with a non-empty range
         {
-            auto result = empty<int>() >> union_with (range (0, 10) ) >> to_vector ();
-            TEST_ASSERT (10U, result.size ());
-            for (auto i = 0U; i < 10 && i < result.size (); ++i)
-            {
-                TEST_ASSERT (static_cast<int> (i), result[i]);
-            }
+            auto zip_width_result =
+                    from (empty_vector)
+                >>  zip_with (from_array (simple_ints))
+                >>  to_vector ()
+                ;
+            TEST_ASSERT (0U, zip_width_result.size ());
         }
 
-        // union of an empty range with a non-empty range
         {
-            int expected[] = {5,4,3,2,1};
-            auto expected_size = get_array_size (expected);
-            auto result = from (empty_vector) >> union_with ( from_array (set1) ) >> to_vector ();
-            TEST_ASSERT (expected_size, result.size ());
-
-            for (auto i = 0U; i < result.size () && i < expected_size; ++i)
-            {
-                TEST_ASSERT (expected[i], result[i]);
-            }
+            auto zip_width_result =
+                    from_array (simple_ints)
+                >>  zip_with (from (empty_vector))
+                >>  to_vector ()
+                ;
+            TEST_ASSERT (0U, zip_width_result.size ());
         }
 
-        // union of a non-empty range with an empty range
         {
-            auto result = range (0, 10) >> union_with (empty<int>() ) >> to_vector ();
-            TEST_ASSERT (10U, result.size ());
-            for (auto i = 0U; i < 10 && i < result.size (); ++i)
+            auto zip_width_result =
+                    from_array (simple_ints)
+                >>  zip_with (from_array (simple_ints))
+                >>  to_vector ()
+                ;
+            TEST_ASSERT (count_of_simple_ints, zip_width_result.size ());
+            for (std::size_t i=0; i<zip_width_result.size (); ++i)
             {
-                TEST_ASSERT (static_cast<int> (i), result[i]);
+                TEST_ASSERT (simple_ints[i], zip_width_result[i].first);
+                TEST_ASSERT (simple_ints[i], zip_width_result[i].second);
             }
         }
 
-        // union of a non-empty range with an empty range
         {
-            int expected[] = {5,4,3,2,1};
-            auto expected_size = get_array_size (expected);
-            auto result = from_array (set1) >> union_with (from (empty_vector)) >> to_vector ();
-            TEST_ASSERT (expected_size, result.size ());
-            for (auto i = 0U; i < expected_size && i < result.size (); ++i)
+            auto expected_size = std::min(count_of_ints, count_of_simple_ints);
+            auto zip_width_result =
+                    from_array (ints)
+                >>  zip_with (from_array (simple_ints))
+                >>  to_vector ()
+                ;
+            TEST_ASSERT (expected_size, zip_width_result.size ());
+            for (std::size_t i=0; i<zip_width_result.size (); ++i)
             {
-                TEST_ASSERT (expected[i], result[i]);
+                TEST_ASSERT (       ints[i], zip_width_result[i].first);
+                TEST_ASSERT (simple_ints[i], zip_width_result[i].second);
             }
         }
 
-        // union of two non-empty ranges
         {
-            int expected[] = {5,4,3,2,1,9,8,6,7};
-            auto expected_size = get_array_size (expected);
-
-            auto result = from_array (set1) >> union_with (from_array (set2)) >> to_vector ();
-            auto result_size = result.size ();
-
-            TEST_ASSERT (expected_size, result_size);
-            for (auto i = 0U; i < expected_size && i < result_size; ++i)
+            auto expected_size = std::min(count_of_ints, count_of_simple_ints);
+            auto zip_width_result =
+                    from_array (simple_ints)
+                >>  zip_with (from_array (ints))
+                >>  to_vector ()
+                ;
+            TEST_ASSERT (expected_size, zip_width_result.size ());
+            for (std::size_t i=0; i<zip_width_result.size (); ++i)
             {
-                TEST_ASSERT (expected[i], result[i]);
+                TEST_ASSERT (simple_ints[i], zip_width_result[i].first);
+                TEST_ASSERT (       ints[i], zip_width_result[i].second);
             }
         }
 
-        // union of range with duplicates with itself
         {
-            auto result = from_array (ints) >> union_with (from_array (ints)) >> to_vector ();
-            auto result_size = result.size ();
+            std::string pairrange[] = {"one", "two", "three"};
+            auto zip_width_result =
+                    from_array(pairrange)
+                >>  zip_with(from_array(simple_ints))
+                >>  to_vector();
 
-            TEST_ASSERT (9U, result_size);
+            auto expected_size = get_array_size(pairrange);
+            TEST_ASSERT(expected_size, zip_width_result.size());
+            for (std::size_t i=0; i<zip_width_result.size (); ++i)
+            {
+                TEST_ASSERT (  pairrange[i], zip_width_result[i].first);
+                TEST_ASSERT (simple_ints[i], zip_width_result[i].second);
+            }
         }
     }
 
-    void test_intersect_with ()
+    void test_move_only ()
     {
         using namespace cpplinq;
 
         TEST_PRELUDE ();
 
-        // intersection of two empty ranges
-        {
-            auto result = from (empty_vector) >> intersect_with (from (empty_vector) ) >> to_vector ();
-            TEST_ASSERT (0U, result.size ());
-        }
+        auto make       = [] (int i) {return std::unique_ptr<int> (new int (i));};
+        auto deref      = [] (std::unique_ptr<int> const & p) {return *p;};
+        auto is_even    = [] (std::unique_ptr<int> const & p) {return *p % 2 == 0;};
 
-        // intersection of an empty range with a non-empty range
         {
-            auto result = empty<int>() >> intersect_with (range (0, 10) ) >> to_vector ();
-            TEST_ASSERT (0U, result.size ());
+            auto result = range (0, 10) >> select (make) >> where (is_even) >> to_vector ();
+            if (TEST_ASSERT (5U, result.size ()))
+            {
+                TEST_ASSERT (8, *result[4]);
+            }
         }
 
-        // intersection of an empty range with a non-empty range
         {
-            auto result = from (empty_vector) >> intersect_with (from_array (set1)) >> to_vector ();
-            TEST_ASSERT (0U, result.size ());
+            auto result = range (0, 10) >> select (make) >> orderby_descending (is_even) >> thenby_descending (deref) >> to_vector ();
+            if (TEST_ASSERT (10U, result.size ()))
+            {
+                TEST_ASSERT (8, *result[0]);
+                TEST_ASSERT (1, *result[9]);
+            }
         }
 
-        // intersection of a non-empty range with an empty range
         {
-            auto result = range (0, 10) >> intersect_with (empty<int>() ) >> to_vector ();
-            TEST_ASSERT (0U, result.size ());
+            auto result = range (0, 10) >> select (make) >> reverse () >> take (3) >> to_list ();
+            if (TEST_ASSERT (3U, result.size ()))
+            {
+                TEST_ASSERT (9, *result.front ());
+            }
         }
 
-        // intersection of a non-empty range with an empty range
         {
-            auto result = from_array (set1) >> intersect_with (from (empty_vector)) >> to_vector ();
-            TEST_ASSERT (0U, result.size ());
+            auto last = range (0, 10) >> select (make) >> last_or_default ();
+            if (TEST_ASSERT (true, (last != nullptr)))
+            {
+                TEST_ASSERT (9, *last);
+            }
         }
 
-        // intersection of two non-empty ranges
         {
-            int expected[] = {5,4,1};
-            auto expected_size = get_array_size (expected);
-
-            auto result = from_array (set1) >> intersect_with (from_array (set2)) >> to_vector ();
-            auto result_size = result.size ();
-
-            TEST_ASSERT (expected_size, result_size);
-            for (auto i = 0U; i < expected_size && i < result_size; ++i)
+            auto map = range (0, 10) >> select (make) >> to_map (deref);
+            if (TEST_ASSERT (10U, map.size ()))
             {
-                TEST_ASSERT (expected[i], result[i]);
+                TEST_ASSERT (7, *map[7]);
             }
-        }
 
-        // intersection of two non-empty ranges
-        {
-            int expected[] = {4,5,1};
-            auto expected_size = get_array_size (expected);
+            auto lookup = range (0, 10) >> select (make) >> to_lookup (is_even);
+            TEST_ASSERT (5U, (lookup[true] >> count ()));
 
-            auto result = from_array (set2) >> intersect_with (from_array (set1)) >> to_vector ();
-            auto result_size = result.size ();
+            auto hash_lookup = range (0, 10) >> select (make) >> to_hash_lookup (deref);
+            TEST_ASSERT (1U, (hash_lookup[3] >> count ()));
+        }
 
-            TEST_ASSERT (expected_size, result_size);
-            for (auto i = 0U; i < expected_size && i < result_size; ++i)
-            {
-                TEST_ASSERT (expected[i], result[i]);
-            }
+        {
+            auto index = 0;
+            auto values = generate ([&] () {return index < 3 ? to_opt (make (index++)) : detail::opt<std::unique_ptr<int>> ();}) >> to_vector ();
+            TEST_ASSERT (3U, values.size ());
         }
 
-        // intersection of non-empty range with duplicates with itself
         {
-            int numbers [] = {3,1,4,1,5,9,2,6,5,4};
-            int expected [] = {3,1,4,5,9,2,6};
-            auto expected_size = get_array_size (expected);
+            // A range that has cached a move-only value can't be copied
+            auto selected       = range (0, 3) >> select (make);
+            auto has_selected   = selected.next ();
+            TEST_ASSERT (true, has_selected);
+            TEST_ASSERT (true, throws_on_copy (selected));
 
-            auto result = from_array (numbers) >> intersect_with (from_array (numbers)) >> to_vector ();
-            auto result_size = result.size ();
+            auto index          = 0;
+            auto generated      = generate ([&] () {return index < 3 ? to_opt (make (index++)) : detail::opt<std::unique_ptr<int>> ();});
+            auto has_generated  = generated.next ();
+            TEST_ASSERT (true, has_generated);
+            TEST_ASSERT (true, throws_on_copy (generated));
 
-            TEST_ASSERT (expected_size, result_size);
-            for (auto i = 0U; i < expected_size && i < result_size; ++i)
-            {
-               TEST_ASSERT (expected[i], result[i]);
-            }
+            auto pairs          = range (0, 3) >> select (make) >> pairwise ();
+            auto has_pair       = pairs.next ();
+            TEST_ASSERT (true, has_pair);
+            TEST_ASSERT (true, throws_on_copy (pairs));
+
+            // A range that has buffered move-only values can't be copied
+            auto reversed       = range (0, 5) >> select (make) >> reverse ();
+            auto has_reversed   = reversed.next ();
+            TEST_ASSERT (true, has_reversed);
+            TEST_ASSERT (true, throws_on_copy (reversed));
+
+            auto sorted         = range (0, 5) >> select (make) >> orderby_descending (deref);
+            auto has_sorted     = sorted.next ();
+            TEST_ASSERT (true, has_sorted);
+            TEST_ASSERT (true, throws_on_copy (sorted));
+
+            auto sorted_by      = range (0, 5) >> select (make) >> orderby_descending (is_even) >> thenby_ascending (deref);
+            auto has_sorted_by  = sorted_by.next ();
+            TEST_ASSERT (true, has_sorted_by);
+            TEST_ASSERT (true, throws_on_copy (sorted_by));
         }
 
-        // code coverage test
         {
-            auto q = from (empty_vector) >> intersect_with (from (empty_vector) );
+            auto key = [] (expensive_copy const & v) {return v.key;};
 
-            TEST_ASSERT (false, q.next ());
-            TEST_ASSERT (false, q.next ());
+            auto test_set = range (0, 100) >> select ([] (int i) {return expensive_copy ((i * 37) % 100, 4U);}) >> to_vector ();
+
+            // Values are copied once, when they are stored in the result
+            expensive_copy::copies () = 0U;
+            auto sorted = from (test_set) >> orderby_ascending (key) >> to_vector ();
+            TEST_ASSERT (100U, expensive_copy::copies ());
+            TEST_ASSERT (0, sorted.front ().key);
+            TEST_ASSERT (99, sorted.back ().key);
+
+            expensive_copy::copies () = 0U;
+            auto lookup = from (test_set) >> to_lookup ([] (expensive_copy const & v) {return v.key % 2;});
+            TEST_ASSERT (100U, expensive_copy::copies ());
+            TEST_ASSERT (50U, (lookup[1] >> count ()));
+
+            expensive_copy::copies () = 0U;
+            auto concatenated = from (test_set) >> concat (from (test_set)) >> count ();
+            TEST_ASSERT (0U, expensive_copy::copies ());
+            TEST_ASSERT (200U, concatenated);
+
+            // pairwise copies each value once, into the previous value
+            expensive_copy::copies () = 0U;
+            auto pairs = from (test_set) >> pairwise () >> count ();
+            TEST_ASSERT (100U, expensive_copy::copies ());
+            TEST_ASSERT (99U, pairs);
         }
     }
 
-    void test_except ()
+    void test_stats ()
     {
         using namespace cpplinq;
 
         TEST_PRELUDE ();
 
-        // difference of two empty ranges
-        {
-            auto result = from (empty_vector) >> except (from (empty_vector)) >> to_vector ();
-            TEST_ASSERT (0U, result.size ());
-        }
+        auto key        = [] (expensive_copy const & v) {return v.key;};
+        auto rebuild    = [] (expensive_copy const & v) {return expensive_copy (v.key, v.payload.size ());};
 
-        // difference of an empty range with a non-empty range
+        std::vector<expensive_copy> values;
+        for (auto i = 0; i < 10; ++i)
         {
-            auto result = empty<int>() >> except (range (0, 10)) >> to_vector ();
-            TEST_ASSERT (0U, result.size ());
+            values.push_back (expensive_copy (i, 16U));
         }
 
-        // difference of an empty range with a non-empty range
-        {
-            auto result = from (empty_vector) >> except (from_array (set1)) >> to_vector ();
-            TEST_ASSERT (0U, result.size ());
-        }
+        TEST_ASSERT (std::string ("where"), std::string (get_operator_name (query_where)));
+        TEST_ASSERT (std::string ("to_vector"), std::string (get_operator_name (query_to_vector)));
 
-        // difference of a non-empty range with an empty range
         {
-            auto result = range (0, 10) >> except (empty<int>()) >> to_vector ();
-            TEST_ASSERT (10U, result.size ());
-            for (auto i = 0U; i < 10 && i < result.size (); ++i)
-            {
-                TEST_ASSERT (static_cast<int> (i), result[i]);
-            }
+            auto before = get_stats ();
+            auto result = from_array (ints) >> where (is_even) >> to_vector ();
+            auto used   = get_stats () - before;
+
+            TEST_ASSERT (even_count_of_ints, result.size ());
+#ifdef CPPLINQ_INSTRUMENT
+            TEST_ASSERT (count_of_ints, used[query_from].yielded);
+            TEST_ASSERT (count_of_ints, used[query_where].pulled);
+            TEST_ASSERT (even_count_of_ints, used[query_where].yielded);
+            TEST_ASSERT (even_count_of_ints, used[query_to_vector].pulled);
+            TEST_ASSERT (even_count_of_ints, used[query_to_vector].copies);
+            TEST_ASSERT (0U, used[query_to_vector].moves);
+#else
+            TEST_ASSERT (0U, used.total ().pulled);
+#endif
         }
 
-        // difference of a non-empty range with an empty range
         {
-            int expected[] = {5,4,3,2,1};
-            auto expected_size = get_array_size (expected);
+            auto copies = expensive_copy::copies ();
+            auto before = get_stats ();
+            auto result = from (values) >> orderby_descending (key) >> to_vector ();
+            auto used   = get_stats () - before;
 
-            auto result = from_array (set1) >> except (from (empty_vector)) >> to_vector ();
-            TEST_ASSERT (expected_size, result.size ());
-            for (auto i = 0U; i < expected_size && i < result.size (); ++i)
-            {
-                TEST_ASSERT (expected[i], result[i]);
-            }
+            TEST_ASSERT (values.size (), result.size ());
+#ifdef CPPLINQ_INSTRUMENT
+            // orderby only keeps the addresses of the values of a container
+            // and copies them once when they are taken
+            TEST_ASSERT (values.size (), used[query_orderby].pulled);
+            TEST_ASSERT (values.size (), used[query_orderby].copies);
+            TEST_ASSERT (0U, used[query_to_vector].copies);
+            TEST_ASSERT (values.size (), used[query_to_vector].moves);
+            TEST_ASSERT ((expensive_copy::copies () - copies), used.total ().copies);
+#else
+            TEST_ASSERT (true, (expensive_copy::copies () >= copies));
+            TEST_ASSERT (0U, used.total ().copies);
+#endif
         }
 
-        // difference of two non-empty ranges
         {
-            int expected[] = {3,2};
-            auto expected_size = get_array_size (expected);
-
-            auto result = from_array (set1) >> except (from_array (set2)) >> to_vector ();
-            auto result_size = result.size ();
+            auto before = get_stats ();
+            auto result = from (values) >> select (rebuild) >> to_vector ();
+            auto used   = get_stats () - before;
 
-            TEST_ASSERT (expected_size, result_size);
-            for (auto i = 0U; i < expected_size && i < result_size; ++i)
-            {
-                TEST_ASSERT (expected[i], result[i]);
-            }
+            TEST_ASSERT (values.size (), result.size ());
+#ifdef CPPLINQ_INSTRUMENT
+            TEST_ASSERT (0U, used[query_to_vector].copies);
+            TEST_ASSERT (values.size (), used[query_to_vector].moves);
+#else
+            TEST_ASSERT (0U, used.total ().moves);
+#endif
         }
 
-        // difference of two non-empty ranges
         {
-            int expected[] = {9,8,6,7};
-            auto expected_size = get_array_size (expected);
-
-            auto result = from_array (set2) >> except (from_array (set1)) >> to_vector ();
-            auto result_size = result.size ();
+            auto before = get_stats ();
+            auto result = from_array (ints) >> where (is_even) >> reverse () >> to_vector ();
+            auto used   = get_stats () - before;
 
-            TEST_ASSERT (expected_size, result_size);
-            for (auto i = 0U; i < expected_size && i < result_size; ++i)
-            {
-                TEST_ASSERT (expected[i], result[i]);
-            }
+            TEST_ASSERT (even_count_of_ints, result.size ());
+#ifdef CPPLINQ_INSTRUMENT
+            TEST_ASSERT (true, (used[query_reverse].allocations > 0U));
+            TEST_ASSERT (true, (used[query_reverse].bytes >= even_count_of_ints * sizeof (int)));
+            TEST_ASSERT (0U, used[query_none].allocations);
+#else
+            TEST_ASSERT (0U, used.total ().allocations);
+#endif
         }
 
-        // difference of non-empty range with duplicates with itself
         {
-           int numbers [] = {3,1,4,1,5,9,2,6,5,4};
-
-           auto result = from_array (numbers) >> except (from_array (numbers)) >> to_vector ();
-           auto result_size = result.size ();
-
-           TEST_ASSERT (0U, result_size);
+            reset_stats ();
+            TEST_ASSERT (0U, get_stats ().total ().pulled);
+            TEST_ASSERT (0U, get_stats ().total ().allocations);
         }
+    }
 
-        // difference of non-empty range with duplicates with empty set
+    void write_test_file (char const * path, std::string const & text)
+    {
+        auto file = fopen (path, "wb");
+        if (file)
         {
-           auto result = from_array (ints) >> except (from (empty_vector)) >> to_vector ();
-           auto result_size = result.size ();
-
-           TEST_ASSERT (9U, result_size);
+            fwrite (text.data (), 1U, text.size (), file);
+            fclose (file);
         }
     }
 
-    void test_concat ()
+    void test_from_lines ()
     {
         using namespace cpplinq;
 
         TEST_PRELUDE ();
 
-        // concat two empty ranges
-        {
-            auto result = empty<int>() >> concat (empty<int>()) >> to_vector ();
-            TEST_ASSERT (0U, result.size ());
-        }
+        auto path       = "cpplinq_test_from_lines.txt";
+        auto to_string  = [] (string_ref line) {return line.str ();};
+        auto not_empty  = [] (string_ref line) {return !line.empty ();};
+        auto first_char = [] (string_ref line) {return line.substr (0U, 1U);};
 
-        // concat two empty ranges
         {
-            auto result = from (empty_vector) >> concat (empty<int>()) >> to_vector ();
-            TEST_ASSERT (0U, result.size ());
-        }
+            write_test_file (path, "alpha\nbeta\r\n\ngamma\nall");
 
-        // concat an empty range with a non empty range
-        {
-            auto expected = range (0,10);
-            auto expected_result = expected >> to_vector ();
-            auto result = empty<int>() >> concat (expected) >> to_vector ();
-            TEST_ASSERT (expected_result.size (), result.size ());
-            for (auto i = 0U; i < expected_result.size () && i < result.size ();++i)
+            auto lines = from_lines (path) >> select (to_string) >> to_vector ();
+            if (TEST_ASSERT (5U, lines.size ()))
             {
-                TEST_ASSERT (expected_result[i], result[i]);
+                TEST_ASSERT (std::string ("alpha"), lines[0]);
+                TEST_ASSERT (std::string ("beta") , lines[1]);
+                TEST_ASSERT (std::string ("")     , lines[2]);
+                TEST_ASSERT (std::string ("gamma"), lines[3]);
+                TEST_ASSERT (std::string ("all")  , lines[4]);
             }
-        }
 
-        // concat an empty range with a non empty range
-        {
-            auto result = empty<int>() >> concat (from_array (ints)) >> to_vector ();
-            TEST_ASSERT (count_of_ints, result.size ());
-            for (auto i = 0U; i < count_of_ints && i < result.size ();++i)
+            TEST_ASSERT (4U, from_lines (path) >> where (not_empty) >> count ());
+
+            // The views stay valid while the range lives
+            auto source = from_lines (path);
+            auto lookup = source >> where (not_empty) >> to_lookup (first_char);
             {
-                TEST_ASSERT (ints[i], result[i]);
+                auto results = lookup[string_ref ("a")] >> select (to_string) >> to_vector ();
+                if (TEST_ASSERT (2U, results.size ()))
+                {
+                    TEST_ASSERT (std::string ("alpha"), results[0]);
+                    TEST_ASSERT (std::string ("all")  , results[1]);
+                }
             }
+
+            auto hash_lookup = source >> where (not_empty) >> to_hash_lookup (first_char);
+            TEST_ASSERT (2U, hash_lookup[string_ref ("a")] >> count ());
+            TEST_ASSERT (1U, hash_lookup[string_ref ("g")] >> count ());
+            TEST_ASSERT (0U, hash_lookup[string_ref ("z")] >> count ());
         }
 
-        // concat a non empty range with an empty range
         {
-            auto expected = range (0,10);
-            auto expected_result = expected >> to_vector ();
-            auto result = expected >> concat (empty<int>()) >> to_vector ();
-            TEST_ASSERT (expected_result.size (), result.size ());
-            for (auto i = 0U; i < expected_result.size () && i < result.size ();++i)
-            {
-                TEST_ASSERT (expected_result[i], result[i]);
-            }
+            // A trailing newline doesn't start another line
+            write_test_file (path, "one\ntwo\n");
+            TEST_ASSERT (2U, from_lines (path) >> count ());
+
+            write_test_file (path, "");
+            TEST_ASSERT (0U, from_lines (path) >> count ());
         }
 
-        // concat a non empty range with an empty range
         {
-            auto result = from_array (ints) >> concat (empty<int>()) >> to_vector ();
-            TEST_ASSERT (count_of_ints, result.size ());
-            for (auto i = 0U; i < count_of_ints && i < result.size ();++i)
+            // Lines keep the file alive after the range is gone
+            write_test_file (path, "alpha\nbeta\n\nall");
+
+            auto initial        = [] (shared_string_ref line) {return line.substr (0U, 1U);};
+            auto lines          = from_lines (path) >> to_vector ();
+            auto lookup         = from_lines (path) >> where (not_empty) >> to_lookup (initial);
+            auto hash_lookup    = from_lines (path) >> where (not_empty) >> to_hash_lookup (initial);
+
+            if (TEST_ASSERT (4U, lines.size ()))
             {
-                TEST_ASSERT (ints[i], result[i]);
+                TEST_ASSERT (std::string ("alpha"), lines[0].str ());
+                TEST_ASSERT (std::string ("all")  , lines[3].str ());
             }
-        }
 
-        // concat two non-empty ranges
-        {
-            int set1[] = {0,1,2,3,4,5};
-            int set2[] = {6,7,8,9};
-            auto result = from_array (set1) >> concat (from_array (set2)) >> to_vector ();
-            TEST_ASSERT (10U, result.size ());
-            for (auto i = 0U; i < 10 && i < result.size (); ++i)
+            auto results = lookup[string_ref ("a")] >> select (to_string) >> to_vector ();
+            if (TEST_ASSERT (2U, results.size ()))
             {
-                TEST_ASSERT (static_cast<int> (i), result[i]);
+                TEST_ASSERT (std::string ("alpha"), results[0]);
+                TEST_ASSERT (std::string ("all")  , results[1]);
             }
+
+            TEST_ASSERT (1U, hash_lookup[string_ref ("b")] >> count ());
         }
 
-        // code coverage test
-        {
-            auto q = empty<int>() >> concat (empty<int>());
+        remove (path);
 
-            TEST_ASSERT (false, q.next ());
-            TEST_ASSERT (false, q.next ());
+        {
+            auto thrown = false;
+            try
+            {
+                from_lines ("cpplinq_test_missing_file.txt") >> count ();
+            }
+            catch (io_exception const &)
+            {
+                thrown = true;
+            }
+            TEST_ASSERT (true, thrown);
         }
     }
 
-    void test_sequence_equal ()
+    struct telemetry_record
+    {
+        int     id      ;
+        double  value   ;
+    };
+
+    void test_from_records ()
     {
         using namespace cpplinq;
 
         TEST_PRELUDE ();
 
-        // test two empty sequences
-        {
-            auto result = empty<int>() >> sequence_equal (empty<int>());
-            TEST_ASSERT (true, result);
-        }
-
-        // test two empty sequences
-        {
-            auto result = from (empty_vector) >> sequence_equal (empty<int>());
-            TEST_ASSERT (true, result);
-        }
+        auto path       = "cpplinq_test_from_records.bin";
+        auto id_of      = [] (telemetry_record const & r) {return r.id;};
+        auto value_of   = [] (telemetry_record const & r) {return r.value;};
+        auto even_id    = [] (telemetry_record const & r) {return r.id % 2 == 0;};
 
-        // test empty sequence with non-empty sequence
+        std::vector<telemetry_record> records;
+        for (auto i = 0; i < 1000; ++i)
         {
-            auto result = empty<int>() >> sequence_equal (range (0,10));
-            TEST_ASSERT (false, result);
+            telemetry_record record = {};
+            record.id       = 999 - i;
+            record.value    = i * 0.5;
+            records.push_back (record);
         }
 
-        // test empty sequence with non-empty sequence
         {
-            auto result = from (empty_vector) >> sequence_equal (from_array (ints));
-            TEST_ASSERT (false, result);
-        }
+            write_test_file (path, std::string (reinterpret_cast<char const *> (records.data ()), records.size () * sizeof (telemetry_record)));
 
-        // test non-empty sequence with empty sequence
-        {
-            auto result = range (0, 10) >> sequence_equal (empty<int>());
-            TEST_ASSERT (false, result);
-        }
+            auto source = from_records<telemetry_record> (path);
 
-        // test non-empty sequence with empty sequence
-        {
-            auto result = from_array (ints) >> sequence_equal (from (empty_vector));
-            TEST_ASSERT (false, result);
-        }
+            TEST_ASSERT (records.size (), source >> count ());
+            TEST_ASSERT ((from (records) >> select (value_of) >> sum ()), (source >> select (value_of) >> sum ()));
+            TEST_ASSERT (500U, source >> where (even_id) >> count ());
+            TEST_ASSERT (989, (source >> skip (10U) >> select (id_of) >> first ()));
+            TEST_ASSERT (0, (source >> element_at_or_default (999U)).id);
+            TEST_ASSERT (records.size (), (source >> parallel () >> where (even_id) >> count ()) * 2U);
 
-        // test non-empty inequal sequences
-        {
-            auto result = range (0,5) >> sequence_equal (range (0,4));
-            TEST_ASSERT (false, result);
-        }
+            // References point into the file
+            auto scan       = source;
+            auto has_first  = scan.next ();
+            if (TEST_ASSERT (true, has_first))
+            {
+                TEST_ASSERT (999, scan.front ().id);
+                TEST_ASSERT (true, (&scan.front () != &records.front ()));
+            }
 
-        // test non-empty inequal sequences
-        {
-            auto result = from_array (set1) >> sequence_equal (from_array (set2));
-            TEST_ASSERT (false, result);
+            auto sorted = source >> orderby_ascending (id_of) >> select (id_of) >> to_vector ();
+            if (TEST_ASSERT (records.size (), sorted.size ()))
+            {
+                TEST_ASSERT (0  , sorted.front ());
+                TEST_ASSERT (999, sorted.back ());
+            }
         }
 
-        // test non-empty equal sequences
         {
-            auto result = from_array (ints) >> sequence_equal (from_array (ints));
-            TEST_ASSERT (true, result);
+            write_test_file (path, "");
+            TEST_ASSERT (0U, from_records<telemetry_record> (path) >> count ());
         }
 
-        // test non-empty equal sequences
         {
-            auto result = range (0,10) >> sequence_equal (range (0,10));
-            TEST_ASSERT (true, result);
-        }
+            // A partial record is an error
+            write_test_file (path, std::string (sizeof (telemetry_record) + 1U, 'x'));
 
-        // test against self
-        {
-            auto seq = from_array (ints);
-            auto result = seq >> sequence_equal (seq);
-            TEST_ASSERT (true, result);
+            auto thrown = false;
+            try
+            {
+                from_records<telemetry_record> (path) >> count ();
+            }
+            catch (io_exception const &)
+            {
+                thrown = true;
+            }
+            TEST_ASSERT (true, thrown);
         }
 
-        auto comparer = [](customer const& c1, customer const& c2)
-        {return c1.first_name == c2.first_name && c1.last_name == c2.last_name;};
+        remove (path);
+    }
 
-        customer customers1[] = {
-            customer (1 , "Bill"    , "Gates"   ),
-            customer (2 , "Steve"   , "Jobs"    ),
-            customer (3 , "Richard" , "Stallman"),
-        };
+    void test_from_csv ()
+    {
+        using namespace cpplinq;
 
-        customer customers2[] = {
-            customer (11 , "Bill"    , "Gates"   ),
-            customer (12 , "Steve"   , "Jobs"    ),
-            customer (13 , "Richard" , "Stallman"),
-        };
+        TEST_PRELUDE ();
 
-        customer customers3[] = {
-            customer (1 , "Bill"    , "Gates"   ),
-            customer (2 , "Steve"   , "Jobs"    ),
-            customer (3 , "Steve"   , "Ballmer" ),
-        };
+        typedef std::tuple<int, double, shared_string_ref, std::string> row_type;
+
+        auto path       = "cpplinq_test_from_csv.csv";
+        auto id_of      = [] (row_type const & r) {return std::get<0> (r);};
+        auto score_of   = [] (row_type const & r) {return std::get<1> (r);};
+        auto city_of    = [] (row_type const & r) {return std::get<2> (r);};
+        auto name_of    = [] (row_type const & r) {return std::get<3> (r);};
+        auto positive   = [] (row_type const & r) {return std::get<1> (r) > 0.0;};
+
+        write_test_file (
+                path
+            ,   "id,name,city,score\n"
+                "1,Alice,\"Oslo, Norway\",3.5\n"
+                "2,\"Bob \"\"The Builder\"\"\",Paris,4\n"
+                "3,Carol,Oslo,2.25\r\n"
+                "\n"
+                "4,Dave,Paris,-1"
+            );
 
-        // test empty with comparer
         {
-            auto result = empty<customer>() >> sequence_equal (empty<customer>(), comparer);
-            TEST_ASSERT (true, result);
-        }
+            // Columns are projected in any order
+            auto source = from_csv (
+                    path
+                ,   csv_options (',', true)
+                ,   csv_column<int>         (0)
+                ,   csv_column<double>      (3)
+                ,   csv_column<string_ref>  (2)
+                ,   csv_column<std::string> (1)
+                );
 
-        // test empty with non-empty with comparer
-        {
-            auto result = from (empty_customers) >> sequence_equal (from_array (customers), comparer);
-            TEST_ASSERT (false, result);
+            auto rows = source >> to_vector ();
+            if (TEST_ASSERT (4U, rows.size ()))
+            {
+                TEST_ASSERT (1                                  , std::get<0> (rows[0]));
+                TEST_ASSERT (3.5                                , std::get<1> (rows[0]));
+                TEST_ASSERT (std::string ("Oslo, Norway")       , std::get<2> (rows[0]).str ());
+                TEST_ASSERT (std::string ("Bob \"The Builder\""), std::get<3> (rows[1]));
+                TEST_ASSERT (2.25                               , std::get<1> (rows[2]));
+                TEST_ASSERT (std::string ("Oslo")               , std::get<2> (rows[2]).str ());
+                TEST_ASSERT (-1.0                               , std::get<1> (rows[3]));
+            }
+
+            TEST_ASSERT (3U, source >> where (positive) >> count ());
+
+            auto by_score = source >> orderby_ascending (score_of) >> select (name_of) >> to_vector ();
+            if (TEST_ASSERT (4U, by_score.size ()))
+            {
+                TEST_ASSERT (std::string ("Dave"), by_score.front ());
+                TEST_ASSERT (std::string ("Bob \"The Builder\""), by_score.back ());
+            }
+
+            auto by_city = source >> to_lookup (city_of);
+            TEST_ASSERT (2U, by_city[string_ref ("Paris")] >> count ());
+            TEST_ASSERT (1U, by_city[string_ref ("Oslo")] >> count ());
+
+            auto joined = from_array (customers) >> join (
+                    source
+                ,   [] (customer const & c) {return static_cast<int> (c.id);}
+                ,   id_of
+                ,   [] (customer const & c, row_type const & r) {return c.last_name + ":" + std::get<3> (r);}
+                ) >> to_vector ();
+            if (TEST_ASSERT (4U, joined.size ()))
+            {
+                TEST_ASSERT (std::string ("Gates:Alice")   , joined[0]);
+                TEST_ASSERT (std::string ("Torvalds:Dave") , joined[3]);
+            }
         }
 
-        // test non-empty with empty with comparer
         {
-            auto result = from_array (customers) >> sequence_equal (from (empty_customers), comparer);
-            TEST_ASSERT (false, result);
+            // Only the projected columns are parsed
+            auto names = from_csv (path, csv_options (',', true), csv_column<std::string> (1)) >> to_vector ();
+            TEST_ASSERT (4U, names.size ());
         }
 
-        // test two equal non-empty sequences with comparer
         {
-            auto result = from_array (customers1) >> sequence_equal (from_array (customers2), comparer);
-            TEST_ASSERT (true, result);
+            auto thrown = false;
+            try
+            {
+                // The header doesn't parse as an int
+                from_csv (path, csv_column<int> (0)) >> count ();
+            }
+            catch (parse_exception const &)
+            {
+                thrown = true;
+            }
+            TEST_ASSERT (true, thrown);
         }
 
-        // test two inequal non-empty sequences with comparer
         {
-            auto result = from_array (customers1) >> sequence_equal (from_array (customers3), comparer);
-            TEST_ASSERT (false, result);
+            auto thrown = false;
+            try
+            {
+                from_csv (path, csv_options (',', true), csv_column<int> (4)) >> count ();
+            }
+            catch (parse_exception const &)
+            {
+                thrown = true;
+            }
+            TEST_ASSERT (true, thrown);
         }
 
-        // test against self with comparer
         {
-            auto seq = from_array (customers1);
-            auto result = seq >> sequence_equal (seq, comparer);
-            TEST_ASSERT (true, result);
-        }
-    }
+            write_test_file (path, "a;-128;255\nb;-129;256\n");
 
-    void test_pairwise ()
-    {
-        using namespace cpplinq;
+            auto first = from_csv (path, csv_options (';'), csv_column<signed char> (1), csv_column<unsigned char> (2)) >> take (1U) >> to_vector ();
+            if (TEST_ASSERT (1U, first.size ()))
+            {
+                TEST_ASSERT (-128, static_cast<int> (std::get<0> (first[0])));
+                TEST_ASSERT (255 , static_cast<int> (std::get<1> (first[0])));
+            }
 
-        TEST_PRELUDE ();
+            auto thrown = false;
+            try
+            {
+                from_csv (path, csv_options (';'), csv_column<signed char> (1)) >> count ();
+            }
+            catch (parse_exception const &)
+            {
+                thrown = true;
+            }
+            TEST_ASSERT (true, thrown);
+        }
 
         {
-            auto pairwise_result =
-                    from (empty_vector)
-                >>  pairwise ()
-                >>  to_vector ()
-                ;
-            TEST_ASSERT (0U, pairwise_result.size ());
+            // Empty lines before the header are skipped
+            write_test_file (path, "\nid,name\n1,x\n");
+
+            auto ids = from_csv (path, csv_options (',', true), csv_column<int> (0)) >> to_vector ();
+            if (TEST_ASSERT (1U, ids.size ()))
+            {
+                TEST_ASSERT (1, std::get<0> (ids[0]));
+            }
         }
 
         {
-            int single_element_vector[] = {1};
-            auto pairwise_result =
-                    from_array (single_element_vector)
-                >>  pairwise ()
-                >>  to_vector ()
-                ;
-            TEST_ASSERT (0U, pairwise_result.size ());
+            // A '\r' ending the text doesn't start another field
+            write_test_file (path, "\"a\"\r");
+
+            auto thrown = false;
+            try
+            {
+                from_csv (path, csv_column<string_ref> (1)) >> count ();
+            }
+            catch (parse_exception const &)
+            {
+                thrown = true;
+            }
+            TEST_ASSERT (true, thrown);
+
+            TEST_ASSERT (1U, from_csv (path, csv_column<std::string> (0)) >> count ());
         }
 
         {
-            auto pairwise_result =
-                    from_array (simple_ints)
-                >>  pairwise ()
-                >>  to_vector ()
-                ;
-            TEST_ASSERT (count_of_simple_ints-1, pairwise_result.size ());
-            for (std::size_t i=0; i < pairwise_result.size (); ++i)
+            // Long fields are parsed, long double keeps its precision
+            auto digits = std::string (80U, '0');
+            write_test_file (path, "0." + digits + "25," + digits + "1.5\n0.1,0.1\n");
+
+            auto values = from_csv (path, csv_column<double> (0), csv_column<long double> (1)) >> to_vector ();
+            if (TEST_ASSERT (2U, values.size ()))
             {
-                TEST_ASSERT (simple_ints[i], pairwise_result[i].first);
-                TEST_ASSERT (simple_ints[i+1], pairwise_result[i].second);
+                TEST_ASSERT (true, (std::get<0> (values[0]) > 0.0 && std::get<0> (values[0]) < 1e-80));
+                TEST_ASSERT (true, (std::get<1> (values[0]) == 1.5L));
+                TEST_ASSERT (true, (std::get<1> (values[1]) == 0.1L));
+            }
+
+            // '.' is the decimal point whatever the locale
+            char const * locales[] = {"de_DE.UTF-8", "de_DE.utf8", "fr_FR.UTF-8", "fr_FR.utf8"};
+            for (auto locale : locales)
+            {
+                if (std::setlocale (LC_NUMERIC, locale))
+                {
+                    auto parsed = from_csv (path, csv_column<double> (1)) >> to_vector ();
+                    std::setlocale (LC_NUMERIC, "C");
+
+                    if (TEST_ASSERT (2U, parsed.size ()))
+                    {
+                        TEST_ASSERT (1.5, std::get<0> (parsed[0]));
+                    }
+                    break;
+                }
             }
         }
+
+        remove (path);
     }
 
-    void test_zip_with ()
+    void test_output_sinks ()
     {
         using namespace cpplinq;
+
         TEST_PRELUDE ();
 
+        auto path = "cpplinq_test_output_sinks.txt";
+
         {
-            auto zip_width_result =
-                    from (empty_vector)
-                >>  zip_with (from (empty_vector))
-                >>  to_vector ()
-                ;
-            TEST_ASSERT (0U, zip_width_result.size ());
+            std::vector<int> result;
+            auto end = from_array (simple_ints) >> where (is_even) >> to_output_iterator (std::back_inserter (result));
+            ignore (end);
+
+            if (TEST_ASSERT (4U, result.size ()))
+            {
+                TEST_ASSERT (2, result.front ());
+                TEST_ASSERT (8, result.back ());
+            }
+
+            int values[9] = {};
+            auto last = from_array (simple_ints) >> to_output_iterator (values);
+            TEST_ASSERT (count_of_simple_ints, static_cast<std::size_t> (last - values));
+            TEST_ASSERT (9, values[8]);
         }
 
         {
-            auto zip_width_result =
-                    from (empty_vector)
-                >>  zip_with (from_array (simple_ints))
-                >>  to_vector ()
-                ;
-            TEST_ASSERT (0U, zip_width_result.size ());
+            std::ostringstream stream;
+            from_array (simple_ints) >> take (3U) >> to_ostream (stream, ", ");
+            TEST_ASSERT (std::string ("1, 2, 3"), stream.str ());
+
+            std::wostringstream wstream;
+            from (empty_vector) >> to_ostream (wstream, L", ");
+            TEST_ASSERT (true, wstream.str ().empty ());
         }
 
         {
-            auto zip_width_result =
-                    from_array (simple_ints)
-                >>  zip_with (from (empty_vector))
-                >>  to_vector ()
-                ;
-            TEST_ASSERT (0U, zip_width_result.size ());
+            std::vector<std::string> lines;
+            lines.push_back ("first");
+            lines.push_back ("");
+            lines.push_back ("third");
+
+            TEST_ASSERT (3U, from (lines) >> to_file (path));
+
+            auto read = from_lines (path) >> select ([] (string_ref line) {return line.str ();}) >> to_vector ();
+            TEST_ASSERT (true, (lines == read));
         }
 
         {
-            auto zip_width_result =
-                    from_array (simple_ints)
-                >>  zip_with (from_array (simple_ints))
-                >>  to_vector ()
-                ;
-            TEST_ASSERT (count_of_simple_ints, zip_width_result.size ());
-            for (std::size_t i=0; i<zip_width_result.size (); ++i)
+            // A small buffer is flushed many times
+            auto formatter = [] (buffered_writer & writer, int i)
             {
-                TEST_ASSERT (simple_ints[i], zip_width_result[i].first);
-                TEST_ASSERT (simple_ints[i], zip_width_result[i].second);
+                writer.write_number (i);
+                writer.put (',');
+                writer.write_number (i * 0.5);
+                writer.write (string_ref (",row\n"));
+            };
+
+            TEST_ASSERT (1000U, range (0, 1000) >> to_file (path, formatter, 64U));
+
+            // The string_ref fields keep the file alive after the range is gone
+            auto rows = from_csv (path, csv_column<int> (0), csv_column<double> (1), csv_column<string_ref> (2)) >> to_vector ();
+            if (TEST_ASSERT (1000U, rows.size ()))
+            {
+                TEST_ASSERT (999    , std::get<0> (rows.back ()));
+                TEST_ASSERT (499.5  , std::get<1> (rows.back ()));
+                TEST_ASSERT (std::string ("row"), std::get<2> (rows.back ()).str ());
             }
         }
 
         {
-            auto expected_size = std::min(count_of_ints, count_of_simple_ints);
-            auto zip_width_result =
-                    from_array (ints)
-                >>  zip_with (from_array (simple_ints))
-                >>  to_vector ()
-                ;
-            TEST_ASSERT (expected_size, zip_width_result.size ());
-            for (std::size_t i=0; i<zip_width_result.size (); ++i)
+            // Numbers are written with '.' whatever the locale and read back exactly
+            auto formatter = [] (buffered_writer & writer, int i)
             {
-                TEST_ASSERT (       ints[i], zip_width_result[i].first);
-                TEST_ASSERT (simple_ints[i], zip_width_result[i].second);
+                writer.write_number (i + 0.1);
+                writer.put (',');
+                writer.write_number (i + 0.1L);
+                writer.put ('\n');
+            };
+
+            char const * locales[] = {"de_DE.UTF-8", "de_DE.utf8", "fr_FR.UTF-8", "fr_FR.utf8", "C"};
+            for (auto locale : locales)
+            {
+                if (std::setlocale (LC_NUMERIC, locale))
+                {
+                    break;
+                }
             }
-        }
 
-        {
-            auto expected_size = std::min(count_of_ints, count_of_simple_ints);
-            auto zip_width_result =
-                    from_array (simple_ints)
-                >>  zip_with (from_array (ints))
-                >>  to_vector ()
-                ;
-            TEST_ASSERT (expected_size, zip_width_result.size ());
-            for (std::size_t i=0; i<zip_width_result.size (); ++i)
+            from_array (simple_ints) >> to_file (path, formatter);
+            auto rows = from_csv (path, csv_column<double> (0), csv_column<long double> (1)) >> to_vector ();
+            std::setlocale (LC_NUMERIC, "C");
+
+            if (TEST_ASSERT (count_of_simple_ints, rows.size ()))
             {
-                TEST_ASSERT (simple_ints[i], zip_width_result[i].first);
-                TEST_ASSERT (       ints[i], zip_width_result[i].second);
+                TEST_ASSERT (9.1, std::get<0> (rows.back ()));
+                TEST_ASSERT (true, (std::get<1> (rows.back ()) == 9 + 0.1L));
             }
         }
 
-        {
-            std::string pairrange[] = {"one", "two", "three"};
-            auto zip_width_result =
-                    from_array(pairrange)
-                >>  zip_with(from_array(simple_ints))
-                >>  to_vector();
+        remove (path);
 
-            auto expected_size = get_array_size(pairrange);
-            TEST_ASSERT(expected_size, zip_width_result.size());
-            for (std::size_t i=0; i<zip_width_result.size (); ++i)
+        {
+            auto thrown = false;
+            try
             {
-                TEST_ASSERT (  pairrange[i], zip_width_result[i].first);
-                TEST_ASSERT (simple_ints[i], zip_width_result[i].second);
+                from_array (simple_ints) >> to_file ("cpplinq_missing_directory/file.txt", [] (buffered_writer &, int) {});
+            }
+            catch (io_exception const &)
+            {
+                thrown = true;
             }
+            TEST_ASSERT (true, thrown);
         }
     }
 
@@ -3005,9 +5765,10 @@ namespace
 
         TEST_ASSERT (expected_complete_sum, result_complete_sum);
 
+        // sum is vectorized and may well beat the loop
         auto ratio_limit    = 2.0;
         auto ratio          = ((double)expected)/result;
-        TEST_ASSERT (true, (ratio > 1/ratio_limit && ratio < ratio_limit));
+        TEST_ASSERT (true, (ratio > 1/ratio_limit));
         printf (
                 "Performance numbers for simple sum over numbers, expected:%lld, result:%lld, ratio_limit:%f, ratio:%f\n"
             ,   expected
@@ -3017,6 +5778,67 @@ namespace
             );
     }
 
+    void test_performance_vectorized_sum ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        int         const test_repeat       = 80000     ;
+        int         const test_size         = 20000     ;
+        auto        expected_complete_sum   = 0.0       ;
+        auto        result_complete_sum     = 0.0       ;
+
+        srand (19740531);
+
+        // Whole numbers keep the sums exact regardless of the order of the additions
+        auto test_set =
+                range (0, test_size)
+            >>  select ([] (int i){return static_cast<double> (rand () % 1000);})
+            >>  to_vector (test_size)
+            ;
+
+        auto expected = execute_testruns (
+                test_repeat
+            ,   [&] ()
+                {
+                    auto set_sum = 0.0;
+                    for (auto v : test_set)
+                    {
+                        set_sum += v;
+                    }
+                    expected_complete_sum += set_sum;
+                }
+            );
+
+        auto result = execute_testruns (
+                test_repeat
+            ,   [&] ()
+                {
+                    auto set_sum =
+                            from (test_set)
+                        >>  sum ()
+                        ;
+                    result_complete_sum += set_sum;
+                }
+            );
+
+        TEST_ASSERT (expected_complete_sum, result_complete_sum);
+
+        // A loop over doubles may not be reordered by the compiler while the
+        // vectorized sum may, so the speedup shows here
+        auto ratio_limit    = 2.0;
+        auto ratio          = ((double)expected)/result;
+        TEST_ASSERT (true, (ratio > 1/ratio_limit));
+        printf (
+                "Performance numbers for vectorized sum over doubles, expected:%lld, result:%lld, ratio_limit:%f, ratio:%f\n"
+            ,   expected
+            ,   result
+            ,   ratio_limit
+            ,   ratio
+            );
+    }
+
     bool is_prime (int i)
     {
         if (i < 2)
@@ -3107,6 +5929,94 @@ namespace
             );
     }
 
+    void test_performance_expensive_copy ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        int         const test_repeat       = 200       ;
+        int         const test_size         = 20000     ;
+        std::size_t const payload_size      = 64U       ;
+        auto        expected_complete_sum   = 0         ;
+        auto        result_complete_sum     = 0         ;
+
+        srand (19740531);
+
+        auto test_set =
+                range (0, test_size)
+            >>  select ([=] (int i){return expensive_copy (rand () % test_size, payload_size);})
+            >>  to_vector (test_size)
+            ;
+
+        auto is_even    = [] (expensive_copy const & v) {return v.key % 2 == 0;};
+        auto key        = [] (expensive_copy const & v) {return v.key;};
+
+        expensive_copy::copies () = 0U;
+
+        auto expected = execute_testruns (
+                test_repeat
+            ,   [&] ()
+                {
+                    std::vector<expensive_copy> sorted;
+                    for (auto & v : test_set)
+                    {
+                        if (is_even (v))
+                        {
+                            sorted.push_back (v);
+                        }
+                    }
+
+                    std::stable_sort (
+                            sorted.begin ()
+                        ,   sorted.end ()
+                        ,   [] (expensive_copy const & l, expensive_copy const & r)
+                            {
+                                return l.key < r.key;
+                            }
+                        );
+
+                    expected_complete_sum += sorted.front ().key + sorted.back ().key;
+                }
+            );
+
+        auto expected_copies = expensive_copy::copies ();
+        expensive_copy::copies () = 0U;
+
+        auto result = execute_testruns (
+                test_repeat
+            ,   [&] ()
+                {
+                    auto sorted =
+                            from (test_set)
+                        >>  where (is_even)
+                        >>  orderby_ascending (key)
+                        >>  to_vector ()
+                        ;
+
+                    result_complete_sum += sorted.front ().key + sorted.back ().key;
+                }
+            );
+
+        auto result_copies = expensive_copy::copies ();
+
+        TEST_ASSERT (expected_complete_sum, result_complete_sum);
+
+        // Each value is copied once, into the result
+        TEST_ASSERT (expected_copies, result_copies);
+
+        auto ratio_limit    = 1.5;
+        auto ratio          = ((double)expected)/result;
+        TEST_ASSERT (true, (ratio > 1/ratio_limit));
+        printf (
+                "Performance numbers for sorting values that are expensive to copy, expected:%lld, result:%lld, ratio_limit:%f, ratio:%f\n"
+            ,   expected
+            ,   result
+            ,   ratio_limit
+            ,   ratio
+            );
+    }
+
     bool run_all_tests (bool run_perfomance_tests)
     {
         // -------------------------------------------------------------------------
@@ -3128,12 +6038,16 @@ namespace
         test_avg                    ();
         test_max                    ();
         test_min                    ();
+        test_vectorized             ();
         test_concatenate            ();
         test_all                    ();
         test_for_each               ();
         test_to_vector              ();
         test_to_map                 ();
+        test_memory_resource        ();
+        test_arena                  ();
         test_to_lookup              ();
+        test_to_hash_lookup         ();
         test_to_list                ();
         test_container              ();
         test_where                  ();
@@ -3141,7 +6055,9 @@ namespace
         test_select                 ();
         test_select_many            ();
         test_join                   ();
+        test_hash_join              ();
         test_orderby                ();
+        test_group_by               ();
         test_reverse                ();
         test_take                   ();
         test_skip                   ();
@@ -3150,6 +6066,10 @@ namespace
         test_contains               ();
         test_element_at_or_default  ();
         test_aggregate              ();
+        test_parallel               ();
+        test_batched                ();
+        test_size_hint              ();
+        test_random_access          ();
         test_distinct               ();
         test_union_with             ();
         test_intersect_with         ();
@@ -3158,6 +6078,12 @@ namespace
         test_sequence_equal         ();
         test_pairwise               ();
         test_zip_with               ();
+        test_move_only              ();
+        test_stats                  ();
+        test_from_lines             ();
+        test_from_records           ();
+        test_from_csv               ();
+        test_output_sinks           ();
         // -------------------------------------------------------------------------
         if (run_perfomance_tests)
         {
@@ -3167,7 +6093,9 @@ namespace
 #endif
             test_performance_range_sum ();
             test_performance_sum ();
+            test_performance_vectorized_sum ();
             test_performance_is_prime ();
+            test_performance_expensive_copy ();
         }
         // -------------------------------------------------------------------------
         if (errors == 0)
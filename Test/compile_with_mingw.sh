@@ -1 +1 @@
-g++ -std=c++0x -O2 -Wall CppLinq.cpp -o cpplinq.exe
\ No newline at end of file
+g++ -std=c++0x -O2 -Wall -pthread CppLinq.cpp -o cpplinq.exe
\ No newline at end of file